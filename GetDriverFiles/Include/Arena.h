@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Bump allocator for memory that's freed all at once, such as what's
+ * needed while one INF is processed.
+ *
+ * Allocations are carved out of blocks taken with malloc_guarded, and
+ * can't be freed one by one. ArenaReset frees them all in O(1), keeping
+ * the blocks for the next use, so an arena reused for each INF stops
+ * calling malloc once it has grown to fit the largest one.
+ *
+ * An arena isn't thread-safe, use one per thread.
+ */
+
+// What malloc guarantees on Windows and glibc, and the size of the
+// block header, so that aData is aligned too.
+#define ARENA_ALIGNMENT (2 * sizeof(void*))
+
+typedef struct arena_block_Tag arena_block;
+struct arena_block_Tag {
+	arena_block* pNext;
+	size_t Size;
+	char aData[];
+};
+
+typedef struct {
+	arena_block* pFirst;
+	arena_block* pBlock; // Being filled, NULL before the first allocation
+	size_t Used;         // Bytes of pBlock in use
+	uint64_t nBlocks;    // Blocks allocated since the arena was initialized
+} arena;
+
+#define ARENA_INIT { NULL, NULL, 0, 0 }
+
+void ArenaInit(arena* pArena);
+void ArenaFree(arena* pArena);
+
+// Frees all the allocations, keeping the blocks.
+static inline void ArenaReset(arena* pArena) {
+	pArena->pBlock = pArena->pFirst;
+	pArena->Used = 0;
+}
+
+void* ArenaAllocSlow(arena* pArena, size_t Size);
+
+// Never fails. The memory is aligned on ARENA_ALIGNMENT.
+static inline void* ArenaAlloc(arena* pArena, size_t Size) {
+	Size = (Size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+	arena_block* pBlock = pArena->pBlock;
+	if (!pBlock || pBlock->Size - pArena->Used < Size)
+		return ArenaAllocSlow(pArena, Size);
+	void* p = pBlock->aData + pArena->Used;
+	pArena->Used += Size;
+	return p;
+}
+
+// Copies Length chars of s, adding a '\0'.
+static inline char* ArenaCopyString(arena* pArena, const char* s, size_t Length) {
+	char* sCopy = ArenaAlloc(pArena, Length + 1);
+	memcpy(sCopy, s, Length);
+	sCopy[Length] = '\0';
+	return sCopy;
+}
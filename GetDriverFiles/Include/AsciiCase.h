@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// ASCII case-insensitive helpers, for INF section, string and file names.
+
+static inline char AsciiToLower(char c) {
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// FNV-1a over the lowercased string.
+static inline uint32_t HashStringI(const char* s, size_t Length) {
+	uint32_t Hash = 2166136261u;
+	for (size_t i = 0; i < Length; ++i) {
+		Hash ^= (uint8_t)AsciiToLower(s[i]);
+		Hash *= 16777619u;
+	}
+	return Hash;
+}
+
+static inline bool EqualStringI(const char* sA, const char* sB, size_t Length) {
+	for (size_t i = 0; i < Length; ++i)
+		if (AsciiToLower(sA[i]) != AsciiToLower(sB[i]))
+			return false;
+	return true;
+}
+
+static inline int CompareStringI(const char* sA, size_t LengthA, const char* sB, size_t LengthB) {
+	size_t Length = LengthA < LengthB ? LengthA : LengthB;
+	for (size_t i = 0; i < Length; ++i) {
+		char a = AsciiToLower(sA[i]);
+		char b = AsciiToLower(sB[i]);
+		if (a != b)
+			return (a > b) - (a < b);
+	}
+	return (LengthA > LengthB) - (LengthA < LengthB);
+}
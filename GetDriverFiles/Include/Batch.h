@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "DriverFiles.h"
+#include "ResultCache.h"
+
+/*
+ * Runs GetDriverFiles on a list of INFs, on nJobs threads.
+ *
+ * Each INF is processed into its own result. pfnEmit is called for each
+ * of them in list order, whatever order they complete in, so the output
+ * doesn't depend on nJobs. It's called by one thread at a time, not
+ * necessarily the calling one. Error is set if the path can't be
+ * resolved or the INF can't be opened.
+ *
+ * INFs with an up-to-date entry in pResultCache are taken from it, the
+ * others are stored to it. It may be NULL.
+ */
+
+typedef void (*batch_emit_proc)(
+	void* pContext,
+	const char* sPath,
+	uint32_t Error,
+	const driver_files_result* pResult
+);
+
+void RunBatch(
+	char* const* asPaths,
+	size_t nPaths,
+	const driver_files_options* pOptions,
+	result_cache* pResultCache,
+	uint32_t nJobs,
+	batch_emit_proc pfnEmit,
+	void* pContext
+);
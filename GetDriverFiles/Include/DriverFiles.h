@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Arena.h"
+#include "InfInclude.h"
+#include "TextBuffer.h"
+
+// Totals of the results merged from more than one INF (CopyINF), added
+// to from any thread.
+typedef struct {
+	volatile size_t nResults;
+	volatile size_t nLines;    // Lines of the INFs merged
+	volatile size_t nDistinct; // Lines kept
+	volatile size_t Bytes;     // Memory the merges took, each one freed before the next
+} merge_stats;
+
+typedef struct {
+	uint8_t bGetCatalog;
+	uint8_t bGetSource;
+	uint8_t bReachableOnly; // Only the source files the install sections copy
+	const char* sLocale; // Hexadecimal LCID, NULL for [Strings] only
+	inf_include_cache* pIncludeCache; // For Include= and Needs=, may be NULL
+	uint32_t nThreads; // For the INFs pulled in by CopyINF, 0 for one per processor
+	merge_stats* pMergeStats; // May be NULL
+} driver_files_options;
+
+typedef struct {
+	text_buffer Output;   // One file per line
+	text_buffer Warnings; // One warning per line
+	text_buffer Inputs;   // Full paths of the INFs the result depends on, one per line
+	uint32_t Error;       // Set if the INF itself can't be opened
+} driver_files_result;
+
+/*
+ * List the files of a driver package: the INF at sInfPath (a full path)
+ * and the INFs it pulls in through CopyINF, recursively.
+ *
+ * Paths are relative to the directory of sInfPath. Files listed by more
+ * than one INF are only listed once.
+ *
+ * pResult must be zeroed before the first call. It can be reused for
+ * the next INF, its buffers are kept.
+ *
+ * pArena holds the memory needed while each INF is parsed, on the
+ * calling thread. It's reset on return, so a caller processing many
+ * INFs can pass the same one each time. May be NULL.
+ */
+void GetDriverFiles(const char* sInfPath, const driver_files_options* pOptions, arena* pArena, driver_files_result* pResult);
+void FreeDriverFilesResult(driver_files_result* pResult);
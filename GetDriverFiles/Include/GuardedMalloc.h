@@ -2,15 +2,21 @@
 
 #include <malloc.h>
 #include <stdlib.h>
+#include <string.h>
 
-inline void* malloc_guarded(size_t size) {
+static inline void* malloc_guarded(size_t size) {
 	void* p = malloc(size);
 	if (!p) abort();
 	return p;
 }
 
-inline void* realloc_guarded(void* p, size_t size) {
+static inline void* realloc_guarded(void* p, size_t size) {
 	void* pNew = realloc(p, size);
 	if (!pNew) abort();
 	return pNew;
 }
+
+static inline char* strdup_guarded(const char* s) {
+	size_t size = strlen(s) + 1;
+	return memcpy(malloc_guarded(size), s, size);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "InfLayout.h"
+#include "InfReader.h"
+#include "InfStrings.h"
+
+/*
+ * INFs named by Include= directives, such as machine.inf or usb.inf,
+ * and by LayoutFile=, such as layout.inf.
+ * https://learn.microsoft.com/en-us/windows-hardware/drivers/install/inf-ddinstall-section
+ *
+ * They're looked up in a single search directory, parsed on first use
+ * and kept until the cache is freed, so INFs including the same system
+ * INF share one copy. The cache is safe to use from several threads.
+ */
+
+typedef struct inf_include_cache_Tag inf_include_cache;
+
+// sLocale is passed to InfLoadStrings for the included INFs.
+inf_include_cache* InfNewIncludeCache(const char* sSearchDir, const char* sLocale);
+void InfFreeIncludeCache(inf_include_cache* pCache);
+
+/*
+ * Name is the file name as written after Include=, matched
+ * case-insensitively. Returns NULL with *pError set if it can't be
+ * opened. The INF and its strings belong to the cache.
+ */
+const inf_file* InfGetIncludedInf(
+	inf_include_cache* pCache,
+	inf_field Name,
+	const inf_strings** ppStrings,
+	uint32_t* pError
+);
+
+// The malloc'd path Name is opened from, with the case of the file on
+// disk where it differs from Name. Doesn't open it.
+char* InfGetIncludePath(inf_include_cache* pCache, inf_field Name);
+
+// Same as InfGetIncludedInf, the layout table is built on first use.
+const inf_layout* InfGetLayout(inf_include_cache* pCache, inf_field Name, uint32_t* pError);
+
+// Lookups served from the cache, and ones that had to open the file.
+void InfGetIncludeStats(inf_include_cache* pCache, uint64_t* pHits, uint64_t* pMisses);
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "Arena.h"
+#include "InfInclude.h"
+#include "InfReader.h"
+#include "InfStrings.h"
+
+/*
+ * Reference graph of the install sections of an INF:
+ * [Manufacturer] -> models sections -> DDInstall sections -> CopyFiles.
+ *
+ * Sections are resolved to their index in the inf_file and each one is
+ * walked at most once, so the graph is built in a single pass whatever
+ * the number of install sections.
+ *
+ * Needs= sections are walked in the INFs named by Include=. The files
+ * they copy come with Windows, so they're only counted.
+ */
+
+// A name found in the INF, %strkey% tokens expanded.
+typedef struct {
+	inf_field Name;
+	uint32_t Section; // Where it was found
+	uint32_t Line;
+} install_ref;
+
+typedef struct {
+	install_ref* aFiles;    // Source files copied, each one once
+	uint32_t nFiles;
+	install_ref* aMissing;  // Sections named by CopyFiles that don't exist
+	uint32_t nMissing;
+	install_ref* aMissingIncludes; // Included INFs that can't be opened
+	uint32_t nMissingIncludes;
+	install_ref* aMissingNeeds; // Needed sections not in the included INFs
+	uint32_t nMissingNeeds;
+	install_ref* aCopyInf;  // CopyINF entries of the DDInstall sections
+	uint32_t nCopyInf;
+	install_ref* aIncludes; // Include= entries reached, found or not
+	uint32_t nIncludes;
+	uint32_t nInstallSections; // DDInstall sections reached
+	uint32_t nNeededSections;  // Sections of included INFs reached
+	uint32_t nIncludedFiles;   // Files copied by those
+} install_graph;
+
+// DDInstall sections are taken with all their platform extensions.
+// https://learn.microsoft.com/en-us/windows-hardware/drivers/install/inf-ddinstall-section
+// pCache may be NULL to ignore Include= and Needs=. The expanded names
+// are allocated in pArena, they're valid until it's reset.
+void InfGetInstallGraph(const inf_file* pInf, const inf_strings* pStrings, inf_include_cache* pCache, arena* pArena, install_graph* pGraph);
+void InfFreeInstallGraph(install_graph* pGraph);
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "InfReader.h"
+#include "InfStrings.h"
+
+/*
+ * [SourceDisksNames] and [SourceDisksFiles] of a layout file, such as
+ * the layout.inf named by LayoutFile= in system INFs.
+ * https://learn.microsoft.com/en-us/windows-hardware/drivers/install/inf-version-section
+ *
+ * The table is built once and never modified afterwards, so it can be
+ * shared by every INF naming the layout file, from any thread. Fields
+ * are views into the inf_file, which must outlive the table.
+ */
+
+typedef struct inf_layout_Tag inf_layout;
+
+typedef struct {
+	inf_field FileName;
+	inf_field DiskPath; // Empty if the disk has no path
+	inf_field Subdir;   // Empty if there's none
+	int32_t DiskId;
+} layout_file;
+
+inf_layout* InfLoadLayout(const inf_file* pInf, const inf_strings* pStrings);
+void InfFreeLayout(inf_layout* pLayout);
+
+/*
+ * The entries for a file name, matched case-insensitively. A file is
+ * listed once per platform section naming it. Returns NULL with
+ * *pCount set to 0 if it isn't listed.
+ */
+const layout_file* InfFindLayoutFile(const inf_layout* pLayout, const char* sFileName, size_t Length, uint32_t* pCount);
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "TextBuffer.h"
+
+// INF paths to process in batch mode.
+typedef struct {
+	char** asPaths;
+	size_t nPaths;
+	size_t Capacity;
+} inf_list;
+
+/*
+ * Adds the INFs named by sArg, which is one of:
+ *  + a file, taken whatever its extension,
+ *  + a directory, searched recursively for *.inf files in name order,
+ *  + "@file", a list of paths,
+ *  + "-", the same list read from stdin.
+ * Lists have one path per line, or are '\0' separated.
+ *
+ * Problems are appended to pWarnings, they don't stop the batch.
+ */
+void InfListAdd(inf_list* pList, const char* sArg, text_buffer* pWarnings);
+void InfListFree(inf_list* pList);
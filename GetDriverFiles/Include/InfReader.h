@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Minimal INF reader, replacing the SetupAPI functions we used.
+ *
+ * The file is memory-mapped once and tokenized into sections, lines and
+ * fields in a single pass. Fields are handed out as views into the
+ * mapping; only fields that need rewriting (quotes, line continuation)
+ * are copied into a side buffer owned by the inf_file.
+ *
+ * Field 0 of a line is its key. Lines without a key report their first
+ * value as field 0, like SetupAPI does.
+ */
+
+typedef struct inf_file_Tag inf_file;
+
+typedef struct {
+	const char* s; // Not '\0' terminated
+	uint32_t Length;
+} inf_field;
+
+// Equivalent of INFCONTEXT.
+typedef struct {
+	const inf_file* pInf;
+	uint32_t Section; // Index of the section
+	uint32_t Line;    // Index of the line inside the section
+} inf_context;
+
+// Returns NULL on failure, *pError receives the system error code.
+inf_file* InfOpenFile(const char* sPath, uint32_t* pError);
+void InfCloseFile(inf_file* pInf);
+
+// -1 if the section doesn't exist.
+int32_t InfGetLineCount(const inf_file* pInf, const char* sSection);
+
+// sKey may be NULL to get the first line of the section.
+bool InfFindFirstLine(const inf_file* pInf, const char* sSection, const char* sKey, inf_context* pContext);
+// Sections are numbered in order of first appearance.
+uint32_t InfGetSectionCount(const inf_file* pInf);
+// Index of the section, -1 if it doesn't exist.
+int32_t InfFindSection(const inf_file* pInf, inf_field Name);
+bool InfFindFirstLineByIndex(const inf_file* pInf, uint32_t Section, const char* sKey, inf_context* pContext);
+bool InfFindNextLine(const inf_context* pContextIn, inf_context* pContextOut);
+bool InfFindNextMatchLine(const inf_context* pContextIn, const char* sKey, inf_context* pContextOut);
+
+// Number of fields, not counting the key.
+uint32_t InfGetFieldCount(const inf_context* pContext);
+bool InfGetStringField(const inf_context* pContext, uint32_t FieldIndex, inf_field* pField);
+bool InfGetIntField(const inf_context* pContext, uint32_t FieldIndex, int32_t* pValue);
+
+// SetupAPI strips the trailing backslashes of paths, we also strip the
+// leading ones.
+void InfTrimBslash(inf_field* pField);
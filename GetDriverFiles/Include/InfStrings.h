@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "InfReader.h"
+
+/*
+ * %strkey% substitution from [Strings] sections.
+ *
+ * The table is loaded once per INF into a case-insensitive open
+ * addressing hash table. Keys and values are views into the inf_file,
+ * so it must outlive the table.
+ */
+
+typedef struct inf_strings_Tag inf_strings;
+
+// Scratch space for expanded fields, reused between calls.
+typedef struct {
+	char* p;
+	size_t Capacity;
+} inf_expand_buffer;
+
+/*
+ * Loads [Strings.<sLocale>] then [Strings]. Keys in the localized
+ * section hide the ones in the base section. sLocale is a hexadecimal
+ * LCID such as "0409", or NULL for the base section only.
+ */
+inf_strings* InfLoadStrings(const inf_file* pInf, const char* sLocale);
+void InfFreeStrings(inf_strings* pStrings);
+
+bool InfLookupString(const inf_strings* pStrings, const char* sKey, size_t KeyLength, inf_field* pValue);
+
+/*
+ * Expand %strkey% tokens in a field. "%%" is a literal '%' and unknown
+ * keys are kept as they are, like SetupAPI does.
+ *
+ * Fields without '%' are returned as they are and nothing is copied.
+ * Otherwise the result lives in pBuffer until its next use.
+ */
+inf_field InfExpandField(const inf_strings* pStrings, inf_field Field, inf_expand_buffer* pBuffer);
+void InfFreeExpandBuffer(inf_expand_buffer* pBuffer);
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/*
+ * Byte level routines for INF text, with SIMD fast paths.
+ */
+
+typedef enum {
+	INF_SIMD_NONE,
+	INF_SIMD_SSE2,
+	INF_SIMD_AVX2,
+} inf_simd_level;
+
+// Best level supported by the CPU, or the one set by InfSetSimdLevel.
+inf_simd_level InfGetSimdLevel(void);
+// Used by the benchmark, before any other thread parses. Levels the CPU
+// doesn't support are clamped.
+void InfSetSimdLevel(inf_simd_level Level);
+
+/*
+ * Encodings. Everything is transcoded to UTF-8 before parsing.
+ * ANSI files are read as Windows-1252.
+ */
+typedef enum {
+	INF_ENCODING_UTF8,
+	INF_ENCODING_UTF16LE,
+	INF_ENCODING_UTF16BE, // Detected but not supported
+	INF_ENCODING_ANSI,
+} inf_encoding;
+
+// *pBomSize receives the number of bytes to skip.
+inf_encoding InfDetectEncoding(const char* pData, size_t Size, size_t* pBomSize);
+bool InfIsUtf8(const char* pData, size_t Size);
+
+// Both return the number of bytes written to pOut,
+// which must hold InfMaxUtf8Size(Size) bytes.
+size_t InfUtf16LeToUtf8(const char* pData, size_t Size, char* pOut);
+size_t InfAnsiToUtf8(const char* pData, size_t Size, char* pOut);
+
+// 3 UTF-8 bytes at most for each byte of either input encoding.
+static inline size_t InfMaxUtf8Size(size_t Size) {
+	return Size * 3;
+}
+
+/*
+ * Structural index: bit i is set if pData[i] is one of
+ *   [ ] \n ; " , =
+ * aBitmap must hold InfStructuralWords(Size) words.
+ */
+void InfBuildStructuralIndex(const char* pData, size_t Size, uint64_t* aBitmap);
+
+static inline size_t InfStructuralWords(size_t Size) {
+	return (Size + 63) / 64;
+}
+
+static inline unsigned InfCountTrailingZeros(uint64_t x) {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+	unsigned long Index;
+	_BitScanForward64(&Index, x);
+	return Index;
+#elif defined(_MSC_VER)
+	unsigned long Index;
+	if (_BitScanForward(&Index, (uint32_t)x))
+		return Index;
+	_BitScanForward(&Index, (uint32_t)(x >> 32));
+	return Index + 32;
+#else
+	return (unsigned)__builtin_ctzll(x);
+#endif
+}
+
+// Position of the first structural character at or after i, Size if none.
+static inline size_t InfNextStructural(const uint64_t* aBitmap, size_t Size, size_t i) {
+	if (i >= Size)
+		return Size;
+	size_t Word = i / 64;
+	uint64_t Mask = aBitmap[Word] & (~(uint64_t)0 << (i % 64));
+	size_t nWords = InfStructuralWords(Size);
+	while (!Mask) {
+		if (++Word >= nWords)
+			return Size;
+		Mask = aBitmap[Word];
+	}
+	return Word * 64 + InfCountTrailingZeros(Mask);
+}
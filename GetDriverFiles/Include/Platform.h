@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Small compatibility layer so the tool also builds on POSIX hosts.
+
+#ifdef _WIN32
+
+#include <Windows.h>
+
+#include "GuardedMalloc.h"
+
+// Both return a malloc'd copy.
+
+static inline wchar_t* Utf8ToUtf16(const char* s) {
+	int Length = MultiByteToWideChar(CP_UTF8, 0, s, -1, NULL, 0); // Contains '\0'
+	wchar_t* ws = malloc_guarded(Length * sizeof(*ws));
+	MultiByteToWideChar(CP_UTF8, 0, s, -1, ws, Length);
+	return ws;
+}
+
+static inline char* Utf16ToUtf8(const wchar_t* ws) {
+	int Length = WideCharToMultiByte(CP_UTF8, 0, ws, -1, NULL, 0, NULL, NULL); // Contains '\0'
+	char* s = malloc_guarded(Length * sizeof(*s));
+	WideCharToMultiByte(CP_UTF8, 0, ws, -1, s, Length, NULL, NULL);
+	return s;
+}
+
+#define PATH_SEPARATOR '\\'
+
+// FILETIME units.
+#define FILE_TIME_PER_SECOND 10000000
+
+#else
+
+#include <errno.h>
+#include <pthread.h>
+#include <strings.h>
+
+#define _stricmp strcasecmp
+
+// Keep the Win32 names for the exit codes we use, backed by errno values.
+#define ERROR_SUCCESS 0
+#define ERROR_INVALID_PARAMETER EINVAL
+#define ERROR_BAD_FORMAT EILSEQ
+#define ERROR_FILE_TOO_LARGE EFBIG
+
+#define PATH_SEPARATOR '/'
+
+// Nanoseconds.
+#define FILE_TIME_PER_SECOND 1000000000
+
+#endif
+
+// Free with FreeSystemErrorMessage. The message ends with a new line.
+char* GetSystemErrorMessage(uint32_t Error);
+void FreeSystemErrorMessage(char* sErrorMessage);
+
+// Returns a malloc'd absolute UTF-8 path, or NULL with *pError set.
+char* GetFullPath(const char* sPath, uint32_t* pError);
+
+// Case-insensitive on Windows.
+int ComparePath(const char* sPathA, const char* sPathB);
+
+// %windir%\INF as a malloc'd UTF-8 path, NULL if there's none.
+char* GetSystemInfDirectory(void);
+
+bool IsDirectory(const char* sPath);
+
+// Calls pfnProc for each entry of sDir but "." and "..", sPath being
+// sDir joined with the entry name. Symbolic links aren't followed.
+typedef void (*directory_proc)(void* pContext, const char* sPath, bool bDirectory);
+bool ListDirectory(const char* sDir, directory_proc pfnProc, void* pContext, uint32_t* pError);
+
+// Files
+
+typedef struct {
+	uint64_t Size;
+	int64_t Modified; // Last write time, FILE_TIME_PER_SECOND units
+} file_stamp;
+
+bool GetFileStamp(const char* sPath, file_stamp* pStamp, uint32_t* pError);
+
+// The current time, as file_stamp.Modified would be.
+int64_t GetCurrentFileTime(void);
+
+// Maps the whole file read-only. An empty file gives NULL with *pError
+// set to ERROR_SUCCESS.
+const void* MapFileView(const char* sPath, size_t* pSize, uint32_t* pError);
+void UnmapFileView(const void* pView, size_t Size);
+
+// Moves sNewPath over sPath, replacing it atomically if it exists.
+bool ReplaceFileWith(const char* sPath, const char* sNewPath, uint32_t* pError);
+
+// Threads
+
+typedef void (*thread_proc)(void* pContext, uint32_t ThreadIndex);
+
+uint32_t GetProcessorCount(void);
+
+// Runs pfnProc on nThreads threads, the calling thread being number 0,
+// and returns once all of them are done.
+void RunThreads(uint32_t nThreads, thread_proc pfnProc, void* pContext);
+
+size_t AtomicFetchAdd(volatile size_t* pValue, size_t Add);
+
+// Sequentially consistent, like AtomicFetchAdd.
+size_t AtomicLoad(volatile size_t* pValue);
+void AtomicStore(volatile size_t* pValue, size_t Value);
+void* AtomicLoadPointer(void* volatile* ppValue);
+void AtomicStorePointer(void* volatile* ppValue, void* pValue);
+
+#ifdef _WIN32
+typedef SRWLOCK mutex;
+#else
+typedef pthread_mutex_t mutex;
+#endif
+
+void MutexInit(mutex* pMutex);
+void MutexDestroy(mutex* pMutex);
+void MutexLock(mutex* pMutex);
+void MutexUnlock(mutex* pMutex);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "DriverFiles.h"
+
+/*
+ * Results of GetDriverFiles kept on disk from one run to the next, so
+ * unchanged INFs aren't parsed again.
+ *
+ * An entry is keyed by the full path of the INF and records the size
+ * and last write time of every INF the result depends on
+ * (driver_files_result.Inputs), missing ones included. It's only used
+ * if all of them still have the same size and time. Each input is
+ * checked once per run, however many entries depend on it. Entries
+ * with an input written within 2 seconds of being checked or processed
+ * aren't stored, as its time may not change with the next write, so a
+ * file changing under the scan can't leave a stale entry behind.
+ *
+ * The file is mapped and read in place. It only holds results for one
+ * set of options, it's ignored if they change.
+ */
+
+typedef struct result_cache_Tag result_cache;
+
+// Never fails, a missing or invalid file gives an empty cache. sInfDir
+// is the include search directory, NULL if there's none.
+result_cache* OpenResultCache(const char* sPath, const driver_files_options* pOptions, const char* sInfDir);
+
+// Writes the entries stored since opening, and the old ones still
+// valid, to the file given to OpenResultCache.
+bool SaveResultCache(result_cache* pCache, uint32_t* pError);
+
+void FreeResultCache(result_cache* pCache);
+
+/*
+ * Fills pResult, which is reset as by GetDriverFiles, if sFullPath has
+ * an up-to-date entry. Inputs is left empty.
+ *
+ * Lookups and stores can be called from several threads.
+ */
+bool ResultCacheLookup(result_cache* pCache, const char* sFullPath, driver_files_result* pResult);
+
+// StartTime is GetCurrentFileTime() from before GetDriverFiles was called.
+void ResultCacheStore(result_cache* pCache, const char* sFullPath, const driver_files_result* pResult, int64_t StartTime);
+
+void GetResultCacheStats(result_cache* pCache, uint64_t* pHits, uint64_t* pMisses);
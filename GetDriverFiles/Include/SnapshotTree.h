@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Tree234.h"
+
+/*
+ * Sorted counted tree shared between one writer and any number of
+ * readers, which never take a lock.
+ *
+ * Nodes are never changed once published. An addition or a deletion
+ * copies the nodes on the path to the elements it changes, shares all
+ * the others with the previous version, and publishes the new root
+ * atomically. A reader pins the root of the moment as a snapshot, and
+ * sees that version for as long as it keeps it pinned, whatever is
+ * written meanwhile.
+ *
+ * What a write replaces, nodes and deleted elements, is freed once no
+ * snapshot can reach it. Each write advances an epoch; each snapshot
+ * records the epoch it was pinned at, and what was replaced at an epoch
+ * is kept until all the snapshots pinned are from later ones.
+ *
+ * Readers are numbered from 0 to nReaders - 1, and each one holds one
+ * snapshot at most. Writes must be serialized by the caller.
+ */
+
+typedef struct snapshot_tree_Tag snapshot_tree;
+typedef struct snapshot_node_Tag snapshot_node;
+
+typedef struct {
+	snapshot_tree* pTree;
+	const snapshot_node* pRoot;
+	uint32_t Reader;
+} snapshot;
+
+// The tree owns the elements added. pfnDestroy, which may be NULL, is
+// called on each one deleted once no reader can see it, and on those
+// left when the tree is freed, which no reader may have pinned.
+snapshot_tree* NewSnapshotTree(cmpfn234 pfnCompare, destroyfn234 pfnDestroy, void* pContext, uint32_t nReaders);
+void FreeSnapshotTree(snapshot_tree* pTree);
+
+// Returns e, or the element already in the tree that compares equal to
+// it, in which case e isn't added.
+void* SnapshotTreeAdd(snapshot_tree* pTree, void* e);
+// Returns false if no element compares equal to e.
+bool SnapshotTreeDelete(snapshot_tree* pTree, void* e);
+
+// Nodes and elements replaced but not freed yet.
+size_t GetSnapshotTreeRetiredCount(const snapshot_tree* pTree);
+
+void PinSnapshot(snapshot_tree* pTree, uint32_t Reader, snapshot* pSnapshot);
+void UnpinSnapshot(snapshot* pSnapshot);
+
+// As count234, index234 and findrelpos234 on the pinned version.
+intptr_t SnapshotCount(const snapshot* pSnapshot);
+void* SnapshotIndex(const snapshot* pSnapshot, intptr_t Index);
+void* SnapshotFind(const snapshot* pSnapshot, void* e, cmpfn234 pfnCompare, int Relation, intptr_t* pIndex);
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Interned strings: each distinct string is stored once and named by a
+ * 32-bit ID, so repeated strings, such as the file lines of merged INF
+ * results, can be compared and hashed as integers.
+ *
+ * Strings are matched case-insensitively (ASCII), like INF names, and
+ * keep the case they were first interned with. IDs count up from 0 and
+ * stay valid until the pool is freed.
+ *
+ * A pool is used by one thread at a time, it has no lock.
+ */
+
+typedef struct string_pool_Tag string_pool;
+
+string_pool* NewStringPool(void);
+void FreeStringPool(string_pool* pPool);
+
+uint32_t InternString(string_pool* pPool, const char* s, size_t Length);
+
+typedef struct {
+	uint64_t nInterned; // InternString calls
+	uint64_t nDistinct; // Strings stored
+	uint64_t PoolBytes; // Memory used by the pool
+} string_pool_stats;
+
+void GetStringPoolStats(string_pool* pPool, string_pool_stats* pStats);
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stddef.h>
+
+// Growable text, results are collected in these before being printed.
+typedef struct {
+	char* p; // Not '\0' terminated
+	size_t Length;
+	size_t Capacity;
+} text_buffer;
+
+void TextAppend(text_buffer* pText, const char* s, size_t Length);
+void TextAppendString(text_buffer* pText, const char* s);
+void TextAppendFormat(text_buffer* pText, const char* sFormat, ...);
+void TextAppendFormatV(text_buffer* pText, const char* sFormat, va_list Args);
+void TextFree(text_buffer* pText);
@@ -32,10 +32,18 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 /*
  * This typedef is opaque outside tree234.c itself.
+ *
+ * Building tree234.c with TREE234_KEYS defined to 4-255 turns the
+ * 2-3-4 tree into a counted B-tree of that many elements per node,
+ * behind the same functions. Defining TREE234_COMPACT as well makes
+ * its nodes smaller: kids are 32-bit numbers instead of pointers, counts
+ * are 32 bits, so a tree holds under 2^32 elements, and there are no
+ * parent pointers.
  */
 typedef struct tree234_Tag tree234;
 
@@ -48,14 +56,37 @@ typedef int (*cmpfn234)(void *, void *);
  */
 tree234 *newtree234(cmpfn234 cmp);
 
+/*
+ * Create a 2-3-4 tree holding the n elements of the array elems, in
+ * linear time. In a sorted tree they must be in increasing order, with
+ * no two comparing equal; in an unsorted tree (cmp NULL) they're given
+ * index 0 to n-1. The array itself isn't kept.
+ */
+tree234 *buildtree234(cmpfn234 cmp, void **elems, intptr_t n);
+
 /*
  * Free a 2-3-4 tree (not including freeing the elements).
  */
 void freetree234(tree234 *t);
 
+/*
+ * Free a 2-3-4 tree, calling destroy(e, ctx) on each element e first,
+ * in index order. It takes O(n) and no recursion; destroy mustn't use
+ * the tree.
+ */
+typedef void (*destroyfn234)(void *e, void *ctx);
+void freetree234_with(tree234 *t, destroyfn234 destroy, void *ctx);
+
 /*
  * Add an element e to a sorted 2-3-4 tree t. Returns e on success,
  * or if an existing element compares equal, returns that.
+ *
+ * Adding past the last element right after adding the last element
+ * takes one comparison, straight into the rightmost leaf while it has
+ * room, and the counts above it are brought up to date by the next
+ * function that needs them. So a tree filled in increasing order can
+ * be read from several threads with find234 and findmany234 only, or
+ * once something else has been called on it.
  */
 void *add234(tree234 *t, void *e);
 
@@ -137,6 +168,57 @@ void *findrel234(tree234 *t, void *e, cmpfn234 cmp, int relation);
 void *findpos234(tree234 *t, void *e, cmpfn234 cmp, intptr_t *index);
 void *findrelpos234(tree234 *t, void *e, cmpfn234 cmp, int relation, intptr_t* index);
 
+/*
+ * Look up n elements at once in a sorted 2-3-4 tree: out[i] is set to
+ * find234(t, keys[i], NULL). Interleaving the lookups lets the memory
+ * fetches of one overlap the searches of the others, so it's faster
+ * than a loop of find234 once the tree is larger than the cache. All
+ * of out is NULL for an unsorted tree.
+ */
+void findmany234(tree234 *t, void **keys, intptr_t n, void **out);
+
+/*
+ * A cursor over a 2-3-4 tree. It keeps the path from the root to the
+ * current element, so stepping to the next or previous element takes
+ * O(1) amortized, where index234 and findrel234 take O(log n) each
+ * time. The tree mustn't be changed while a cursor is in use.
+ *
+ * Each function returns the element the cursor is then at, or NULL
+ * once it has left the tree (or the range); it stays off from then on.
+ * `index' is the numeric index of the current element.
+ *
+ * iter234_seek goes to the element findrel234 would find.
+ *
+ * iter234_range goes to the first element e with lo <= e < hi, and
+ * next and prev then stay between those. Either bound may be NULL to
+ * leave that end open. It takes O(log n) to start and O(1) per step,
+ * which makes a prefix query out of two keys: in a tree of paths
+ * compared with strcmp,
+ *
+ *   for (p = iter234_range(&it, tree, "amd64\\", "amd64]", NULL);
+ *        p != NULL; p = iter234_next(&it))
+ *       consume(p);
+ *
+ * lists everything under amd64\ (']' being the character after '\').
+ */
+#define ITER234_DEPTH 64
+
+typedef struct {
+	tree234 *tree;
+	intptr_t index;
+	intptr_t begin, end;          /* the range, end excluded */
+	int depth;                    /* of the current node, -1 when off */
+	int pos[ITER234_DEPTH];       /* element index at depth, kid index above */
+	struct node234_Tag *nodes[ITER234_DEPTH];
+} iter234;
+
+void *iter234_first(iter234 *it, tree234 *t);
+void *iter234_last(iter234 *it, tree234 *t);
+void *iter234_seek(iter234 *it, tree234 *t, void *e, cmpfn234 cmp, int relation);
+void *iter234_range(iter234 *it, tree234 *t, void *lo, void *hi, cmpfn234 cmp);
+void *iter234_next(iter234 *it);
+void *iter234_prev(iter234 *it);
+
 /*
  * Delete an element e in a 2-3-4 tree. Does not free the element,
  * merely removes all links to it from the tree nodes.
@@ -162,3 +244,56 @@ void *delpos234(tree234 *t, intptr_t index);
  */
 intptr_t count234(tree234 *t);
 
+/*
+ * Join two trees: all the elements of `right' are moved to the end of
+ * `left', which is returned, and `right' is freed. In sorted trees,
+ * every element of left must compare less than every element of right.
+ *
+ * Split a tree: the elements from the given index to the end are moved
+ * out of t into a new tree, which is returned (NULL if the index is out
+ * of range). splitkey234 splits a sorted tree before the first element
+ * comparing >= e, cmp defaulting to the tree's compare function.
+ *
+ * All three take O(log n). The trees they leave may share node memory,
+ * which is freed with the last of them. Trees sharing it also share
+ * where new nodes come from, so they must not be used from different
+ * threads at the same time; each can still be freed from any thread.
+ *
+ * Built with TREE234_COMPACT, joining trees that don't share it copies
+ * the nodes of the smaller one, which takes O(size of the smaller).
+ * Each element is copied O(log n) times at most over any run of joins.
+ */
+tree234 *join234(tree234 *left, tree234 *right);
+tree234 *split234(tree234 *t, intptr_t index);
+tree234 *splitkey234(tree234 *t, void *e, cmpfn234 cmp);
+
+/*
+ * Freeze a sorted tree into a flat block that holds no pointers, so it
+ * can be written to a file and mapped back as it is. The elements
+ * themselves can't go in it: key(e) gives a 64-bit key for each, which
+ * must increase along the tree, and the block is searched by key. What
+ * a search gives is the index of the element, which the caller can use
+ * to look up whatever goes with it in an array of its own.
+ *
+ * freeze234 writes frozensize234(count234(t)) bytes to buf and returns
+ * it, or NULL if the tree is unsorted, the keys don't increase, or it
+ * has 2^32 - 1 elements or more. Searches are fastest with buf 64-byte
+ * aligned. The block is in host byte order. openfrozen234 checks that
+ * size bytes read or mapped from a file are a whole frozen tree and
+ * returns them, or NULL; a corrupt one gives wrong answers, but is
+ * never read outside of and gives no index out of range.
+ *
+ * findfrozen234 returns the index of the element findrelpos234 would
+ * find (REL234_* as there), or -1, in O(log n) steps that don't branch
+ * on the keys. frozenkey234 returns the key at an index from 0 to
+ * frozencount234(f) - 1.
+ */
+typedef struct frozen234_Tag frozen234;
+typedef uint64_t (*keyfn234)(void *e);
+
+size_t frozensize234(intptr_t n);
+frozen234 *freeze234(tree234 *t, keyfn234 key, void *buf);
+const frozen234 *openfrozen234(const void *buf, size_t size);
+intptr_t frozencount234(const frozen234 *f);
+uint64_t frozenkey234(const frozen234 *f, intptr_t index);
+intptr_t findfrozen234(const frozen234 *f, uint64_t key, int relation);
@@ -0,0 +1,485 @@
+/*
+ * Tree234Template.h: a sorted counted B-tree specialized for one
+ * element type, to be included once per type after defining:
+ *
+ *   TYPED234_NAME       prefix of the names it defines, e.g. idtree
+ *   TYPED234_TYPE       element type, stored by value in the nodes
+ *   TYPED234_LESS(a, b) nonzero if *a sorts before *b, given two
+ *                       pointers to TYPED234_TYPE
+ *   TYPED234_KEYS       elements per node, 4 to 255, 15 if not defined
+ *
+ * Where tree234 calls a cmpfn234 through a pointer on void* elements
+ * held elsewhere, this compares elements held in the node with an
+ * expression the compiler can inline, and searches a node with a
+ * branch-free binary search. It defines idtree_elem, the element
+ * type T, idtree_tree, and:
+ *
+ *   idtree_tree *idtree_new(void);
+ *   void idtree_free(idtree_tree *t);
+ *   intptr_t idtree_count(idtree_tree *t);
+ *   T *idtree_add(idtree_tree *t, T e);
+ *   T *idtree_index(idtree_tree *t, intptr_t index);
+ *   T *idtree_findrelpos(idtree_tree *t, const T *e, int relation, intptr_t *index);
+ *   T *idtree_find(idtree_tree *t, const T *e);
+ *   int idtree_delpos(idtree_tree *t, intptr_t index, T *deleted);
+ *   int idtree_del(idtree_tree *t, const T *e, T *deleted);
+ *
+ * which behave as add234, index234, findrelpos234 (REL234_*, with e
+ * NULL for the ends), find234, delpos234 and del234 do on a sorted
+ * tree, except that elements are returned as pointers into the nodes:
+ * they're valid until the tree is next changed. The deletions copy the
+ * element to *deleted if it isn't NULL, and return 0 if there was
+ * nothing to delete. There's no unsorted variant.
+ *
+ * The nodes are the ones of the B-tree layout of tree234.c without the
+ * parent pointer, and so are the algorithms; it's tested alongside it.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "GuardedMalloc.h"
+#include "Tree234.h"
+
+#if !defined(TYPED234_NAME) || !defined(TYPED234_TYPE) || !defined(TYPED234_LESS)
+#error Define TYPED234_NAME, TYPED234_TYPE and TYPED234_LESS first
+#endif
+
+#ifndef TYPED234_KEYS
+#define TYPED234_KEYS 15
+#endif
+
+#if TYPED234_KEYS < 4 || TYPED234_KEYS > 255
+#error TYPED234_KEYS must be between 4 and 255
+#endif
+
+#define TYPED234_CAT2(a, b) a##_##b
+#define TYPED234_CAT(a, b) TYPED234_CAT2(a, b)
+#define TYPED234_FN(x) TYPED234_CAT(TYPED234_NAME, x)
+#define TYPED234_TREE TYPED234_FN(tree)
+#define TYPED234_NODE TYPED234_FN(node)
+#define TYPED234_ELEM TYPED234_FN(elem)
+#define TYPED234_INNER TYPED234_FN(inner)
+#define TYPED234_KIDS(n) (((TYPED234_INNER*)(n))->kids)
+#define TYPED234_COUNTS(n) (((TYPED234_INNER*)(n))->counts)
+#define TYPED234_MIN ((TYPED234_KEYS - 1) / 2)
+#define TYPED234_EQUAL(a, b) (!TYPED234_LESS(a, b) && !TYPED234_LESS(b, a))
+
+/* A typedef, so that const applies to the whole element type. */
+typedef TYPED234_TYPE TYPED234_ELEM;
+typedef struct TYPED234_FN(node_Tag) TYPED234_NODE;
+
+/* A leaf, and the start of an internal node. */
+struct TYPED234_FN(node_Tag) {
+	int32_t nelems;
+	int32_t leaf;
+	TYPED234_ELEM elems[TYPED234_KEYS];
+};
+
+typedef struct {
+	TYPED234_NODE node;
+	intptr_t counts[TYPED234_KEYS + 1];
+	TYPED234_NODE* kids[TYPED234_KEYS + 1];
+} TYPED234_INNER;
+
+typedef struct {
+	TYPED234_NODE* root;
+} TYPED234_TREE;
+
+static inline TYPED234_NODE* TYPED234_FN(newnode)(int leaf) {
+	TYPED234_NODE* n = malloc_guarded(leaf ? sizeof(TYPED234_NODE) : sizeof(TYPED234_INNER));
+	n->nelems = 0;
+	n->leaf = leaf;
+	return n;
+}
+
+static inline TYPED234_TREE* TYPED234_FN(new)(void) {
+	TYPED234_TREE* t = malloc_guarded(sizeof(*t));
+	t->root = NULL;
+	return t;
+}
+
+static inline void TYPED234_FN(freenode)(TYPED234_NODE* n) {
+	intptr_t i;
+	if (!n->leaf)
+		for (i = 0; i <= n->nelems; i++)
+			TYPED234_FN(freenode)(TYPED234_KIDS(n)[i]);
+	free(n);
+}
+
+static inline void TYPED234_FN(free)(TYPED234_TREE* t) {
+	if (t->root)
+		TYPED234_FN(freenode)(t->root);
+	free(t);
+}
+
+static inline intptr_t TYPED234_FN(countnode)(TYPED234_NODE* n) {
+	intptr_t count, i;
+	if (!n)
+		return 0;
+	count = n->nelems;
+	if (!n->leaf)
+		for (i = 0; i <= n->nelems; i++)
+			count += TYPED234_COUNTS(n)[i];
+	return count;
+}
+
+static inline intptr_t TYPED234_FN(count)(TYPED234_TREE* t) {
+	return TYPED234_FN(countnode)(t->root);
+}
+
+/*
+ * The number of elements of n that sort before e. Each step halves the
+ * range by selecting its base, which compiles to a conditional move
+ * rather than a branch.
+ */
+static inline intptr_t TYPED234_FN(search)(TYPED234_NODE* n, const TYPED234_ELEM* e) {
+	const TYPED234_ELEM* base = n->elems;
+	intptr_t len = n->nelems, half;
+	if (len == 0)
+		return 0;
+	while (len > 1) {
+		half = len / 2;
+		base = TYPED234_LESS(&base[half], e) ? base + half : base;
+		len -= half;
+	}
+	return (base - n->elems) + (TYPED234_LESS(base, e) ? 1 : 0);
+}
+
+static inline void TYPED234_FN(splitkid)(TYPED234_NODE* n, intptr_t i) {
+	TYPED234_NODE* left = TYPED234_KIDS(n)[i];
+	TYPED234_NODE* right = TYPED234_FN(newnode)(left->leaf);
+	intptr_t mid = TYPED234_KEYS / 2;
+	intptr_t nright = TYPED234_KEYS - mid - 1;
+	intptr_t rcount = nright, j;
+
+	memcpy(right->elems, left->elems + mid + 1, nright * sizeof(*right->elems));
+	if (!left->leaf) {
+		memcpy(TYPED234_KIDS(right), TYPED234_KIDS(left) + mid + 1, (nright + 1) * sizeof(TYPED234_NODE*));
+		memcpy(TYPED234_COUNTS(right), TYPED234_COUNTS(left) + mid + 1, (nright + 1) * sizeof(intptr_t));
+		for (j = 0; j <= nright; j++)
+			rcount += TYPED234_COUNTS(right)[j];
+	}
+	right->nelems = (int32_t)nright;
+	left->nelems = (int32_t)mid;
+
+	memmove(n->elems + i + 1, n->elems + i, (n->nelems - i) * sizeof(*n->elems));
+	memmove(TYPED234_KIDS(n) + i + 2, TYPED234_KIDS(n) + i + 1, (n->nelems - i) * sizeof(TYPED234_NODE*));
+	memmove(TYPED234_COUNTS(n) + i + 2, TYPED234_COUNTS(n) + i + 1, (n->nelems - i) * sizeof(intptr_t));
+	n->elems[i] = left->elems[mid];
+	TYPED234_KIDS(n)[i + 1] = right;
+	TYPED234_COUNTS(n)[i + 1] = rcount;
+	TYPED234_COUNTS(n)[i] -= rcount + 1;
+	n->nelems++;
+}
+
+static inline TYPED234_ELEM* TYPED234_FN(add)(TYPED234_TREE* t, TYPED234_ELEM e) {
+	TYPED234_NODE* path[64];
+	intptr_t kids[64];
+	intptr_t depth = 0, i;
+	TYPED234_NODE* n;
+
+	if (t->root == NULL) {
+		t->root = TYPED234_FN(newnode)(1);
+		t->root->elems[0] = e;
+		t->root->nelems = 1;
+		return &t->root->elems[0];
+	}
+	if (t->root->nelems == TYPED234_KEYS) {
+		TYPED234_NODE* root = TYPED234_FN(newnode)(0);
+		TYPED234_KIDS(root)[0] = t->root;
+		TYPED234_COUNTS(root)[0] = TYPED234_FN(countnode)(t->root);
+		t->root = root;
+		TYPED234_FN(splitkid)(root, 0);
+	}
+
+	n = t->root;
+	for (;;) {
+		i = TYPED234_FN(search)(n, &e);
+		if (i < n->nelems && !TYPED234_LESS(&e, &n->elems[i]))
+			return &n->elems[i];
+		if (n->leaf)
+			break;
+		if (TYPED234_KIDS(n)[i]->nelems == TYPED234_KEYS) {
+			TYPED234_FN(splitkid)(n, i);
+			if (TYPED234_EQUAL(&e, &n->elems[i]))
+				return &n->elems[i];
+			if (TYPED234_LESS(&n->elems[i], &e))
+				i++;
+		}
+		assert(depth < 64);
+		path[depth] = n;
+		kids[depth++] = i;
+		n = TYPED234_KIDS(n)[i];
+	}
+
+	memmove(n->elems + i + 1, n->elems + i, (n->nelems - i) * sizeof(*n->elems));
+	n->elems[i] = e;
+	n->nelems++;
+	while (depth-- > 0)
+		TYPED234_COUNTS(path[depth])[kids[depth]]++;
+	return &n->elems[i];
+}
+
+static inline TYPED234_ELEM* TYPED234_FN(index)(TYPED234_TREE* t, intptr_t index) {
+	TYPED234_NODE* n = t->root;
+	intptr_t i;
+
+	if (index < 0 || index >= TYPED234_FN(countnode)(n))
+		return NULL;
+	for (;;) {
+		if (n->leaf)
+			return &n->elems[index];
+		for (i = 0; index > TYPED234_COUNTS(n)[i]; i++)
+			index -= TYPED234_COUNTS(n)[i] + 1;
+		if (index == TYPED234_COUNTS(n)[i])
+			return &n->elems[i];
+		n = TYPED234_KIDS(n)[i];
+	}
+}
+
+static inline TYPED234_ELEM* TYPED234_FN(findrelpos)(TYPED234_TREE* t, const TYPED234_ELEM* e,
+	int relation, intptr_t* index) {
+	TYPED234_NODE* n = t->root;
+	TYPED234_ELEM* equal = NULL;
+	intptr_t lt = 0, i, k, count, ret;
+	int found = 0;
+
+	assert(relation >= REL234_EQ && relation <= REL234_GE);
+	if (!n)
+		return NULL;
+
+	/* A plain find needs no counting. */
+	if (relation == REL234_EQ && !index) {
+		for (;;) {
+			i = TYPED234_FN(search)(n, e);
+			if (i < n->nelems && !TYPED234_LESS(e, &n->elems[i]))
+				return &n->elems[i];
+			if (n->leaf)
+				return NULL;
+			n = TYPED234_KIDS(n)[i];
+		}
+	}
+	count = TYPED234_FN(countnode)(n);
+
+	if (e == NULL) {
+		assert(relation == REL234_LT || relation == REL234_GT);
+		lt = (relation == REL234_LT ? count : 0);
+	}
+	else {
+		for (;;) {
+			i = TYPED234_FN(search)(n, e);
+			found = (i < n->nelems && !TYPED234_LESS(e, &n->elems[i]));
+			if (!n->leaf)
+				for (k = 0; k < i + found; k++)
+					lt += TYPED234_COUNTS(n)[k];
+			lt += i;
+			if (found || n->leaf) {
+				if (found)
+					equal = &n->elems[i];
+				break;
+			}
+			n = TYPED234_KIDS(n)[i];
+		}
+	}
+
+	switch (relation) {
+	case REL234_EQ:
+		ret = found ? lt : -1;
+		break;
+	case REL234_LT:
+		ret = lt - 1;
+		break;
+	case REL234_LE:
+		ret = found ? lt : lt - 1;
+		break;
+	case REL234_GT:
+		ret = found ? lt + 1 : lt;
+		break;
+	default: /* REL234_GE */
+		ret = lt;
+		break;
+	}
+	if (ret < 0 || ret >= count)
+		return NULL;
+	if (index)
+		*index = ret;
+	return (found && ret == lt) ? equal : TYPED234_FN(index)(t, ret);
+}
+
+static inline TYPED234_ELEM* TYPED234_FN(find)(TYPED234_TREE* t, const TYPED234_ELEM* e) {
+	return TYPED234_FN(findrelpos)(t, e, REL234_EQ, NULL);
+}
+
+static inline TYPED234_NODE* TYPED234_FN(mergekids)(TYPED234_TREE* t, TYPED234_NODE* n, intptr_t i) {
+	TYPED234_NODE* left = TYPED234_KIDS(n)[i];
+	TYPED234_NODE* right = TYPED234_KIDS(n)[i + 1];
+
+	left->elems[left->nelems] = n->elems[i];
+	memcpy(left->elems + left->nelems + 1, right->elems, right->nelems * sizeof(*left->elems));
+	if (!left->leaf) {
+		memcpy(TYPED234_KIDS(left) + left->nelems + 1, TYPED234_KIDS(right), (right->nelems + 1) * sizeof(TYPED234_NODE*));
+		memcpy(TYPED234_COUNTS(left) + left->nelems + 1, TYPED234_COUNTS(right), (right->nelems + 1) * sizeof(intptr_t));
+	}
+	left->nelems += right->nelems + 1;
+	TYPED234_COUNTS(n)[i] += TYPED234_COUNTS(n)[i + 1] + 1;
+	free(right);
+
+	memmove(n->elems + i, n->elems + i + 1, (n->nelems - i - 1) * sizeof(*n->elems));
+	memmove(TYPED234_KIDS(n) + i + 1, TYPED234_KIDS(n) + i + 2, (n->nelems - i - 1) * sizeof(TYPED234_NODE*));
+	memmove(TYPED234_COUNTS(n) + i + 1, TYPED234_COUNTS(n) + i + 2, (n->nelems - i - 1) * sizeof(intptr_t));
+	n->nelems--;
+
+	if (n->nelems == 0) {
+		t->root = left;
+		free(n);
+	}
+	return left;
+}
+
+static inline intptr_t TYPED234_FN(fillkid)(TYPED234_TREE* t, TYPED234_NODE* n, intptr_t i, intptr_t* index) {
+	TYPED234_NODE* kid = TYPED234_KIDS(n)[i];
+	TYPED234_NODE* sib;
+	intptr_t moved;
+
+	if (kid->nelems > TYPED234_MIN)
+		return i;
+
+	if (i > 0 && TYPED234_KIDS(n)[i - 1]->nelems > TYPED234_MIN) {
+		sib = TYPED234_KIDS(n)[i - 1];
+		memmove(kid->elems + 1, kid->elems, kid->nelems * sizeof(*kid->elems));
+		kid->elems[0] = n->elems[i - 1];
+		n->elems[i - 1] = sib->elems[sib->nelems - 1];
+		moved = 1;
+		if (!kid->leaf) {
+			memmove(TYPED234_KIDS(kid) + 1, TYPED234_KIDS(kid), (kid->nelems + 1) * sizeof(TYPED234_NODE*));
+			memmove(TYPED234_COUNTS(kid) + 1, TYPED234_COUNTS(kid), (kid->nelems + 1) * sizeof(intptr_t));
+			TYPED234_KIDS(kid)[0] = TYPED234_KIDS(sib)[sib->nelems];
+			TYPED234_COUNTS(kid)[0] = TYPED234_COUNTS(sib)[sib->nelems];
+			moved += TYPED234_COUNTS(kid)[0];
+		}
+		kid->nelems++;
+		sib->nelems--;
+		TYPED234_COUNTS(n)[i - 1] -= moved;
+		TYPED234_COUNTS(n)[i] += moved;
+		*index += moved;
+		return i;
+	}
+
+	if (i < n->nelems && TYPED234_KIDS(n)[i + 1]->nelems > TYPED234_MIN) {
+		sib = TYPED234_KIDS(n)[i + 1];
+		kid->elems[kid->nelems] = n->elems[i];
+		n->elems[i] = sib->elems[0];
+		memmove(sib->elems, sib->elems + 1, (sib->nelems - 1) * sizeof(*sib->elems));
+		moved = 1;
+		if (!kid->leaf) {
+			TYPED234_KIDS(kid)[kid->nelems + 1] = TYPED234_KIDS(sib)[0];
+			TYPED234_COUNTS(kid)[kid->nelems + 1] = TYPED234_COUNTS(sib)[0];
+			moved += TYPED234_COUNTS(sib)[0];
+			memmove(TYPED234_KIDS(sib), TYPED234_KIDS(sib) + 1, sib->nelems * sizeof(TYPED234_NODE*));
+			memmove(TYPED234_COUNTS(sib), TYPED234_COUNTS(sib) + 1, sib->nelems * sizeof(intptr_t));
+		}
+		kid->nelems++;
+		sib->nelems--;
+		TYPED234_COUNTS(n)[i] += moved;
+		TYPED234_COUNTS(n)[i + 1] -= moved;
+		return i;
+	}
+
+	if (i < n->nelems) {
+		TYPED234_FN(mergekids)(t, n, i);
+		return i;
+	}
+	*index += TYPED234_COUNTS(n)[i - 1] + 1;
+	TYPED234_FN(mergekids)(t, n, i - 1);
+	return i - 1;
+}
+
+static inline int TYPED234_FN(delpos)(TYPED234_TREE* t, intptr_t index, TYPED234_ELEM* deleted) {
+	TYPED234_NODE* n = t->root;
+	TYPED234_ELEM* slot = NULL;    /* where the replacing element goes */
+	intptr_t i;
+
+	if (index < 0 || index >= TYPED234_FN(countnode)(n))
+		return 0;
+
+	for (;;) {
+		if (n->leaf) {
+			TYPED234_ELEM e = n->elems[index];
+			memmove(n->elems + index, n->elems + index + 1,
+				(n->nelems - index - 1) * sizeof(*n->elems));
+			n->nelems--;
+			if (n->nelems == 0) {
+				free(n);
+				t->root = NULL;
+			}
+			if (slot)
+				*slot = e;
+			else if (deleted)
+				*deleted = e;
+			return 1;
+		}
+
+		for (i = 0; index > TYPED234_COUNTS(n)[i]; i++)
+			index -= TYPED234_COUNTS(n)[i] + 1;
+
+		if (index == TYPED234_COUNTS(n)[i]) {
+			if (TYPED234_KIDS(n)[i]->nelems > TYPED234_MIN) {
+				if (deleted)
+					*deleted = n->elems[i];
+				slot = &n->elems[i];
+				index = TYPED234_COUNTS(n)[i] - 1;
+			}
+			else if (TYPED234_KIDS(n)[i + 1]->nelems > TYPED234_MIN) {
+				if (deleted)
+					*deleted = n->elems[i];
+				slot = &n->elems[i];
+				index = 0;
+				i++;
+			}
+			else {
+				TYPED234_NODE* kid = TYPED234_FN(mergekids)(t, n, i);
+				if (t->root == kid) {
+					n = kid;
+					continue;
+				}
+			}
+		}
+		else {
+			/* A merge under the root frees it. */
+			TYPED234_NODE* root = t->root;
+			i = TYPED234_FN(fillkid)(t, n, i, &index);
+			if (t->root != root) {
+				n = t->root;
+				continue;
+			}
+		}
+		TYPED234_COUNTS(n)[i]--;
+		n = TYPED234_KIDS(n)[i];
+	}
+}
+
+static inline int TYPED234_FN(del)(TYPED234_TREE* t, const TYPED234_ELEM* e, TYPED234_ELEM* deleted) {
+	intptr_t index;
+	if (!TYPED234_FN(findrelpos)(t, e, REL234_EQ, &index))
+		return 0;
+	return TYPED234_FN(delpos)(t, index, deleted);
+}
+
+#undef TYPED234_NAME
+#undef TYPED234_TYPE
+#undef TYPED234_ELEM
+#undef TYPED234_LESS
+#undef TYPED234_KEYS
+#undef TYPED234_CAT2
+#undef TYPED234_CAT
+#undef TYPED234_FN
+#undef TYPED234_TREE
+#undef TYPED234_NODE
+#undef TYPED234_INNER
+#undef TYPED234_KIDS
+#undef TYPED234_COUNTS
+#undef TYPED234_MIN
+#undef TYPED234_EQUAL
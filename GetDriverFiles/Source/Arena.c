@@ -0,0 +1,45 @@
+#include "Arena.h"
+#include "GuardedMalloc.h"
+
+// Blocks double from the first size to the last one. Larger allocations
+// get a block of their own.
+#define FIRST_BLOCK_SIZE 4096
+#define BLOCK_SIZE (256 * 1024)
+
+void ArenaInit(arena* pArena) {
+	*pArena = (arena)ARENA_INIT;
+}
+
+void ArenaFree(arena* pArena) {
+	for (arena_block* pBlock = pArena->pFirst; pBlock;) {
+		arena_block* pNext = pBlock->pNext;
+		free(pBlock);
+		pBlock = pNext;
+	}
+	ArenaInit(pArena);
+}
+
+// Moves on to the next block, if it's large enough, or inserts a new one
+// after the current one. The blocks skipped stay in the list, they're
+// tried again after the next reset.
+void* ArenaAllocSlow(arena* pArena, size_t Size) {
+	arena_block* pBlock = pArena->pBlock;
+	arena_block* pNext = pBlock ? pBlock->pNext : pArena->pFirst;
+	if (!pNext || pNext->Size < Size) {
+		size_t BlockSize = !pBlock ? FIRST_BLOCK_SIZE : pBlock->Size * 2 > BLOCK_SIZE ? BLOCK_SIZE : pBlock->Size * 2;
+		if (BlockSize < Size)
+			BlockSize = Size;
+		arena_block* pNew = malloc_guarded(sizeof(*pNew) + BlockSize);
+		pNew->Size = BlockSize;
+		pNew->pNext = pNext;
+		if (pBlock)
+			pBlock->pNext = pNew;
+		else
+			pArena->pFirst = pNew;
+		pArena->nBlocks += 1;
+		pNext = pNew;
+	}
+	pArena->pBlock = pNext;
+	pArena->Used = Size;
+	return pNext->aData;
+}
@@ -0,0 +1,319 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "Platform.h"
+
+#include "Batch.h"
+#include "GuardedMalloc.h"
+
+typedef struct {
+	driver_files_result Result;
+	uint32_t Error;
+	bool bDone;
+} batch_task;
+
+// The tasks a worker has left, [Next, End). The owner takes them from
+// the front, thieves take the back half, so each worker walks contiguous
+// runs of the list.
+typedef struct {
+	mutex Lock;
+	size_t Next;
+	size_t End;
+	arena Arena; // Reused for each of its INFs
+	char aPadding[64]; // Keep the workers' locks on separate cache lines
+} batch_worker;
+
+typedef struct {
+	char* const* asPaths;
+	size_t nPaths;
+	const driver_files_options* pOptions;
+	result_cache* pResultCache;
+	batch_task* aTasks;
+	batch_worker* aWorkers;
+	uint32_t nWorkers;
+
+	mutex EmitLock;
+	size_t NextEmit;
+	batch_emit_proc pfnEmit;
+	void* pContext;
+} batch_context;
+
+static bool PopTask(batch_worker* pWorker, size_t* pIndex) {
+	MutexLock(&pWorker->Lock);
+	bool bFound = pWorker->Next < pWorker->End;
+	if (bFound)
+		*pIndex = pWorker->Next++;
+	MutexUnlock(&pWorker->Lock);
+	return bFound;
+}
+
+// Moves the back half of another worker's tasks to pWorker, which has
+// none left. No task is ever added, so once every worker is empty, the
+// batch is done.
+static bool StealTasks(batch_context* pBatch, uint32_t WorkerIndex) {
+	batch_worker* pWorker = &pBatch->aWorkers[WorkerIndex];
+	for (uint32_t i = 1; i < pBatch->nWorkers; ++i) {
+		batch_worker* pVictim = &pBatch->aWorkers[(WorkerIndex + i) % pBatch->nWorkers];
+		MutexLock(&pVictim->Lock);
+		size_t Left = pVictim->End - pVictim->Next;
+		if (Left == 0) {
+			MutexUnlock(&pVictim->Lock);
+			continue;
+		}
+		size_t Stolen = (Left + 1) / 2;
+		size_t End = pVictim->End;
+		pVictim->End -= Stolen;
+		MutexUnlock(&pVictim->Lock);
+
+		MutexLock(&pWorker->Lock);
+		pWorker->Next = End - Stolen;
+		pWorker->End = End;
+		MutexUnlock(&pWorker->Lock);
+		return true;
+	}
+	return false;
+}
+
+// Marks the task done and emits every completed task following the
+// last emitted one. Results completed ahead of their turn are kept until
+// then, the output of an INF being a few KB at most.
+static void CompleteTask(batch_context* pBatch, size_t Index) {
+	MutexLock(&pBatch->EmitLock);
+	pBatch->aTasks[Index].bDone = true;
+	while (pBatch->NextEmit < pBatch->nPaths) {
+		size_t i = pBatch->NextEmit;
+		batch_task* pTask = &pBatch->aTasks[i];
+		if (!pTask->bDone)
+			break;
+		pBatch->pfnEmit(pBatch->pContext, pBatch->asPaths[i], pTask->Error, &pTask->Result);
+		FreeDriverFilesResult(&pTask->Result);
+		++pBatch->NextEmit;
+	}
+	MutexUnlock(&pBatch->EmitLock);
+}
+
+static void RunTask(batch_context* pBatch, size_t Index, arena* pArena) {
+	batch_task* pTask = &pBatch->aTasks[Index];
+	uint32_t Error = ERROR_SUCCESS;
+	char* sFullPath = GetFullPath(pBatch->asPaths[Index], &Error);
+	if (sFullPath) {
+		result_cache* pResultCache = pBatch->pResultCache;
+		if (!pResultCache || !ResultCacheLookup(pResultCache, sFullPath, &pTask->Result)) {
+			int64_t StartTime = GetCurrentFileTime();
+			GetDriverFiles(sFullPath, pBatch->pOptions, pArena, &pTask->Result);
+			if (pResultCache)
+				ResultCacheStore(pResultCache, sFullPath, &pTask->Result, StartTime);
+		}
+		Error = pTask->Result.Error;
+		free(sFullPath);
+	}
+	pTask->Error = Error;
+	CompleteTask(pBatch, Index);
+}
+
+static void BatchWorker(void* pParameter, uint32_t ThreadIndex) {
+	batch_context* pBatch = pParameter;
+	batch_worker* pWorker = &pBatch->aWorkers[ThreadIndex];
+	for (;;) {
+		size_t Index;
+		if (PopTask(pWorker, &Index))
+			RunTask(pBatch, Index, &pWorker->Arena);
+		else if (!StealTasks(pBatch, ThreadIndex))
+			break;
+	}
+}
+
+void RunBatch(
+	char* const* asPaths,
+	size_t nPaths,
+	const driver_files_options* pOptions,
+	result_cache* pResultCache,
+	uint32_t nJobs,
+	batch_emit_proc pfnEmit,
+	void* pContext
+) {
+	if (nJobs == 0)
+		nJobs = GetProcessorCount();
+	if (nJobs > nPaths)
+		nJobs = nPaths > 0 ? (uint32_t)nPaths : 1;
+
+	// The INFs are already spread over the threads, process the CopyINF
+	// levels of each one serially.
+	driver_files_options Options = *pOptions;
+	if (nJobs > 1)
+		Options.nThreads = 1;
+
+	batch_context Batch;
+	Batch.asPaths = asPaths;
+	Batch.nPaths = nPaths;
+	Batch.pOptions = &Options;
+	Batch.pResultCache = pResultCache;
+	Batch.aTasks = malloc_guarded((nPaths + 1) * sizeof(*Batch.aTasks));
+	memset(Batch.aTasks, 0, (nPaths + 1) * sizeof(*Batch.aTasks));
+	Batch.aWorkers = malloc_guarded(nJobs * sizeof(*Batch.aWorkers));
+	Batch.nWorkers = nJobs;
+	MutexInit(&Batch.EmitLock);
+	Batch.NextEmit = 0;
+	Batch.pfnEmit = pfnEmit;
+	Batch.pContext = pContext;
+
+	// Deal the list in contiguous runs.
+	for (uint32_t i = 0; i < nJobs; ++i) {
+		batch_worker* pWorker = &Batch.aWorkers[i];
+		MutexInit(&pWorker->Lock);
+		ArenaInit(&pWorker->Arena);
+		pWorker->Next = nPaths * i / nJobs;
+		pWorker->End = nPaths * (i + 1) / nJobs;
+	}
+
+	if (nJobs > 1)
+		RunThreads(nJobs, BatchWorker, &Batch);
+	else
+		BatchWorker(&Batch, 0);
+
+	for (uint32_t i = 0; i < nJobs; ++i) {
+		MutexDestroy(&Batch.aWorkers[i].Lock);
+		ArenaFree(&Batch.aWorkers[i].Arena);
+	}
+	MutexDestroy(&Batch.EmitLock);
+	free(Batch.aWorkers);
+	free(Batch.aTasks);
+}
+
+#ifdef BENCH_BATCH
+
+/*
+ * Scaling benchmark, build with the other sources but Main.c:
+ *   cc -O2 -DBENCH_BATCH -pthread -IInclude Source/Arena.c Source/Batch.c Source/DriverFiles.c Source/Inf*.c Source/Platform.c Source/ResultCache.c Source/StringPool.c Source/TextBuffer.c Source/Tree234.c
+ *
+ * It writes N driver INFs (2000 by default) named bench_batch_*.inf in
+ * the current directory, the even ones pulling in the next one by
+ * CopyINF, then scans them with 1, 2, 4... threads up to the processor
+ * count, or the second argument. Each run's output is checked against
+ * the serial one.
+ *
+ * It then scans them serially with a result cache, cold then warm.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+
+static double Now(void) {
+	struct timespec Time;
+	timespec_get(&Time, TIME_UTC);
+	return (double)Time.tv_sec + (double)Time.tv_nsec * 1e-9;
+}
+
+static void AppendResult(void* pContext, const char* sPath, uint32_t Error, const driver_files_result* pResult) {
+	text_buffer* pText = pContext;
+	TextAppendFormat(pText, "%s %u\n", sPath, Error);
+	TextAppend(pText, pResult->Output.p, pResult->Output.Length);
+	TextAppend(pText, pResult->Warnings.p, pResult->Warnings.Length);
+}
+
+int main(int argc, char** argv) {
+	size_t nInfs = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000;
+	char** asPaths = malloc_guarded(nInfs * sizeof(*asPaths));
+	for (size_t i = 0; i < nInfs; ++i) {
+		char sName[64];
+		snprintf(sName, sizeof(sName), "bench_batch_%05zu.inf", i);
+		uint32_t Error;
+		FILE* pFile = fopen(sName, "wb");
+		if (!pFile) {
+			perror(sName);
+			return 1;
+		}
+		fprintf(pFile, "[Version]\nSignature=\"$Windows NT$\"\nCatalogFile=drv%05zu.cat\n\n", i);
+		fprintf(pFile, "[Manufacturer]\n%%Mfg%%=Models,NTamd64\n\n[Models.NTamd64]\n%%Desc%%=Install,PCI\\VEN_%04zx\n\n", i);
+		fprintf(pFile, "[Install.NTamd64]\nCopyFiles=Files\n");
+		if (i % 2 == 0 && i + 1 < nInfs)
+			fprintf(pFile, "CopyINF=bench_batch_%05zu.inf\n", i + 1);
+		fprintf(pFile, "\n[Files]\n");
+		for (size_t j = 0; j < 100; ++j)
+			fprintf(pFile, "file%05zu_%03zu.sys\n", i, j);
+		fprintf(pFile, "\n[SourceDisksNames]\n1 = %%Disk%%,,,\\x64\n\n[SourceDisksFiles]\n");
+		for (size_t j = 0; j < 100; ++j)
+			fprintf(pFile, "file%05zu_%03zu.sys = 1,drivers\\sub%zu\n", i, j, j % 8);
+		fprintf(pFile, "\n[Strings]\nMfg=\"Bench\"\nDesc=\"Bench device %zu\"\nDisk=\"Disk 1\"\n", i);
+		fclose(pFile);
+		asPaths[i] = GetFullPath(sName, &Error);
+	}
+
+	driver_files_options Options = { 1, 1, 0, NULL, NULL, 0, NULL };
+	text_buffer Serial = { NULL, 0, 0 };
+	uint32_t nProcessors = GetProcessorCount();
+	uint32_t MaxJobs = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : nProcessors;
+	if (MaxJobs == 0)
+		MaxJobs = 1;
+	printf("%zu INFs, %u processors\n", nInfs, nProcessors);
+	double SerialTime = 0;
+	for (uint32_t nJobs = 1;; nJobs *= 2) {
+		if (nJobs > MaxJobs)
+			nJobs = MaxJobs;
+		text_buffer Text = { NULL, 0, 0 };
+		double Start = Now();
+		RunBatch(asPaths, nInfs, &Options, NULL, nJobs, AppendResult, &Text);
+		double Time = Now() - Start;
+		if (nJobs == 1) {
+			SerialTime = Time;
+			Serial = Text;
+		} else {
+			if (Text.Length != Serial.Length || memcmp(Text.p, Serial.p, Text.Length) != 0) {
+				fprintf(stderr, "Output with %u jobs differs from the serial one\n", nJobs);
+				return 1;
+			}
+			TextFree(&Text);
+		}
+		printf("%3u jobs: %8.1f ms, %8.0f INF/s, speedup %.2f\n", nJobs, Time * 1e3, nInfs / Time, SerialTime / Time);
+		if (nJobs == MaxJobs)
+			break;
+	}
+
+	// Files written less than 2 seconds ago aren't cached, wait.
+	int64_t Written = GetCurrentFileTime();
+	while (GetCurrentFileTime() < Written + 3 * (int64_t)FILE_TIME_PER_SECOND)
+		;
+	const char* sCachePath = "bench_batch.cache";
+	remove(sCachePath);
+	for (int Run = 0; Run < 2; ++Run) {
+		result_cache* pCache = OpenResultCache(sCachePath, &Options, NULL);
+		text_buffer Text = { NULL, 0, 0 };
+		double Start = Now();
+		RunBatch(asPaths, nInfs, &Options, pCache, 1, AppendResult, &Text);
+		double Time = Now() - Start;
+		uint64_t Hits;
+		uint64_t Misses;
+		GetResultCacheStats(pCache, &Hits, &Misses);
+		uint32_t Error;
+		if (!SaveResultCache(pCache, &Error)) {
+			fprintf(stderr, "Cannot save %s: %u\n", sCachePath, Error);
+			return 1;
+		}
+		FreeResultCache(pCache);
+		if (Text.Length != Serial.Length || memcmp(Text.p, Serial.p, Text.Length) != 0) {
+			fprintf(stderr, "Output with the cache differs from the serial one\n");
+			return 1;
+		}
+		TextFree(&Text);
+		printf(
+			"%s cache: %8.1f ms, %8.0f INF/s, %"PRIu64" hits, speedup %.2f\n",
+			Run == 0 ? "cold" : "warm",
+			Time * 1e3,
+			nInfs / Time,
+			Hits,
+			SerialTime / Time
+		);
+	}
+	remove(sCachePath);
+
+	TextFree(&Serial);
+	for (size_t i = 0; i < nInfs; ++i) {
+		remove(asPaths[i]);
+		free(asPaths[i]);
+	}
+	free(asPaths);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,935 @@
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "Platform.h"
+
+#include "Arena.h"
+#include "AsciiCase.h"
+#include "DriverFiles.h"
+#include "GuardedMalloc.h"
+#include "InfInstall.h"
+#include "InfReader.h"
+#include "InfStrings.h"
+#include "StringPool.h"
+#include "Tree234.h"
+
+#define static_arrlen(X) (sizeof(X) / sizeof(*X))
+
+// One INF of the package, the root one or one pulled in by CopyINF.
+typedef struct inf_node_Tag inf_node;
+struct inf_node_Tag {
+	char* sPath;   // Full path, used to detect INFs reached twice
+	char* sName;   // Relative to the root INF directory, NULL for the root
+	char* sPrefix; // Directory part of sName, "" for the root
+	inf_node* pParent;
+	uint32_t Error;
+	text_buffer Output;
+	text_buffer Warnings;
+	text_buffer Inputs; // Include= and LayoutFile= INFs read, one path per line
+	char** asCopyInf; // CopyINF entries, relative to the directory of this INF
+	uint32_t nCopyInf;
+};
+
+static void Warn(inf_node* pNode, const char* sFormat, ...) {
+	TextAppendString(&pNode->Warnings, "WARNING: ");
+	if (pNode->sName)
+		TextAppendFormat(&pNode->Warnings, "%s: ", pNode->sName);
+	va_list Args;
+	va_start(Args, sFormat);
+	TextAppendFormatV(&pNode->Warnings, sFormat, Args);
+	va_end(Args);
+}
+
+typedef struct {
+	int32_t Id;
+	inf_field Path; // Empty if there's no path
+} disk_properties;
+
+// Disk IDs are small integers, mostly 1 to 100. The ones below
+// DISK_MAP_DIRECT are indexed directly, the others are hashed.
+#define DISK_MAP_DIRECT 256
+
+typedef struct {
+	disk_properties* apDirect[DISK_MAP_DIRECT];
+	disk_properties** apHashed; // Open addressing, NULL for an empty slot
+	uint32_t HashMask;          // Slot count - 1, a power of 2
+	uint32_t nHashed;
+} disk_map;
+
+static uint32_t HashDiskId(int32_t Id) {
+	return (uint32_t)Id * 2654435761u;
+}
+
+// The slot of Id, or the empty slot where it goes.
+static disk_properties** FindDiskSlot(disk_properties** apHashed, uint32_t Mask, int32_t Id) {
+	uint32_t Slot = HashDiskId(Id) & Mask;
+	while (apHashed[Slot] && apHashed[Slot]->Id != Id)
+		Slot = (Slot + 1) & Mask;
+	return &apHashed[Slot];
+}
+
+// Keeps the load factor at 1/2 at most. The old table is left in the
+// arena.
+static void GrowDiskMap(disk_map* pMap, arena* pArena) {
+	uint32_t OldCount = pMap->apHashed ? pMap->HashMask + 1 : 0;
+	uint32_t Count = OldCount ? OldCount * 2 : 16;
+	disk_properties** apHashed = ArenaAlloc(pArena, Count * sizeof(*apHashed));
+	memset(apHashed, 0, Count * sizeof(*apHashed));
+	for (uint32_t i = 0; i < OldCount; ++i)
+		if (pMap->apHashed[i])
+			*FindDiskSlot(apHashed, Count - 1, pMap->apHashed[i]->Id) = pMap->apHashed[i];
+	pMap->apHashed = apHashed;
+	pMap->HashMask = Count - 1;
+}
+
+// Returns the disk with this ID. If there's none, it's added with only
+// its Id set, and *pbAdded is set.
+static disk_properties* DiskMapInsert(disk_map* pMap, int32_t Id, arena* pArena, bool* pbAdded) {
+	disk_properties** ppDisk;
+	if ((uint32_t)Id < DISK_MAP_DIRECT) {
+		ppDisk = &pMap->apDirect[Id];
+	} else {
+		if ((pMap->nHashed + 1) * 2 > (pMap->apHashed ? pMap->HashMask + 1 : 0))
+			GrowDiskMap(pMap, pArena);
+		ppDisk = FindDiskSlot(pMap->apHashed, pMap->HashMask, Id);
+	}
+	*pbAdded = !*ppDisk;
+	if (*pbAdded) {
+		*ppDisk = ArenaAlloc(pArena, sizeof(**ppDisk));
+		(*ppDisk)->Id = Id;
+		pMap->nHashed += (uint32_t)Id >= DISK_MAP_DIRECT;
+	}
+	return *ppDisk;
+}
+
+static const disk_properties* DiskMapFind(const disk_map* pMap, int32_t Id) {
+	if ((uint32_t)Id < DISK_MAP_DIRECT)
+		return pMap->apDirect[Id];
+	if (!pMap->apHashed)
+		return NULL;
+	return *FindDiskSlot(pMap->apHashed, pMap->HashMask, Id);
+}
+
+static void GetCatalogFile(inf_node* pNode, const inf_file* pInf, const inf_strings* pStrings) {
+	// Get catalog file
+	// https://learn.microsoft.com/en-us/windows-hardware/drivers/install/inf-version-section
+
+	char* asCatalogFileVariants[] = {
+		"CatalogFile",
+		"CatalogFile.NT",
+		"CatalogFile.NTX86",
+		"CatalogFile.NTIA64",
+		"CatalogFile.NTAMD64",
+		"CatalogFile.NTARM",
+		"CatalogFile.NTARM64",
+	};
+	inf_expand_buffer ExpandBuffer = { NULL, 0 };
+	for (size_t i = 0; i < static_arrlen(asCatalogFileVariants); ++i) {
+
+		// Assuming there are no repeated entry.
+		inf_context InfContext;
+		if (
+			InfFindFirstLine(
+				pInf,
+				"Version",
+				asCatalogFileVariants[i],
+				&InfContext
+			)
+		) {
+
+			inf_field FileName;
+			if (!InfGetStringField(&InfContext, 1, &FileName))
+				// Never happens, a line with a key always has at least one field.
+				continue;
+			FileName = InfExpandField(pStrings, FileName, &ExpandBuffer);
+
+			// From the docs: "Windows assumes that the catalog file is in the same location as the INF file."
+			TextAppendFormat(&pNode->Output, "%s%.*s\n", pNode->sPrefix, (int)FileName.Length, FileName.s);
+
+		}
+
+	};
+	InfFreeExpandBuffer(&ExpandBuffer);
+}
+
+// The map and the disks are allocated in pArena.
+static const disk_map* LoadDisks(inf_node* pNode, const inf_file* pInf, const inf_strings* pStrings, arena* pArena) {
+
+	// Get disk paths
+	// https://learn.microsoft.com/en-us/windows-hardware/drivers/install/inf-sourcedisksnames-section
+
+	char* asSourceDisksNamesVariants[] = {
+		"SourceDisksNames",
+		"SourceDisksNames.X86",
+		"SourceDisksNames.IA64",
+		"SourceDisksNames.AMD64",
+		"SourceDisksNames.ARM",
+		"SourceDisksNames.ARM64",
+	};
+	inf_expand_buffer ExpandBuffer = { NULL, 0 };
+	disk_map* pDisks = ArenaAlloc(pArena, sizeof(*pDisks));
+	memset(pDisks, 0, sizeof(*pDisks));
+	for (size_t i = 0; i < static_arrlen(asSourceDisksNamesVariants); ++i) {
+
+		// Repeated sections are merged by the reader.
+		inf_context InfContext;
+		if (
+			InfFindFirstLine(
+				pInf,
+				asSourceDisksNamesVariants[i],
+				NULL,
+				&InfContext
+			)
+		) {
+
+			int32_t RemainingLines = InfGetLineCount(pInf, asSourceDisksNamesVariants[i]);
+			if (RemainingLines == -1)
+				continue;
+
+			while (RemainingLines > 0) {
+
+				int32_t DiskId;
+				if (!InfGetIntField(&InfContext, 0, &DiskId)) {
+					Warn(
+						pNode,
+						"Section %u, line %u: "
+						"Cannot find diskid. Skipping line.\n",
+						InfContext.Section,
+						InfContext.Line
+					);
+					goto NextLine0;
+				}
+
+				// Skip repeated entries
+				bool bAdded;
+				disk_properties* pDiskProperties = DiskMapInsert(pDisks, DiskId, pArena, &bAdded);
+				if (!bAdded) {
+					Warn(
+						pNode,
+						"Section %u, line %u: "
+						"Repeated diskid %"PRIu32". Skipping line.\n",
+						InfContext.Section,
+						InfContext.Line,
+						DiskId
+					);
+					goto NextLine0;
+				}
+
+				if (InfGetStringField(&InfContext, 4, &pDiskProperties->Path)) {
+					inf_field Path = InfExpandField(pStrings, pDiskProperties->Path, &ExpandBuffer);
+					if (Path.s != pDiskProperties->Path.s)
+						// The buffer is reused, keep a copy.
+						Path.s = ArenaCopyString(pArena, Path.s, Path.Length);
+					pDiskProperties->Path = Path;
+					InfTrimBslash(&pDiskProperties->Path);
+				} else {
+					pDiskProperties->Path = (inf_field){ NULL, 0 };
+				}
+
+				NextLine0:
+				InfFindNextLine(&InfContext, &InfContext);
+				--RemainingLines;
+
+			};
+
+		}
+
+	};
+	InfFreeExpandBuffer(&ExpandBuffer);
+	return pDisks;
+}
+
+// Appends the path of the [SourceDisksFiles] entry at pContext, relative
+// to the root INF.
+static void AppendSourceFile(
+	inf_node* pNode,
+	const disk_map* pDisks,
+	const inf_context* pContext,
+	inf_field FileName,
+	const inf_strings* pStrings,
+	inf_expand_buffer* pExpandBuffer
+) {
+
+	// Get corresponding disk path
+
+	int32_t DiskId = 0;
+	if (!InfGetIntField(pContext, 1, &DiskId)) {
+		Warn(
+			pNode,
+			"Section %u, line %u: "
+			"Cannot find diskid. Skipping line.\n",
+			pContext->Section,
+			pContext->Line
+		);
+		return;
+	}
+
+	const disk_properties* pDiskProperties = DiskMapFind(pDisks, DiskId);
+
+	if (!pDiskProperties) {
+		Warn(
+			pNode,
+			"Section %u, line %u: "
+			"Unknown diskid %"PRIu32". Skipping line.\n",
+			pContext->Section,
+			pContext->Line,
+			DiskId
+		);
+		return;
+	}
+	bool bHaveDiskPath = pDiskProperties->Path.Length > 0;
+
+	// Get sub dir
+
+	inf_field Subdir = { 0 };
+	bool bHaveSubdir = InfGetStringField(pContext, 2, &Subdir);
+	if (bHaveSubdir) {
+		Subdir = InfExpandField(pStrings, Subdir, pExpandBuffer);
+		InfTrimBslash(&Subdir);
+	}
+	bHaveSubdir &= Subdir.Length > 0; // Handle empty sub dir "0,,"
+
+	// Combine all parts
+
+	TextAppendString(&pNode->Output, pNode->sPrefix);
+	if (bHaveDiskPath) {
+		TextAppend(&pNode->Output, pDiskProperties->Path.s, pDiskProperties->Path.Length);
+		TextAppend(&pNode->Output, "\\", 1);
+	}
+	if (bHaveSubdir) {
+		TextAppend(&pNode->Output, Subdir.s, Subdir.Length);
+		TextAppend(&pNode->Output, "\\", 1);
+	}
+	TextAppend(&pNode->Output, FileName.s, FileName.Length);
+	TextAppend(&pNode->Output, "\n", 1);
+}
+
+// Get source files
+// https://learn.microsoft.com/en-us/windows-hardware/drivers/install/inf-sourcedisksfiles-section
+
+static char* asSourceDisksFilesVariants[] = {
+	"SourceDisksFiles",
+	"SourceDisksFiles.X86",
+	"SourceDisksFiles.IA64",
+	"SourceDisksFiles.AMD64",
+	"SourceDisksFiles.ARM",
+	"SourceDisksFiles.ARM64",
+};
+
+static void GetSourceFiles(inf_node* pNode, const inf_file* pInf, const inf_strings* pStrings, arena* pArena) {
+	inf_expand_buffer ExpandBuffer = { NULL, 0 };
+	inf_expand_buffer ExpandBuffer2 = { NULL, 0 };
+	const disk_map* pDisks = LoadDisks(pNode, pInf, pStrings, pArena);
+	for (size_t i = 0; i < static_arrlen(asSourceDisksFilesVariants); ++i) {
+
+		// Repeated sections are merged by the reader.
+		inf_context InfContext;
+		if (
+			InfFindFirstLine(
+				pInf,
+				asSourceDisksFilesVariants[i],
+				NULL,
+				&InfContext
+			)
+		) {
+
+			do {
+
+				inf_field FileName;
+				if (!InfGetStringField(&InfContext, 0, &FileName))
+					// Never happens as it'll output empty string instead.
+					continue;
+				FileName = InfExpandField(pStrings, FileName, &ExpandBuffer);
+				AppendSourceFile(pNode, pDisks, &InfContext, FileName, pStrings, &ExpandBuffer2);
+
+			} while (InfFindNextLine(&InfContext, &InfContext));
+
+		}
+
+	};
+
+	InfFreeExpandBuffer(&ExpandBuffer);
+	InfFreeExpandBuffer(&ExpandBuffer2);
+}
+
+typedef struct {
+	inf_field Name;
+	inf_context Context;
+} source_file;
+
+static int SourceFileCompare(const void* pA, const void* pB) {
+	const inf_field* A = &((const source_file*)pA)->Name;
+	const inf_field* B = &((const source_file*)pB)->Name;
+	return CompareStringI(A->s, A->Length, B->s, B->Length);
+}
+
+// Only list the source files the install sections copy, see InfInstall.h.
+static void AppendIncludePath(inf_node* pNode, inf_include_cache* pCache, inf_field Name) {
+	char* sPath = InfGetIncludePath(pCache, Name);
+	TextAppendFormat(&pNode->Inputs, "%s\n", sPath);
+	free(sPath);
+}
+
+// LayoutFile=filename.inf[,...] supplies the source files of system INFs.
+// The layouts are shared through the include cache.
+static const inf_layout** GetLayouts(
+	inf_node* pNode,
+	const inf_file* pInf,
+	const inf_strings* pStrings,
+	inf_include_cache* pCache,
+	arena* pArena,
+	uint32_t* pnLayouts
+) {
+	*pnLayouts = 0;
+	inf_context InfContext;
+	if (!pCache || !InfFindFirstLine(pInf, "Version", "LayoutFile", &InfContext))
+		return NULL;
+
+	inf_expand_buffer ExpandBuffer = { NULL, 0 };
+	uint32_t FieldCount = InfGetFieldCount(&InfContext);
+	const inf_layout** apLayouts = ArenaAlloc(pArena, (FieldCount + 1) * sizeof(*apLayouts));
+	for (uint32_t i = 1; i <= FieldCount; ++i) {
+		inf_field Name;
+		InfGetStringField(&InfContext, i, &Name);
+		Name = InfExpandField(pStrings, Name, &ExpandBuffer);
+		if (Name.Length == 0)
+			continue;
+
+		AppendIncludePath(pNode, pCache, Name);
+		uint32_t Error;
+		const inf_layout* pLayout = InfGetLayout(pCache, Name, &Error);
+		if (pLayout) {
+			apLayouts[(*pnLayouts)++] = pLayout;
+			continue;
+		}
+		char* sErrorMessage = GetSystemErrorMessage(Error);
+		Warn(pNode, "Unable to open the layout file '%.*s': %s", (int)Name.Length, Name.s, sErrorMessage);
+		FreeSystemErrorMessage(sErrorMessage);
+	}
+	InfFreeExpandBuffer(&ExpandBuffer);
+	return apLayouts;
+}
+
+// Layout paths are relative to the Windows media, not to the root INF.
+static void AppendLayoutFile(inf_node* pNode, const layout_file* pFile) {
+	if (pFile->DiskPath.Length > 0) {
+		TextAppend(&pNode->Output, pFile->DiskPath.s, pFile->DiskPath.Length);
+		TextAppend(&pNode->Output, "\\", 1);
+	}
+	if (pFile->Subdir.Length > 0) {
+		TextAppend(&pNode->Output, pFile->Subdir.s, pFile->Subdir.Length);
+		TextAppend(&pNode->Output, "\\", 1);
+	}
+	TextAppend(&pNode->Output, pFile->FileName.s, pFile->FileName.Length);
+	TextAppend(&pNode->Output, "\n", 1);
+}
+
+static bool FindInLayouts(inf_node* pNode, const inf_layout** apLayouts, uint32_t nLayouts, inf_field FileName) {
+	for (uint32_t i = 0; i < nLayouts; ++i) {
+		uint32_t Count;
+		const layout_file* aFiles = InfFindLayoutFile(apLayouts[i], FileName.s, FileName.Length, &Count);
+		for (uint32_t j = 0; j < Count; ++j)
+			AppendLayoutFile(pNode, &aFiles[j]);
+		if (Count > 0)
+			return true;
+	}
+	return false;
+}
+
+static void GetReachableFiles(
+	inf_node* pNode,
+	const inf_file* pInf,
+	const inf_strings* pStrings,
+	const install_graph* pGraph,
+	inf_include_cache* pCache,
+	arena* pArena
+) {
+	inf_expand_buffer ExpandBuffer = { NULL, 0 };
+	uint32_t nLayouts;
+	const inf_layout** apLayouts = GetLayouts(pNode, pInf, pStrings, pCache, pArena, &nLayouts);
+
+	// Sort [SourceDisksFiles] by name. A file can be listed by several
+	// platform variants, all of them are kept.
+	uint32_t nSourceFiles = 0;
+	uint32_t Capacity = 0;
+	source_file* aSourceFiles = NULL;
+	for (size_t i = 0; i < static_arrlen(asSourceDisksFilesVariants); ++i) {
+		inf_context InfContext;
+		if (!InfFindFirstLine(pInf, asSourceDisksFilesVariants[i], NULL, &InfContext))
+			continue;
+		do {
+			if (nSourceFiles == Capacity) {
+				Capacity = Capacity ? Capacity * 2 : 64;
+				aSourceFiles = realloc_guarded(aSourceFiles, Capacity * sizeof(*aSourceFiles));
+			}
+			source_file* pSourceFile = &aSourceFiles[nSourceFiles++];
+			inf_field FileName;
+			InfGetStringField(&InfContext, 0, &FileName);
+			pSourceFile->Name = InfExpandField(pStrings, FileName, &ExpandBuffer);
+			if (pSourceFile->Name.s != FileName.s)
+				pSourceFile->Name.s = ArenaCopyString(pArena, pSourceFile->Name.s, pSourceFile->Name.Length);
+			pSourceFile->Context = InfContext;
+		} while (InfFindNextLine(&InfContext, &InfContext));
+	}
+	if (nSourceFiles > 0)
+		qsort(aSourceFiles, nSourceFiles, sizeof(*aSourceFiles), SourceFileCompare);
+
+	const disk_map* pDisks = LoadDisks(pNode, pInf, pStrings, pArena);
+	for (uint32_t i = 0; i < pGraph->nFiles; ++i) {
+		const install_ref* pRef = &pGraph->aFiles[i];
+
+		// Lower bound
+		source_file Key = { pRef->Name, { NULL, 0, 0 } };
+		uint32_t Low = 0;
+		uint32_t High = nSourceFiles;
+		while (Low < High) {
+			uint32_t Middle = Low + (High - Low) / 2;
+			if (SourceFileCompare(&aSourceFiles[Middle], &Key) < 0)
+				Low = Middle + 1;
+			else
+				High = Middle;
+		}
+
+		if (Low == nSourceFiles || SourceFileCompare(&aSourceFiles[Low], &Key) != 0) {
+			// The INF's own sections come first.
+			if (FindInLayouts(pNode, apLayouts, nLayouts, pRef->Name))
+				continue;
+			Warn(
+				pNode,
+				"Section %u, line %u: "
+				"%.*s is copied but isn't in SourceDisksFiles.\n",
+				pRef->Section,
+				pRef->Line,
+				(int)pRef->Name.Length,
+				pRef->Name.s
+			);
+			continue;
+		}
+		for (; Low < nSourceFiles && SourceFileCompare(&aSourceFiles[Low], &Key) == 0; ++Low)
+			AppendSourceFile(pNode, pDisks, &aSourceFiles[Low].Context, aSourceFiles[Low].Name, pStrings, &ExpandBuffer);
+	}
+
+	for (uint32_t i = 0; i < pGraph->nMissing; ++i) {
+		const install_ref* pRef = &pGraph->aMissing[i];
+		Warn(
+			pNode,
+			"Section %u, line %u: "
+			"Cannot find CopyFiles section %.*s.\n",
+			pRef->Section,
+			pRef->Line,
+			(int)pRef->Name.Length,
+			pRef->Name.s
+		);
+	}
+
+	for (uint32_t i = 0; i < pGraph->nMissingIncludes; ++i) {
+		const install_ref* pRef = &pGraph->aMissingIncludes[i];
+		Warn(
+			pNode,
+			"Section %u, line %u: "
+			"Cannot open included INF %.*s.\n",
+			pRef->Section,
+			pRef->Line,
+			(int)pRef->Name.Length,
+			pRef->Name.s
+		);
+	}
+
+	for (uint32_t i = 0; i < pGraph->nMissingNeeds; ++i) {
+		const install_ref* pRef = &pGraph->aMissingNeeds[i];
+		Warn(
+			pNode,
+			"Section %u, line %u: "
+			"Cannot find needed section %.*s in the included INFs.\n",
+			pRef->Section,
+			pRef->Line,
+			(int)pRef->Name.Length,
+			pRef->Name.s
+		);
+	}
+
+	free(aSourceFiles);
+	InfFreeExpandBuffer(&ExpandBuffer);
+}
+
+static void AddCopyInf(inf_node* pNode, inf_field FileName, uint32_t* pCapacity) {
+	InfTrimBslash(&FileName);
+	if (FileName.Length == 0)
+		return;
+
+	if (pNode->nCopyInf == *pCapacity) {
+		*pCapacity = *pCapacity ? *pCapacity * 2 : 4;
+		pNode->asCopyInf = realloc_guarded(pNode->asCopyInf, *pCapacity * sizeof(*pNode->asCopyInf));
+	}
+	char* sFileName = malloc_guarded(FileName.Length + 1);
+	memcpy(sFileName, FileName.s, FileName.Length);
+	sFileName[FileName.Length] = '\0';
+	pNode->asCopyInf[pNode->nCopyInf++] = sFileName;
+}
+
+// CopyINF is only valid in DDInstall sections. Without the install graph
+// any section will do.
+// https://learn.microsoft.com/en-us/windows-hardware/drivers/install/inf-copyinf-directive
+static void GetCopyInf(inf_node* pNode, const inf_file* pInf, const inf_strings* pStrings) {
+	inf_expand_buffer ExpandBuffer = { NULL, 0 };
+	uint32_t Capacity = 0;
+	uint32_t nSections = InfGetSectionCount(pInf);
+	for (uint32_t Section = 0; Section < nSections; ++Section) {
+		inf_context InfContext;
+		if (!InfFindFirstLineByIndex(pInf, Section, "CopyINF", &InfContext))
+			continue;
+		do {
+			uint32_t FieldCount = InfGetFieldCount(&InfContext);
+			for (uint32_t i = 1; i <= FieldCount; ++i) {
+				inf_field FileName;
+				InfGetStringField(&InfContext, i, &FileName);
+				AddCopyInf(pNode, InfExpandField(pStrings, FileName, &ExpandBuffer), &Capacity);
+			}
+		} while (InfFindNextMatchLine(&InfContext, "CopyINF", &InfContext));
+	}
+	InfFreeExpandBuffer(&ExpandBuffer);
+}
+
+// What's allocated in pArena is freed on return.
+static void ProcessInf(inf_node* pNode, const driver_files_options* pOptions, arena* pArena) {
+	inf_file* pInf = InfOpenFile(pNode->sPath, &pNode->Error);
+	if (!pInf)
+		return;
+
+	// The companion INFs are part of the package too, the root one the
+	// user already knows.
+	if (pNode->sName && pOptions->bGetSource)
+		TextAppendFormat(&pNode->Output, "%s\n", pNode->sName);
+
+	inf_strings* pStrings = InfLoadStrings(pInf, pOptions->sLocale);
+	if (pOptions->bGetCatalog)
+		GetCatalogFile(pNode, pInf, pStrings);
+
+	if (pOptions->bReachableOnly) {
+		install_graph Graph;
+		InfGetInstallGraph(pInf, pStrings, pOptions->pIncludeCache, pArena, &Graph);
+		if (pOptions->bGetSource)
+			GetReachableFiles(pNode, pInf, pStrings, &Graph, pOptions->pIncludeCache, pArena);
+		uint32_t Capacity = 0;
+		for (uint32_t i = 0; i < Graph.nCopyInf; ++i)
+			AddCopyInf(pNode, Graph.aCopyInf[i].Name, &Capacity);
+		for (uint32_t i = 0; i < Graph.nIncludes; ++i)
+			AppendIncludePath(pNode, pOptions->pIncludeCache, Graph.aIncludes[i].Name);
+		InfFreeInstallGraph(&Graph);
+	} else {
+		if (pOptions->bGetSource)
+			GetSourceFiles(pNode, pInf, pStrings, pArena);
+		GetCopyInf(pNode, pInf, pStrings);
+	}
+
+	InfFreeStrings(pStrings);
+	InfCloseFile(pInf);
+	ArenaReset(pArena);
+}
+
+// INFs of one level of the CopyINF graph are independent, parse them in parallel.
+
+typedef struct {
+	inf_node** apNodes;
+	size_t nNodes;
+	volatile size_t Next;
+	const driver_files_options* pOptions;
+	arena** apArenas; // One per thread
+} level_context;
+
+static void ProcessLevel(void* pParameter, uint32_t ThreadIndex) {
+	level_context* pLevel = pParameter;
+	for (;;) {
+		size_t i = AtomicFetchAdd(&pLevel->Next, 1);
+		if (i >= pLevel->nNodes)
+			break;
+		ProcessInf(pLevel->apNodes[i], pLevel->pOptions, pLevel->apArenas[ThreadIndex]);
+	}
+}
+
+static int NodeCompare(inf_node* A, inf_node* B) {
+	return ComparePath(A->sPath, B->sPath);
+}
+
+static inf_node* NewNode(char* sPath, char* sName, inf_node* pParent) {
+	inf_node* pNode = malloc_guarded(sizeof(*pNode));
+	memset(pNode, 0, sizeof(*pNode));
+	pNode->sPath = sPath;
+	pNode->sName = sName;
+	pNode->pParent = pParent;
+
+	const char* pSlash = sName ? strrchr(sName, '\\') : NULL;
+	size_t PrefixLength = pSlash ? (size_t)(pSlash + 1 - sName) : 0;
+	pNode->sPrefix = malloc_guarded(PrefixLength + 1);
+	if (PrefixLength > 0)
+		memcpy(pNode->sPrefix, sName, PrefixLength);
+	pNode->sPrefix[PrefixLength] = '\0';
+	return pNode;
+}
+
+static void FreeNode(inf_node* pNode) {
+	for (uint32_t i = 0; i < pNode->nCopyInf; ++i)
+		free(pNode->asCopyInf[i]);
+	free(pNode->asCopyInf);
+	TextFree(&pNode->Output);
+	TextFree(&pNode->Warnings);
+	TextFree(&pNode->Inputs);
+	free(pNode->sPrefix);
+	free(pNode->sName);
+	free(pNode->sPath);
+	free(pNode);
+}
+
+static const char* GetNodeName(const inf_node* pNode) {
+	if (pNode->sName)
+		return pNode->sName;
+	const char* pSeparator = strrchr(pNode->sPath, PATH_SEPARATOR);
+	return pSeparator ? pSeparator + 1 : pNode->sPath;
+}
+
+// pParent copies pTarget, one of its ancestors.
+static void WarnCycle(inf_node* pParent, const inf_node* pTarget) {
+	size_t Depth = 1;
+	for (const inf_node* p = pParent; p != pTarget; p = p->pParent)
+		++Depth;
+	const inf_node** apChain = malloc_guarded(Depth * sizeof(*apChain));
+	size_t i = Depth;
+	for (const inf_node* p = pParent; i > 0; p = p->pParent)
+		apChain[--i] = p;
+
+	text_buffer Chain = { NULL, 0, 0 };
+	for (i = 0; i < Depth; ++i) {
+		TextAppendString(&Chain, GetNodeName(apChain[i]));
+		TextAppend(&Chain, " -> ", 4);
+	}
+	TextAppendString(&Chain, GetNodeName(pTarget));
+	Warn(pParent, "CopyINF cycle %.*s. Skipping it.\n", (int)Chain.Length, Chain.p);
+	TextFree(&Chain);
+	free(apChain);
+}
+
+// Queue the INFs pNode copies that weren't seen yet.
+static void ResolveCopyInf(inf_node* pNode, const char* sRootDir, tree234* pNodeTree, inf_node*** papNodes, size_t* pnNodes, size_t* pCapacity) {
+	for (uint32_t i = 0; i < pNode->nCopyInf; ++i) {
+		// Names are relative to the root INF directory and use '\\' like
+		// the rest of the output.
+		size_t PrefixLength = strlen(pNode->sPrefix);
+		size_t FileLength = strlen(pNode->asCopyInf[i]);
+		char* sName = malloc_guarded(PrefixLength + FileLength + 1);
+		memcpy(sName, pNode->sPrefix, PrefixLength);
+		memcpy(sName + PrefixLength, pNode->asCopyInf[i], FileLength + 1);
+		for (char* p = sName; *p; ++p)
+			if (*p == '/')
+				*p = '\\';
+
+		size_t RootDirLength = strlen(sRootDir);
+		char* sPath = malloc_guarded(RootDirLength + PrefixLength + FileLength + 1);
+		memcpy(sPath, sRootDir, RootDirLength);
+		memcpy(sPath + RootDirLength, sName, PrefixLength + FileLength + 1);
+		for (char* p = sPath + RootDirLength; *p; ++p)
+			if (*p == '\\')
+				*p = PATH_SEPARATOR;
+
+		// Missing files are reported when opening them.
+		uint32_t Error;
+		char* sFullPath = GetFullPath(sPath, &Error);
+		if (sFullPath) {
+			free(sPath);
+			sPath = sFullPath;
+		}
+
+		inf_node* pChild = NewNode(sPath, sName, pNode);
+		inf_node* pFound = add234(pNodeTree, pChild);
+		if (pFound != pChild) {
+			// Reached twice: either a shared companion, or a cycle.
+			for (const inf_node* p = pNode; p; p = p->pParent) {
+				if (p == pFound) {
+					WarnCycle(pNode, pFound);
+					break;
+				}
+			}
+			FreeNode(pChild);
+			continue;
+		}
+
+		if (*pnNodes == *pCapacity) {
+			*pCapacity *= 2;
+			*papNodes = realloc_guarded(*papNodes, *pCapacity * sizeof(**papNodes));
+		}
+		(*papNodes)[(*pnNodes)++] = pChild;
+	}
+}
+
+// Set of string IDs, open addressing.
+typedef struct {
+	uint32_t* aSlots; // UINT32_MAX for empty slots
+	uint32_t Mask;
+} id_set;
+
+static void IdSetInit(id_set* pSet, size_t MaxCount) {
+	uint32_t SlotCount = 16;
+	while (SlotCount < MaxCount * 2)
+		SlotCount *= 2;
+	pSet->aSlots = malloc_guarded(SlotCount * sizeof(*pSet->aSlots));
+	memset(pSet->aSlots, 0xFF, SlotCount * sizeof(*pSet->aSlots));
+	pSet->Mask = SlotCount - 1;
+}
+
+// IDs are spread enough to be used as their own hash.
+static uint32_t IdSetFind(const id_set* pSet, uint32_t Id) {
+	uint32_t Slot = (Id * 2654435761u) & pSet->Mask;
+	while (pSet->aSlots[Slot] != UINT32_MAX && pSet->aSlots[Slot] != Id)
+		Slot = (Slot + 1) & pSet->Mask;
+	return Slot;
+}
+
+static bool IdSetContains(const id_set* pSet, uint32_t Id) {
+	return pSet->aSlots[IdSetFind(pSet, Id)] == Id;
+}
+
+// The set is sized for all the IDs up front, it never grows.
+static void IdSetAdd(id_set* pSet, uint32_t Id) {
+	pSet->aSlots[IdSetFind(pSet, Id)] = Id;
+}
+
+// Appends the lines of Text not already in pSeen, matched
+// case-insensitively. Repeated lines within Text are kept, like for a
+// single INF.
+static void AppendNewLines(text_buffer* pOutput, const text_buffer* pText, string_pool* pPool, id_set* pSeen, uint32_t* aIds) {
+	const char* p = pText->p;
+	const char* pEnd = pText->p + pText->Length;
+	size_t nIds = 0;
+	while (p < pEnd) {
+		const char* pNewLine = memchr(p, '\n', pEnd - p);
+		size_t Length = pNewLine - p;
+		uint32_t Id = InternString(pPool, p, Length);
+		if (!IdSetContains(pSeen, Id)) {
+			TextAppend(pOutput, p, Length + 1);
+			aIds[nIds++] = Id;
+		}
+		p = pNewLine + 1;
+	}
+	for (size_t i = 0; i < nIds; ++i)
+		IdSetAdd(pSeen, aIds[i]);
+}
+
+void GetDriverFiles(const char* sInfPath, const driver_files_options* pOptions, arena* pArena, driver_files_result* pResult) {
+	pResult->Output.Length = 0;
+	pResult->Warnings.Length = 0;
+	pResult->Inputs.Length = 0;
+	pResult->Error = ERROR_SUCCESS;
+
+	const char* pLastSeparator = strrchr(sInfPath, PATH_SEPARATOR);
+	size_t RootDirLength = pLastSeparator ? (size_t)(pLastSeparator + 1 - sInfPath) : 0;
+	char* sRootDir = malloc_guarded(RootDirLength + 1);
+	memcpy(sRootDir, sInfPath, RootDirLength);
+	sRootDir[RootDirLength] = '\0';
+
+	// Nodes are kept in BFS order, each level following the previous one.
+	size_t Capacity = 16;
+	size_t nNodes = 1;
+	inf_node** apNodes = malloc_guarded(Capacity * sizeof(*apNodes));
+	apNodes[0] = NewNode(strdup_guarded(sInfPath), NULL, NULL);
+	tree234* pNodeTree = newtree234((cmpfn234)NodeCompare);
+	add234(pNodeTree, apNodes[0]);
+
+	// The calling thread uses pArena, the others get their own.
+	uint32_t nProcessors = pOptions->nThreads ? pOptions->nThreads : GetProcessorCount();
+	arena* aArenas = malloc_guarded(nProcessors * sizeof(*aArenas));
+	arena** apArenas = malloc_guarded(nProcessors * sizeof(*apArenas));
+	for (uint32_t i = 0; i < nProcessors; ++i) {
+		ArenaInit(&aArenas[i]);
+		apArenas[i] = &aArenas[i];
+	}
+	if (pArena)
+		apArenas[0] = pArena;
+
+	size_t LevelStart = 0;
+	while (LevelStart < nNodes) {
+		size_t LevelEnd = nNodes;
+		level_context Level = { apNodes + LevelStart, LevelEnd - LevelStart, 0, pOptions, apArenas };
+		uint32_t nThreads = Level.nNodes < nProcessors ? (uint32_t)Level.nNodes : nProcessors;
+		if (nThreads > 1)
+			RunThreads(nThreads, ProcessLevel, &Level);
+		else
+			ProcessLevel(&Level, 0);
+
+		// Resolve in order so the output doesn't depend on thread timing.
+		for (size_t i = LevelStart; i < LevelEnd; ++i) {
+			inf_node* pNode = apNodes[i];
+			if (pNode->Error != ERROR_SUCCESS) {
+				if (i == 0)
+					break;
+				char* sErrorMessage = GetSystemErrorMessage(pNode->Error);
+				Warn(pNode, "Unable to open the CopyINF file '%s': %s", pNode->sPath, sErrorMessage);
+				FreeSystemErrorMessage(sErrorMessage);
+				continue;
+			}
+			ResolveCopyInf(pNode, sRootDir, pNodeTree, &apNodes, &nNodes, &Capacity);
+		}
+		LevelStart = LevelEnd;
+	}
+	for (uint32_t i = 0; i < nProcessors; ++i)
+		ArenaFree(&aArenas[i]);
+	free(aArenas);
+	free(apArenas);
+
+	pResult->Error = apNodes[0]->Error;
+	if (pResult->Error == ERROR_SUCCESS && nNodes == 1) {
+		TextAppend(&pResult->Output, apNodes[0]->Output.p, apNodes[0]->Output.Length);
+		TextAppend(&pResult->Warnings, apNodes[0]->Warnings.p, apNodes[0]->Warnings.Length);
+	} else if (pResult->Error == ERROR_SUCCESS) {
+		// Merge, dropping the files an earlier INF already listed. The
+		// pool only lives for this result.
+		size_t MaxLines = 1;
+		size_t MaxNodeLines = 1;
+		for (size_t i = 0; i < nNodes; ++i) {
+			size_t nLines = 0;
+			for (size_t j = 0; j < apNodes[i]->Output.Length; ++j)
+				nLines += apNodes[i]->Output.p[j] == '\n';
+			MaxLines += nLines;
+			MaxNodeLines = nLines > MaxNodeLines ? nLines : MaxNodeLines;
+		}
+		string_pool* pPool = NewStringPool();
+		id_set Seen;
+		IdSetInit(&Seen, MaxLines);
+		uint32_t* aIds = malloc_guarded(MaxNodeLines * sizeof(*aIds));
+		for (size_t i = 0; i < nNodes; ++i) {
+			inf_node* pNode = apNodes[i];
+			AppendNewLines(&pResult->Output, &pNode->Output, pPool, &Seen, aIds);
+			TextAppend(&pResult->Warnings, pNode->Warnings.p, pNode->Warnings.Length);
+		}
+		merge_stats* pStats = pOptions->pMergeStats;
+		if (pStats) {
+			string_pool_stats PoolStats;
+			GetStringPoolStats(pPool, &PoolStats);
+			AtomicFetchAdd(&pStats->nResults, 1);
+			AtomicFetchAdd(&pStats->nLines, (size_t)PoolStats.nInterned);
+			AtomicFetchAdd(&pStats->nDistinct, (size_t)PoolStats.nDistinct);
+			AtomicFetchAdd(&pStats->Bytes, (size_t)PoolStats.PoolBytes + (Seen.Mask + 1) * sizeof(*Seen.aSlots) + MaxNodeLines * sizeof(*aIds));
+		}
+		free(aIds);
+		free(Seen.aSlots);
+		FreeStringPool(pPool);
+	}
+
+	// Opened or not, each INF reached changes the result if it changes.
+	for (size_t i = 0; i < nNodes; ++i) {
+		TextAppendFormat(&pResult->Inputs, "%s\n", apNodes[i]->sPath);
+		TextAppend(&pResult->Inputs, apNodes[i]->Inputs.p, apNodes[i]->Inputs.Length);
+	}
+
+	freetree234(pNodeTree);
+	for (size_t i = 0; i < nNodes; ++i)
+		FreeNode(apNodes[i]);
+	free(apNodes);
+	free(sRootDir);
+}
+
+void FreeDriverFilesResult(driver_files_result* pResult) {
+	TextFree(&pResult->Output);
+	TextFree(&pResult->Warnings);
+	TextFree(&pResult->Inputs);
+}
@@ -0,0 +1,230 @@
+#include <string.h>
+
+#include "Platform.h"
+
+#include "AsciiCase.h"
+#include "GuardedMalloc.h"
+#include "InfInclude.h"
+#include "Tree234.h"
+
+// The cache lock only covers the tree. Each entry is opened under its
+// own lock, so a thread parsing one INF holds up only the threads that
+// need the same one.
+typedef struct {
+	char* sName; // Canonical name: lowercase, '\\' separated
+	mutex Lock;
+	bool bOpened;
+	char* sPath; // Path to open, with the case found on disk
+	inf_file* pInf; // NULL if it couldn't be opened
+	inf_strings* pStrings;
+	inf_layout* pLayout; // Built on first use as a layout file
+	uint32_t Error;
+} included_inf;
+
+struct inf_include_cache_Tag {
+	char* sSearchDir; // Ends with PATH_SEPARATOR
+	char* sLocale;
+	tree234* pIncludedTree;
+	mutex Lock;
+	volatile size_t Hits;
+	volatile size_t Misses;
+};
+
+static int IncludedCompare(included_inf* A, included_inf* B) {
+	return strcmp(A->sName, B->sName);
+}
+
+inf_include_cache* InfNewIncludeCache(const char* sSearchDir, const char* sLocale) {
+	inf_include_cache* pCache = malloc_guarded(sizeof(*pCache));
+	size_t Length = strlen(sSearchDir);
+	pCache->sSearchDir = malloc_guarded(Length + 2);
+	memcpy(pCache->sSearchDir, sSearchDir, Length);
+	if (Length > 0 && sSearchDir[Length - 1] != PATH_SEPARATOR && sSearchDir[Length - 1] != '/')
+		pCache->sSearchDir[Length++] = PATH_SEPARATOR;
+	pCache->sSearchDir[Length] = '\0';
+	pCache->sLocale = sLocale ? strdup_guarded(sLocale) : NULL;
+	pCache->pIncludedTree = newtree234((cmpfn234)IncludedCompare);
+	MutexInit(&pCache->Lock);
+	pCache->Hits = 0;
+	pCache->Misses = 0;
+	return pCache;
+}
+
+static void FreeIncluded(included_inf* p, void* pContext) {
+	(void)pContext;
+	if (p->pLayout)
+		InfFreeLayout(p->pLayout);
+	if (p->pInf) {
+		InfFreeStrings(p->pStrings);
+		InfCloseFile(p->pInf);
+	}
+	MutexDestroy(&p->Lock);
+	free(p->sPath);
+	free(p->sName);
+	free(p);
+}
+
+void InfFreeIncludeCache(inf_include_cache* pCache) {
+	freetree234_with(pCache->pIncludedTree, (destroyfn234)FreeIncluded, NULL);
+	MutexDestroy(&pCache->Lock);
+	free(pCache->sLocale);
+	free(pCache->sSearchDir);
+	free(pCache);
+}
+
+#ifdef _WIN32
+
+static char* ResolvePath(const inf_include_cache* pCache, const char* sPath) {
+	(void)pCache;
+	return strdup_guarded(sPath);
+}
+
+#else
+
+typedef struct {
+	const char* sName;
+	size_t Length;
+	char* sFound;
+} name_search;
+
+// Keeps the first match in strcmp order, not the directory's.
+static void FindNameI(void* pContext, const char* sPath, bool bDirectory) {
+	(void)bDirectory;
+	name_search* pSearch = pContext;
+	const char* sName = strrchr(sPath, PATH_SEPARATOR) + 1;
+	if (strlen(sName) != pSearch->Length || !EqualStringI(sName, pSearch->sName, pSearch->Length))
+		return;
+	if (pSearch->sFound && strcmp(sPath, pSearch->sFound) >= 0)
+		return;
+	free(pSearch->sFound);
+	pSearch->sFound = strdup_guarded(sPath);
+}
+
+// Names are case-insensitive on Windows, the INF may not use the case
+// of the file. Each component of the path under the search directory
+// that doesn't exist as written is looked for in its directory.
+static char* ResolvePath(const inf_include_cache* pCache, const char* sPath) {
+	size_t DirLength = strlen(pCache->sSearchDir);
+	char* sResolved = strdup_guarded(sPath);
+	for (char* pStart = sResolved + DirLength; *pStart;) {
+		char* pEnd = strchr(pStart, PATH_SEPARATOR);
+		size_t Length = pEnd ? (size_t)(pEnd - pStart) : strlen(pStart);
+		char Next = pStart[Length];
+		pStart[Length] = '\0';
+		file_stamp Stamp;
+		uint32_t Error;
+		if (!GetFileStamp(sResolved, &Stamp, &Error)) {
+			size_t ParentLength = pStart > sResolved ? (size_t)(pStart - sResolved - 1) : 1;
+			char* sParent = malloc_guarded(ParentLength + 1);
+			memcpy(sParent, pStart > sResolved ? sResolved : ".", ParentLength);
+			sParent[ParentLength] = '\0';
+			name_search Search = { pStart, Length, NULL };
+			ListDirectory(sParent, FindNameI, &Search, &Error);
+			if (Search.sFound)
+				memcpy(pStart, strrchr(Search.sFound, PATH_SEPARATOR) + 1, Length);
+			free(Search.sFound);
+			free(sParent);
+		}
+		pStart[Length] = Next;
+		pStart += Length + (Next != '\0');
+	}
+	return sResolved;
+}
+
+#endif
+
+static char* GetWrittenPath(const inf_include_cache* pCache, inf_field Name) {
+	size_t DirLength = strlen(pCache->sSearchDir);
+	char* sPath = malloc_guarded(DirLength + Name.Length + 1);
+	memcpy(sPath, pCache->sSearchDir, DirLength);
+	for (uint32_t i = 0; i < Name.Length; ++i)
+		sPath[DirLength + i] = (Name.s[i] == '\\' || Name.s[i] == '/') ? PATH_SEPARATOR : Name.s[i];
+	sPath[DirLength + Name.Length] = '\0';
+	return sPath;
+}
+
+// Called with the entry lock held.
+static void ResolveIncluded(inf_include_cache* pCache, included_inf* pIncluded, inf_field Name) {
+	if (pIncluded->sPath)
+		return;
+	char* sPath = GetWrittenPath(pCache, Name);
+	pIncluded->sPath = ResolvePath(pCache, sPath);
+	free(sPath);
+}
+
+// Called with the entry lock held.
+static void OpenIncluded(inf_include_cache* pCache, included_inf* pIncluded, inf_field Name) {
+	ResolveIncluded(pCache, pIncluded, Name);
+	pIncluded->Error = ERROR_SUCCESS;
+	pIncluded->pInf = InfOpenFile(pIncluded->sPath, &pIncluded->Error);
+	pIncluded->pStrings = pIncluded->pInf ? InfLoadStrings(pIncluded->pInf, pCache->sLocale) : NULL;
+	pIncluded->bOpened = true;
+}
+
+// Returns the entry with its lock held, opened and counted in the
+// stats if bOpen, else with only its path resolved.
+static included_inf* GetIncluded(inf_include_cache* pCache, inf_field Name, bool bOpen) {
+	char* sName = malloc_guarded(Name.Length + 1);
+	for (uint32_t i = 0; i < Name.Length; ++i)
+		sName[i] = Name.s[i] == '/' ? '\\' : AsciiToLower(Name.s[i]);
+	sName[Name.Length] = '\0';
+
+	MutexLock(&pCache->Lock);
+	included_inf* pIncluded = find234(pCache->pIncludedTree, &(included_inf){ .sName = sName }, NULL);
+	if (pIncluded) {
+		free(sName);
+	} else {
+		pIncluded = malloc_guarded(sizeof(*pIncluded));
+		memset(pIncluded, 0, sizeof(*pIncluded));
+		pIncluded->sName = sName;
+		MutexInit(&pIncluded->Lock);
+		add234(pCache->pIncludedTree, pIncluded);
+	}
+	MutexUnlock(&pCache->Lock);
+
+	MutexLock(&pIncluded->Lock);
+	if (!bOpen) {
+		ResolveIncluded(pCache, pIncluded, Name);
+		return pIncluded;
+	}
+	AtomicFetchAdd(pIncluded->bOpened ? &pCache->Hits : &pCache->Misses, 1);
+	if (!pIncluded->bOpened)
+		OpenIncluded(pCache, pIncluded, Name);
+	return pIncluded;
+}
+
+char* InfGetIncludePath(inf_include_cache* pCache, inf_field Name) {
+	included_inf* pIncluded = GetIncluded(pCache, Name, false);
+	char* sPath = strdup_guarded(pIncluded->sPath);
+	MutexUnlock(&pIncluded->Lock);
+	return sPath;
+}
+
+const inf_file* InfGetIncludedInf(
+	inf_include_cache* pCache,
+	inf_field Name,
+	const inf_strings** ppStrings,
+	uint32_t* pError
+) {
+	included_inf* pIncluded = GetIncluded(pCache, Name, true);
+	MutexUnlock(&pIncluded->Lock);
+
+	*ppStrings = pIncluded->pStrings;
+	*pError = pIncluded->Error;
+	return pIncluded->pInf;
+}
+
+const inf_layout* InfGetLayout(inf_include_cache* pCache, inf_field Name, uint32_t* pError) {
+	included_inf* pIncluded = GetIncluded(pCache, Name, true);
+	if (pIncluded->pInf && !pIncluded->pLayout)
+		pIncluded->pLayout = InfLoadLayout(pIncluded->pInf, pIncluded->pStrings);
+	MutexUnlock(&pIncluded->Lock);
+
+	*pError = pIncluded->Error;
+	return pIncluded->pLayout;
+}
+
+void InfGetIncludeStats(inf_include_cache* pCache, uint64_t* pHits, uint64_t* pMisses) {
+	*pHits = AtomicLoad(&pCache->Hits);
+	*pMisses = AtomicLoad(&pCache->Misses);
+}
@@ -0,0 +1,375 @@
+#include <string.h>
+
+#include "Platform.h"
+
+#include "Arena.h"
+#include "AsciiCase.h"
+#include "GuardedMalloc.h"
+#include "InfInstall.h"
+#include "TextBuffer.h"
+#include "Tree234.h"
+
+#define static_arrlen(X) (sizeof(X) / sizeof(*X))
+
+// Most specific last, all of them are taken.
+static const char* asPlatformSuffixes[] = {
+	"",
+	".NT",
+	".NTx86",
+	".NTia64",
+	".NTamd64",
+	".NTarm",
+	".NTarm64",
+};
+
+// One per INF walked: the INF given, and the ones it includes.
+typedef struct install_walk_Tag install_walk;
+struct install_walk_Tag {
+	const inf_file* pInf;
+	const inf_strings* pStrings;
+	install_graph* pGraph;
+	inf_include_cache* pCache;
+	arena* pArena; // Holds the expanded names and the files
+	uint8_t* abVisited; // One per section
+	inf_expand_buffer ExpandBuffer;
+	install_walk* pRoot; // NULL for the INF given
+
+	// Only used by the root walk.
+
+	// Files are de-duplicated through the tree, apFiles keeps their order.
+	tree234* pFileTree;
+	install_ref** apFiles;
+	uint32_t FileCapacity;
+	uint32_t MissingCapacity;
+	uint32_t MissingIncludeCapacity;
+	uint32_t MissingNeedsCapacity;
+	uint32_t CopyInfCapacity;
+	uint32_t IncludeCapacity;
+	install_walk** apIncluded;
+	uint32_t nIncluded;
+};
+
+static int RefCompare(install_ref* A, install_ref* B) {
+	return CompareStringI(A->Name.s, A->Name.Length, B->Name.s, B->Name.Length);
+}
+
+static install_ref MakeRef(install_walk* pWalk, inf_field Field, const inf_context* pContext) {
+	install_ref Ref = { Field, pContext->Section, pContext->Line };
+	Ref.Name = InfExpandField(pWalk->pStrings, Field, &pWalk->ExpandBuffer);
+	if (Ref.Name.s != Field.s)
+		// The buffer is reused, keep a copy.
+		Ref.Name.s = ArenaCopyString(pWalk->pArena, Ref.Name.s, Ref.Name.Length);
+	return Ref;
+}
+
+static void PushRef(install_ref** paRefs, uint32_t* pnRefs, uint32_t* pCapacity, install_ref Ref) {
+	if (*pnRefs == *pCapacity) {
+		*pCapacity = *pCapacity ? *pCapacity * 2 : 16;
+		*paRefs = realloc_guarded(*paRefs, *pCapacity * sizeof(**paRefs));
+	}
+	(*paRefs)[(*pnRefs)++] = Ref;
+}
+
+static void AddFile(install_walk* pWalk, install_ref Ref) {
+	if (Ref.Name.Length == 0 || pWalk->pRoot) {
+		// Files of included INFs come with Windows, not with the package.
+		if (pWalk->pRoot)
+			pWalk->pGraph->nIncludedFiles += 1;
+		return;
+	}
+
+	install_ref* pRef = ArenaAlloc(pWalk->pArena, sizeof(*pRef));
+	*pRef = Ref;
+	if (add234(pWalk->pFileTree, pRef) != pRef)
+		return;
+	install_graph* pGraph = pWalk->pGraph;
+	if (pGraph->nFiles == pWalk->FileCapacity) {
+		pWalk->FileCapacity = pWalk->FileCapacity ? pWalk->FileCapacity * 2 : 16;
+		pWalk->apFiles = realloc_guarded(pWalk->apFiles, pWalk->FileCapacity * sizeof(*pWalk->apFiles));
+	}
+	pWalk->apFiles[pGraph->nFiles++] = pRef;
+}
+
+// Marks the section as visited, false if it was already.
+static bool Visit(install_walk* pWalk, int32_t Section) {
+	if (Section < 0 || pWalk->abVisited[Section])
+		return false;
+	pWalk->abVisited[Section] = 1;
+	return true;
+}
+
+// Lines are: destination-file-name[,source-file-name][,unused][,flag]
+// https://learn.microsoft.com/en-us/windows-hardware/drivers/install/inf-copyfiles-directive
+static void WalkFileList(install_walk* pWalk, uint32_t Section) {
+	inf_context InfContext;
+	if (!InfFindFirstLineByIndex(pWalk->pInf, Section, NULL, &InfContext))
+		return;
+	do {
+		inf_field FileName;
+		if (!InfGetStringField(&InfContext, 2, &FileName) || FileName.Length == 0)
+			InfGetStringField(&InfContext, 1, &FileName);
+		AddFile(pWalk, MakeRef(pWalk, FileName, &InfContext));
+	} while (InfFindNextLine(&InfContext, &InfContext));
+}
+
+static install_walk* GetIncludedWalk(install_walk* pWalk, inf_field Name) {
+	install_walk* pRoot = pWalk->pRoot ? pWalk->pRoot : pWalk;
+	const inf_strings* pStrings;
+	uint32_t Error;
+	const inf_file* pInf = InfGetIncludedInf(pWalk->pCache, Name, &pStrings, &Error);
+	if (!pInf)
+		return NULL;
+
+	for (uint32_t i = 0; i < pRoot->nIncluded; ++i)
+		if (pRoot->apIncluded[i]->pInf == pInf)
+			return pRoot->apIncluded[i];
+
+	install_walk* pIncluded = malloc_guarded(sizeof(*pIncluded));
+	memset(pIncluded, 0, sizeof(*pIncluded));
+	pIncluded->pInf = pInf;
+	pIncluded->pStrings = pStrings;
+	pIncluded->pGraph = pWalk->pGraph;
+	pIncluded->pCache = pWalk->pCache;
+	pIncluded->pArena = pWalk->pArena;
+	pIncluded->abVisited = calloc(InfGetSectionCount(pInf) + 1, sizeof(*pIncluded->abVisited));
+	if (!pIncluded->abVisited)
+		abort();
+	pIncluded->pRoot = pRoot;
+	pRoot->apIncluded = realloc_guarded(pRoot->apIncluded, (pRoot->nIncluded + 1) * sizeof(*pRoot->apIncluded));
+	pRoot->apIncluded[pRoot->nIncluded++] = pIncluded;
+	return pIncluded;
+}
+
+static void WalkDDInstall(install_walk* pWalk, uint32_t Section);
+
+// Include=filename.inf[,...] and Needs=inf-section-name[,...]: the needed
+// sections are looked up in the included INFs, in order, and processed
+// as if they were part of this DDInstall section.
+static void WalkNeeds(install_walk* pWalk, uint32_t Section) {
+	install_graph* pGraph = pWalk->pGraph;
+	inf_context InfContext;
+	if (!InfFindFirstLineByIndex(pWalk->pInf, Section, "Needs", &InfContext))
+		return;
+
+	install_walk* pRoot = pWalk->pRoot ? pWalk->pRoot : pWalk;
+	install_walk** apIncluded = NULL;
+	uint32_t nIncluded = 0;
+	inf_context IncludeContext;
+	if (InfFindFirstLineByIndex(pWalk->pInf, Section, "Include", &IncludeContext)) {
+		do {
+			uint32_t FieldCount = InfGetFieldCount(&IncludeContext);
+			apIncluded = realloc_guarded(apIncluded, (nIncluded + FieldCount + 1) * sizeof(*apIncluded));
+			for (uint32_t i = 1; i <= FieldCount; ++i) {
+				inf_field Field;
+				InfGetStringField(&IncludeContext, i, &Field);
+				install_ref Ref = MakeRef(pWalk, Field, &IncludeContext);
+				if (Ref.Name.Length > 0)
+					PushRef(&pGraph->aIncludes, &pGraph->nIncludes, &pRoot->IncludeCapacity, Ref);
+				install_walk* pIncluded = Ref.Name.Length > 0 ? GetIncludedWalk(pWalk, Ref.Name) : NULL;
+				if (pIncluded)
+					apIncluded[nIncluded++] = pIncluded;
+				else if (Ref.Name.Length > 0 && !pWalk->pRoot)
+					PushRef(&pGraph->aMissingIncludes, &pGraph->nMissingIncludes, &pWalk->MissingIncludeCapacity, Ref);
+			}
+		} while (InfFindNextMatchLine(&IncludeContext, "Include", &IncludeContext));
+	}
+
+	do {
+		uint32_t FieldCount = InfGetFieldCount(&InfContext);
+		for (uint32_t i = 1; i <= FieldCount; ++i) {
+			inf_field Field;
+			InfGetStringField(&InfContext, i, &Field);
+			install_ref Ref = MakeRef(pWalk, Field, &InfContext);
+			if (Ref.Name.Length == 0)
+				continue;
+
+			bool bFound = false;
+			for (uint32_t j = 0; j < nIncluded && !bFound; ++j) {
+				install_walk* pIncluded = apIncluded[j];
+				int32_t Needed = InfFindSection(pIncluded->pInf, Ref.Name);
+				if (Needed < 0)
+					continue;
+				bFound = true;
+				if (Visit(pIncluded, Needed)) {
+					pGraph->nNeededSections += 1;
+					WalkDDInstall(pIncluded, (uint32_t)Needed);
+				}
+			}
+
+			// Needed sections of a missing INF are only reported once.
+			if (!bFound && nIncluded > 0 && !pWalk->pRoot)
+				PushRef(&pGraph->aMissingNeeds, &pGraph->nMissingNeeds, &pWalk->MissingNeedsCapacity, Ref);
+		}
+	} while (InfFindNextMatchLine(&InfContext, "Needs", &InfContext));
+	free(apIncluded);
+}
+
+static void WalkDDInstall(install_walk* pWalk, uint32_t Section) {
+	install_graph* pGraph = pWalk->pGraph;
+	inf_context InfContext;
+
+	if (InfFindFirstLineByIndex(pWalk->pInf, Section, "CopyFiles", &InfContext)) {
+		do {
+			uint32_t FieldCount = InfGetFieldCount(&InfContext);
+			for (uint32_t i = 1; i <= FieldCount; ++i) {
+				inf_field Field;
+				InfGetStringField(&InfContext, i, &Field);
+				install_ref Ref = MakeRef(pWalk, Field, &InfContext);
+
+				// CopyFiles=@filename copies a single file.
+				if (Ref.Name.Length > 0 && Ref.Name.s[0] == '@') {
+					++Ref.Name.s;
+					--Ref.Name.Length;
+					AddFile(pWalk, Ref);
+					continue;
+				}
+
+				int32_t FileList = InfFindSection(pWalk->pInf, Ref.Name);
+				if (FileList < 0 && Ref.Name.Length > 0 && !pWalk->pRoot) {
+					PushRef(&pGraph->aMissing, &pGraph->nMissing, &pWalk->MissingCapacity, Ref);
+					continue;
+				}
+				if (Visit(pWalk, FileList))
+					WalkFileList(pWalk, (uint32_t)FileList);
+			}
+		} while (InfFindNextMatchLine(&InfContext, "CopyFiles", &InfContext));
+	}
+
+	if (pWalk->pCache)
+		WalkNeeds(pWalk, Section);
+
+	// https://learn.microsoft.com/en-us/windows-hardware/drivers/install/inf-copyinf-directive
+	if (!pWalk->pRoot && InfFindFirstLineByIndex(pWalk->pInf, Section, "CopyINF", &InfContext)) {
+		do {
+			uint32_t FieldCount = InfGetFieldCount(&InfContext);
+			for (uint32_t i = 1; i <= FieldCount; ++i) {
+				inf_field Field;
+				InfGetStringField(&InfContext, i, &Field);
+				PushRef(&pGraph->aCopyInf, &pGraph->nCopyInf, &pWalk->CopyInfCapacity, MakeRef(pWalk, Field, &InfContext));
+			}
+		} while (InfFindNextMatchLine(&InfContext, "CopyINF", &InfContext));
+	}
+}
+
+static int32_t FindDecoratedSection(const inf_file* pInf, text_buffer* pName, size_t BaseLength, const char* sSuffix) {
+	pName->Length = BaseLength;
+	TextAppendString(pName, sSuffix);
+	return InfFindSection(pInf, (inf_field){ pName->p, (uint32_t)pName->Length });
+}
+
+static void WalkInstall(install_walk* pWalk, inf_field Name) {
+	// Name may live in the expand buffer, which walking reuses.
+	text_buffer Section = { NULL, 0, 0 };
+	TextAppend(&Section, Name.s, Name.Length);
+	size_t BaseLength = Section.Length;
+
+	for (size_t i = 0; i < static_arrlen(asPlatformSuffixes); ++i) {
+		int32_t DDInstall = FindDecoratedSection(pWalk->pInf, &Section, BaseLength, asPlatformSuffixes[i]);
+		if (Visit(pWalk, DDInstall)) {
+			pWalk->pGraph->nInstallSections += 1;
+			WalkDDInstall(pWalk, (uint32_t)DDInstall);
+		}
+
+		// Co-installers are copied by their own CopyFiles.
+		size_t DecoratedLength = Section.Length;
+		int32_t CoInstallers = FindDecoratedSection(pWalk->pInf, &Section, DecoratedLength, ".CoInstallers");
+		if (Visit(pWalk, CoInstallers))
+			WalkDDInstall(pWalk, (uint32_t)CoInstallers);
+	}
+	TextFree(&Section);
+}
+
+// Lines are: device-description=install-section-name,hw-id[,compatible-id...]
+// https://learn.microsoft.com/en-us/windows-hardware/drivers/install/inf-models-section
+static void WalkModels(install_walk* pWalk, uint32_t Section) {
+	inf_context InfContext;
+	if (!InfFindFirstLineByIndex(pWalk->pInf, Section, NULL, &InfContext))
+		return;
+	do {
+		inf_field Install;
+		if (!InfGetStringField(&InfContext, 1, &Install))
+			continue;
+		WalkInstall(pWalk, InfExpandField(pWalk->pStrings, Install, &pWalk->ExpandBuffer));
+	} while (InfFindNextLine(&InfContext, &InfContext));
+}
+
+// Lines are: manufacturer-identifier=models-section-name[,TargetOSVersion...]
+// https://learn.microsoft.com/en-us/windows-hardware/drivers/install/inf-manufacturer-section
+static void WalkManufacturer(install_walk* pWalk) {
+	inf_context InfContext;
+	if (!InfFindFirstLine(pWalk->pInf, "Manufacturer", NULL, &InfContext))
+		return;
+	text_buffer Models = { NULL, 0, 0 };
+	do {
+		inf_field Field;
+		if (!InfGetStringField(&InfContext, 1, &Field))
+			continue;
+		Field = InfExpandField(pWalk->pStrings, Field, &pWalk->ExpandBuffer);
+		Models.Length = 0;
+		TextAppend(&Models, Field.s, Field.Length);
+		size_t BaseLength = Models.Length;
+
+		// The undecorated section is used when no decoration matches.
+		int32_t Section = FindDecoratedSection(pWalk->pInf, &Models, BaseLength, "");
+		if (Visit(pWalk, Section))
+			WalkModels(pWalk, (uint32_t)Section);
+
+		uint32_t FieldCount = InfGetFieldCount(&InfContext);
+		for (uint32_t i = 2; i <= FieldCount; ++i) {
+			InfGetStringField(&InfContext, i, &Field);
+			Field = InfExpandField(pWalk->pStrings, Field, &pWalk->ExpandBuffer);
+			Models.Length = BaseLength;
+			TextAppend(&Models, ".", 1);
+			TextAppend(&Models, Field.s, Field.Length);
+			Section = InfFindSection(pWalk->pInf, (inf_field){ Models.p, (uint32_t)Models.Length });
+			if (Visit(pWalk, Section))
+				WalkModels(pWalk, (uint32_t)Section);
+		}
+	} while (InfFindNextLine(&InfContext, &InfContext));
+	TextFree(&Models);
+}
+
+void InfGetInstallGraph(const inf_file* pInf, const inf_strings* pStrings, inf_include_cache* pCache, arena* pArena, install_graph* pGraph) {
+	memset(pGraph, 0, sizeof(*pGraph));
+
+	install_walk Walk = { 0 };
+	Walk.pInf = pInf;
+	Walk.pStrings = pStrings;
+	Walk.pGraph = pGraph;
+	Walk.pCache = pCache;
+	Walk.pArena = pArena;
+	Walk.abVisited = calloc(InfGetSectionCount(pInf) + 1, sizeof(*Walk.abVisited));
+	if (!Walk.abVisited)
+		abort();
+	Walk.pFileTree = newtree234((cmpfn234)RefCompare);
+
+	WalkManufacturer(&Walk);
+
+	// Non-PnP INFs are installed through [DefaultInstall].
+	// https://learn.microsoft.com/en-us/windows-hardware/drivers/install/inf-defaultinstall-section
+	WalkInstall(&Walk, (inf_field){ "DefaultInstall", sizeof("DefaultInstall") - 1 });
+
+	pGraph->aFiles = malloc_guarded((pGraph->nFiles + 1) * sizeof(*pGraph->aFiles));
+	for (uint32_t i = 0; i < pGraph->nFiles; ++i)
+		pGraph->aFiles[i] = *Walk.apFiles[i];
+	free(Walk.apFiles);
+	for (uint32_t i = 0; i < Walk.nIncluded; ++i) {
+		InfFreeExpandBuffer(&Walk.apIncluded[i]->ExpandBuffer);
+		free(Walk.apIncluded[i]->abVisited);
+		free(Walk.apIncluded[i]);
+	}
+	free(Walk.apIncluded);
+	freetree234(Walk.pFileTree);
+	InfFreeExpandBuffer(&Walk.ExpandBuffer);
+	free(Walk.abVisited);
+}
+
+void InfFreeInstallGraph(install_graph* pGraph) {
+	free(pGraph->aFiles);
+	free(pGraph->aMissing);
+	free(pGraph->aMissingIncludes);
+	free(pGraph->aMissingNeeds);
+	free(pGraph->aCopyInf);
+	free(pGraph->aIncludes);
+	memset(pGraph, 0, sizeof(*pGraph));
+}
@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "Arena.h"
+#include "AsciiCase.h"
+#include "GuardedMalloc.h"
+#include "InfLayout.h"
+
+#define static_arrlen(X) (sizeof(X) / sizeof(*X))
+
+// Undecorated first, files of a platform section use the disks of the
+// same platform, or the undecorated ones.
+static const char* asPlatformSuffixes[] = {
+	"",
+	".X86",
+	".IA64",
+	".AMD64",
+	".ARM",
+	".ARM64",
+};
+
+typedef struct {
+	int32_t Id;
+	uint32_t Platform; // Index into asPlatformSuffixes
+	inf_field Path;
+	uint32_t Order;
+} layout_disk;
+
+typedef struct {
+	uint32_t Hash;
+	uint32_t First; // Index into aFiles, UINT32_MAX for empty slots
+	uint32_t Count;
+} name_slot;
+
+struct inf_layout_Tag {
+	layout_disk* aDisks; // Sorted by platform then ID
+	uint32_t nDisks;
+	layout_file* aFiles; // Grouped by name
+	uint32_t nFiles;
+	name_slot* aSlots;
+	uint32_t Mask; // Slot count - 1, a power of 2
+	arena Expanded; // Copies of the expanded fields
+};
+
+static inf_field Expand(inf_layout* pLayout, const inf_strings* pStrings, inf_field Field, inf_expand_buffer* pBuffer) {
+	inf_field Expanded = InfExpandField(pStrings, Field, pBuffer);
+	if (Expanded.s != Field.s)
+		Expanded.s = ArenaCopyString(&pLayout->Expanded, Expanded.s, Expanded.Length);
+	return Expanded;
+}
+
+static int DiskCompare(const void* pA, const void* pB) {
+	const layout_disk* A = pA;
+	const layout_disk* B = pB;
+	if (A->Platform != B->Platform)
+		return (A->Platform > B->Platform) - (A->Platform < B->Platform);
+	return (A->Id > B->Id) - (A->Id < B->Id);
+}
+
+static const layout_disk* FindDisk(const inf_layout* pLayout, uint32_t Platform, int32_t Id) {
+	layout_disk Key = { Id, Platform, { NULL, 0 }, 0 };
+	return bsearch(&Key, pLayout->aDisks, pLayout->nDisks, sizeof(*pLayout->aDisks), DiskCompare);
+}
+
+static void LoadDisks(inf_layout* pLayout, const inf_file* pInf, const inf_strings* pStrings, inf_expand_buffer* pBuffer) {
+	uint32_t Capacity = 0;
+	for (uint32_t Platform = 0; Platform < static_arrlen(asPlatformSuffixes); ++Platform) {
+		char sSection[64];
+		snprintf(sSection, sizeof(sSection), "SourceDisksNames%s", asPlatformSuffixes[Platform]);
+		inf_context InfContext;
+		if (!InfFindFirstLine(pInf, sSection, NULL, &InfContext))
+			continue;
+		do {
+			int32_t Id;
+			if (!InfGetIntField(&InfContext, 0, &Id))
+				continue;
+			if (pLayout->nDisks == Capacity) {
+				Capacity = Capacity ? Capacity * 2 : 16;
+				pLayout->aDisks = realloc_guarded(pLayout->aDisks, Capacity * sizeof(*pLayout->aDisks));
+			}
+			layout_disk* pDisk = &pLayout->aDisks[pLayout->nDisks++];
+			pDisk->Id = Id;
+			pDisk->Platform = Platform;
+			pDisk->Order = pLayout->nDisks;
+			pDisk->Path = (inf_field){ NULL, 0 };
+			if (InfGetStringField(&InfContext, 4, &pDisk->Path)) {
+				pDisk->Path = Expand(pLayout, pStrings, pDisk->Path, pBuffer);
+				InfTrimBslash(&pDisk->Path);
+			}
+		} while (InfFindNextLine(&InfContext, &InfContext));
+	}
+}
+
+// Sorts the disks, keeping the first of repeated IDs like the INF's own
+// disks. Order is the load order, qsort isn't stable.
+static int DiskOrderCompare(const void* pA, const void* pB) {
+	int Result = DiskCompare(pA, pB);
+	if (Result != 0)
+		return Result;
+	const layout_disk* A = pA;
+	const layout_disk* B = pB;
+	return (A->Order > B->Order) - (A->Order < B->Order);
+}
+
+static void SortDisks(inf_layout* pLayout) {
+	if (pLayout->nDisks == 0)
+		return;
+	qsort(pLayout->aDisks, pLayout->nDisks, sizeof(*pLayout->aDisks), DiskOrderCompare);
+	uint32_t nUnique = 1;
+	for (uint32_t i = 1; i < pLayout->nDisks; ++i)
+		if (DiskCompare(&pLayout->aDisks[i], &pLayout->aDisks[nUnique - 1]) != 0)
+			pLayout->aDisks[nUnique++] = pLayout->aDisks[i];
+	pLayout->nDisks = nUnique;
+}
+
+typedef struct {
+	layout_file File;
+	uint32_t Order; // Makes the sort stable
+} pending_file;
+
+static int PendingCompare(const void* pA, const void* pB) {
+	const pending_file* A = pA;
+	const pending_file* B = pB;
+	int Result = CompareStringI(A->File.FileName.s, A->File.FileName.Length, B->File.FileName.s, B->File.FileName.Length);
+	if (Result != 0)
+		return Result;
+	return (A->Order > B->Order) - (A->Order < B->Order);
+}
+
+inf_layout* InfLoadLayout(const inf_file* pInf, const inf_strings* pStrings) {
+	inf_layout* pLayout = malloc_guarded(sizeof(*pLayout));
+	memset(pLayout, 0, sizeof(*pLayout));
+	ArenaInit(&pLayout->Expanded);
+	inf_expand_buffer ExpandBuffer = { NULL, 0 };
+
+	LoadDisks(pLayout, pInf, pStrings, &ExpandBuffer);
+	SortDisks(pLayout);
+
+	// Collect the files with their disk resolved.
+	pending_file* aPending = NULL;
+	uint32_t nPending = 0;
+	uint32_t Capacity = 0;
+	for (uint32_t Platform = 0; Platform < static_arrlen(asPlatformSuffixes); ++Platform) {
+		char sSection[64];
+		snprintf(sSection, sizeof(sSection), "SourceDisksFiles%s", asPlatformSuffixes[Platform]);
+		inf_context InfContext;
+		if (!InfFindFirstLine(pInf, sSection, NULL, &InfContext))
+			continue;
+		do {
+			layout_file File;
+			if (!InfGetIntField(&InfContext, 1, &File.DiskId))
+				continue;
+			const layout_disk* pDisk = FindDisk(pLayout, Platform, File.DiskId);
+			if (!pDisk && Platform != 0)
+				pDisk = FindDisk(pLayout, 0, File.DiskId);
+			if (!pDisk)
+				continue;
+			File.DiskPath = pDisk->Path;
+
+			InfGetStringField(&InfContext, 0, &File.FileName);
+			File.FileName = Expand(pLayout, pStrings, File.FileName, &ExpandBuffer);
+			if (InfGetStringField(&InfContext, 2, &File.Subdir)) {
+				File.Subdir = Expand(pLayout, pStrings, File.Subdir, &ExpandBuffer);
+				InfTrimBslash(&File.Subdir);
+			} else {
+				File.Subdir = (inf_field){ NULL, 0 };
+			}
+
+			if (nPending == Capacity) {
+				Capacity = Capacity ? Capacity * 2 : 256;
+				aPending = realloc_guarded(aPending, Capacity * sizeof(*aPending));
+			}
+			aPending[nPending] = (pending_file){ File, nPending };
+			++nPending;
+		} while (InfFindNextLine(&InfContext, &InfContext));
+	}
+	if (nPending > 0)
+		qsort(aPending, nPending, sizeof(*aPending), PendingCompare);
+
+	pLayout->aFiles = malloc_guarded((nPending + 1) * sizeof(*pLayout->aFiles));
+	pLayout->nFiles = nPending;
+	for (uint32_t i = 0; i < nPending; ++i)
+		pLayout->aFiles[i] = aPending[i].File;
+	free(aPending);
+
+	// Hash the distinct names, keeping the load factor at 1/2 at most.
+	uint32_t SlotCount = 16;
+	while (SlotCount < pLayout->nFiles * 2)
+		SlotCount *= 2;
+	pLayout->aSlots = malloc_guarded(SlotCount * sizeof(*pLayout->aSlots));
+	for (uint32_t i = 0; i < SlotCount; ++i)
+		pLayout->aSlots[i] = (name_slot){ 0, UINT32_MAX, 0 };
+	pLayout->Mask = SlotCount - 1;
+
+	for (uint32_t i = 0; i < pLayout->nFiles;) {
+		const inf_field* pName = &pLayout->aFiles[i].FileName;
+		uint32_t Count = 1;
+		while (
+			i + Count < pLayout->nFiles &&
+			CompareStringI(pName->s, pName->Length, pLayout->aFiles[i + Count].FileName.s, pLayout->aFiles[i + Count].FileName.Length) == 0
+		)
+			++Count;
+
+		uint32_t Hash = HashStringI(pName->s, pName->Length);
+		uint32_t Slot = Hash & pLayout->Mask;
+		while (pLayout->aSlots[Slot].First != UINT32_MAX)
+			Slot = (Slot + 1) & pLayout->Mask;
+		pLayout->aSlots[Slot] = (name_slot){ Hash, i, Count };
+		i += Count;
+	}
+
+	InfFreeExpandBuffer(&ExpandBuffer);
+	return pLayout;
+}
+
+void InfFreeLayout(inf_layout* pLayout) {
+	ArenaFree(&pLayout->Expanded);
+	free(pLayout->aSlots);
+	free(pLayout->aFiles);
+	free(pLayout->aDisks);
+	free(pLayout);
+}
+
+const layout_file* InfFindLayoutFile(const inf_layout* pLayout, const char* sFileName, size_t Length, uint32_t* pCount) {
+	uint32_t Hash = HashStringI(sFileName, Length);
+	for (uint32_t Slot = Hash & pLayout->Mask;; Slot = (Slot + 1) & pLayout->Mask) {
+		const name_slot* pSlot = &pLayout->aSlots[Slot];
+		if (pSlot->First == UINT32_MAX) {
+			*pCount = 0;
+			return NULL;
+		}
+		const layout_file* pFile = &pLayout->aFiles[pSlot->First];
+		if (pSlot->Hash == Hash && CompareStringI(pFile->FileName.s, pFile->FileName.Length, sFileName, Length) == 0) {
+			*pCount = pSlot->Count;
+			return pFile;
+		}
+	}
+}
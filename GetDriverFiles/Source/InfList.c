@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "Platform.h"
+
+#include "GuardedMalloc.h"
+#include "InfList.h"
+
+static void Push(inf_list* pList, const char* sPath, size_t Length) {
+	if (pList->nPaths == pList->Capacity) {
+		pList->Capacity = pList->Capacity ? pList->Capacity * 2 : 64;
+		pList->asPaths = realloc_guarded(pList->asPaths, pList->Capacity * sizeof(*pList->asPaths));
+	}
+	char* sCopy = malloc_guarded(Length + 1);
+	memcpy(sCopy, sPath, Length);
+	sCopy[Length] = '\0';
+	pList->asPaths[pList->nPaths++] = sCopy;
+}
+
+static bool HasInfExtension(const char* sPath) {
+	size_t Length = strlen(sPath);
+	return Length >= 4 && _stricmp(sPath + Length - 4, ".inf") == 0;
+}
+
+// Directories
+
+typedef struct {
+	char* sPath;
+	bool bDirectory;
+} directory_entry;
+
+typedef struct {
+	directory_entry* aEntries;
+	size_t nEntries;
+	size_t Capacity;
+} directory_entries;
+
+static void CollectEntry(void* pContext, const char* sPath, bool bDirectory) {
+	directory_entries* pEntries = pContext;
+	if (!bDirectory && !HasInfExtension(sPath))
+		return;
+	if (pEntries->nEntries == pEntries->Capacity) {
+		pEntries->Capacity = pEntries->Capacity ? pEntries->Capacity * 2 : 64;
+		pEntries->aEntries = realloc_guarded(pEntries->aEntries, pEntries->Capacity * sizeof(*pEntries->aEntries));
+	}
+	directory_entry* pEntry = &pEntries->aEntries[pEntries->nEntries++];
+	pEntry->sPath = strdup_guarded(sPath);
+	pEntry->bDirectory = bDirectory;
+}
+
+static int EntryCompare(const void* pA, const void* pB) {
+	return strcmp(((const directory_entry*)pA)->sPath, ((const directory_entry*)pB)->sPath);
+}
+
+static void AddDirectory(inf_list* pList, const char* sDir, text_buffer* pWarnings) {
+	directory_entries Entries = { NULL, 0, 0 };
+	uint32_t Error;
+	if (!ListDirectory(sDir, CollectEntry, &Entries, &Error)) {
+		char* sErrorMessage = GetSystemErrorMessage(Error);
+		TextAppendFormat(pWarnings, "WARNING: Unable to list the directory '%s': %s", sDir, sErrorMessage);
+		FreeSystemErrorMessage(sErrorMessage);
+		return;
+	}
+
+	// The order readdir gives isn't stable, sort so batches are reproducible.
+	if (Entries.nEntries > 0)
+		qsort(Entries.aEntries, Entries.nEntries, sizeof(*Entries.aEntries), EntryCompare);
+	for (size_t i = 0; i < Entries.nEntries; ++i) {
+		directory_entry* pEntry = &Entries.aEntries[i];
+		if (pEntry->bDirectory)
+			AddDirectory(pList, pEntry->sPath, pWarnings);
+		else
+			Push(pList, pEntry->sPath, strlen(pEntry->sPath));
+		free(pEntry->sPath);
+	}
+	free(Entries.aEntries);
+}
+
+// Lists
+
+static void AddListText(inf_list* pList, const char* p, size_t Size) {
+	const char* pEnd = p + Size;
+	while (p < pEnd) {
+		const char* pLineEnd = p;
+		while (pLineEnd < pEnd && *pLineEnd != '\n' && *pLineEnd != '\0')
+			++pLineEnd;
+		const char* pTrimmedEnd = pLineEnd;
+		while (pTrimmedEnd > p && (pTrimmedEnd[-1] == '\r' || pTrimmedEnd[-1] == ' ' || pTrimmedEnd[-1] == '\t'))
+			--pTrimmedEnd;
+		if (pTrimmedEnd > p)
+			Push(pList, p, pTrimmedEnd - p);
+		p = pLineEnd + 1;
+	}
+}
+
+static bool ReadAll(FILE* pFile, text_buffer* pText) {
+	char aBuffer[65536];
+	size_t Read;
+	while ((Read = fread(aBuffer, 1, sizeof(aBuffer), pFile)) > 0)
+		TextAppend(pText, aBuffer, Read);
+	return !ferror(pFile);
+}
+
+static void AddList(inf_list* pList, const char* sListPath, text_buffer* pWarnings) {
+	text_buffer Text = { NULL, 0, 0 };
+	bool bStdin = strcmp(sListPath, "-") == 0;
+	FILE* pFile = stdin;
+	if (!bStdin) {
+#ifdef _WIN32
+		wchar_t* wsListPath = Utf8ToUtf16(sListPath);
+		pFile = _wfopen(wsListPath, L"rb");
+		free(wsListPath);
+#else
+		pFile = fopen(sListPath, "rb");
+#endif
+	}
+	if (!pFile) {
+		char* sErrorMessage = GetSystemErrorMessage(errno);
+		TextAppendFormat(pWarnings, "WARNING: Unable to open the list '%s': %s", sListPath, sErrorMessage);
+		FreeSystemErrorMessage(sErrorMessage);
+		return;
+	}
+
+	if (!ReadAll(pFile, &Text))
+		TextAppendFormat(pWarnings, "WARNING: Unable to read the whole list '%s'.\n", sListPath);
+	if (!bStdin)
+		fclose(pFile);
+
+	// Skip a UTF-8 BOM, as left by Notepad.
+	size_t Start = Text.Length >= 3 && memcmp(Text.p, "\xEF\xBB\xBF", 3) == 0 ? 3 : 0;
+	AddListText(pList, Text.p + Start, Text.Length - Start);
+	TextFree(&Text);
+}
+
+void InfListAdd(inf_list* pList, const char* sArg, text_buffer* pWarnings) {
+	if (strcmp(sArg, "-") == 0)
+		AddList(pList, sArg, pWarnings);
+	else if (sArg[0] == '@')
+		AddList(pList, sArg + 1, pWarnings);
+	else if (IsDirectory(sArg))
+		AddDirectory(pList, sArg, pWarnings);
+	else
+		Push(pList, sArg, strlen(sArg));
+}
+
+void InfListFree(inf_list* pList) {
+	for (size_t i = 0; i < pList->nPaths; ++i)
+		free(pList->asPaths[i]);
+	free(pList->asPaths);
+	pList->asPaths = NULL;
+	pList->nPaths = 0;
+	pList->Capacity = 0;
+}
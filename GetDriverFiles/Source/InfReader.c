@@ -0,0 +1,629 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "Platform.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "AsciiCase.h"
+#include "GuardedMalloc.h"
+#include "InfReader.h"
+#include "InfText.h"
+#include "Tree234.h"
+
+typedef struct {
+	uint32_t FirstField; // Index of the key slot in aFields
+	uint32_t FieldCount; // Not counting the key
+	uint32_t Section;
+	uint8_t bHasKey;
+} inf_line;
+
+typedef struct {
+	inf_field Name;
+	uint32_t Index;
+	uint32_t FirstLine; // Index into aSectionLines
+	uint32_t LineCount;
+} inf_section;
+
+struct inf_file_Tag {
+	const char* pData; // UTF-8, either the mapping or pDecoded
+	size_t DataSize;
+	void* pMapping;
+	size_t MappingSize;
+	char* pDecoded;
+
+	// Side buffer for fields that can't be views into the mapping.
+	// Rewritten fields never grow, so DataSize bytes are always enough.
+	char* pRewrite;
+	size_t RewriteUsed;
+
+	inf_field* aFields;
+	uint32_t nFields;
+	uint32_t FieldCapacity;
+
+	inf_line* aLines;
+	uint32_t nLines;
+	uint32_t LineCapacity;
+
+	inf_section** apSections;
+	uint32_t nSections;
+	uint32_t SectionCapacity;
+
+	uint32_t* aSectionLines; // Line indices grouped by section
+	tree234* pSectionTree;
+
+	// Only valid while parsing.
+	uint64_t* aStructural;
+};
+
+static bool IsBlank(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f' || c == '\x1a';
+}
+
+static int FieldCompareI(const inf_field* A, const inf_field* B) {
+	return CompareStringI(A->s, A->Length, B->s, B->Length);
+}
+
+static int SectionCompare(inf_section* A, inf_section* B) {
+	return FieldCompareI(&A->Name, &B->Name);
+}
+
+// Mapping
+
+static bool MapFile(inf_file* pInf, const char* sPath, uint32_t* pError) {
+#ifdef _WIN32
+	wchar_t* wsPath = Utf8ToUtf16(sPath);
+	HANDLE hFile = CreateFileW(
+		wsPath,
+		GENERIC_READ,
+		FILE_SHARE_READ,
+		NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+		NULL
+	);
+	free(wsPath);
+	if (hFile == INVALID_HANDLE_VALUE) {
+		*pError = GetLastError();
+		return false;
+	}
+
+	LARGE_INTEGER FileSize;
+	if (!GetFileSizeEx(hFile, &FileSize)) {
+		*pError = GetLastError();
+		CloseHandle(hFile);
+		return false;
+	}
+	if (FileSize.QuadPart == 0) {
+		// Can't map an empty file.
+		CloseHandle(hFile);
+		return true;
+	}
+
+	HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!hMapping) {
+		*pError = GetLastError();
+		CloseHandle(hFile);
+		return false;
+	}
+	void* pView = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+	if (!pView)
+		*pError = GetLastError();
+
+	// The view keeps the file alive.
+	CloseHandle(hMapping);
+	CloseHandle(hFile);
+	if (!pView)
+		return false;
+
+	pInf->pMapping = pView;
+	pInf->MappingSize = (size_t)FileSize.QuadPart;
+#else
+	int Fd = open(sPath, O_RDONLY);
+	if (Fd < 0) {
+		*pError = errno;
+		return false;
+	}
+
+	struct stat Stat;
+	if (fstat(Fd, &Stat) != 0) {
+		*pError = errno;
+		close(Fd);
+		return false;
+	}
+	if (Stat.st_size == 0) {
+		close(Fd);
+		return true;
+	}
+
+	void* pView = mmap(NULL, (size_t)Stat.st_size, PROT_READ, MAP_PRIVATE, Fd, 0);
+	if (pView == MAP_FAILED)
+		*pError = errno;
+	close(Fd);
+	if (pView == MAP_FAILED)
+		return false;
+
+	pInf->pMapping = pView;
+	pInf->MappingSize = (size_t)Stat.st_size;
+#endif
+	pInf->pData = pInf->pMapping;
+	pInf->DataSize = pInf->MappingSize;
+	return true;
+}
+
+static void UnmapFile(inf_file* pInf) {
+	if (!pInf->pMapping)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(pInf->pMapping);
+#else
+	munmap(pInf->pMapping, pInf->MappingSize);
+#endif
+	pInf->pMapping = NULL;
+}
+
+// Tokenizer
+
+static uint32_t PushField(inf_file* pInf, inf_field Field) {
+	if (pInf->nFields == pInf->FieldCapacity) {
+		pInf->FieldCapacity = pInf->FieldCapacity ? pInf->FieldCapacity * 2 : 256;
+		pInf->aFields = realloc_guarded(pInf->aFields, pInf->FieldCapacity * sizeof(*pInf->aFields));
+	}
+	pInf->aFields[pInf->nFields] = Field;
+	return pInf->nFields++;
+}
+
+static inf_line* PushLine(inf_file* pInf) {
+	if (pInf->nLines == pInf->LineCapacity) {
+		pInf->LineCapacity = pInf->LineCapacity ? pInf->LineCapacity * 2 : 64;
+		pInf->aLines = realloc_guarded(pInf->aLines, pInf->LineCapacity * sizeof(*pInf->aLines));
+	}
+	return &pInf->aLines[pInf->nLines++];
+}
+
+static size_t SkipToNextLine(const char* pData, size_t Size, size_t i) {
+	const char* pNewLine = memchr(pData + i, '\n', Size - i);
+	return pNewLine ? (size_t)(pNewLine - pData) + 1 : Size;
+}
+
+static inf_field TrimmedView(const char* pData, size_t Start, size_t End) {
+	while (Start < End && IsBlank(pData[Start]))
+		++Start;
+	while (End > Start && IsBlank(pData[End - 1]))
+		--End;
+	return (inf_field){ pData + Start, (uint32_t)(End - Start) };
+}
+
+// A line continues if its last non-blank character is '\'.
+static bool IsContinuation(const char* pData, size_t Start, size_t End) {
+	while (End > Start && IsBlank(pData[End - 1]))
+		--End;
+	return End > Start && pData[End - 1] == '\\';
+}
+
+// Copy a field that contains quotes or line continuations into the side buffer.
+static inf_field RewriteField(inf_file* pInf, size_t Start, size_t End) {
+	const char* pData = pInf->pData;
+	if (!pInf->pRewrite)
+		pInf->pRewrite = malloc_guarded(pInf->DataSize);
+
+	char* pOut = pInf->pRewrite + pInf->RewriteUsed;
+	size_t Length = 0;
+	size_t KeptLength = 0; // Length up to the last non-blank or quoted char
+	bool bStarted = false;
+	bool bInQuote = false;
+
+	for (size_t i = Start; i < End; ++i) {
+		char c = pData[i];
+		if (bInQuote) {
+			if (c == '"') {
+				if (i + 1 < End && pData[i + 1] == '"') {
+					// "" inside quotes is a literal quote
+					pOut[Length++] = '"';
+					++i;
+				} else {
+					bInQuote = false;
+				}
+			} else {
+				pOut[Length++] = c;
+			}
+			KeptLength = Length;
+			continue;
+		}
+
+		if (c == '"') {
+			bInQuote = true;
+			bStarted = true;
+			continue;
+		}
+		if (c == '\\') {
+			size_t j = i + 1;
+			while (j < End && IsBlank(pData[j]))
+				++j;
+			if (j < End && (pData[j] == '\n' || pData[j] == ';')) {
+				// Line continuation, drop it with any comment after it.
+				i = SkipToNextLine(pData, End, j) - 1;
+				continue;
+			}
+		}
+		if (c == ';') {
+			i = SkipToNextLine(pData, End, i) - 1;
+			continue;
+		}
+		if (IsBlank(c)) {
+			if (bStarted)
+				pOut[Length++] = c;
+			continue;
+		}
+
+		bStarted = true;
+		pOut[Length++] = c;
+		KeptLength = Length;
+	}
+
+	pInf->RewriteUsed += KeptLength;
+	return (inf_field){ pOut, (uint32_t)KeptLength };
+}
+
+static uint32_t AddField(inf_file* pInf, size_t Start, size_t End, bool bDirty) {
+	if (bDirty)
+		return PushField(pInf, RewriteField(pInf, Start, End));
+	return PushField(pInf, TrimmedView(pInf->pData, Start, End));
+}
+
+static size_t ParseSectionHeader(inf_file* pInf, size_t i, uint32_t* pSection) {
+	const char* pData = pInf->pData;
+	size_t Size = pInf->DataSize;
+
+	size_t Start = i + 1;
+	size_t End = InfNextStructural(pInf->aStructural, Size, Start);
+	while (End < Size && pData[End] != ']' && pData[End] != '\n')
+		End = InfNextStructural(pInf->aStructural, Size, End + 1);
+
+	inf_section* pNew = malloc_guarded(sizeof(*pNew));
+	pNew->Name = TrimmedView(pData, Start, End);
+	pNew->Index = pInf->nSections;
+	pNew->FirstLine = 0;
+	pNew->LineCount = 0;
+
+	// Duplicate sections are merged into the first one.
+	inf_section* pSection2 = add234(pInf->pSectionTree, pNew);
+	if (pSection2 != pNew) {
+		free(pNew);
+	} else {
+		if (pInf->nSections == pInf->SectionCapacity) {
+			pInf->SectionCapacity = pInf->SectionCapacity ? pInf->SectionCapacity * 2 : 16;
+			pInf->apSections = realloc_guarded(
+				pInf->apSections,
+				pInf->SectionCapacity * sizeof(*pInf->apSections)
+			);
+		}
+		pInf->apSections[pInf->nSections++] = pNew;
+	}
+	*pSection = pSection2->Index;
+
+	return SkipToNextLine(pData, Size, End);
+}
+
+static size_t ParseLine(inf_file* pInf, size_t i, uint32_t Section) {
+	const char* pData = pInf->pData;
+	size_t Size = pInf->DataSize;
+
+	uint32_t KeyField = PushField(pInf, (inf_field){ NULL, 0 });
+	bool bHasKey = false;
+	bool bInQuote = false;
+	bool bDirty = false;
+	size_t FieldStart = i;
+	size_t FieldEnd;
+
+	// Only structural characters can change the state, jump between them.
+	while (1) {
+		i = InfNextStructural(pInf->aStructural, Size, i);
+		if (i >= Size) {
+			FieldEnd = Size;
+			break;
+		}
+
+		char c = pData[i];
+		if (bInQuote) {
+			if (c == '"') {
+				bInQuote = false;
+			} else if (c == '\n') {
+				// Unterminated quote
+				FieldEnd = i++;
+				break;
+			}
+			++i;
+			continue;
+		}
+
+		if (c == '"') {
+			bInQuote = true;
+			bDirty = true;
+		} else if (c == ',') {
+			AddField(pInf, FieldStart, i, bDirty);
+			FieldStart = i + 1;
+			bDirty = false;
+		} else if (c == '=' && !bHasKey && pInf->nFields == KeyField + 1) {
+			pInf->aFields[KeyField] = bDirty ?
+				RewriteField(pInf, FieldStart, i) :
+				TrimmedView(pData, FieldStart, i);
+			bHasKey = true;
+			FieldStart = i + 1;
+			bDirty = false;
+		} else if (c == ';' || c == '\n') {
+			bool bContinue = IsContinuation(pData, FieldStart, i);
+			size_t LineEnd = (c == ';') ? SkipToNextLine(pData, Size, i) : i + 1;
+			if (bContinue) {
+				bDirty = true;
+				i = LineEnd;
+				continue;
+			}
+			FieldEnd = i;
+			i = LineEnd;
+			break;
+		}
+		++i;
+	}
+	AddField(pInf, FieldStart, FieldEnd, bDirty);
+
+	if (Section == UINT32_MAX) {
+		// Line outside of any section
+		pInf->nFields = KeyField;
+		return i;
+	}
+
+	if (!bHasKey)
+		pInf->aFields[KeyField] = pInf->aFields[KeyField + 1];
+
+	inf_line* pLine = PushLine(pInf);
+	pLine->FirstField = KeyField;
+	pLine->FieldCount = pInf->nFields - KeyField - 1;
+	pLine->Section = Section;
+	pLine->bHasKey = bHasKey;
+	pInf->apSections[Section]->LineCount += 1;
+
+	return i;
+}
+
+static void GroupLinesBySection(inf_file* pInf) {
+	uint32_t FirstLine = 0;
+	for (uint32_t i = 0; i < pInf->nSections; ++i) {
+		pInf->apSections[i]->FirstLine = FirstLine;
+		FirstLine += pInf->apSections[i]->LineCount;
+		pInf->apSections[i]->LineCount = 0;
+	}
+
+	pInf->aSectionLines = malloc_guarded((pInf->nLines + 1) * sizeof(*pInf->aSectionLines));
+	for (uint32_t i = 0; i < pInf->nLines; ++i) {
+		inf_section* pSection = pInf->apSections[pInf->aLines[i].Section];
+		pInf->aSectionLines[pSection->FirstLine + pSection->LineCount++] = i;
+	}
+}
+
+static void InfParse(inf_file* pInf) {
+	const char* pData = pInf->pData;
+	size_t Size = pInf->DataSize;
+	uint32_t Section = UINT32_MAX;
+
+	pInf->aStructural = malloc_guarded((InfStructuralWords(Size) + 1) * sizeof(*pInf->aStructural));
+	InfBuildStructuralIndex(pData, Size, pInf->aStructural);
+
+	size_t i = 0;
+	while (i < Size) {
+		char c = pData[i];
+		if (IsBlank(c) || c == '\n')
+			++i;
+		else if (c == ';')
+			i = SkipToNextLine(pData, Size, i);
+		else if (c == '[')
+			i = ParseSectionHeader(pInf, i, &Section);
+		else
+			i = ParseLine(pInf, i, Section);
+	}
+
+	free(pInf->aStructural);
+	pInf->aStructural = NULL;
+
+	GroupLinesBySection(pInf);
+}
+
+// Public functions
+
+inf_file* InfOpenFile(const char* sPath, uint32_t* pError) {
+	inf_file* pInf = malloc_guarded(sizeof(*pInf));
+	memset(pInf, 0, sizeof(*pInf));
+
+	if (!MapFile(pInf, sPath, pError)) {
+		free(pInf);
+		return NULL;
+	}
+
+	// UTF-8 files are parsed straight from the mapping,
+	// others are transcoded to UTF-8 and unmapped.
+	size_t BomSize;
+	inf_encoding Encoding = InfDetectEncoding(pInf->pData, pInf->DataSize, &BomSize);
+	const char* pText = pInf->pData + BomSize;
+	size_t TextSize = pInf->DataSize - BomSize;
+	switch (Encoding) {
+	case INF_ENCODING_UTF8:
+		pInf->pData = pText;
+		pInf->DataSize = TextSize;
+		break;
+	case INF_ENCODING_UTF16LE:
+	case INF_ENCODING_ANSI:
+		pInf->pDecoded = malloc_guarded(InfMaxUtf8Size(TextSize));
+		if (Encoding == INF_ENCODING_UTF16LE)
+			pInf->DataSize = InfUtf16LeToUtf8(pText, TextSize, pInf->pDecoded);
+		else
+			pInf->DataSize = InfAnsiToUtf8(pText, TextSize, pInf->pDecoded);
+		pInf->pData = pInf->pDecoded;
+		UnmapFile(pInf);
+		break;
+	default:
+		UnmapFile(pInf);
+		free(pInf);
+		*pError = ERROR_BAD_FORMAT;
+		return NULL;
+	}
+
+	pInf->pSectionTree = newtree234((cmpfn234)SectionCompare);
+	InfParse(pInf);
+	return pInf;
+}
+
+void InfCloseFile(inf_file* pInf) {
+	for (uint32_t i = 0; i < pInf->nSections; ++i)
+		free(pInf->apSections[i]);
+	freetree234(pInf->pSectionTree);
+	free(pInf->apSections);
+	free(pInf->aSectionLines);
+	free(pInf->aLines);
+	free(pInf->aFields);
+	free(pInf->pRewrite);
+	free(pInf->pDecoded);
+	UnmapFile(pInf);
+	free(pInf);
+}
+
+static inf_section* FindSection(const inf_file* pInf, const char* sSection) {
+	inf_section Key = { .Name = { sSection, (uint32_t)strlen(sSection) } };
+	return find234(pInf->pSectionTree, &Key, NULL);
+}
+
+static const inf_line* GetLine(const inf_context* pContext) {
+	const inf_file* pInf = pContext->pInf;
+	const inf_section* pSection = pInf->apSections[pContext->Section];
+	return &pInf->aLines[pInf->aSectionLines[pSection->FirstLine + pContext->Line]];
+}
+
+static bool MatchKey(const inf_context* pContext, const inf_field* pKey) {
+	const inf_line* pLine = GetLine(pContext);
+	return pLine->bHasKey && FieldCompareI(&pContext->pInf->aFields[pLine->FirstField], pKey) == 0;
+}
+
+int32_t InfGetLineCount(const inf_file* pInf, const char* sSection) {
+	inf_section* pSection = FindSection(pInf, sSection);
+	if (!pSection)
+		return -1;
+	return (int32_t)pSection->LineCount;
+}
+
+uint32_t InfGetSectionCount(const inf_file* pInf) {
+	return pInf->nSections;
+}
+
+int32_t InfFindSection(const inf_file* pInf, inf_field Name) {
+	inf_section Key = { .Name = Name };
+	inf_section* pSection = find234(pInf->pSectionTree, &Key, NULL);
+	return pSection ? (int32_t)pSection->Index : -1;
+}
+
+static bool FindFirstLine(const inf_file* pInf, const inf_section* pSection, const char* sKey, inf_context* pContext) {
+	if (!pSection || pSection->LineCount == 0)
+		return false;
+
+	inf_context Context = { pInf, pSection->Index, 0 };
+	if (sKey) {
+		inf_field Key = { sKey, (uint32_t)strlen(sKey) };
+		while (!MatchKey(&Context, &Key)) {
+			if (++Context.Line >= pSection->LineCount)
+				return false;
+		}
+	}
+	*pContext = Context;
+	return true;
+}
+
+bool InfFindFirstLine(const inf_file* pInf, const char* sSection, const char* sKey, inf_context* pContext) {
+	return FindFirstLine(pInf, FindSection(pInf, sSection), sKey, pContext);
+}
+
+bool InfFindFirstLineByIndex(const inf_file* pInf, uint32_t Section, const char* sKey, inf_context* pContext) {
+	if (Section >= pInf->nSections)
+		return false;
+	return FindFirstLine(pInf, pInf->apSections[Section], sKey, pContext);
+}
+
+bool InfFindNextLine(const inf_context* pContextIn, inf_context* pContextOut) {
+	const inf_section* pSection = pContextIn->pInf->apSections[pContextIn->Section];
+	if (pContextIn->Line + 1 >= pSection->LineCount)
+		return false;
+	*pContextOut = *pContextIn;
+	pContextOut->Line += 1;
+	return true;
+}
+
+bool InfFindNextMatchLine(const inf_context* pContextIn, const char* sKey, inf_context* pContextOut) {
+	const inf_section* pSection = pContextIn->pInf->apSections[pContextIn->Section];
+	inf_field Key = { sKey, (uint32_t)strlen(sKey) };
+	inf_context Context = *pContextIn;
+	do {
+		if (++Context.Line >= pSection->LineCount)
+			return false;
+	} while (!MatchKey(&Context, &Key));
+	*pContextOut = Context;
+	return true;
+}
+
+uint32_t InfGetFieldCount(const inf_context* pContext) {
+	return GetLine(pContext)->FieldCount;
+}
+
+bool InfGetStringField(const inf_context* pContext, uint32_t FieldIndex, inf_field* pField) {
+	const inf_line* pLine = GetLine(pContext);
+	if (FieldIndex > pLine->FieldCount)
+		return false;
+	*pField = pContext->pInf->aFields[pLine->FirstField + FieldIndex];
+	return true;
+}
+
+// Decimal, or hexadecimal with a 0x prefix.
+bool InfGetIntField(const inf_context* pContext, uint32_t FieldIndex, int32_t* pValue) {
+	inf_field Field;
+	if (!InfGetStringField(pContext, FieldIndex, &Field))
+		return false;
+
+	const char* p = Field.s;
+	const char* pEnd = Field.s + Field.Length;
+	bool bNegative = false;
+	if (p < pEnd && (*p == '-' || *p == '+'))
+		bNegative = *p++ == '-';
+
+	uint32_t Base = 10;
+	if (pEnd - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+		Base = 16;
+		p += 2;
+	}
+	if (p == pEnd)
+		return false;
+
+	uint32_t Value = 0;
+	for (; p < pEnd; ++p) {
+		uint32_t Digit;
+		char c = AsciiToLower(*p);
+		if (c >= '0' && c <= '9')
+			Digit = c - '0';
+		else if (Base == 16 && c >= 'a' && c <= 'f')
+			Digit = c - 'a' + 10;
+		else
+			return false;
+		Value = Value * Base + Digit;
+	}
+	*pValue = bNegative ? -(int32_t)Value : (int32_t)Value;
+	return true;
+}
+
+void InfTrimBslash(inf_field* pField) {
+	while (pField->Length > 0 && pField->s[0] == '\\') {
+		++pField->s;
+		--pField->Length;
+	}
+	while (pField->Length > 0 && pField->s[pField->Length - 1] == '\\')
+		--pField->Length;
+}
@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "AsciiCase.h"
+#include "GuardedMalloc.h"
+#include "InfStrings.h"
+
+typedef struct {
+	uint32_t Hash;
+	inf_field Key; // Key.s is NULL for empty slots
+	inf_field Value;
+} string_entry;
+
+struct inf_strings_Tag {
+	string_entry* aEntries;
+	uint32_t Mask; // Capacity - 1, capacity is a power of 2
+	uint32_t Count;
+};
+
+static bool KeyEqualI(const inf_field* pKey, const char* s, size_t Length) {
+	return pKey->Length == Length && EqualStringI(pKey->s, s, Length);
+}
+
+static string_entry* FindSlot(const inf_strings* pStrings, const char* sKey, size_t KeyLength, uint32_t Hash) {
+	for (uint32_t i = Hash & pStrings->Mask;; i = (i + 1) & pStrings->Mask) {
+		string_entry* pEntry = &pStrings->aEntries[i];
+		if (!pEntry->Key.s)
+			return pEntry;
+		if (pEntry->Hash == Hash && KeyEqualI(&pEntry->Key, sKey, KeyLength))
+			return pEntry;
+	}
+}
+
+// Existing keys are kept, so the first section loaded wins.
+static void LoadSection(inf_strings* pStrings, const inf_file* pInf, const char* sSection) {
+	inf_context InfContext;
+	if (!InfFindFirstLine(pInf, sSection, NULL, &InfContext))
+		return;
+
+	do {
+		inf_field Key;
+		inf_field Value;
+		InfGetStringField(&InfContext, 0, &Key);
+		if (!InfGetStringField(&InfContext, 1, &Value))
+			Value = Key;
+
+		uint32_t Hash = HashStringI(Key.s, Key.Length);
+		string_entry* pEntry = FindSlot(pStrings, Key.s, Key.Length, Hash);
+		if (pEntry->Key.s)
+			continue;
+		pEntry->Hash = Hash;
+		pEntry->Key = Key;
+		pEntry->Value = Value;
+		pStrings->Count += 1;
+	} while (InfFindNextLine(&InfContext, &InfContext));
+}
+
+inf_strings* InfLoadStrings(const inf_file* pInf, const char* sLocale) {
+	char sLocaleSection[64] = "";
+	if (sLocale)
+		snprintf(sLocaleSection, sizeof(sLocaleSection), "Strings.%s", sLocale);
+
+	// Keep the load factor at 1/2 at most.
+	int32_t nLines = 0;
+	int32_t nBaseLines = InfGetLineCount(pInf, "Strings");
+	int32_t nLocaleLines = sLocale ? InfGetLineCount(pInf, sLocaleSection) : -1;
+	if (nBaseLines > 0)
+		nLines += nBaseLines;
+	if (nLocaleLines > 0)
+		nLines += nLocaleLines;
+	uint32_t Capacity = 16;
+	while (Capacity < (uint32_t)nLines * 2)
+		Capacity *= 2;
+
+	inf_strings* pStrings = malloc_guarded(sizeof(*pStrings));
+	pStrings->aEntries = malloc_guarded(Capacity * sizeof(*pStrings->aEntries));
+	memset(pStrings->aEntries, 0, Capacity * sizeof(*pStrings->aEntries));
+	pStrings->Mask = Capacity - 1;
+	pStrings->Count = 0;
+
+	if (sLocale)
+		LoadSection(pStrings, pInf, sLocaleSection);
+	LoadSection(pStrings, pInf, "Strings");
+	return pStrings;
+}
+
+void InfFreeStrings(inf_strings* pStrings) {
+	free(pStrings->aEntries);
+	free(pStrings);
+}
+
+bool InfLookupString(const inf_strings* pStrings, const char* sKey, size_t KeyLength, inf_field* pValue) {
+	string_entry* pEntry = FindSlot(pStrings, sKey, KeyLength, HashStringI(sKey, KeyLength));
+	if (!pEntry->Key.s)
+		return false;
+	*pValue = pEntry->Value;
+	return true;
+}
+
+static void Append(inf_expand_buffer* pBuffer, size_t* pLength, const char* s, size_t Length) {
+	if (Length == 0)
+		return;
+	if (*pLength + Length > pBuffer->Capacity) {
+		size_t Capacity = pBuffer->Capacity ? pBuffer->Capacity : 64;
+		while (Capacity < *pLength + Length)
+			Capacity *= 2;
+		pBuffer->p = realloc_guarded(pBuffer->p, Capacity);
+		pBuffer->Capacity = Capacity;
+	}
+	memcpy(pBuffer->p + *pLength, s, Length);
+	*pLength += Length;
+}
+
+inf_field InfExpandField(const inf_strings* pStrings, inf_field Field, inf_expand_buffer* pBuffer) {
+	const char* pPercent = Field.Length ? memchr(Field.s, '%', Field.Length) : NULL;
+	if (!pPercent)
+		return Field;
+
+	const char* p = Field.s;
+	const char* pEnd = Field.s + Field.Length;
+	size_t Length = 0;
+	while (pPercent) {
+		Append(pBuffer, &Length, p, pPercent - p);
+
+		const char* pKey = pPercent + 1;
+		const char* pClose = memchr(pKey, '%', pEnd - pKey);
+		if (!pClose) {
+			// Lone '%', keep it.
+			p = pPercent;
+			break;
+		}
+
+		inf_field Value;
+		if (pClose == pKey)
+			Append(pBuffer, &Length, "%", 1);
+		else if (InfLookupString(pStrings, pKey, pClose - pKey, &Value))
+			Append(pBuffer, &Length, Value.s, Value.Length);
+		else
+			Append(pBuffer, &Length, pPercent, pClose + 1 - pPercent);
+
+		p = pClose + 1;
+		pPercent = memchr(p, '%', pEnd - p);
+	}
+	Append(pBuffer, &Length, p, pEnd - p);
+
+	// The buffer is still NULL if nothing was ever appended to it.
+	return (inf_field){ Length ? pBuffer->p : "", (uint32_t)Length };
+}
+
+void InfFreeExpandBuffer(inf_expand_buffer* pBuffer) {
+	free(pBuffer->p);
+	pBuffer->p = NULL;
+	pBuffer->Capacity = 0;
+}
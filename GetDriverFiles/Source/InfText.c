@@ -0,0 +1,597 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "InfText.h"
+#include "Platform.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define INF_X86 1
+#include <immintrin.h>
+#ifndef _MSC_VER
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define INF_TARGET(X) __attribute__((target(X)))
+#else
+#define INF_TARGET(X)
+#endif
+
+// CPU detection
+
+static inf_simd_level DetectSimdLevel(void) {
+#ifdef INF_X86
+#ifdef _MSC_VER
+	int aInfo[4];
+	__cpuid(aInfo, 0);
+	int MaxLeaf = aInfo[0];
+	__cpuid(aInfo, 1);
+	bool bSse2 = (aInfo[3] >> 26) & 1;
+	bool bOsxsave = (aInfo[2] >> 27) & 1;
+	bool bAvx2 = false;
+	if (MaxLeaf >= 7 && bOsxsave && (_xgetbv(0) & 6) == 6) {
+		__cpuidex(aInfo, 7, 0);
+		bAvx2 = (aInfo[1] >> 5) & 1;
+	}
+#else
+	__builtin_cpu_init();
+	bool bSse2 = __builtin_cpu_supports("sse2");
+	bool bAvx2 = __builtin_cpu_supports("avx2");
+#endif
+	if (bAvx2)
+		return INF_SIMD_AVX2;
+	if (bSse2)
+		return INF_SIMD_SSE2;
+#endif
+	return INF_SIMD_NONE;
+}
+
+// Level + 1, 0 until detected. Batch workers can get here first at the
+// same time; they'd store the same value.
+static volatile size_t g_SupportedSimdLevel;
+static volatile size_t g_SimdLevel;
+
+static size_t GetSupportedSimdLevel(void) {
+	size_t Level = AtomicLoad(&g_SupportedSimdLevel);
+	if (Level == 0) {
+		Level = (size_t)DetectSimdLevel() + 1;
+		AtomicStore(&g_SupportedSimdLevel, Level);
+	}
+	return Level;
+}
+
+inf_simd_level InfGetSimdLevel(void) {
+	size_t Level = AtomicLoad(&g_SimdLevel);
+	if (Level == 0) {
+		Level = GetSupportedSimdLevel();
+		AtomicStore(&g_SimdLevel, Level);
+	}
+	return (inf_simd_level)(Level - 1);
+}
+
+void InfSetSimdLevel(inf_simd_level Level) {
+	size_t Supported = GetSupportedSimdLevel();
+	AtomicStore(&g_SimdLevel, (size_t)Level + 1 < Supported ? (size_t)Level + 1 : Supported);
+}
+
+// Structural index
+
+static const uint8_t s_abIsStructural[256] = {
+	['['] = 1, [']'] = 1, ['\n'] = 1, [';'] = 1, ['"'] = 1, [','] = 1, ['='] = 1,
+};
+
+static void BuildStructuralIndexScalar(const char* pData, size_t Size, size_t FirstWord, uint64_t* aBitmap) {
+	for (size_t Word = FirstWord; Word * 64 < Size; ++Word) {
+		size_t Start = Word * 64;
+		size_t End = Size - Start < 64 ? Size : Start + 64;
+		uint64_t Mask = 0;
+		for (size_t i = Start; i < End; ++i)
+			Mask |= (uint64_t)s_abIsStructural[(uint8_t)pData[i]] << (i - Start);
+		aBitmap[Word] = Mask;
+	}
+}
+
+#ifdef INF_X86
+
+INF_TARGET("sse2")
+static uint32_t ClassifySse2(const char* p) {
+	__m128i v = _mm_loadu_si128((const __m128i*)p);
+	__m128i m = _mm_or_si128(
+		_mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('[')), _mm_cmpeq_epi8(v, _mm_set1_epi8(']'))),
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8(';')))
+		),
+		_mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8(','))),
+			_mm_cmpeq_epi8(v, _mm_set1_epi8('='))
+		)
+	);
+	return (uint32_t)_mm_movemask_epi8(m);
+}
+
+INF_TARGET("sse2")
+static void BuildStructuralIndexSse2(const char* pData, size_t Size, uint64_t* aBitmap) {
+	size_t nFullWords = Size / 64;
+	for (size_t Word = 0; Word < nFullWords; ++Word) {
+		const char* p = pData + Word * 64;
+		aBitmap[Word] =
+			(uint64_t)ClassifySse2(p) |
+			(uint64_t)ClassifySse2(p + 16) << 16 |
+			(uint64_t)ClassifySse2(p + 32) << 32 |
+			(uint64_t)ClassifySse2(p + 48) << 48;
+	}
+	BuildStructuralIndexScalar(pData, Size, nFullWords, aBitmap);
+}
+
+INF_TARGET("avx2")
+static uint32_t ClassifyAvx2(const char* p) {
+	__m256i v = _mm256_loadu_si256((const __m256i*)p);
+	__m256i m = _mm256_or_si256(
+		_mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('[')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(']'))),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(';')))
+		),
+		_mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(','))),
+			_mm256_cmpeq_epi8(v, _mm256_set1_epi8('='))
+		)
+	);
+	return (uint32_t)_mm256_movemask_epi8(m);
+}
+
+INF_TARGET("avx2")
+static void BuildStructuralIndexAvx2(const char* pData, size_t Size, uint64_t* aBitmap) {
+	size_t nFullWords = Size / 64;
+	for (size_t Word = 0; Word < nFullWords; ++Word) {
+		const char* p = pData + Word * 64;
+		aBitmap[Word] = (uint64_t)ClassifyAvx2(p) | (uint64_t)ClassifyAvx2(p + 32) << 32;
+	}
+	BuildStructuralIndexScalar(pData, Size, nFullWords, aBitmap);
+}
+
+#endif
+
+void InfBuildStructuralIndex(const char* pData, size_t Size, uint64_t* aBitmap) {
+	switch (InfGetSimdLevel()) {
+#ifdef INF_X86
+	case INF_SIMD_AVX2:
+		BuildStructuralIndexAvx2(pData, Size, aBitmap);
+		break;
+	case INF_SIMD_SSE2:
+		BuildStructuralIndexSse2(pData, Size, aBitmap);
+		break;
+#endif
+	default:
+		BuildStructuralIndexScalar(pData, Size, 0, aBitmap);
+		break;
+	}
+}
+
+// Encodings
+
+static size_t PutUtf8(char* pOut, uint32_t c) {
+	if (c < 0x80) {
+		pOut[0] = (char)c;
+		return 1;
+	}
+	if (c < 0x800) {
+		pOut[0] = (char)(0xC0 | c >> 6);
+		pOut[1] = (char)(0x80 | (c & 0x3F));
+		return 2;
+	}
+	if (c < 0x10000) {
+		pOut[0] = (char)(0xE0 | c >> 12);
+		pOut[1] = (char)(0x80 | (c >> 6 & 0x3F));
+		pOut[2] = (char)(0x80 | (c & 0x3F));
+		return 3;
+	}
+	pOut[0] = (char)(0xF0 | c >> 18);
+	pOut[1] = (char)(0x80 | (c >> 12 & 0x3F));
+	pOut[2] = (char)(0x80 | (c >> 6 & 0x3F));
+	pOut[3] = (char)(0x80 | (c & 0x3F));
+	return 4;
+}
+
+// Unpaired surrogates become U+FFFD.
+static uint32_t ReadUtf16Le(const uint8_t* p, size_t nUnits, size_t* pi) {
+	size_t i = *pi;
+	uint32_t c = p[2 * i] | (uint32_t)p[2 * i + 1] << 8;
+	*pi = ++i;
+	if (c >= 0xD800 && c <= 0xDBFF) {
+		if (i < nUnits) {
+			uint32_t c2 = p[2 * i] | (uint32_t)p[2 * i + 1] << 8;
+			if (c2 >= 0xDC00 && c2 <= 0xDFFF) {
+				*pi = i + 1;
+				return 0x10000 + ((c - 0xD800) << 10) + (c2 - 0xDC00);
+			}
+		}
+		return 0xFFFD;
+	}
+	if (c >= 0xDC00 && c <= 0xDFFF)
+		return 0xFFFD;
+	return c;
+}
+
+// 0x80 to 0x9F, the rest of the upper half maps to itself.
+// Undefined bytes map to the C1 control with the same value, like Windows does.
+static const uint16_t s_aWindows1252[32] = {
+	0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+	0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+	0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+	0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178,
+};
+
+static size_t PutWindows1252(char* pOut, uint8_t b) {
+	return PutUtf8(pOut, (b >= 0x80 && b < 0xA0) ? s_aWindows1252[b - 0x80] : b);
+}
+
+// Length of the valid UTF-8 sequence at p, 0 if invalid.
+static size_t Utf8SequenceLength(const uint8_t* p, size_t Size) {
+	uint8_t b = p[0];
+	if (b < 0x80)
+		return 1;
+
+	size_t Length;
+	uint32_t c;
+	if (b >= 0xC2 && b <= 0xDF) {
+		Length = 2;
+		c = b & 0x1F;
+	} else if (b >= 0xE0 && b <= 0xEF) {
+		Length = 3;
+		c = b & 0x0F;
+	} else if (b >= 0xF0 && b <= 0xF4) {
+		Length = 4;
+		c = b & 0x07;
+	} else {
+		return 0;
+	}
+	if (Length > Size)
+		return 0;
+	for (size_t i = 1; i < Length; ++i) {
+		if ((p[i] & 0xC0) != 0x80)
+			return 0;
+		c = c << 6 | (p[i] & 0x3F);
+	}
+
+	// Overlong forms and surrogates
+	if ((Length == 3 && c < 0x800) || (Length == 4 && c < 0x10000))
+		return 0;
+	if (c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF))
+		return 0;
+	return Length;
+}
+
+static bool IsUtf8Scalar(const uint8_t* p, size_t Size) {
+	size_t i = 0;
+	while (i < Size) {
+		size_t Length = Utf8SequenceLength(p + i, Size - i);
+		if (!Length)
+			return false;
+		i += Length;
+	}
+	return true;
+}
+
+static size_t Utf16LeToUtf8Scalar(const uint8_t* p, size_t nUnits, char* pOut) {
+	size_t i = 0;
+	size_t o = 0;
+	while (i < nUnits)
+		o += PutUtf8(pOut + o, ReadUtf16Le(p, nUnits, &i));
+	return o;
+}
+
+static size_t AnsiToUtf8Scalar(const uint8_t* p, size_t Size, char* pOut) {
+	size_t o = 0;
+	for (size_t i = 0; i < Size; ++i)
+		o += PutWindows1252(pOut + o, p[i]);
+	return o;
+}
+
+#ifdef INF_X86
+
+/*
+ * The SIMD paths only handle blocks that are entirely ASCII, which is
+ * nearly every block of an INF. Other blocks go through the scalar step.
+ */
+
+INF_TARGET("sse2")
+static bool IsUtf8Sse2(const uint8_t* p, size_t Size) {
+	size_t i = 0;
+	while (i < Size) {
+		if (Size - i >= 16 && !_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(p + i)))) {
+			i += 16;
+			continue;
+		}
+		size_t Length = Utf8SequenceLength(p + i, Size - i);
+		if (!Length)
+			return false;
+		i += Length;
+	}
+	return true;
+}
+
+INF_TARGET("avx2")
+static bool IsUtf8Avx2(const uint8_t* p, size_t Size) {
+	size_t i = 0;
+	while (i < Size) {
+		if (Size - i >= 32 && !_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)(p + i)))) {
+			i += 32;
+			continue;
+		}
+		size_t Length = Utf8SequenceLength(p + i, Size - i);
+		if (!Length)
+			return false;
+		i += Length;
+	}
+	return true;
+}
+
+INF_TARGET("sse2")
+static size_t Utf16LeToUtf8Sse2(const uint8_t* p, size_t nUnits, char* pOut) {
+	const __m128i vNonAscii = _mm_set1_epi16((short)0xFF80);
+	size_t i = 0;
+	size_t o = 0;
+	while (i < nUnits) {
+		if (nUnits - i >= 8) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(p + 2 * i));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, vNonAscii), _mm_setzero_si128())) == 0xFFFF) {
+				_mm_storel_epi64((__m128i*)(pOut + o), _mm_packus_epi16(v, v));
+				i += 8;
+				o += 8;
+				continue;
+			}
+		}
+		o += PutUtf8(pOut + o, ReadUtf16Le(p, nUnits, &i));
+	}
+	return o;
+}
+
+INF_TARGET("avx2")
+static size_t Utf16LeToUtf8Avx2(const uint8_t* p, size_t nUnits, char* pOut) {
+	const __m256i vNonAscii = _mm256_set1_epi16((short)0xFF80);
+	size_t i = 0;
+	size_t o = 0;
+	while (i < nUnits) {
+		if (nUnits - i >= 16) {
+			__m256i v = _mm256_loadu_si256((const __m256i*)(p + 2 * i));
+			if (_mm256_testz_si256(v, vNonAscii)) {
+				__m128i vPacked = _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+				_mm_storeu_si128((__m128i*)(pOut + o), vPacked);
+				i += 16;
+				o += 16;
+				continue;
+			}
+		}
+		o += PutUtf8(pOut + o, ReadUtf16Le(p, nUnits, &i));
+	}
+	return o;
+}
+
+INF_TARGET("sse2")
+static size_t AnsiToUtf8Sse2(const uint8_t* p, size_t Size, char* pOut) {
+	size_t i = 0;
+	size_t o = 0;
+	while (i < Size) {
+		if (Size - i >= 16) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+			if (!_mm_movemask_epi8(v)) {
+				_mm_storeu_si128((__m128i*)(pOut + o), v);
+				i += 16;
+				o += 16;
+				continue;
+			}
+		}
+		o += PutWindows1252(pOut + o, p[i++]);
+	}
+	return o;
+}
+
+INF_TARGET("avx2")
+static size_t AnsiToUtf8Avx2(const uint8_t* p, size_t Size, char* pOut) {
+	size_t i = 0;
+	size_t o = 0;
+	while (i < Size) {
+		if (Size - i >= 32) {
+			__m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+			if (!_mm256_movemask_epi8(v)) {
+				_mm256_storeu_si256((__m256i*)(pOut + o), v);
+				i += 32;
+				o += 32;
+				continue;
+			}
+		}
+		o += PutWindows1252(pOut + o, p[i++]);
+	}
+	return o;
+}
+
+#endif
+
+inf_encoding InfDetectEncoding(const char* pData, size_t Size, size_t* pBomSize) {
+	const uint8_t* p = (const uint8_t*)pData;
+	*pBomSize = 0;
+
+	if (Size >= 3 && p[0] == 0xEF && p[1] == 0xBB && p[2] == 0xBF) {
+		*pBomSize = 3;
+		return INF_ENCODING_UTF8;
+	}
+	if (Size >= 2 && p[0] == 0xFF && p[1] == 0xFE) {
+		*pBomSize = 2;
+		return INF_ENCODING_UTF16LE;
+	}
+	if (Size >= 2 && p[0] == 0xFE && p[1] == 0xFF) {
+		*pBomSize = 2;
+		return INF_ENCODING_UTF16BE;
+	}
+
+	// No BOM. UTF-16 INF files start with ASCII text,
+	// so look for zero high bytes in the first few units.
+	size_t nCheck = Size < 64 ? Size & ~(size_t)1 : 64;
+	if (nCheck >= 2) {
+		bool bUtf16 = true;
+		for (size_t i = 0; i < nCheck && bUtf16; i += 2)
+			bUtf16 = p[i] != 0 && p[i + 1] == 0;
+		if (bUtf16)
+			return INF_ENCODING_UTF16LE;
+	}
+
+	return InfIsUtf8(pData, Size) ? INF_ENCODING_UTF8 : INF_ENCODING_ANSI;
+}
+
+bool InfIsUtf8(const char* pData, size_t Size) {
+	const uint8_t* p = (const uint8_t*)pData;
+	switch (InfGetSimdLevel()) {
+#ifdef INF_X86
+	case INF_SIMD_AVX2:
+		return IsUtf8Avx2(p, Size);
+	case INF_SIMD_SSE2:
+		return IsUtf8Sse2(p, Size);
+#endif
+	default:
+		return IsUtf8Scalar(p, Size);
+	}
+}
+
+size_t InfUtf16LeToUtf8(const char* pData, size_t Size, char* pOut) {
+	const uint8_t* p = (const uint8_t*)pData;
+	size_t nUnits = Size / 2; // A trailing odd byte is dropped
+	switch (InfGetSimdLevel()) {
+#ifdef INF_X86
+	case INF_SIMD_AVX2:
+		return Utf16LeToUtf8Avx2(p, nUnits, pOut);
+	case INF_SIMD_SSE2:
+		return Utf16LeToUtf8Sse2(p, nUnits, pOut);
+#endif
+	default:
+		return Utf16LeToUtf8Scalar(p, nUnits, pOut);
+	}
+}
+
+size_t InfAnsiToUtf8(const char* pData, size_t Size, char* pOut) {
+	const uint8_t* p = (const uint8_t*)pData;
+	switch (InfGetSimdLevel()) {
+#ifdef INF_X86
+	case INF_SIMD_AVX2:
+		return AnsiToUtf8Avx2(p, Size, pOut);
+	case INF_SIMD_SSE2:
+		return AnsiToUtf8Sse2(p, Size, pOut);
+#endif
+	default:
+		return AnsiToUtf8Scalar(p, Size, pOut);
+	}
+}
+
+#ifdef BENCH
+
+/*
+ * Microbenchmark, build with InfReader.c and Tree234.c:
+ *   cc -O2 -DBENCH -pthread -IInclude Source/InfText.c Source/InfReader.c Source/Tree234.c Source/Platform.c
+ *
+ * It writes a layout-style INF with a large [SourceDisksFiles] section
+ * and reports the throughput of each SIMD level, for the structural
+ * index alone, for the whole parse and for transcoding the same text
+ * from UTF-16LE and ANSI.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "GuardedMalloc.h"
+#include "InfReader.h"
+
+static double Now(void) {
+	struct timespec Time;
+	timespec_get(&Time, TIME_UTC);
+	return (double)Time.tv_sec + (double)Time.tv_nsec * 1e-9;
+}
+
+static const char* s_asLevelNames[] = { "scalar", "sse2", "avx2" };
+
+int main(int argc, char** argv) {
+	size_t nLines = argc > 1 ? strtoul(argv[1], NULL, 10) : 50000;
+	const char* sPath = "bench_layout.inf";
+
+	FILE* pFile = fopen(sPath, "wb");
+	if (!pFile) {
+		perror(sPath);
+		return 1;
+	}
+	fprintf(pFile, "[Version]\nSignature=\"$Windows NT$\"\nLayoutFile=layout.inf\n\n");
+	fprintf(pFile, "[SourceDisksNames]\n1 = %%DiskName%%,,,\"\"\n2 = %%DiskName%%,,,\\x64 ; comment\n\n");
+	fprintf(pFile, "[SourceDisksFiles]\n");
+	for (size_t i = 0; i < nLines; ++i)
+		fprintf(pFile, "file%06zu.sys = %zu,drivers\\sub%zu,%zu ; size\n", i, i % 2 + 1, i % 16, i * 37);
+	fclose(pFile);
+
+	pFile = fopen(sPath, "rb");
+	fseek(pFile, 0, SEEK_END);
+	size_t Size = (size_t)ftell(pFile);
+	fseek(pFile, 0, SEEK_SET);
+	char* pData = malloc_guarded(Size);
+	fread(pData, 1, Size, pFile);
+	fclose(pFile);
+
+	uint64_t* aBitmap = malloc_guarded(InfStructuralWords(Size) * sizeof(*aBitmap));
+
+	char* pUtf16 = malloc_guarded(Size * 2);
+	for (size_t i = 0; i < Size; ++i) {
+		pUtf16[2 * i] = pData[i];
+		pUtf16[2 * i + 1] = 0;
+	}
+	char* pUtf8 = malloc_guarded(InfMaxUtf8Size(Size * 2));
+	printf("%zu lines, %zu bytes\n", nLines, Size);
+
+	inf_simd_level MaxLevel = InfGetSimdLevel();
+	for (int Level = INF_SIMD_NONE; Level <= (int)MaxLevel; ++Level) {
+		InfSetSimdLevel(Level);
+
+		size_t nRuns = 200;
+		double Start = Now();
+		for (size_t i = 0; i < nRuns; ++i)
+			InfBuildStructuralIndex(pData, Size, aBitmap);
+		double IndexTime = (Now() - Start) / nRuns;
+
+		nRuns = 20;
+		Start = Now();
+		for (size_t i = 0; i < nRuns; ++i) {
+			uint32_t Error;
+			inf_file* pInf = InfOpenFile(sPath, &Error);
+			if (!pInf) {
+				fprintf(stderr, "Cannot open %s: %u\n", sPath, Error);
+				return 1;
+			}
+			InfCloseFile(pInf);
+		}
+		double ParseTime = (Now() - Start) / nRuns;
+
+		nRuns = 100;
+		Start = Now();
+		for (size_t i = 0; i < nRuns; ++i)
+			InfUtf16LeToUtf8(pUtf16, Size * 2, pUtf8);
+		double Utf16Time = (Now() - Start) / nRuns;
+
+		Start = Now();
+		for (size_t i = 0; i < nRuns; ++i)
+			InfAnsiToUtf8(pData, Size, pUtf8);
+		double AnsiTime = (Now() - Start) / nRuns;
+
+		printf(
+			"%-6s  index: %8.1f MB/s  parse: %8.1f MB/s  utf16: %8.1f MB/s  ansi: %8.1f MB/s\n",
+			s_asLevelNames[Level],
+			Size / IndexTime / 1e6,
+			Size / ParseTime / 1e6,
+			Size * 2 / Utf16Time / 1e6,
+			Size / AnsiTime / 1e6
+		);
+	}
+
+	free(pUtf8);
+	free(pUtf16);
+	free(aBitmap);
+	free(pData);
+	remove(sPath);
+	return 0;
+}
+
+#endif
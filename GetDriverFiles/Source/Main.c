@@ -1,428 +1,171 @@
 #include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
 
-#include <Windows.h>
-#include <setupapi.h>
+#include "Platform.h"
 
+#include "Batch.h"
+#include "DriverFiles.h"
 #include "GuardedMalloc.h"
-#include "Tree234.h"
-
-#define static_arrlen(X) (sizeof(X) / sizeof(*X))
-#define cast(T, X) ((T)(X))
-
-static char* GetSystemErrorMessage(uint32_t Win32Error) {
-	char* sErrorMessage = NULL;
-	FormatMessageA(
-		FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_IGNORE_INSERTS,
-		NULL,
-		HRESULT_FROM_WIN32(Win32Error),
-		MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
-		(char*)&sErrorMessage,
-		0,
-		NULL
-	);
-
-	if (!sErrorMessage) {
-		size_t Length = sizeof("An unknown error has occured.");
-		sErrorMessage = LocalAlloc(LMEM_FIXED, Length);
-		if (!sErrorMessage)
-			abort();
-		memcpy(sErrorMessage, "An unknown error has occured.", Length);
-	}
-	return sErrorMessage;
+#include "InfList.h"
+
+// Options start with '/', which also starts absolute paths on POSIX.
+// There, an argument with another '/' is taken as a path.
+static bool IsOption(const char* sArg) {
+	if (sArg[0] != '/')
+		return false;
+#ifdef _WIN32
+	return true;
+#else
+	return !strchr(sArg + 1, '/');
+#endif
 }
 
-// MaxSize may includes '\0'
-static size_t RemoveLeadingBslash(char* Str, size_t MaxSize) {
-	size_t i;
-	for (i = 0; i < MaxSize && Str[i] == '\\'; ++i);
-	size_t Offset = i;
-	for (i; i < MaxSize; ++i)
-		Str[i - Offset] = Str[i];
-	return Offset;
+static void WriteText(FILE* pStream, const text_buffer* pText) {
+	if (pText->Length > 0)
+		fwrite(pText->p, 1, pText->Length, pStream);
 }
 
-typedef struct {
-	int32_t Id;
-	char* Path;
-} disk_properties;
-
-static int DiskIdCompare(disk_properties* A, disk_properties* B) {
-	return (A->Id > B->Id) - (A->Id < B->Id);
-}
-
-static void GetCatalogFile(HINF hInf) {
-	// Get catalog file
-	// https://learn.microsoft.com/en-us/windows-hardware/drivers/install/inf-version-section
-
-	char* asCatalogFileVariants[] = {
-		"CatalogFile",
-		"CatalogFile.NT",
-		"CatalogFile.NTX86",
-		"CatalogFile.NTIA64",
-		"CatalogFile.NTAMD64",
-		"CatalogFile.NTARM",
-		"CatalogFile.NTARM64",
-	};
-	for (size_t i = 0; i < static_arrlen(asCatalogFileVariants); ++i) {
-
-		// Assuming there are no repeated entry.
-		INFCONTEXT InfContext;
-		if (
-			SetupFindFirstLineA(
-				hInf,
-				"Version",
-				asCatalogFileVariants[i],
-				&InfContext
-			)
-		) {
-
-			uint32_t FileNameLength = 0; // '\0' included
-			if (
-				!SetupGetStringFieldA(
-					&InfContext,
-					1,
-					NULL,
-					0,
-					&FileNameLength
-				)
-			)
-				// Bug: This never happens as it'll get FieldIndex 0 instead,
-				// but that's how SetupApi works with wierd files so lets not change that.
-				continue;
-
-			char* psFileName = malloc_guarded(FileNameLength * sizeof(char));
-			SetupGetStringFieldA(&InfContext, 1, psFileName, FileNameLength, NULL);
-
-			// From the docs: "Windows assumes that the catalog file is in the same location as the INF file."
-			puts(psFileName);
-			free(psFileName);
-
-		}
-
-	};
+// Writes each line of pText to pStream, after sPrefix.
+static void WritePrefixedLines(FILE* pStream, const char* sPrefix, const text_buffer* pText) {
+	const char* p = pText->p;
+	const char* pEnd = p + pText->Length;
+	while (p < pEnd) {
+		const char* pLineEnd = memchr(p, '\n', pEnd - p);
+		pLineEnd = pLineEnd ? pLineEnd + 1 : pEnd;
+		fputs(sPrefix, pStream);
+		fwrite(p, 1, pLineEnd - p, pStream);
+		p = pLineEnd;
+	}
+	if (pText->Length > 0 && pEnd[-1] != '\n')
+		fputc('\n', pStream);
 }
 
-static void GetSourceFiles(HINF hInf) {
-
-	// Get disk paths
-	// https://learn.microsoft.com/en-us/windows-hardware/drivers/install/inf-sourcedisksnames-section
-
-	char* asSourceDisksNamesVariants[] = {
-		"SourceDisksNames",
-		"SourceDisksNames.X86",
-		"SourceDisksNames.IA64",
-		"SourceDisksNames.AMD64",
-		"SourceDisksNames.ARM",
-		"SourceDisksNames.ARM64",
-	};
-	tree234* pDisksPropTree = newtree234(DiskIdCompare);
-	for (size_t i = 0; i < static_arrlen(asSourceDisksNamesVariants); ++i) {
-
-		// Assuming there are no repeated entry.
-		INFCONTEXT InfContext;
-		if (
-			SetupFindFirstLineA(
-				hInf,
-				asSourceDisksNamesVariants[i],
-				NULL,
-				&InfContext
-			)
-		) {
-
-			int32_t RemainingLines = SetupGetLineCountA(hInf, asSourceDisksNamesVariants[i]);
-			if (RemainingLines == -1)
-				continue;
-
-			while (RemainingLines > 0) {
-
-				disk_properties* pDiskProperties = malloc_guarded(sizeof(*pDiskProperties));
-				if (!SetupGetIntField(&InfContext, 0, &pDiskProperties->Id)) {
-					fprintf(
-						stderr,
-						"WARNING: Section %u, line %u: "
-						"Cannot find diskid. Skipping line.\n",
-						InfContext.Section,
-						InfContext.Line
-					);
-					goto NextLine0;
-				}
-
-				// Skip repeated entries
-				if (find234(pDisksPropTree, pDiskProperties, NULL)) {
-					fprintf(
-						stderr,
-						"WARNING: Section %u, line %u: "
-						"Repeated diskid %"PRIu32". Skipping line.\n",
-						InfContext.Section,
-						InfContext.Line,
-						pDiskProperties->Id
-					);
-					goto NextLine0;
-				}
-				uint32_t PathLength = 0; // Incldues '\0'
-				if (
-					SetupGetStringFieldA(
-						&InfContext,
-						4,
-						NULL,
-						0,
-						&PathLength
-					)
-				) {
-					if (PathLength > 1) {
-						pDiskProperties->Path = malloc_guarded(PathLength * sizeof(*pDiskProperties->Path));
-						SetupGetStringFieldA(
-							&InfContext,
-							4,
-							pDiskProperties->Path,
-							PathLength,
-							NULL
-						); // Any trailing backslashes are not included.
-						RemoveLeadingBslash(pDiskProperties->Path, PathLength);
-					} else {
-						// Don't malloc empty string.
-						pDiskProperties->Path = NULL;
-					}
-				} else {
-					pDiskProperties->Path = NULL;
-				}
-				add234(pDisksPropTree, pDiskProperties);
-
-				NextLine0:
-				SetupFindNextLine(&InfContext, &InfContext);
-				--RemainingLines;
-
-			};
-
-		}
-
-	};
-
-	// Get source files
-	// https://learn.microsoft.com/en-us/windows-hardware/drivers/install/inf-sourcedisksfiles-section
-
-	char* asSourceDisksFilesVariants[] = {
-		"SourceDisksFiles",
-		"SourceDisksFiles.X86",
-		"SourceDisksFiles.IA64",
-		"SourceDisksFiles.AMD64",
-		"SourceDisksFiles.ARM",
-		"SourceDisksFiles.ARM64",
-	};
-	for (size_t i = 0; i < static_arrlen(asSourceDisksFilesVariants); ++i) {
-
-		// Assuming there are no repeated entry.
-		INFCONTEXT InfContext;
-		if (
-			SetupFindFirstLineA(
-				hInf,
-				asSourceDisksFilesVariants[i],
-				NULL,
-				&InfContext
-			)
-		) {
-
-			int32_t RemainingLines = SetupGetLineCountA(hInf, asSourceDisksFilesVariants[i]);
-			if (RemainingLines == -1)
-				continue;
-
-			while (RemainingLines > 0) {
-
-				// Get file name length
-
-				uint32_t FileNameLength = 0;
-				if (
-					!SetupGetStringFieldA(
-						&InfContext,
-						0,
-						NULL,
-						0,
-						&FileNameLength
-					)
-				)
-					// Never happens as it'll output empty string instead.
-					goto NextLine1;
-				FileNameLength -= 1;
-
-				// Get corresponding disk path
-
-				uint32_t DiskId = 0;
-				if (!SetupGetIntField(&InfContext, 1, &DiskId)) {
-					fprintf(
-						stderr,
-						"WARNING: Section %u, line %u: "
-						"Cannot find diskid. Skipping line.\n",
-						InfContext.Section,
-						InfContext.Line
-					);
-					goto NextLine1;
-				}
-
-				disk_properties* pDiskProperties = find234(
-					pDisksPropTree,
-					&(disk_properties){ DiskId, NULL },
-					NULL
-				);
-
-				BOOL bHaveDiskPath = FALSE;
-				size_t DiskPathLength = 0;
-				if (pDiskProperties) {
-					bHaveDiskPath = !!pDiskProperties->Path;
-					if (pDiskProperties->Path)
-						DiskPathLength = strlen(pDiskProperties->Path);
-				} else {
-					fprintf(
-						stderr,
-						"WARNING: Section %u, line %u: "
-						"Unknown diskid %"PRIu32". Skipping line.\n",
-						InfContext.Section,
-						InfContext.Line,
-						DiskId
-					);
-					goto NextLine1;
-				}
-
-				// Get sub dir length
-
-				uint32_t SubdirLength = 0;
-				BOOL bHaveSubdir = SetupGetStringFieldA(
-					&InfContext,
-					2,
-					NULL,
-					0,
-					&SubdirLength
-				);
-				SubdirLength -= 1;
-				bHaveSubdir &= SubdirLength > 0; // Handle empty sub dir "0,,"
-
-				// Combine all parts
-
-				size_t FullPathLength = 0;
-				if (bHaveDiskPath)
-					FullPathLength += DiskPathLength + 1; // Add '\\'
-				if (bHaveSubdir)
-					FullPathLength += SubdirLength + 1; // Add '\\'
-				FullPathLength += FileNameLength + 1; // Add '\0'
-				// Note: Always leave a character for SetupGetStringFieldA to put '\0'
-
-				char* sFullPathName = malloc_guarded(FullPathLength * sizeof(*sFullPathName));
-				char* pFullPathName2 = sFullPathName;
-
-				if (bHaveDiskPath) {
-					memcpy(pFullPathName2, pDiskProperties->Path, DiskPathLength);
-					pFullPathName2 += DiskPathLength;
-					*pFullPathName2++ = '\\';
-				}
-
-				if (bHaveSubdir) {
-					SetupGetStringFieldA(
-						&InfContext,
-						2,
-						pFullPathName2,
-						SubdirLength + 1,
-						NULL
-					);
-					size_t nLeadingBSlash = RemoveLeadingBslash(pFullPathName2, SubdirLength + 1);
-					pFullPathName2 += SubdirLength - nLeadingBSlash;
-					*pFullPathName2++ = '\\';
-				}
-
-				// Append file name.
-
-				SetupGetStringFieldA(
-					&InfContext,
-					0,
-					pFullPathName2,
-					FileNameLength + 1,
-					NULL
-				);
-				pFullPathName2 += FileNameLength;
-
-				// Print
-
-				puts(sFullPathName);
-				free(sFullPathName);
-
-				NextLine1:
-				SetupFindNextLine(&InfContext, &InfContext);
-				--RemainingLines;
-
-			};
-
-		}
-
-	};
-
-	for (
-		disk_properties* p = delpos234(pDisksPropTree, 0);
-		p != NULL;
-		p = delpos234(pDisksPropTree, 0)
-	) {
-		if (p->Path) free(p->Path);
-		free(p);
+typedef struct {
+	uint8_t bBatch;
+	size_t nFailed;
+	uint32_t FirstError;
+} batch_output;
+
+static void EmitResult(void* pContext, const char* sPath, uint32_t Error, const driver_files_result* pResult) {
+	batch_output* pOutput = pContext;
+	if (Error != ERROR_SUCCESS) {
+		char* sErrorMessage = GetSystemErrorMessage(Error);
+		if (!pOutput->bBatch)
+			printf(
+				"ERROR: Unable to open the file '%s':\n"
+				"%s",
+				sPath,
+				sErrorMessage
+			);
+		else
+			fprintf(stderr, "%s: ERROR %u: %s", sPath, Error, sErrorMessage);
+		FreeSystemErrorMessage(sErrorMessage);
+		if (pOutput->nFailed++ == 0)
+			pOutput->FirstError = Error;
+	} else if (!pOutput->bBatch) {
+		WriteText(stderr, &pResult->Warnings);
+		WriteText(stdout, &pResult->Output);
+	} else {
+		size_t PrefixLength = strlen(sPath);
+		char* sPrefix = malloc_guarded(PrefixLength + 3);
+		memcpy(sPrefix, sPath, PrefixLength);
+		memcpy(sPrefix + PrefixLength, ": ", 3);
+		WritePrefixedLines(stderr, sPrefix, &pResult->Warnings);
+		sPrefix[PrefixLength] = '\t';
+		sPrefix[PrefixLength + 1] = '\0';
+		WritePrefixedLines(stdout, sPrefix, &pResult->Output);
+		free(sPrefix);
 	}
-	freetree234(pDisksPropTree);
 }
 
-int main(int argc, char** argv) {
+// Arguments are UTF-8.
+static int Main(int argc, char** argv) {
 
 	if (argc < 2) {
 		fprintf(
 			stderr,
 			"ERROR: No INF file specified.\n"
 			"\n"
-			"USAGE: %s <InfFile> [/source | /cat]\n"
+			"USAGE: %s <InfFile | Dir | @ListFile | ->... [/source | /cat] [/reachable] [/infdir <Dir>] [/locale <LCID>] [/jobs <N>] [/cache <File>] [/stats]\n"
+			"\n"
+			"  Dir         Process every *.inf file below Dir.\n"
+			"  @ListFile   Process the INF files listed in ListFile, one per line.\n"
+			"  -           Same, reading the list from stdin.\n"
+			"  /cat        Get catalog file only.\n"
+			"  /source     Get source files only.\n"
+			"  /reachable  Only get the source files the install sections copy.\n"
+			"  /infdir     Where to find the INFs named by Include= and LayoutFile=,\n"
+			"              %%windir%%\\INF by default.\n"
+			"  /locale     Use [Strings.<LCID>] before [Strings], e.g. /locale 0409.\n"
+			"  /jobs       Process N INF files at a time, 0 for one per processor.\n"
+			"              The output is the same, in the same order.\n"
+			"  /cache      Keep the results in File, and reuse them for the INF files\n"
+			"              that didn't change since.\n"
+			"  /stats      Print statistics at the end.\n"
 			"\n"
-			"  /cat      Get catalog file only.\n"
-			"  /source   Get source files only.\n",
+			"With several INF files, output lines are prefixed by the INF path and\n"
+			"a tab. Errors are reported on stderr and don't stop the batch.\n",
 			argv[0]
 		);
 		return ERROR_INVALID_PARAMETER;
 	}
 
-	// Normalize path
-
-	size_t FullInfPathLength = GetFullPathNameA(argv[1], 0, NULL, NULL); // Contains '\0'
-	if (FullInfPathLength == 0) {
-		char* sErrorMessage = GetSystemErrorMessage(GetLastError());
-		printf("ERROR: %s:\n", sErrorMessage);
-		LocalFree(sErrorMessage);
-		return GetLastError();
-	}
-
-	char* FullInfPath = malloc(FullInfPathLength * sizeof(*FullInfPath));
-	GetFullPathNameA(argv[1], (uint32_t)FullInfPathLength, FullInfPath, NULL);
-
-	unsigned int ErrorLine; // Currently unused
-	HINF hInf = SetupOpenInfFileA(
-		FullInfPath,
-		NULL,
-		INF_STYLE_WIN4,
-		&ErrorLine
-	);
-	if (hInf == INVALID_HANDLE_VALUE) {
-		char* sErrorMessage = GetSystemErrorMessage(GetLastError());
-		printf(
-			"ERROR: Unable to open the file '%s':\n"
-			"%s",
-			FullInfPath,
-			sErrorMessage
-		);
-		LocalFree(sErrorMessage);
-		return GetLastError();
-	}
-
-	uint8_t bGetCatalog = 1;
-	uint8_t bGetSource = 1;
-	if (argc == 3) {
-		if (_stricmp("/cat", argv[2]) == 0)
-			bGetSource = 0;
-		else if (_stricmp("/source", argv[2]) == 0)
-			bGetCatalog = 0;
-		else
-			fprintf(stderr, "WARNING: Ignoring unknown option %s.\n", argv[2]);
+	driver_files_options Options = { 1, 1, 0, NULL, NULL, 0, NULL };
+	merge_stats MergeStats = { 0, 0, 0, 0 };
+	char sLocale[16];
+	const char* sInfDir = NULL;
+	const char* sCachePath = NULL;
+	uint8_t bStats = 0;
+	inf_list Infs = { NULL, 0, 0 };
+	text_buffer ListWarnings = { NULL, 0, 0 };
+	batch_output Output = { 0, 0, ERROR_SUCCESS };
+	uint32_t nJobs = 1;
+	for (int i = 1; i < argc; ++i) {
+		// The first argument is always an INF, as it used to be.
+		if (i == 1 || !IsOption(argv[i])) {
+			if (i > 1 || strcmp(argv[i], "-") == 0 || argv[i][0] == '@' || IsDirectory(argv[i]))
+				Output.bBatch = 1;
+			InfListAdd(&Infs, argv[i], &ListWarnings);
+		} else if (_stricmp("/cat", argv[i]) == 0) {
+			Options.bGetSource = 0;
+		} else if (_stricmp("/source", argv[i]) == 0) {
+			Options.bGetCatalog = 0;
+		} else if (_stricmp("/reachable", argv[i]) == 0) {
+			Options.bReachableOnly = 1;
+		} else if (_stricmp("/infdir", argv[i]) == 0 && i + 1 < argc) {
+			sInfDir = argv[++i];
+		} else if (_stricmp("/jobs", argv[i]) == 0 && i + 1 < argc) {
+			char* pEnd;
+			unsigned long Jobs = strtoul(argv[++i], &pEnd, 10);
+			if (*pEnd || Jobs > 1024) {
+				fprintf(stderr, "WARNING: Ignoring invalid job count %s.\n", argv[i]);
+				continue;
+			}
+			nJobs = (uint32_t)Jobs;
+		} else if (_stricmp("/cache", argv[i]) == 0 && i + 1 < argc) {
+			sCachePath = argv[++i];
+		} else if (_stricmp("/stats", argv[i]) == 0) {
+			bStats = 1;
+			Options.pMergeStats = &MergeStats;
+		} else if (_stricmp("/locale", argv[i]) == 0 && i + 1 < argc) {
+			// Section names use 4 hex digits.
+			char* pEnd;
+			unsigned long Lcid = strtoul(argv[++i], &pEnd, 16);
+			if (*pEnd || Lcid > 0xFFFF) {
+				fprintf(stderr, "WARNING: Ignoring invalid locale %s.\n", argv[i]);
+				continue;
+			}
+			snprintf(sLocale, sizeof(sLocale), "%04lx", Lcid);
+			Options.sLocale = sLocale;
+		} else {
+			fprintf(stderr, "WARNING: Ignoring unknown option %s.\n", argv[i]);
+		}
 	}
+	WriteText(stderr, &ListWarnings);
+	TextFree(&ListWarnings);
+	if (Infs.nPaths == 0)
+		fprintf(stderr, "WARNING: No INF file found.\n");
 
 	// A driver package contains:
 	//  + INF files (the user already knows it)
@@ -430,14 +173,115 @@ int main(int argc, char** argv) {
 	//  + Driver files (.sys) and other files
 	//    I think these 2 are all included in [SourceDisksFiles],
 	//    They're called "source files".
-	// 
+	//
 	// https://learn.microsoft.com/en-us/windows-hardware/drivers/install/components-of-a-driver-package
+	//
+	// CopyINF pulls in more INF files, whose files are part of the package
+	// too.
+	// https://learn.microsoft.com/en-us/windows-hardware/drivers/install/inf-copyinf-directive
+	//
+	// Include= and LayoutFile= name system INFs. Without a system INF
+	// directory, look next to the (first) INF, as in a copy of %windir%\INF.
+
+	char* sSystemInfDir = sInfDir ? NULL : GetSystemInfDirectory();
+	if (!sInfDir && !sSystemInfDir && Infs.nPaths > 0) {
+		uint32_t Error;
+		sSystemInfDir = GetFullPath(Infs.asPaths[0], &Error);
+		if (sSystemInfDir) {
+			char* pSeparator = strrchr(sSystemInfDir, PATH_SEPARATOR);
+			*(pSeparator ? pSeparator + 1 : sSystemInfDir) = '\0';
+		}
+	}
+	if (sSystemInfDir)
+		sInfDir = sSystemInfDir;
+	// One cache for the whole batch, system INFs are parsed once.
+	if (Options.bReachableOnly && sInfDir)
+		Options.pIncludeCache = InfNewIncludeCache(sInfDir, Options.sLocale);
+
+	// A single INF keeps its original output, with its full path in errors.
+	if (!Output.bBatch && Infs.nPaths == 1) {
+		uint32_t Error = ERROR_SUCCESS;
+		char* FullInfPath = GetFullPath(Infs.asPaths[0], &Error);
+		if (!FullInfPath) {
+			// realpath fails on a missing file where GetFullPathName
+			// doesn't, report it as the open would.
+			EmitResult(&Output, Infs.asPaths[0], Error, NULL);
+		} else {
+			free(Infs.asPaths[0]);
+			Infs.asPaths[0] = FullInfPath;
+		}
+	}
+
+	result_cache* pResultCache = sCachePath ? OpenResultCache(sCachePath, &Options, sInfDir) : NULL;
+	if (Output.FirstError == ERROR_SUCCESS)
+		RunBatch(Infs.asPaths, Infs.nPaths, &Options, pResultCache, nJobs, EmitResult, &Output);
+
+	if (bStats && Output.bBatch)
+		fprintf(stderr, "Processed %zu INF files, %zu failed.\n", Infs.nPaths, Output.nFailed);
+	if (bStats && Options.pIncludeCache) {
+		uint64_t Hits;
+		uint64_t Misses;
+		InfGetIncludeStats(Options.pIncludeCache, &Hits, &Misses);
+		fprintf(stderr, "Include cache: %"PRIu64" hits, %"PRIu64" misses.\n", Hits, Misses);
+	}
+	if (bStats && MergeStats.nResults) {
+		fprintf(
+			stderr,
+			"CopyINF merges: %zu results, %zu lines, %zu kept, %zu KB each on average.\n",
+			MergeStats.nResults,
+			MergeStats.nLines,
+			MergeStats.nDistinct,
+			(MergeStats.Bytes / MergeStats.nResults + 1023) / 1024
+		);
+	}
+	if (bStats && pResultCache) {
+		uint64_t Hits;
+		uint64_t Misses;
+		GetResultCacheStats(pResultCache, &Hits, &Misses);
+		fprintf(stderr, "Result cache: %"PRIu64" hits, %"PRIu64" misses.\n", Hits, Misses);
+	}
 
-	if (bGetCatalog)
-		GetCatalogFile(hInf);
-	if (bGetSource)
-		GetSourceFiles(hInf);
+	if (pResultCache) {
+		uint32_t Error;
+		if (!SaveResultCache(pResultCache, &Error)) {
+			char* sErrorMessage = GetSystemErrorMessage(Error);
+			fprintf(stderr, "WARNING: Unable to save the cache '%s': %s", sCachePath, sErrorMessage);
+			FreeSystemErrorMessage(sErrorMessage);
+		}
+		FreeResultCache(pResultCache);
+	}
+
+	if (Options.pIncludeCache)
+		InfFreeIncludeCache(Options.pIncludeCache);
+	free(sSystemInfDir);
+	InfListFree(&Infs);
+	return Output.FirstError;
+}
+
+#ifdef _WIN32
+
+// The ANSI arguments mangle non-ASCII paths, take the wide ones and use UTF-8.
+int wmain(int argc, wchar_t** wargv) {
+	char** argv = malloc_guarded((argc + 1) * sizeof(*argv));
+	for (int i = 0; i < argc; ++i)
+		argv[i] = Utf16ToUtf8(wargv[i]);
+	argv[argc] = NULL;
 
-	SetupCloseInfFile(hInf);
-	return ERROR_SUCCESS;
+	uint32_t OldOutputCP = GetConsoleOutputCP();
+	SetConsoleOutputCP(CP_UTF8);
+	int Result = Main(argc, argv);
+	SetConsoleOutputCP(OldOutputCP);
+
+	for (int i = 0; i < argc; ++i)
+		free(argv[i]);
+	free(argv);
+	return Result;
+}
+
+#else
+
+int main(int argc, char** argv) {
+	return Main(argc, argv);
 }
+
+#endif
@@ -0,0 +1,464 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "Platform.h"
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "GuardedMalloc.h"
+
+#ifdef _WIN32
+
+char* GetSystemErrorMessage(uint32_t Win32Error) {
+	char* sErrorMessage = NULL;
+	FormatMessageA(
+		FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_IGNORE_INSERTS,
+		NULL,
+		HRESULT_FROM_WIN32(Win32Error),
+		MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
+		(char*)&sErrorMessage,
+		0,
+		NULL
+	);
+
+	if (!sErrorMessage) {
+		size_t Length = sizeof("An unknown error has occured.");
+		sErrorMessage = LocalAlloc(LMEM_FIXED, Length);
+		if (!sErrorMessage)
+			abort();
+		memcpy(sErrorMessage, "An unknown error has occured.", Length);
+	}
+	return sErrorMessage;
+}
+
+void FreeSystemErrorMessage(char* sErrorMessage) {
+	LocalFree(sErrorMessage);
+}
+
+char* GetFullPath(const char* sPath, uint32_t* pError) {
+	wchar_t* wsPath = Utf8ToUtf16(sPath);
+	size_t FullPathLength = GetFullPathNameW(wsPath, 0, NULL, NULL); // Contains '\0'
+	char* sFullPath = NULL;
+	*pError = GetLastError();
+	if (FullPathLength != 0) {
+		wchar_t* wsFullPath = malloc_guarded(FullPathLength * sizeof(*wsFullPath));
+		GetFullPathNameW(wsPath, (uint32_t)FullPathLength, wsFullPath, NULL);
+		sFullPath = Utf16ToUtf8(wsFullPath);
+		free(wsFullPath);
+	}
+	free(wsPath);
+	return sFullPath;
+}
+
+int ComparePath(const char* sPathA, const char* sPathB) {
+	return _stricmp(sPathA, sPathB);
+}
+
+bool IsDirectory(const char* sPath) {
+	wchar_t* wsPath = Utf8ToUtf16(sPath);
+	uint32_t Attributes = GetFileAttributesW(wsPath);
+	free(wsPath);
+	return Attributes != INVALID_FILE_ATTRIBUTES && (Attributes & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+static char* JoinPath(const char* sDir, const char* sName) {
+	size_t DirLength = strlen(sDir);
+	size_t NameLength = strlen(sName);
+	char* sPath = malloc_guarded(DirLength + NameLength + 2);
+	memcpy(sPath, sDir, DirLength);
+	if (DirLength > 0 && sDir[DirLength - 1] != PATH_SEPARATOR && sDir[DirLength - 1] != '/')
+		sPath[DirLength++] = PATH_SEPARATOR;
+	memcpy(sPath + DirLength, sName, NameLength + 1);
+	return sPath;
+}
+
+bool ListDirectory(const char* sDir, directory_proc pfnProc, void* pContext, uint32_t* pError) {
+	char* sPattern = JoinPath(sDir, "*");
+	wchar_t* wsPattern = Utf8ToUtf16(sPattern);
+	free(sPattern);
+	WIN32_FIND_DATAW FindData;
+	HANDLE hFind = FindFirstFileW(wsPattern, &FindData);
+	free(wsPattern);
+	if (hFind == INVALID_HANDLE_VALUE) {
+		*pError = GetLastError();
+		return false;
+	}
+
+	do {
+		if (wcscmp(FindData.cFileName, L".") == 0 || wcscmp(FindData.cFileName, L"..") == 0)
+			continue;
+		char* sName = Utf16ToUtf8(FindData.cFileName);
+		char* sPath = JoinPath(sDir, sName);
+		bool bDirectory =
+			(FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+			!(FindData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT);
+		pfnProc(pContext, sPath, bDirectory);
+		free(sPath);
+		free(sName);
+	} while (FindNextFileW(hFind, &FindData));
+	FindClose(hFind);
+	return true;
+}
+
+char* GetSystemInfDirectory(void) {
+	wchar_t wsWindowsDir[MAX_PATH + sizeof("\\INF")];
+	uint32_t Length = GetWindowsDirectoryW(wsWindowsDir, MAX_PATH);
+	if (Length == 0 || Length >= MAX_PATH)
+		return NULL;
+	memcpy(wsWindowsDir + Length, L"\\INF", sizeof(L"\\INF"));
+	return Utf16ToUtf8(wsWindowsDir);
+}
+
+bool GetFileStamp(const char* sPath, file_stamp* pStamp, uint32_t* pError) {
+	wchar_t* wsPath = Utf8ToUtf16(sPath);
+	WIN32_FILE_ATTRIBUTE_DATA Data;
+	bool bSuccess = GetFileAttributesExW(wsPath, GetFileExInfoStandard, &Data);
+	free(wsPath);
+	if (!bSuccess) {
+		*pError = GetLastError();
+		return false;
+	}
+	pStamp->Size = ((uint64_t)Data.nFileSizeHigh << 32) | Data.nFileSizeLow;
+	pStamp->Modified = ((int64_t)Data.ftLastWriteTime.dwHighDateTime << 32) | Data.ftLastWriteTime.dwLowDateTime;
+	return true;
+}
+
+int64_t GetCurrentFileTime(void) {
+	FILETIME Now;
+	GetSystemTimeAsFileTime(&Now);
+	return ((int64_t)Now.dwHighDateTime << 32) | Now.dwLowDateTime;
+}
+
+const void* MapFileView(const char* sPath, size_t* pSize, uint32_t* pError) {
+	*pSize = 0;
+	*pError = ERROR_SUCCESS;
+	wchar_t* wsPath = Utf8ToUtf16(sPath);
+	HANDLE hFile = CreateFileW(wsPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	free(wsPath);
+	if (hFile == INVALID_HANDLE_VALUE) {
+		*pError = GetLastError();
+		return NULL;
+	}
+
+	LARGE_INTEGER FileSize;
+	if (!GetFileSizeEx(hFile, &FileSize) || FileSize.QuadPart == 0) {
+		*pError = FileSize.QuadPart == 0 ? ERROR_SUCCESS : GetLastError();
+		CloseHandle(hFile);
+		return NULL;
+	}
+	HANDLE hMapping = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	void* pView = hMapping ? MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+	if (!pView)
+		*pError = GetLastError();
+	if (hMapping)
+		CloseHandle(hMapping);
+	CloseHandle(hFile);
+	if (pView)
+		*pSize = (size_t)FileSize.QuadPart;
+	return pView;
+}
+
+void UnmapFileView(const void* pView, size_t Size) {
+	(void)Size;
+	if (pView)
+		UnmapViewOfFile(pView);
+}
+
+bool ReplaceFileWith(const char* sPath, const char* sNewPath, uint32_t* pError) {
+	wchar_t* wsPath = Utf8ToUtf16(sPath);
+	wchar_t* wsNewPath = Utf8ToUtf16(sNewPath);
+	bool bSuccess = MoveFileExW(wsNewPath, wsPath, MOVEFILE_REPLACE_EXISTING);
+	if (!bSuccess)
+		*pError = GetLastError();
+	free(wsNewPath);
+	free(wsPath);
+	return bSuccess;
+}
+
+#else
+
+char* GetSystemErrorMessage(uint32_t Error) {
+	// Match FormatMessage, which ends the message with a new line.
+	const char* sMessage = strerror((int)Error);
+	size_t Length = strlen(sMessage);
+	char* sErrorMessage = malloc_guarded(Length + 2);
+	memcpy(sErrorMessage, sMessage, Length);
+	sErrorMessage[Length] = '\n';
+	sErrorMessage[Length + 1] = '\0';
+	return sErrorMessage;
+}
+
+void FreeSystemErrorMessage(char* sErrorMessage) {
+	free(sErrorMessage);
+}
+
+char* GetFullPath(const char* sPath, uint32_t* pError) {
+	char* sFullPath = realpath(sPath, NULL);
+	if (!sFullPath)
+		*pError = errno;
+	return sFullPath;
+}
+
+int ComparePath(const char* sPathA, const char* sPathB) {
+	return strcmp(sPathA, sPathB);
+}
+
+char* GetSystemInfDirectory(void) {
+	return NULL;
+}
+
+bool IsDirectory(const char* sPath) {
+	struct stat Stat;
+	return stat(sPath, &Stat) == 0 && S_ISDIR(Stat.st_mode);
+}
+
+static char* JoinPath(const char* sDir, const char* sName) {
+	size_t DirLength = strlen(sDir);
+	size_t NameLength = strlen(sName);
+	char* sPath = malloc_guarded(DirLength + NameLength + 2);
+	memcpy(sPath, sDir, DirLength);
+	if (DirLength > 0 && sDir[DirLength - 1] != PATH_SEPARATOR)
+		sPath[DirLength++] = PATH_SEPARATOR;
+	memcpy(sPath + DirLength, sName, NameLength + 1);
+	return sPath;
+}
+
+bool ListDirectory(const char* sDir, directory_proc pfnProc, void* pContext, uint32_t* pError) {
+	DIR* pDir = opendir(sDir);
+	if (!pDir) {
+		*pError = errno;
+		return false;
+	}
+
+	for (struct dirent* pEntry = readdir(pDir); pEntry; pEntry = readdir(pDir)) {
+		if (strcmp(pEntry->d_name, ".") == 0 || strcmp(pEntry->d_name, "..") == 0)
+			continue;
+		char* sPath = JoinPath(sDir, pEntry->d_name);
+		struct stat Stat;
+		bool bDirectory = lstat(sPath, &Stat) == 0 && S_ISDIR(Stat.st_mode);
+		pfnProc(pContext, sPath, bDirectory);
+		free(sPath);
+	}
+	closedir(pDir);
+	return true;
+}
+
+bool GetFileStamp(const char* sPath, file_stamp* pStamp, uint32_t* pError) {
+	struct stat Stat;
+	if (stat(sPath, &Stat) != 0) {
+		*pError = errno;
+		return false;
+	}
+	pStamp->Size = (uint64_t)Stat.st_size;
+	pStamp->Modified = (int64_t)Stat.st_mtim.tv_sec * FILE_TIME_PER_SECOND + Stat.st_mtim.tv_nsec;
+	return true;
+}
+
+int64_t GetCurrentFileTime(void) {
+	struct timespec Now;
+	clock_gettime(CLOCK_REALTIME, &Now);
+	return (int64_t)Now.tv_sec * FILE_TIME_PER_SECOND + Now.tv_nsec;
+}
+
+const void* MapFileView(const char* sPath, size_t* pSize, uint32_t* pError) {
+	*pSize = 0;
+	*pError = ERROR_SUCCESS;
+	int Fd = open(sPath, O_RDONLY);
+	if (Fd < 0) {
+		*pError = errno;
+		return NULL;
+	}
+
+	struct stat Stat;
+	void* pView = NULL;
+	if (fstat(Fd, &Stat) != 0) {
+		*pError = errno;
+	} else if (Stat.st_size > 0) {
+		pView = mmap(NULL, (size_t)Stat.st_size, PROT_READ, MAP_PRIVATE, Fd, 0);
+		if (pView == MAP_FAILED) {
+			*pError = errno;
+			pView = NULL;
+		} else {
+			*pSize = (size_t)Stat.st_size;
+		}
+	}
+	close(Fd);
+	return pView;
+}
+
+void UnmapFileView(const void* pView, size_t Size) {
+	if (pView)
+		munmap((void*)pView, Size);
+}
+
+bool ReplaceFileWith(const char* sPath, const char* sNewPath, uint32_t* pError) {
+	if (rename(sNewPath, sPath) != 0) {
+		*pError = errno;
+		return false;
+	}
+	return true;
+}
+
+#endif
+
+// Threads
+
+typedef struct {
+	thread_proc pfnProc;
+	void* pContext;
+	uint32_t ThreadIndex;
+} thread_start;
+
+#ifdef _WIN32
+
+static DWORD WINAPI ThreadStart(void* pParameter) {
+	thread_start* pStart = pParameter;
+	pStart->pfnProc(pStart->pContext, pStart->ThreadIndex);
+	return 0;
+}
+
+uint32_t GetProcessorCount(void) {
+	return GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+}
+
+void RunThreads(uint32_t nThreads, thread_proc pfnProc, void* pContext) {
+	thread_start* aStarts = malloc_guarded(nThreads * sizeof(*aStarts));
+	HANDLE* ahThreads = malloc_guarded(nThreads * sizeof(*ahThreads));
+	for (uint32_t i = 1; i < nThreads; ++i) {
+		aStarts[i] = (thread_start){ pfnProc, pContext, i };
+		ahThreads[i] = CreateThread(NULL, 0, ThreadStart, &aStarts[i], 0, NULL);
+		if (!ahThreads[i])
+			abort();
+	}
+	pfnProc(pContext, 0);
+	for (uint32_t i = 1; i < nThreads; ++i) {
+		WaitForSingleObject(ahThreads[i], INFINITE);
+		CloseHandle(ahThreads[i]);
+	}
+	free(ahThreads);
+	free(aStarts);
+}
+
+size_t AtomicFetchAdd(volatile size_t* pValue, size_t Add) {
+#ifdef _WIN64
+	return (size_t)InterlockedExchangeAdd64((volatile LONG64*)pValue, (LONG64)Add);
+#else
+	return (size_t)InterlockedExchangeAdd((volatile LONG*)pValue, (LONG)Add);
+#endif
+}
+
+// The stores are full barriers, so loads with acquire semantics keep
+// everything in a single order.
+size_t AtomicLoad(volatile size_t* pValue) {
+#ifdef _WIN64
+	return (size_t)ReadAcquire64((volatile LONG64*)pValue);
+#else
+	return (size_t)ReadAcquire((volatile LONG*)pValue);
+#endif
+}
+
+void AtomicStore(volatile size_t* pValue, size_t Value) {
+#ifdef _WIN64
+	InterlockedExchange64((volatile LONG64*)pValue, (LONG64)Value);
+#else
+	InterlockedExchange((volatile LONG*)pValue, (LONG)Value);
+#endif
+}
+
+void* AtomicLoadPointer(void* volatile* ppValue) {
+	return ReadPointerAcquire(ppValue);
+}
+
+void AtomicStorePointer(void* volatile* ppValue, void* pValue) {
+	InterlockedExchangePointer(ppValue, pValue);
+}
+
+void MutexInit(mutex* pMutex) {
+	InitializeSRWLock(pMutex);
+}
+
+void MutexDestroy(mutex* pMutex) {
+	(void)pMutex;
+}
+
+void MutexLock(mutex* pMutex) {
+	AcquireSRWLockExclusive(pMutex);
+}
+
+void MutexUnlock(mutex* pMutex) {
+	ReleaseSRWLockExclusive(pMutex);
+}
+
+#else
+
+static void* ThreadStart(void* pParameter) {
+	thread_start* pStart = pParameter;
+	pStart->pfnProc(pStart->pContext, pStart->ThreadIndex);
+	return NULL;
+}
+
+uint32_t GetProcessorCount(void) {
+	long Count = sysconf(_SC_NPROCESSORS_ONLN);
+	return Count > 0 ? (uint32_t)Count : 1;
+}
+
+void RunThreads(uint32_t nThreads, thread_proc pfnProc, void* pContext) {
+	thread_start* aStarts = malloc_guarded(nThreads * sizeof(*aStarts));
+	pthread_t* aThreads = malloc_guarded(nThreads * sizeof(*aThreads));
+	for (uint32_t i = 1; i < nThreads; ++i) {
+		aStarts[i] = (thread_start){ pfnProc, pContext, i };
+		if (pthread_create(&aThreads[i], NULL, ThreadStart, &aStarts[i]) != 0)
+			abort();
+	}
+	pfnProc(pContext, 0);
+	for (uint32_t i = 1; i < nThreads; ++i)
+		pthread_join(aThreads[i], NULL);
+	free(aThreads);
+	free(aStarts);
+}
+
+size_t AtomicFetchAdd(volatile size_t* pValue, size_t Add) {
+	return __atomic_fetch_add(pValue, Add, __ATOMIC_SEQ_CST);
+}
+
+size_t AtomicLoad(volatile size_t* pValue) {
+	return __atomic_load_n(pValue, __ATOMIC_SEQ_CST);
+}
+
+void AtomicStore(volatile size_t* pValue, size_t Value) {
+	__atomic_store_n(pValue, Value, __ATOMIC_SEQ_CST);
+}
+
+void* AtomicLoadPointer(void* volatile* ppValue) {
+	return __atomic_load_n(ppValue, __ATOMIC_SEQ_CST);
+}
+
+void AtomicStorePointer(void* volatile* ppValue, void* pValue) {
+	__atomic_store_n(ppValue, pValue, __ATOMIC_SEQ_CST);
+}
+
+void MutexInit(mutex* pMutex) {
+	if (pthread_mutex_init(pMutex, NULL) != 0)
+		abort();
+}
+
+void MutexDestroy(mutex* pMutex) {
+	pthread_mutex_destroy(pMutex);
+}
+
+void MutexLock(mutex* pMutex) {
+	pthread_mutex_lock(pMutex);
+}
+
+void MutexUnlock(mutex* pMutex) {
+	pthread_mutex_unlock(pMutex);
+}
+
+#endif
@@ -0,0 +1,593 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "Platform.h"
+
+#include "GuardedMalloc.h"
+#include "ResultCache.h"
+#include "Tree234.h"
+
+/*
+ * File layout, in host byte order:
+ *   cache_header
+ *   cache_entry[nEntries], sorted by path hash then path
+ *   cache_input[], the inputs of each entry in turn
+ *   strings, '\0' terminated
+ * Offsets are from the start of the file.
+ */
+
+#define CACHE_VERSION 2
+
+// A file written within this time before it was checked may still be
+// changing with the same timestamp, as on FAT volumes.
+#define RACY_TIME (2 * (int64_t)FILE_TIME_PER_SECOND)
+
+typedef struct {
+	char aMagic[8];
+	uint32_t Version;
+	uint32_t nEntries;
+	uint64_t OptionsKey;
+	uint64_t FileSize;
+} cache_header;
+
+typedef struct {
+	uint64_t PathHash;
+	uint32_t Path;
+	uint32_t PathLength;
+	uint32_t Inputs;
+	uint32_t nInputs;
+	uint32_t Output;
+	uint32_t OutputLength;
+	uint32_t Warnings;
+	uint32_t WarningsLength;
+	uint32_t Error;
+	uint32_t Reserved;
+} cache_entry;
+
+typedef struct {
+	file_stamp Stamp; // Size is MISSING_SIZE if the file didn't exist
+	uint32_t Path;
+	uint32_t PathLength;
+} cache_input;
+
+#define MISSING_SIZE UINT64_MAX
+
+// What an input is on disk, read once per run whichever entries name it.
+typedef struct {
+	char* sPath;
+	bool bExists;
+	file_stamp Stamp;
+	int64_t CheckTime;
+} checked_input;
+
+static int CheckedCompare(checked_input* A, checked_input* B) {
+	return strcmp(A->sPath, B->sPath);
+}
+
+static void FreeChecked(checked_input* p, void* pContext) {
+	(void)pContext;
+	free(p->sPath);
+	free(p);
+}
+
+static const char s_aMagic[8] = { 'G', 'D', 'F', 'C', 'A', 'C', 'H', 'E' };
+
+// Entries stored during this run.
+
+typedef struct {
+	char* sPath;
+	file_stamp Stamp;
+} new_input;
+
+typedef struct {
+	uint64_t PathHash;
+	char* sPath;
+	char* pOutput;
+	uint32_t OutputLength;
+	char* pWarnings;
+	uint32_t WarningsLength;
+	uint32_t Error;
+	new_input* aInputs;
+	uint32_t nInputs;
+} new_entry;
+
+struct result_cache_Tag {
+	char* sPath;
+	uint64_t OptionsKey;
+
+	const uint8_t* pView;
+	size_t ViewSize;
+	const cache_entry* aEntries; // NULL if the file is missing or invalid
+	uint32_t nEntries;
+	uint8_t* abDropped; // Old entries found stale or replaced
+
+	new_entry* aNew;
+	size_t nNew;
+	size_t NewCapacity;
+
+	// Inputs shared by many entries, such as layout.inf, are only
+	// checked once per run.
+	tree234* pCheckedTree;
+
+	mutex Lock;
+	uint64_t Hits;
+	uint64_t Misses;
+};
+
+// 8 bytes at a time, finished as in MurmurHash3, for the paths and the
+// options.
+static uint64_t HashBytes(const void* p, size_t Size) {
+	const uint8_t* pBytes = p;
+	uint64_t Hash = 0x9E3779B97F4A7C15ull ^ Size;
+	size_t i = 0;
+	for (; i + 8 <= Size; i += 8) {
+		uint64_t Word;
+		memcpy(&Word, pBytes + i, 8);
+		Hash = (Hash ^ Word) * 0xFF51AFD7ED558CCDull;
+		Hash ^= Hash >> 32;
+	}
+	uint64_t Tail = 0;
+	if (i < Size)
+		memcpy(&Tail, pBytes + i, Size - i);
+	Hash = (Hash ^ Tail) * 0xFF51AFD7ED558CCDull;
+	Hash ^= Hash >> 33;
+	Hash *= 0xC4CEB9FE1A85EC53ull;
+	Hash ^= Hash >> 33;
+	return Hash;
+}
+
+static int ComparePathKey(uint64_t HashA, const char* sA, uint64_t HashB, const char* sB) {
+	if (HashA != HashB)
+		return (HashA > HashB) - (HashA < HashB);
+	return strcmp(sA, sB);
+}
+
+// Opening
+
+static bool InBounds(const result_cache* pCache, uint64_t Offset, uint64_t Size) {
+	return Offset <= pCache->ViewSize && Size <= pCache->ViewSize - Offset;
+}
+
+static bool StringInBounds(const result_cache* pCache, uint32_t Offset, uint32_t Length) {
+	return InBounds(pCache, Offset, (uint64_t)Length + 1) && pCache->pView[Offset + Length] == '\0';
+}
+
+// Checks every offset once so lookups can trust them.
+static bool ValidateFile(result_cache* pCache) {
+	if (pCache->ViewSize < sizeof(cache_header))
+		return false;
+	const cache_header* pHeader = (const cache_header*)pCache->pView;
+	if (
+		memcmp(pHeader->aMagic, s_aMagic, sizeof(s_aMagic)) != 0 ||
+		pHeader->Version != CACHE_VERSION ||
+		pHeader->OptionsKey != pCache->OptionsKey ||
+		pHeader->FileSize != pCache->ViewSize ||
+		!InBounds(pCache, sizeof(cache_header), (uint64_t)pHeader->nEntries * sizeof(cache_entry))
+	)
+		return false;
+
+	const cache_entry* aEntries = (const cache_entry*)(pCache->pView + sizeof(cache_header));
+	for (uint32_t i = 0; i < pHeader->nEntries; ++i) {
+		const cache_entry* pEntry = &aEntries[i];
+		if (
+			!StringInBounds(pCache, pEntry->Path, pEntry->PathLength) ||
+			!InBounds(pCache, pEntry->Output, pEntry->OutputLength) ||
+			!InBounds(pCache, pEntry->Warnings, pEntry->WarningsLength) ||
+			pEntry->Inputs % 8 != 0 ||
+			!InBounds(pCache, pEntry->Inputs, (uint64_t)pEntry->nInputs * sizeof(cache_input))
+		)
+			return false;
+		const cache_input* aInputs = (const cache_input*)(pCache->pView + pEntry->Inputs);
+		for (uint32_t j = 0; j < pEntry->nInputs; ++j)
+			if (!StringInBounds(pCache, aInputs[j].Path, aInputs[j].PathLength))
+				return false;
+	}
+	pCache->aEntries = aEntries;
+	pCache->nEntries = pHeader->nEntries;
+	return true;
+}
+
+result_cache* OpenResultCache(const char* sPath, const driver_files_options* pOptions, const char* sInfDir) {
+	result_cache* pCache = malloc_guarded(sizeof(*pCache));
+	memset(pCache, 0, sizeof(*pCache));
+	pCache->sPath = strdup_guarded(sPath);
+	pCache->pCheckedTree = newtree234((cmpfn234)CheckedCompare);
+	MutexInit(&pCache->Lock);
+
+	text_buffer Key = { NULL, 0, 0 };
+	TextAppendFormat(
+		&Key,
+		"%u %u %u %s %s",
+		pOptions->bGetCatalog,
+		pOptions->bGetSource,
+		pOptions->bReachableOnly,
+		pOptions->sLocale ? pOptions->sLocale : "",
+		pOptions->bReachableOnly && sInfDir ? sInfDir : ""
+	);
+	pCache->OptionsKey = HashBytes(Key.p, Key.Length);
+	TextFree(&Key);
+
+	uint32_t Error;
+	pCache->pView = MapFileView(sPath, &pCache->ViewSize, &Error);
+	if (pCache->pView && !ValidateFile(pCache)) {
+		UnmapFileView(pCache->pView, pCache->ViewSize);
+		pCache->pView = NULL;
+	}
+	pCache->abDropped = calloc(pCache->nEntries + 1, 1);
+	if (!pCache->abDropped)
+		abort();
+	return pCache;
+}
+
+static void FreeNewEntry(new_entry* pEntry) {
+	for (uint32_t i = 0; i < pEntry->nInputs; ++i)
+		free(pEntry->aInputs[i].sPath);
+	free(pEntry->aInputs);
+	free(pEntry->pWarnings);
+	free(pEntry->pOutput);
+	free(pEntry->sPath);
+}
+
+void FreeResultCache(result_cache* pCache) {
+	for (size_t i = 0; i < pCache->nNew; ++i)
+		FreeNewEntry(&pCache->aNew[i]);
+	free(pCache->aNew);
+	free(pCache->abDropped);
+	freetree234_with(pCache->pCheckedTree, (destroyfn234)FreeChecked, NULL);
+	if (pCache->pView)
+		UnmapFileView(pCache->pView, pCache->ViewSize);
+	MutexDestroy(&pCache->Lock);
+	free(pCache->sPath);
+	free(pCache);
+}
+
+// Lookups
+
+static const char* ViewString(const result_cache* pCache, uint32_t Offset) {
+	return (const char*)pCache->pView + Offset;
+}
+
+// Index of the entry for sPath, -1 if there's none.
+static int64_t FindEntry(const result_cache* pCache, uint64_t PathHash, const char* sPath) {
+	uint32_t Low = 0;
+	uint32_t High = pCache->nEntries;
+	while (Low < High) {
+		uint32_t Middle = Low + (High - Low) / 2;
+		const cache_entry* pEntry = &pCache->aEntries[Middle];
+		if (ComparePathKey(pEntry->PathHash, ViewString(pCache, pEntry->Path), PathHash, sPath) < 0)
+			Low = Middle + 1;
+		else
+			High = Middle;
+	}
+	if (Low == pCache->nEntries)
+		return -1;
+	const cache_entry* pEntry = &pCache->aEntries[Low];
+	if (pEntry->PathHash != PathHash || strcmp(ViewString(pCache, pEntry->Path), sPath) != 0)
+		return -1;
+	return Low;
+}
+
+static checked_input* GetCheckedInput(result_cache* pCache, const char* sPath) {
+	checked_input Key = { .sPath = (char*)sPath };
+	MutexLock(&pCache->Lock);
+	checked_input* pChecked = find234(pCache->pCheckedTree, &Key, NULL);
+	MutexUnlock(&pCache->Lock);
+	if (pChecked)
+		return pChecked;
+
+	// Another thread may check it meanwhile, the first one is kept.
+	checked_input* pNew = malloc_guarded(sizeof(*pNew));
+	memset(pNew, 0, sizeof(*pNew));
+	pNew->sPath = strdup_guarded(sPath);
+	pNew->CheckTime = GetCurrentFileTime();
+	uint32_t Error;
+	pNew->bExists = GetFileStamp(sPath, &pNew->Stamp, &Error);
+	MutexLock(&pCache->Lock);
+	pChecked = add234(pCache->pCheckedTree, pNew);
+	MutexUnlock(&pCache->Lock);
+	if (pChecked != pNew)
+		FreeChecked(pNew, NULL);
+	return pChecked;
+}
+
+// Entries are only stored once their inputs are older than RACY_TIME,
+// so a later write always changes the time: equal stamps are trusted.
+static bool IsInputUnchanged(result_cache* pCache, const cache_input* pInput) {
+	checked_input* pChecked = GetCheckedInput(pCache, ViewString(pCache, pInput->Path));
+	if (!pChecked->bExists)
+		return pInput->Stamp.Size == MISSING_SIZE;
+	return pChecked->Stamp.Size == pInput->Stamp.Size && pChecked->Stamp.Modified == pInput->Stamp.Modified;
+}
+
+bool ResultCacheLookup(result_cache* pCache, const char* sFullPath, driver_files_result* pResult) {
+	int64_t Index = pCache->aEntries ? FindEntry(pCache, HashBytes(sFullPath, strlen(sFullPath)), sFullPath) : -1;
+	bool bValid = Index >= 0;
+	if (bValid) {
+		const cache_entry* pEntry = &pCache->aEntries[Index];
+		const cache_input* aInputs = (const cache_input*)(pCache->pView + pEntry->Inputs);
+		for (uint32_t i = 0; i < pEntry->nInputs && bValid; ++i)
+			bValid = IsInputUnchanged(pCache, &aInputs[i]);
+		if (bValid) {
+			pResult->Output.Length = 0;
+			pResult->Warnings.Length = 0;
+			pResult->Inputs.Length = 0;
+			TextAppend(&pResult->Output, ViewString(pCache, pEntry->Output), pEntry->OutputLength);
+			TextAppend(&pResult->Warnings, ViewString(pCache, pEntry->Warnings), pEntry->WarningsLength);
+			pResult->Error = pEntry->Error;
+		}
+	}
+
+	MutexLock(&pCache->Lock);
+	if (bValid) {
+		pCache->Hits += 1;
+	} else {
+		pCache->Misses += 1;
+		if (Index >= 0)
+			pCache->abDropped[Index] = 1;
+	}
+	MutexUnlock(&pCache->Lock);
+	return bValid;
+}
+
+// Stores
+
+static int StringPointerCompare(const void* pA, const void* pB) {
+	return strcmp(*(char* const*)pA, *(char* const*)pB);
+}
+
+static char* CopyBytes(const char* p, size_t Length) {
+	char* pCopy = malloc_guarded(Length + 1);
+	if (Length > 0)
+		memcpy(pCopy, p, Length);
+	pCopy[Length] = '\0';
+	return pCopy;
+}
+
+void ResultCacheStore(result_cache* pCache, const char* sFullPath, const driver_files_result* pResult, int64_t StartTime) {
+	// One input per line, some of them repeated.
+	size_t nLines = 0;
+	for (size_t i = 0; i < pResult->Inputs.Length; ++i)
+		nLines += pResult->Inputs.p[i] == '\n';
+	char** asLines = malloc_guarded((nLines + 1) * sizeof(*asLines));
+	nLines = 0;
+	for (size_t Start = 0, i = 0; i < pResult->Inputs.Length; ++i) {
+		if (pResult->Inputs.p[i] != '\n')
+			continue;
+		asLines[nLines++] = CopyBytes(pResult->Inputs.p + Start, i - Start);
+		Start = i + 1;
+	}
+	if (nLines > 0)
+		qsort(asLines, nLines, sizeof(*asLines), StringPointerCompare);
+
+	new_entry Entry = { 0 };
+	Entry.aInputs = malloc_guarded((nLines + 1) * sizeof(*Entry.aInputs));
+	bool bStable = true;
+	for (size_t i = 0; i < nLines; ++i) {
+		if (!bStable || (Entry.nInputs > 0 && strcmp(asLines[i], Entry.aInputs[Entry.nInputs - 1].sPath) == 0)) {
+			free(asLines[i]);
+			continue;
+		}
+		new_input* pInput = &Entry.aInputs[Entry.nInputs++];
+		pInput->sPath = asLines[i];
+		// The stamp may be from before the INF was processed, when it was
+		// looked up. It's only kept if the file was old enough then for
+		// any write since to have changed it.
+		const checked_input* pChecked = GetCheckedInput(pCache, pInput->sPath);
+		if (!pChecked->bExists) {
+			pInput->Stamp = (file_stamp){ MISSING_SIZE, 0 };
+			continue;
+		}
+		pInput->Stamp = pChecked->Stamp;
+		int64_t CheckTime = pChecked->CheckTime < StartTime ? pChecked->CheckTime : StartTime;
+		bStable = pInput->Stamp.Modified < CheckTime - RACY_TIME;
+	}
+	free(asLines);
+
+	if (!bStable) {
+		FreeNewEntry(&Entry);
+		return;
+	}
+	Entry.sPath = strdup_guarded(sFullPath);
+	Entry.PathHash = HashBytes(sFullPath, strlen(sFullPath));
+	Entry.pOutput = CopyBytes(pResult->Output.p, pResult->Output.Length);
+	Entry.OutputLength = (uint32_t)pResult->Output.Length;
+	Entry.pWarnings = CopyBytes(pResult->Warnings.p, pResult->Warnings.Length);
+	Entry.WarningsLength = (uint32_t)pResult->Warnings.Length;
+	Entry.Error = pResult->Error;
+
+	MutexLock(&pCache->Lock);
+	int64_t Index = pCache->aEntries ? FindEntry(pCache, Entry.PathHash, Entry.sPath) : -1;
+	if (Index >= 0)
+		pCache->abDropped[Index] = 1;
+	if (pCache->nNew == pCache->NewCapacity) {
+		pCache->NewCapacity = pCache->NewCapacity ? pCache->NewCapacity * 2 : 256;
+		pCache->aNew = realloc_guarded(pCache->aNew, pCache->NewCapacity * sizeof(*pCache->aNew));
+	}
+	pCache->aNew[pCache->nNew++] = Entry;
+	MutexUnlock(&pCache->Lock);
+}
+
+void GetResultCacheStats(result_cache* pCache, uint64_t* pHits, uint64_t* pMisses) {
+	MutexLock(&pCache->Lock);
+	*pHits = pCache->Hits;
+	*pMisses = pCache->Misses;
+	MutexUnlock(&pCache->Lock);
+}
+
+// Saving
+
+// An entry to write, old or new.
+typedef struct {
+	uint64_t PathHash;
+	const char* sPath;
+	const cache_entry* pOld;
+	const new_entry* pNew;
+} save_record;
+
+static int RecordCompare(const void* pA, const void* pB) {
+	const save_record* A = pA;
+	const save_record* B = pB;
+	return ComparePathKey(A->PathHash, A->sPath, B->PathHash, B->sPath);
+}
+
+// Appends the bytes and a '\0' to the strings, returns their offset.
+static uint32_t AppendString(text_buffer* pStrings, uint64_t StringsBase, const char* p, size_t Length) {
+	uint64_t Offset = StringsBase + pStrings->Length;
+	TextAppend(pStrings, p, Length);
+	TextAppend(pStrings, "", 1);
+	return Offset <= UINT32_MAX ? (uint32_t)Offset : UINT32_MAX;
+}
+
+static uint32_t GetFileError(void) {
+#ifdef _WIN32
+	return (uint32_t)_doserrno;
+#else
+	return (uint32_t)errno;
+#endif
+}
+
+static bool WriteParts(const char* sPath, const void* aParts[], const size_t aSizes[], size_t nParts, uint32_t* pError) {
+#ifdef _WIN32
+	wchar_t* wsPath = Utf8ToUtf16(sPath);
+	FILE* pFile = _wfopen(wsPath, L"wb");
+	free(wsPath);
+#else
+	FILE* pFile = fopen(sPath, "wb");
+#endif
+	if (!pFile) {
+		*pError = GetFileError();
+		return false;
+	}
+	bool bSuccess = true;
+	for (size_t i = 0; i < nParts && bSuccess; ++i)
+		bSuccess = aSizes[i] == 0 || fwrite(aParts[i], 1, aSizes[i], pFile) == aSizes[i];
+	if (fclose(pFile) != 0)
+		bSuccess = false;
+	if (!bSuccess) {
+		*pError = GetFileError();
+		remove(sPath);
+	}
+	return bSuccess;
+}
+
+bool SaveResultCache(result_cache* pCache, uint32_t* pError) {
+	size_t nRecords = 0;
+	save_record* aRecords = malloc_guarded((pCache->nEntries + pCache->nNew + 1) * sizeof(*aRecords));
+	for (size_t i = 0; i < pCache->nNew; ++i) {
+		const new_entry* pNew = &pCache->aNew[i];
+		aRecords[nRecords++] = (save_record){ pNew->PathHash, pNew->sPath, NULL, pNew };
+	}
+	for (uint32_t i = 0; i < pCache->nEntries; ++i) {
+		const cache_entry* pOld = &pCache->aEntries[i];
+		if (!pCache->abDropped[i])
+			aRecords[nRecords++] = (save_record){ pOld->PathHash, ViewString(pCache, pOld->Path), pOld, NULL };
+	}
+
+	// Old entries of the INFs stored again are dropped, a path is only
+	// repeated if it was given twice. Keep none of them rather than
+	// guessing which one is right.
+	if (nRecords > 0)
+		qsort(aRecords, nRecords, sizeof(*aRecords), RecordCompare);
+	size_t nUnique = 0;
+	for (size_t i = 0; i < nRecords;) {
+		size_t j = i + 1;
+		while (j < nRecords && RecordCompare(&aRecords[i], &aRecords[j]) == 0)
+			++j;
+		if (j == i + 1)
+			aRecords[nUnique++] = aRecords[i];
+		i = j;
+	}
+	nRecords = nUnique;
+
+	uint64_t nInputs = 0;
+	for (size_t i = 0; i < nRecords; ++i)
+		nInputs += aRecords[i].pOld ? aRecords[i].pOld->nInputs : aRecords[i].pNew->nInputs;
+
+	uint64_t InputsBase = sizeof(cache_header) + nRecords * sizeof(cache_entry);
+	uint64_t StringsBase = InputsBase + nInputs * sizeof(cache_input);
+	cache_entry* aEntries = malloc_guarded((nRecords + 1) * sizeof(*aEntries));
+	cache_input* aInputs = malloc_guarded((nInputs + 1) * sizeof(*aInputs));
+	text_buffer Strings = { NULL, 0, 0 };
+	uint64_t iInput = 0;
+	for (size_t i = 0; i < nRecords; ++i) {
+		const save_record* pRecord = &aRecords[i];
+		cache_entry* pEntry = &aEntries[i];
+		memset(pEntry, 0, sizeof(*pEntry));
+		pEntry->PathHash = pRecord->PathHash;
+		pEntry->PathLength = (uint32_t)strlen(pRecord->sPath);
+		pEntry->Path = AppendString(&Strings, StringsBase, pRecord->sPath, pEntry->PathLength);
+		pEntry->Inputs = (uint32_t)(InputsBase + iInput * sizeof(cache_input));
+		if (pRecord->pOld) {
+			const cache_entry* pOld = pRecord->pOld;
+			pEntry->OutputLength = pOld->OutputLength;
+			pEntry->Output = AppendString(&Strings, StringsBase, ViewString(pCache, pOld->Output), pOld->OutputLength);
+			pEntry->WarningsLength = pOld->WarningsLength;
+			pEntry->Warnings = AppendString(&Strings, StringsBase, ViewString(pCache, pOld->Warnings), pOld->WarningsLength);
+			pEntry->Error = pOld->Error;
+			pEntry->nInputs = pOld->nInputs;
+			const cache_input* aOldInputs = (const cache_input*)(pCache->pView + pOld->Inputs);
+			for (uint32_t j = 0; j < pOld->nInputs; ++j) {
+				cache_input* pInput = &aInputs[iInput++];
+				*pInput = aOldInputs[j];
+				pInput->Path = AppendString(&Strings, StringsBase, ViewString(pCache, aOldInputs[j].Path), aOldInputs[j].PathLength);
+			}
+		} else {
+			const new_entry* pNew = pRecord->pNew;
+			pEntry->OutputLength = pNew->OutputLength;
+			pEntry->Output = AppendString(&Strings, StringsBase, pNew->pOutput, pNew->OutputLength);
+			pEntry->WarningsLength = pNew->WarningsLength;
+			pEntry->Warnings = AppendString(&Strings, StringsBase, pNew->pWarnings, pNew->WarningsLength);
+			pEntry->Error = pNew->Error;
+			pEntry->nInputs = pNew->nInputs;
+			for (uint32_t j = 0; j < pNew->nInputs; ++j) {
+				const new_input* pNewInput = &pNew->aInputs[j];
+				cache_input* pInput = &aInputs[iInput++];
+				memset(pInput, 0, sizeof(*pInput));
+				pInput->Stamp = pNewInput->Stamp;
+				pInput->PathLength = (uint32_t)strlen(pNewInput->sPath);
+				pInput->Path = AppendString(&Strings, StringsBase, pNewInput->sPath, pInput->PathLength);
+			}
+		}
+	}
+	free(aRecords);
+
+	// The old file is copied, it can go. It must be unmapped to be
+	// replaced on Windows.
+	if (pCache->pView)
+		UnmapFileView(pCache->pView, pCache->ViewSize);
+	pCache->pView = NULL;
+	pCache->aEntries = NULL;
+	pCache->nEntries = 0;
+
+	cache_header Header;
+	memset(&Header, 0, sizeof(Header));
+	memcpy(Header.aMagic, s_aMagic, sizeof(s_aMagic));
+	Header.Version = CACHE_VERSION;
+	Header.nEntries = (uint32_t)nRecords;
+	Header.OptionsKey = pCache->OptionsKey;
+	Header.FileSize = StringsBase + Strings.Length;
+
+	bool bSuccess = false;
+	if (Header.FileSize > UINT32_MAX) {
+		*pError = ERROR_FILE_TOO_LARGE;
+	} else {
+		size_t TempLength = strlen(pCache->sPath);
+		char* sTempPath = malloc_guarded(TempLength + sizeof(".tmp"));
+		memcpy(sTempPath, pCache->sPath, TempLength);
+		memcpy(sTempPath + TempLength, ".tmp", sizeof(".tmp"));
+		const void* aParts[] = { &Header, aEntries, aInputs, Strings.p };
+		size_t aSizes[] = { sizeof(Header), nRecords * sizeof(*aEntries), nInputs * sizeof(*aInputs), Strings.Length };
+		bSuccess = WriteParts(sTempPath, aParts, aSizes, 4, pError);
+		if (bSuccess) {
+			bSuccess = ReplaceFileWith(pCache->sPath, sTempPath, pError);
+			if (!bSuccess)
+				remove(sTempPath);
+		}
+		free(sTempPath);
+	}
+
+	TextFree(&Strings);
+	free(aInputs);
+	free(aEntries);
+	return bSuccess;
+}
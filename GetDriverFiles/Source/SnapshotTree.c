@@ -0,0 +1,757 @@
+#include <assert.h>
+#include <string.h>
+
+#include "Platform.h"
+
+#include "GuardedMalloc.h"
+#include "SnapshotTree.h"
+
+// Elements per node at most, and at least but in the root.
+#define MAX_ELEMS 15
+#define MIN_ELEMS 7
+
+// A node has room for one element more than it keeps, so an insertion
+// can overflow it before it's split. Only the write that creates a node
+// may change it, until it's published.
+struct snapshot_node_Tag {
+	size_t Epoch; // Of the write that created it
+	uint32_t nElems;
+	bool bLeaf;
+	void* apElems[MAX_ELEMS + 1];
+	intptr_t aCounts[MAX_ELEMS + 2]; // Elements under each kid
+	snapshot_node* apKids[MAX_ELEMS + 2];
+};
+
+typedef struct {
+	volatile size_t Epoch; // Of the snapshot pinned, 0 for none
+	char aPadding[64 - sizeof(size_t)]; // A cache line per reader
+} reader_slot;
+
+typedef struct {
+	void* p;
+	size_t Epoch; // Of the write that replaced it
+	bool bElement;
+} retired;
+
+struct snapshot_tree_Tag {
+	snapshot_node* volatile pRoot;
+	volatile size_t Epoch; // From 1, incremented by each write
+	cmpfn234 pfnCompare;
+	destroyfn234 pfnDestroy;
+	void* pContext;
+	reader_slot* aReaders;
+	uint32_t nReaders;
+	// Oldest first, from FirstRetired to nRetired.
+	retired* aRetired;
+	size_t FirstRetired;
+	size_t nRetired;
+	size_t RetiredCapacity;
+};
+
+snapshot_tree* NewSnapshotTree(cmpfn234 pfnCompare, destroyfn234 pfnDestroy, void* pContext, uint32_t nReaders) {
+	snapshot_tree* pTree = malloc_guarded(sizeof(*pTree));
+	memset(pTree, 0, sizeof(*pTree));
+	pTree->Epoch = 1;
+	pTree->pfnCompare = pfnCompare;
+	pTree->pfnDestroy = pfnDestroy;
+	pTree->pContext = pContext;
+	pTree->aReaders = malloc_guarded(nReaders * sizeof(*pTree->aReaders));
+	memset(pTree->aReaders, 0, nReaders * sizeof(*pTree->aReaders));
+	pTree->nReaders = nReaders;
+	return pTree;
+}
+
+static void FreeRetired(snapshot_tree* pTree, const retired* pRetired) {
+	if (!pRetired->bElement)
+		free(pRetired->p);
+	else if (pTree->pfnDestroy)
+		pTree->pfnDestroy(pRetired->p, pTree->pContext);
+}
+
+static void FreeNodes(snapshot_tree* pTree, snapshot_node* pNode) {
+	if (pTree->pfnDestroy)
+		for (uint32_t i = 0; i < pNode->nElems; ++i)
+			pTree->pfnDestroy(pNode->apElems[i], pTree->pContext);
+	if (!pNode->bLeaf)
+		for (uint32_t i = 0; i <= pNode->nElems; ++i)
+			FreeNodes(pTree, pNode->apKids[i]);
+	free(pNode);
+}
+
+void FreeSnapshotTree(snapshot_tree* pTree) {
+	for (size_t i = pTree->FirstRetired; i < pTree->nRetired; ++i)
+		FreeRetired(pTree, &pTree->aRetired[i]);
+	if (pTree->pRoot)
+		FreeNodes(pTree, pTree->pRoot);
+	free(pTree->aRetired);
+	free(pTree->aReaders);
+	free(pTree);
+}
+
+size_t GetSnapshotTreeRetiredCount(const snapshot_tree* pTree) {
+	return pTree->nRetired - pTree->FirstRetired;
+}
+
+static intptr_t CountNode(const snapshot_node* pNode) {
+	if (!pNode)
+		return 0;
+	intptr_t Count = pNode->nElems;
+	if (!pNode->bLeaf)
+		for (uint32_t i = 0; i <= pNode->nElems; ++i)
+			Count += pNode->aCounts[i];
+	return Count;
+}
+
+// The index of the first element >= e, *pbFound set if it's equal.
+static uint32_t SearchNode(const snapshot_node* pNode, void* e, cmpfn234 pfnCompare, bool* pbFound) {
+	uint32_t Low = 0;
+	uint32_t High = pNode->nElems;
+	*pbFound = false;
+	while (Low < High) {
+		uint32_t Middle = (Low + High) / 2;
+		int Compare = pfnCompare(e, pNode->apElems[Middle]);
+		if (Compare == 0) {
+			*pbFound = true;
+			return Middle;
+		}
+		if (Compare < 0)
+			High = Middle;
+		else
+			Low = Middle + 1;
+	}
+	return Low;
+}
+
+static void* IndexNode(const snapshot_node* pNode, intptr_t Index) {
+	if (Index < 0 || Index >= CountNode(pNode))
+		return NULL;
+	for (;;) {
+		if (pNode->bLeaf)
+			return pNode->apElems[Index];
+		uint32_t i = 0;
+		for (; Index > pNode->aCounts[i]; ++i)
+			Index -= pNode->aCounts[i] + 1;
+		if (Index == pNode->aCounts[i])
+			return pNode->apElems[i];
+		pNode = pNode->apKids[i];
+	}
+}
+
+// findrelpos234 on the version rooted at pRoot.
+static void* FindInVersion(const snapshot_node* pRoot, void* e, cmpfn234 pfnCompare, int Relation, intptr_t* pIndex) {
+	const snapshot_node* pNode = pRoot;
+	bool bFound = false;
+	if (!pNode)
+		return NULL;
+
+	if (Relation == REL234_EQ && !pIndex) {
+		for (;;) {
+			uint32_t i = SearchNode(pNode, e, pfnCompare, &bFound);
+			if (bFound)
+				return pNode->apElems[i];
+			if (pNode->bLeaf)
+				return NULL;
+			pNode = pNode->apKids[i];
+		}
+	}
+
+	// Count the elements < e, NULL being above or below all of them.
+	intptr_t Count = CountNode(pRoot);
+	intptr_t Less = 0;
+	if (!e) {
+		assert(Relation == REL234_LT || Relation == REL234_GT);
+		Less = Relation == REL234_LT ? Count : 0;
+	} else {
+		for (;;) {
+			uint32_t i = SearchNode(pNode, e, pfnCompare, &bFound);
+			if (!pNode->bLeaf)
+				for (uint32_t k = 0; k < i + bFound; ++k)
+					Less += pNode->aCounts[k];
+			Less += i;
+			if (bFound || pNode->bLeaf)
+				break;
+			pNode = pNode->apKids[i];
+		}
+	}
+
+	intptr_t Index;
+	switch (Relation) {
+	case REL234_EQ:
+		Index = bFound ? Less : -1;
+		break;
+	case REL234_LT:
+		Index = Less - 1;
+		break;
+	case REL234_LE:
+		Index = bFound ? Less : Less - 1;
+		break;
+	case REL234_GT:
+		Index = bFound ? Less + 1 : Less;
+		break;
+	default: // REL234_GE
+		Index = Less;
+		break;
+	}
+	if (Index < 0 || Index >= Count)
+		return NULL;
+	if (pIndex)
+		*pIndex = Index;
+	return IndexNode(pRoot, Index);
+}
+
+// Writer side
+
+static void Retire(snapshot_tree* pTree, void* p, bool bElement) {
+	if (pTree->nRetired == pTree->RetiredCapacity) {
+		pTree->RetiredCapacity = pTree->RetiredCapacity ? pTree->RetiredCapacity * 2 : 64;
+		pTree->aRetired = realloc_guarded(pTree->aRetired, pTree->RetiredCapacity * sizeof(*pTree->aRetired));
+	}
+	pTree->aRetired[pTree->nRetired++] = (retired){ p, pTree->Epoch, bElement };
+}
+
+static snapshot_node* NewNode(snapshot_tree* pTree, bool bLeaf) {
+	snapshot_node* pNode = malloc_guarded(sizeof(*pNode));
+	pNode->Epoch = pTree->Epoch;
+	pNode->nElems = 0;
+	pNode->bLeaf = bLeaf;
+	return pNode;
+}
+
+// The node itself if this write created it, else a copy replacing it.
+static snapshot_node* Writable(snapshot_tree* pTree, snapshot_node* pNode) {
+	if (pNode->Epoch == pTree->Epoch)
+		return pNode;
+	snapshot_node* pCopy = malloc_guarded(sizeof(*pCopy));
+	memcpy(pCopy, pNode, sizeof(*pCopy));
+	pCopy->Epoch = pTree->Epoch;
+	Retire(pTree, pNode, false);
+	return pCopy;
+}
+
+static void DropNode(snapshot_tree* pTree, snapshot_node* pNode) {
+	if (pNode->Epoch == pTree->Epoch)
+		free(pNode);
+	else
+		Retire(pTree, pNode, false);
+}
+
+// Inserts e at i, the kid after it being left for the caller to set.
+static void InsertAt(snapshot_node* pNode, uint32_t i, void* e) {
+	uint32_t nAfter = pNode->nElems - i;
+	memmove(&pNode->apElems[i + 1], &pNode->apElems[i], nAfter * sizeof(*pNode->apElems));
+	if (!pNode->bLeaf) {
+		memmove(&pNode->apKids[i + 2], &pNode->apKids[i + 1], nAfter * sizeof(*pNode->apKids));
+		memmove(&pNode->aCounts[i + 2], &pNode->aCounts[i + 1], nAfter * sizeof(*pNode->aCounts));
+	}
+	pNode->apElems[i] = e;
+	pNode->nElems += 1;
+}
+
+// Removes the element at i, and the kid after it.
+static void RemoveAt(snapshot_node* pNode, uint32_t i) {
+	uint32_t nAfter = pNode->nElems - i - 1;
+	memmove(&pNode->apElems[i], &pNode->apElems[i + 1], nAfter * sizeof(*pNode->apElems));
+	if (!pNode->bLeaf) {
+		memmove(&pNode->apKids[i + 1], &pNode->apKids[i + 2], nAfter * sizeof(*pNode->apKids));
+		memmove(&pNode->aCounts[i + 1], &pNode->aCounts[i + 2], nAfter * sizeof(*pNode->aCounts));
+	}
+	pNode->nElems -= 1;
+}
+
+// Moves the upper half of pNode to a new node, returned, and the
+// element between the halves to *ppMiddle.
+static snapshot_node* Split(snapshot_tree* pTree, snapshot_node* pNode, void** ppMiddle) {
+	uint32_t Middle = pNode->nElems / 2;
+	snapshot_node* pRight = NewNode(pTree, pNode->bLeaf);
+	pRight->nElems = pNode->nElems - Middle - 1;
+	memcpy(pRight->apElems, &pNode->apElems[Middle + 1], pRight->nElems * sizeof(*pRight->apElems));
+	if (!pNode->bLeaf) {
+		memcpy(pRight->apKids, &pNode->apKids[Middle + 1], (pRight->nElems + 1) * sizeof(*pRight->apKids));
+		memcpy(pRight->aCounts, &pNode->aCounts[Middle + 1], (pRight->nElems + 1) * sizeof(*pRight->aCounts));
+	}
+	*ppMiddle = pNode->apElems[Middle];
+	pNode->nElems = Middle;
+	return pRight;
+}
+
+// Adds e, which isn't in the subtree, to a writable copy of pNode. If
+// that overflows, the copy keeps the lower half and *ppRight gets the
+// upper one, *ppMiddle the element between them.
+static snapshot_node* Insert(snapshot_tree* pTree, snapshot_node* pNode, void* e, void** ppMiddle, snapshot_node** ppRight) {
+	bool bFound;
+	uint32_t i = SearchNode(pNode, e, pTree->pfnCompare, &bFound);
+	snapshot_node* pCopy = Writable(pTree, pNode);
+	*ppRight = NULL;
+	if (pCopy->bLeaf) {
+		InsertAt(pCopy, i, e);
+	} else {
+		void* pKidMiddle;
+		snapshot_node* pKidRight;
+		snapshot_node* pKid = Insert(pTree, pCopy->apKids[i], e, &pKidMiddle, &pKidRight);
+		pCopy->apKids[i] = pKid;
+		if (pKidRight) {
+			InsertAt(pCopy, i, pKidMiddle);
+			pCopy->apKids[i + 1] = pKidRight;
+			pCopy->aCounts[i] = CountNode(pKid);
+			pCopy->aCounts[i + 1] = CountNode(pKidRight);
+		} else {
+			pCopy->aCounts[i] += 1;
+		}
+	}
+	if (pCopy->nElems > MAX_ELEMS)
+		*ppRight = Split(pTree, pCopy, ppMiddle);
+	return pCopy;
+}
+
+// Merges kid i, element i and kid i + 1 into kid i.
+static void MergeKids(snapshot_tree* pTree, snapshot_node* pNode, uint32_t i) {
+	snapshot_node* pLeft = Writable(pTree, pNode->apKids[i]);
+	snapshot_node* pRight = pNode->apKids[i + 1];
+	pLeft->apElems[pLeft->nElems] = pNode->apElems[i];
+	memcpy(&pLeft->apElems[pLeft->nElems + 1], pRight->apElems, pRight->nElems * sizeof(*pLeft->apElems));
+	if (!pLeft->bLeaf) {
+		memcpy(&pLeft->apKids[pLeft->nElems + 1], pRight->apKids, (pRight->nElems + 1) * sizeof(*pLeft->apKids));
+		memcpy(&pLeft->aCounts[pLeft->nElems + 1], pRight->aCounts, (pRight->nElems + 1) * sizeof(*pLeft->aCounts));
+	}
+	pLeft->nElems += pRight->nElems + 1;
+	pNode->apKids[i] = pLeft;
+	pNode->aCounts[i] += pNode->aCounts[i + 1] + 1;
+	DropNode(pTree, pRight);
+	RemoveAt(pNode, i);
+}
+
+// Brings kid i of pNode, writable and one element short, back to
+// MIN_ELEMS with an element of a sibling, or merges it with one.
+static void FixKid(snapshot_tree* pTree, snapshot_node* pNode, uint32_t i) {
+	snapshot_node* pKid = pNode->apKids[i];
+	intptr_t Moved = 1;
+	if (i > 0 && pNode->apKids[i - 1]->nElems > MIN_ELEMS) {
+		snapshot_node* pLeft = Writable(pTree, pNode->apKids[i - 1]);
+		pNode->apKids[i - 1] = pLeft;
+		memmove(&pKid->apElems[1], pKid->apElems, pKid->nElems * sizeof(*pKid->apElems));
+		pKid->apElems[0] = pNode->apElems[i - 1];
+		if (!pKid->bLeaf) {
+			memmove(&pKid->apKids[1], pKid->apKids, (pKid->nElems + 1) * sizeof(*pKid->apKids));
+			memmove(&pKid->aCounts[1], pKid->aCounts, (pKid->nElems + 1) * sizeof(*pKid->aCounts));
+			pKid->apKids[0] = pLeft->apKids[pLeft->nElems];
+			pKid->aCounts[0] = pLeft->aCounts[pLeft->nElems];
+			Moved += pKid->aCounts[0];
+		}
+		pKid->nElems += 1;
+		pNode->apElems[i - 1] = pLeft->apElems[pLeft->nElems - 1];
+		pLeft->nElems -= 1;
+		pNode->aCounts[i - 1] -= Moved;
+		pNode->aCounts[i] += Moved;
+	} else if (i < pNode->nElems && pNode->apKids[i + 1]->nElems > MIN_ELEMS) {
+		snapshot_node* pRight = Writable(pTree, pNode->apKids[i + 1]);
+		pNode->apKids[i + 1] = pRight;
+		pKid->apElems[pKid->nElems] = pNode->apElems[i];
+		if (!pKid->bLeaf) {
+			pKid->apKids[pKid->nElems + 1] = pRight->apKids[0];
+			pKid->aCounts[pKid->nElems + 1] = pRight->aCounts[0];
+			Moved += pRight->aCounts[0];
+			memmove(pRight->apKids, &pRight->apKids[1], pRight->nElems * sizeof(*pRight->apKids));
+			memmove(pRight->aCounts, &pRight->aCounts[1], pRight->nElems * sizeof(*pRight->aCounts));
+		}
+		pKid->nElems += 1;
+		pNode->apElems[i] = pRight->apElems[0];
+		memmove(pRight->apElems, &pRight->apElems[1], (pRight->nElems - 1) * sizeof(*pRight->apElems));
+		pRight->nElems -= 1;
+		pNode->aCounts[i] += Moved;
+		pNode->aCounts[i + 1] -= Moved;
+	} else {
+		MergeKids(pTree, pNode, i > 0 ? i - 1 : i);
+	}
+}
+
+// Deletes the element at Index from a writable copy of pNode, which may
+// be left one element short for the caller to fix.
+static snapshot_node* Delete(snapshot_tree* pTree, snapshot_node* pNode, intptr_t Index, void** ppDeleted) {
+	snapshot_node* pCopy = Writable(pTree, pNode);
+	if (pCopy->bLeaf) {
+		*ppDeleted = pCopy->apElems[Index];
+		RemoveAt(pCopy, (uint32_t)Index);
+		return pCopy;
+	}
+	uint32_t i = 0;
+	for (; Index > pCopy->aCounts[i]; ++i)
+		Index -= pCopy->aCounts[i] + 1;
+	snapshot_node* pKid;
+	if (Index == pCopy->aCounts[i]) {
+		// The element is this node's: the greatest one of the kid
+		// before it takes its place.
+		void* pPrevious;
+		*ppDeleted = pCopy->apElems[i];
+		pKid = Delete(pTree, pCopy->apKids[i], pCopy->aCounts[i] - 1, &pPrevious);
+		pCopy->apElems[i] = pPrevious;
+	} else {
+		pKid = Delete(pTree, pCopy->apKids[i], Index, ppDeleted);
+	}
+	pCopy->apKids[i] = pKid;
+	pCopy->aCounts[i] -= 1;
+	if (pKid->nElems < MIN_ELEMS)
+		FixKid(pTree, pCopy, i);
+	return pCopy;
+}
+
+// A reader pinned at an epoch after the one of a write loaded the root
+// published by that write, or a later one, so what the write replaced
+// can go once all the readers pinned are from later epochs.
+static void Reclaim(snapshot_tree* pTree) {
+	if (pTree->FirstRetired == pTree->nRetired)
+		return;
+	size_t Oldest = AtomicLoad(&pTree->Epoch);
+	for (uint32_t i = 0; i < pTree->nReaders; ++i) {
+		size_t Epoch = AtomicLoad(&pTree->aReaders[i].Epoch);
+		if (Epoch != 0 && Epoch < Oldest)
+			Oldest = Epoch;
+	}
+	while (pTree->FirstRetired < pTree->nRetired && pTree->aRetired[pTree->FirstRetired].Epoch < Oldest)
+		FreeRetired(pTree, &pTree->aRetired[pTree->FirstRetired++]);
+	if (pTree->FirstRetired * 2 > pTree->nRetired) {
+		pTree->nRetired -= pTree->FirstRetired;
+		memmove(pTree->aRetired, &pTree->aRetired[pTree->FirstRetired], pTree->nRetired * sizeof(*pTree->aRetired));
+		pTree->FirstRetired = 0;
+	}
+}
+
+static void Publish(snapshot_tree* pTree, snapshot_node* pRoot) {
+	AtomicStorePointer((void* volatile*)&pTree->pRoot, pRoot);
+	AtomicFetchAdd(&pTree->Epoch, 1);
+	Reclaim(pTree);
+}
+
+void* SnapshotTreeAdd(snapshot_tree* pTree, void* e) {
+	snapshot_node* pRoot = pTree->pRoot;
+	void* pFound = FindInVersion(pRoot, e, pTree->pfnCompare, REL234_EQ, NULL);
+	if (pFound)
+		return pFound;
+
+	if (!pRoot) {
+		pRoot = NewNode(pTree, true);
+		InsertAt(pRoot, 0, e);
+	} else {
+		void* pMiddle;
+		snapshot_node* pRight;
+		snapshot_node* pLeft = Insert(pTree, pRoot, e, &pMiddle, &pRight);
+		pRoot = pLeft;
+		if (pRight) {
+			pRoot = NewNode(pTree, false);
+			pRoot->nElems = 1;
+			pRoot->apElems[0] = pMiddle;
+			pRoot->apKids[0] = pLeft;
+			pRoot->apKids[1] = pRight;
+			pRoot->aCounts[0] = CountNode(pLeft);
+			pRoot->aCounts[1] = CountNode(pRight);
+		}
+	}
+	Publish(pTree, pRoot);
+	return e;
+}
+
+bool SnapshotTreeDelete(snapshot_tree* pTree, void* e) {
+	snapshot_node* pRoot = pTree->pRoot;
+	intptr_t Index;
+	if (!FindInVersion(pRoot, e, pTree->pfnCompare, REL234_EQ, &Index))
+		return false;
+
+	void* pDeleted;
+	pRoot = Delete(pTree, pRoot, Index, &pDeleted);
+	if (pRoot->nElems == 0) {
+		snapshot_node* pEmpty = pRoot;
+		pRoot = pEmpty->bLeaf ? NULL : pEmpty->apKids[0];
+		DropNode(pTree, pEmpty);
+	}
+	Retire(pTree, pDeleted, true);
+	Publish(pTree, pRoot);
+	return true;
+}
+
+// Reader side
+
+void PinSnapshot(snapshot_tree* pTree, uint32_t Reader, snapshot* pSnapshot) {
+	// The epoch must be visible before the root is loaded, so that the
+	// writer doesn't free what this root leads to.
+	AtomicStore(&pTree->aReaders[Reader].Epoch, AtomicLoad(&pTree->Epoch));
+	pSnapshot->pTree = pTree;
+	pSnapshot->pRoot = AtomicLoadPointer((void* volatile*)&pTree->pRoot);
+	pSnapshot->Reader = Reader;
+}
+
+void UnpinSnapshot(snapshot* pSnapshot) {
+	AtomicStore(&pSnapshot->pTree->aReaders[pSnapshot->Reader].Epoch, 0);
+	pSnapshot->pRoot = NULL;
+}
+
+intptr_t SnapshotCount(const snapshot* pSnapshot) {
+	return CountNode(pSnapshot->pRoot);
+}
+
+void* SnapshotIndex(const snapshot* pSnapshot, intptr_t Index) {
+	return IndexNode(pSnapshot->pRoot, Index);
+}
+
+void* SnapshotFind(const snapshot* pSnapshot, void* e, cmpfn234 pfnCompare, int Relation, intptr_t* pIndex) {
+	return FindInVersion(pSnapshot->pRoot, e, pfnCompare ? pfnCompare : pSnapshot->pTree->pfnCompare, Relation, pIndex);
+}
+
+#ifdef BENCH_SNAPSHOT_TREE
+
+/*
+ * Benchmark, build with Platform.c and Tree234.c:
+ *   cc -O2 -DBENCH_SNAPSHOT_TREE -pthread -IInclude Source/SnapshotTree.c Source/Platform.c Source/Tree234.c
+ *
+ * It first checks the tree against a tree234 through random additions
+ * and deletions, and that a snapshot pinned meanwhile doesn't change.
+ *
+ * It then loads N keys (1000000 by default), and has 1, 8 and 32 reader
+ * threads look up random keys for a second each, while one more thread
+ * adds and deletes others all along. The same runs on a tree234 behind
+ * a mutex give the baseline.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#define MAX_READERS 32
+
+static double Now(void) {
+	struct timespec Time;
+	timespec_get(&Time, TIME_UTC);
+	return (double)Time.tv_sec + (double)Time.tv_nsec * 1e-9;
+}
+
+static uint64_t Random(uint64_t* pState) {
+	*pState ^= *pState << 13;
+	*pState ^= *pState >> 7;
+	*pState ^= *pState << 17;
+	return *pState;
+}
+
+static int CompareKey(void* pA, void* pB) {
+	intptr_t a = *(intptr_t*)pA;
+	intptr_t b = *(intptr_t*)pB;
+	return (a > b) - (a < b);
+}
+
+static void CountDestroyed(void* e, void* pContext) {
+	(void)e;
+	++*(size_t*)pContext;
+}
+
+static void Fail(const char* sWhat) {
+	fprintf(stderr, "%s\n", sWhat);
+	exit(1);
+}
+
+// Returns the element count, checking the counts, the fill and that
+// all the leaves are at the same depth.
+static intptr_t CheckNode(const snapshot_node* pNode, bool bRoot, int Depth, int* pLeafDepth) {
+	if (pNode->nElems > MAX_ELEMS || pNode->nElems < (bRoot ? 1u : MIN_ELEMS))
+		Fail("Node fill out of bounds");
+	if (pNode->bLeaf) {
+		if (*pLeafDepth < 0)
+			*pLeafDepth = Depth;
+		else if (*pLeafDepth != Depth)
+			Fail("Leaves at different depths");
+		return pNode->nElems;
+	}
+	intptr_t Count = pNode->nElems;
+	for (uint32_t i = 0; i <= pNode->nElems; ++i) {
+		if (CheckNode(pNode->apKids[i], false, Depth + 1, pLeafDepth) != pNode->aCounts[i])
+			Fail("Wrong kid count");
+		Count += pNode->aCounts[i];
+	}
+	return Count;
+}
+
+static void CheckAgainst(snapshot_tree* pTree, tree234* pMirror) {
+	snapshot Snapshot;
+	PinSnapshot(pTree, 0, &Snapshot);
+	int LeafDepth = -1;
+	intptr_t Count = count234(pMirror);
+	if (Snapshot.pRoot && CheckNode(Snapshot.pRoot, true, 0, &LeafDepth) != Count)
+		Fail("Wrong count");
+	if (SnapshotCount(&Snapshot) != Count)
+		Fail("Wrong count");
+	for (intptr_t i = 0; i < Count; ++i) {
+		void* e = index234(pMirror, i);
+		intptr_t Index = -1;
+		if (SnapshotIndex(&Snapshot, i) != e || SnapshotFind(&Snapshot, e, NULL, REL234_EQ, &Index) != e || Index != i)
+			Fail("Wrong element");
+	}
+	if (Count && SnapshotFind(&Snapshot, NULL, NULL, REL234_GT, NULL) != index234(pMirror, 0))
+		Fail("Wrong first element");
+	UnpinSnapshot(&Snapshot);
+}
+
+static void CheckTree(intptr_t* aKeys) {
+	enum { nKeys = 3000, nOps = 20000 };
+	size_t nDestroyed = 0;
+	snapshot_tree* pTree = NewSnapshotTree(CompareKey, CountDestroyed, &nDestroyed, 2);
+	tree234* pMirror = newtree234(CompareKey);
+	uint64_t State = 1;
+	size_t nDeleted = 0;
+	snapshot Old = { NULL, NULL, 0 };
+	void** apOld = NULL;
+	intptr_t nOld = 0;
+	for (int Op = 0; Op < nOps; ++Op) {
+		void* e = &aKeys[Random(&State) % nKeys];
+		// Grow for the first half, then mostly shrink to empty.
+		bool bAdd = Random(&State) % 100 < (Op < nOps / 2 ? 70u : 25u);
+		if (bAdd) {
+			if (SnapshotTreeAdd(pTree, e) != add234(pMirror, e))
+				Fail("Add mismatch");
+		} else {
+			bool bDeleted = SnapshotTreeDelete(pTree, e);
+			if (bDeleted != (del234(pMirror, e) != NULL))
+				Fail("Delete mismatch");
+			nDeleted += bDeleted;
+		}
+		if (Op % 7 == 0 || Op > nOps - 2000)
+			CheckAgainst(pTree, pMirror);
+
+		if (Op == nOps / 4) {
+			PinSnapshot(pTree, 1, &Old);
+			nOld = count234(pMirror);
+			apOld = malloc_guarded((nOld + 1) * sizeof(*apOld));
+			for (intptr_t i = 0; i < nOld; ++i)
+				apOld[i] = index234(pMirror, i);
+		} else if (Op == nOps * 3 / 4) {
+			if (SnapshotCount(&Old) != nOld)
+				Fail("Pinned snapshot changed");
+			for (intptr_t i = 0; i < nOld; ++i)
+				if (SnapshotIndex(&Old, i) != apOld[i])
+					Fail("Pinned snapshot changed");
+			UnpinSnapshot(&Old);
+			free(apOld);
+		}
+	}
+	// Nothing is pinned, so each write frees all it replaces.
+	SnapshotTreeDelete(pTree, &aKeys[nKeys]);
+	if (SnapshotTreeAdd(pTree, &aKeys[nKeys]) != &aKeys[nKeys] || GetSnapshotTreeRetiredCount(pTree) != 0)
+		Fail("Retired nodes not freed");
+	if (nDestroyed != nDeleted)
+		Fail("Deleted elements not destroyed");
+	intptr_t nLeft = count234(pMirror) + 1;
+	FreeSnapshotTree(pTree);
+	freetree234(pMirror);
+	if (nDestroyed != nDeleted + nLeft)
+		Fail("Elements left not destroyed");
+	printf("Checked %d operations\n", nOps);
+}
+
+typedef struct {
+	size_t n;
+	char aPadding[64 - sizeof(size_t)];
+} counter;
+
+typedef struct {
+	intptr_t* aKeys;
+	size_t nKeys; // Even keys loaded, odd ones written
+	snapshot_tree* pTree;
+	tree234* pLocked;
+	mutex Mutex;
+	uint32_t nReaders;
+	volatile size_t nReadersDone;
+	double Deadline;
+	counter aCounts[MAX_READERS + 1];
+} bench;
+
+static void ThreadProc(void* pContext, uint32_t ThreadIndex) {
+	bench* pBench = pContext;
+	uint64_t State = 0x9E3779B97F4A7C15u * (ThreadIndex + 1);
+	size_t n = 0;
+	if (ThreadIndex == 0) {
+		// The writer, until the readers are done.
+		while (AtomicLoad(&pBench->nReadersDone) < pBench->nReaders) {
+			void* e = &pBench->aKeys[(Random(&State) % pBench->nKeys) | 1];
+			if (pBench->pTree) {
+				if (SnapshotTreeAdd(pBench->pTree, e) != e)
+					SnapshotTreeDelete(pBench->pTree, e);
+			} else {
+				MutexLock(&pBench->Mutex);
+				if (add234(pBench->pLocked, e) != e)
+					del234(pBench->pLocked, e);
+				MutexUnlock(&pBench->Mutex);
+			}
+			++n;
+		}
+	} else {
+		while ((n & 1023) != 0 || Now() < pBench->Deadline) {
+			void* e = &pBench->aKeys[Random(&State) % pBench->nKeys];
+			if (pBench->pTree) {
+				snapshot Snapshot;
+				PinSnapshot(pBench->pTree, ThreadIndex - 1, &Snapshot);
+				if (!SnapshotFind(&Snapshot, e, NULL, REL234_EQ, NULL) && (*(intptr_t*)e & 1) == 0)
+					Fail("Loaded key not found");
+				UnpinSnapshot(&Snapshot);
+			} else {
+				MutexLock(&pBench->Mutex);
+				if (!find234(pBench->pLocked, e, NULL) && (*(intptr_t*)e & 1) == 0)
+					Fail("Loaded key not found");
+				MutexUnlock(&pBench->Mutex);
+			}
+			++n;
+		}
+		AtomicFetchAdd(&pBench->nReadersDone, 1);
+	}
+	pBench->aCounts[ThreadIndex].n = n;
+}
+
+int main(int argc, char** argv) {
+	size_t nKeys = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	intptr_t* aKeys = malloc_guarded(2 * nKeys * sizeof(*aKeys));
+	for (size_t i = 0; i < 2 * nKeys; ++i)
+		aKeys[i] = (intptr_t)i;
+	if (nKeys < 3001)
+		Fail("At least 3001 keys are needed");
+	CheckTree(aKeys);
+
+	printf("%zu keys, %u processors\n", nKeys, GetProcessorCount());
+	static const uint32_t anReaders[] = { 1, 8, MAX_READERS };
+	for (int bLocked = 0; bLocked < 2; ++bLocked) {
+		for (size_t r = 0; r < sizeof(anReaders) / sizeof(*anReaders); ++r) {
+			bench* pBench = malloc_guarded(sizeof(*pBench));
+			memset(pBench, 0, sizeof(*pBench));
+			pBench->aKeys = aKeys;
+			pBench->nKeys = 2 * nKeys;
+			pBench->nReaders = anReaders[r];
+			if (bLocked) {
+				pBench->pLocked = newtree234(CompareKey);
+				for (size_t i = 0; i < nKeys; ++i)
+					add234(pBench->pLocked, &aKeys[2 * i]);
+				MutexInit(&pBench->Mutex);
+			} else {
+				pBench->pTree = NewSnapshotTree(CompareKey, NULL, NULL, MAX_READERS);
+				for (size_t i = 0; i < nKeys; ++i)
+					SnapshotTreeAdd(pBench->pTree, &aKeys[2 * i]);
+			}
+			double Start = Now();
+			pBench->Deadline = Start + 1;
+			RunThreads(anReaders[r] + 1, ThreadProc, pBench);
+			double Time = Now() - Start;
+			size_t nLookups = 0;
+			for (uint32_t i = 1; i <= anReaders[r]; ++i)
+				nLookups += pBench->aCounts[i].n;
+			printf(
+				"%s %2u readers: %10.0f lookups/s, %9.0f writes/s\n",
+				bLocked ? "tree234+mutex" : "snapshot tree",
+				anReaders[r],
+				nLookups / Time,
+				pBench->aCounts[0].n / Time
+			);
+			if (bLocked) {
+				MutexDestroy(&pBench->Mutex);
+				freetree234(pBench->pLocked);
+			} else {
+				FreeSnapshotTree(pBench->pTree);
+			}
+			free(pBench);
+		}
+	}
+	free(aKeys);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,149 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AsciiCase.h"
+#include "GuardedMalloc.h"
+#include "StringPool.h"
+
+// Chunks of string data double from the first size to the last one,
+// so small pools don't pay for a large chunk.
+#define FIRST_CHUNK_SIZE 1024
+#define CHUNK_SIZE 65536
+
+typedef struct {
+	const char* s;
+	uint32_t Length;
+	uint32_t Hash;
+} pool_entry;
+
+typedef struct {
+	uint32_t Hash;
+	uint32_t Index; // Index of the entry + 1, 0 for an empty slot
+} pool_slot;
+
+typedef struct pool_chunk_Tag pool_chunk;
+struct pool_chunk_Tag {
+	pool_chunk* pNext;
+	size_t Used;
+	size_t Size;
+	char aData[];
+};
+
+struct string_pool_Tag {
+	pool_slot* aSlots;
+	uint32_t Mask; // Slot count - 1, a power of 2
+	pool_entry* aEntries;
+	uint32_t nEntries;
+	uint32_t EntryCapacity;
+	pool_chunk* pChunk; // Being filled, linked to the full ones
+	uint64_t nInterned;
+	uint64_t ChunkBytes;
+};
+
+string_pool* NewStringPool(void) {
+	string_pool* pPool = malloc_guarded(sizeof(*pPool));
+	memset(pPool, 0, sizeof(*pPool));
+	pPool->Mask = 15;
+	pPool->aSlots = malloc_guarded((pPool->Mask + 1) * sizeof(*pPool->aSlots));
+	memset(pPool->aSlots, 0, (pPool->Mask + 1) * sizeof(*pPool->aSlots));
+	return pPool;
+}
+
+void FreeStringPool(string_pool* pPool) {
+	for (pool_chunk* pChunk = pPool->pChunk; pChunk;) {
+		pool_chunk* pNext = pChunk->pNext;
+		free(pChunk);
+		pChunk = pNext;
+	}
+	free(pPool->aEntries);
+	free(pPool->aSlots);
+	free(pPool);
+}
+
+// Long strings get a chunk of their own, put behind the current one so
+// its free space isn't lost.
+static char* CopyToChunk(string_pool* pPool, const char* s, size_t Length) {
+	pool_chunk* pChunk = pPool->pChunk;
+	if (!pChunk || pChunk->Size - pChunk->Used < Length + 1) {
+		size_t ChunkSize = !pChunk ? FIRST_CHUNK_SIZE : pChunk->Size * 2 > CHUNK_SIZE ? CHUNK_SIZE : pChunk->Size * 2;
+		bool bOwnChunk = Length + 1 > ChunkSize / 4;
+		size_t Size = bOwnChunk ? Length + 1 : ChunkSize;
+		pool_chunk* pNew = malloc_guarded(sizeof(*pNew) + Size);
+		pNew->Used = 0;
+		pNew->Size = Size;
+		pPool->ChunkBytes += sizeof(*pNew) + Size;
+		if (pChunk && bOwnChunk) {
+			pNew->pNext = pChunk->pNext;
+			pChunk->pNext = pNew;
+		} else {
+			pNew->pNext = pChunk;
+			pPool->pChunk = pNew;
+		}
+		pChunk = pNew;
+	}
+	char* pCopy = pChunk->aData + pChunk->Used;
+	memcpy(pCopy, s, Length);
+	pCopy[Length] = '\0';
+	pChunk->Used += Length + 1;
+	return pCopy;
+}
+
+static void GrowSlots(string_pool* pPool) {
+	uint32_t OldCount = pPool->Mask + 1;
+	pool_slot* aOld = pPool->aSlots;
+	pPool->Mask = OldCount * 2 - 1;
+	pPool->aSlots = malloc_guarded(OldCount * 2 * sizeof(*pPool->aSlots));
+	memset(pPool->aSlots, 0, OldCount * 2 * sizeof(*pPool->aSlots));
+	for (uint32_t i = 0; i < OldCount; ++i) {
+		if (!aOld[i].Index)
+			continue;
+		uint32_t Slot = aOld[i].Hash & pPool->Mask;
+		while (pPool->aSlots[Slot].Index)
+			Slot = (Slot + 1) & pPool->Mask;
+		pPool->aSlots[Slot] = aOld[i];
+	}
+	free(aOld);
+}
+
+uint32_t InternString(string_pool* pPool, const char* s, size_t Length) {
+	uint32_t Hash = HashStringI(s, Length);
+	pPool->nInterned += 1;
+
+	uint32_t Slot = Hash & pPool->Mask;
+	for (; pPool->aSlots[Slot].Index; Slot = (Slot + 1) & pPool->Mask) {
+		if (pPool->aSlots[Slot].Hash != Hash)
+			continue;
+		uint32_t Index = pPool->aSlots[Slot].Index - 1;
+		const pool_entry* pEntry = &pPool->aEntries[Index];
+		if (pEntry->Length == Length && EqualStringI(pEntry->s, s, Length))
+			return Index;
+	}
+
+	uint32_t Index = pPool->nEntries;
+	if (Index == UINT32_MAX - 1)
+		abort();
+	if (Index == pPool->EntryCapacity) {
+		pPool->EntryCapacity = pPool->EntryCapacity ? pPool->EntryCapacity * 2 : 16;
+		pPool->aEntries = realloc_guarded(pPool->aEntries, (size_t)pPool->EntryCapacity * sizeof(*pPool->aEntries));
+	}
+	pool_entry* pEntry = &pPool->aEntries[Index];
+	pEntry->s = CopyToChunk(pPool, s, Length);
+	pEntry->Length = (uint32_t)Length;
+	pEntry->Hash = Hash;
+	pPool->nEntries += 1;
+	pPool->aSlots[Slot] = (pool_slot){ Hash, Index + 1 };
+
+	// Keep the load factor at 1/2 at most.
+	if (pPool->nEntries * 2 > pPool->Mask + 1)
+		GrowSlots(pPool);
+	return Index;
+}
+
+void GetStringPoolStats(string_pool* pPool, string_pool_stats* pStats) {
+	pStats->nInterned = pPool->nInterned;
+	pStats->nDistinct = pPool->nEntries;
+	pStats->PoolBytes = sizeof(*pPool) + pPool->ChunkBytes;
+	pStats->PoolBytes += (uint64_t)(pPool->Mask + 1) * sizeof(*pPool->aSlots);
+	pStats->PoolBytes += (uint64_t)pPool->EntryCapacity * sizeof(*pPool->aEntries);
+}
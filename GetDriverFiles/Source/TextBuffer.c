@@ -0,0 +1,56 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "GuardedMalloc.h"
+#include "TextBuffer.h"
+
+static void Reserve(text_buffer* pText, size_t Length) {
+	if (pText->Length + Length <= pText->Capacity)
+		return;
+	size_t Capacity = pText->Capacity ? pText->Capacity : 256;
+	while (Capacity < pText->Length + Length)
+		Capacity *= 2;
+	pText->p = realloc_guarded(pText->p, Capacity);
+	pText->Capacity = Capacity;
+}
+
+void TextAppend(text_buffer* pText, const char* s, size_t Length) {
+	if (Length == 0)
+		return;
+	Reserve(pText, Length);
+	memcpy(pText->p + pText->Length, s, Length);
+	pText->Length += Length;
+}
+
+void TextAppendString(text_buffer* pText, const char* s) {
+	TextAppend(pText, s, strlen(s));
+}
+
+void TextAppendFormat(text_buffer* pText, const char* sFormat, ...) {
+	va_list Args;
+	va_start(Args, sFormat);
+	TextAppendFormatV(pText, sFormat, Args);
+	va_end(Args);
+}
+
+void TextAppendFormatV(text_buffer* pText, const char* sFormat, va_list Args) {
+	va_list Args2;
+	va_copy(Args2, Args);
+	int Length = vsnprintf(NULL, 0, sFormat, Args2);
+	va_end(Args2);
+	if (Length <= 0)
+		return;
+
+	// vsnprintf needs room for '\0'
+	Reserve(pText, (size_t)Length + 1);
+	vsnprintf(pText->p + pText->Length, (size_t)Length + 1, sFormat, Args);
+	pText->Length += (size_t)Length;
+}
+
+void TextFree(text_buffer* pText) {
+	free(pText->p);
+	pText->p = NULL;
+	pText->Length = 0;
+	pText->Capacity = 0;
+}
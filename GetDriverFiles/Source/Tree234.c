@@ -30,14 +30,17 @@
  * and add support for intptr_t
  */
 
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include "Tree234.h"
 #include "GuardedMalloc.h"
 
 #define smalloc malloc_guarded
+#define srealloc realloc_guarded
 #define sfree free
 
 void* mknew_helper(size_t size) {
@@ -55,11 +58,279 @@ void* mknew_helper(size_t size) {
 #define LOG(x)
 #endif
 
+/*
+ * Ask for the cache line at p ahead of use, where the compiler has a
+ * way to.
+ */
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <xmmintrin.h>
+#define PREFETCH234(p) _mm_prefetch((const char*)(p), _MM_HINT_T0)
+#elif defined(__GNUC__)
+#define PREFETCH234(p) __builtin_prefetch(p)
+#else
+#define PREFETCH234(p) ((void)(p))
+#endif
+
+/*
+ * For the count of trees sharing a heap, so that each can be freed
+ * from its own thread.
+ */
+#if defined(_MSC_VER)
+#include <intrin.h>
+#ifdef _WIN64
+#define ATOMICADD234(p, v) _InterlockedExchangeAdd64((volatile __int64*)(p), (v))
+#else
+#define ATOMICADD234(p, v) _InterlockedExchangeAdd((volatile long*)(p), (long)(v))
+#endif
+#else
+#define ATOMICADD234(p, v) __atomic_fetch_add((p), (v), __ATOMIC_ACQ_REL)
+#endif
+
+/*
+ * Elements per node. 3 gives the 2-3-4 tree below; larger values give
+ * the counted B-tree after it, which has the same interface.
+ */
+#ifndef TREE234_KEYS
+#define TREE234_KEYS 3
+#endif
+
+/*
+ * Nodes are carved out of slabs, each one twice the size of the
+ * previous one up to SLAB234_MAX nodes, so a tree of n nodes takes
+ * O(log n + n / SLAB234_MAX) mallocs. Deleted nodes go on a free list
+ * for the next insertions, linked through their first field (the
+ * parent pointer in both layouts); the slabs are only released with
+ * the heap they belong to.
+ *
+ * A heap is normally a tree's own, but split234 leaves two trees with
+ * nodes from the same slabs, so they share it, and join234 of two
+ * trees with different heaps moves the slabs of the right one to the
+ * left one. The right heap is then left forwarding to the left one for
+ * the other trees still using it. A heap goes when no tree and no
+ * other heap refers to it. Only that count is atomic: the free list
+ * and slabs of a shared heap are not locked.
+ *
+ * With TREE234_COMPACT, slabs are all of SLAB234_MAX nodes and listed
+ * in a table per pool, so a node can be found from a 32-bit number:
+ * the pool in the top bit, then the slab and the place in it. The
+ * number is kept in the node's first field, and the free list goes
+ * through the second. Heaps are never merged then, as that would
+ * renumber the nodes of one of them.
+ */
+#ifdef TREE234_COMPACT
+#if TREE234_KEYS == 3
+#error TREE234_COMPACT needs the B-tree layout (TREE234_KEYS of 4 or more)
+#endif
+#define SLAB234_SHIFT 6
+#define SLAB234_MIN (1 << SLAB234_SHIFT)
+#define SLAB234_MAX (1 << SLAB234_SHIFT)
+#define NEXTFREE234(n) (((void**)(n))[1])
+#else
+#define SLAB234_MIN 8
+#define SLAB234_MAX 1024
+#define NEXTFREE234(n) (*(void**)(n))
+#endif
+
+typedef struct slab234_Tag slab234;
+typedef struct heap234_Tag heap234;
+
+struct slab234_Tag {
+	slab234* next;
+	intptr_t size;
+	void* nodes[];
+};
+
+typedef struct {
+	void* freenodes, * lastfree;
+	slab234* slabs, * lastslab;    /* newest first */
+	intptr_t slabused;             /* nodes handed out from slabs */
+	size_t nodesize;
+#ifdef TREE234_COMPACT
+	char** chunks;                 /* the slabs' nodes, oldest first */
+	uint32_t nchunks, chunkroom;
+	uint32_t tag;                  /* the top bit of the pool's numbers */
+#endif
+} pool234;
+
+struct heap234_Tag {
+	volatile intptr_t refs;        /* trees and heaps forwarding here */
+	heap234* merged;               /* where the slabs went, if joined */
+	pool234 pools[2];              /* the 2-3-4 layout only uses one */
+};
+
+static heap234* newheap234(size_t size0, size_t size1) {
+	heap234* heap = mknew(heap234);
+	intptr_t i;
+	heap->refs = 1;
+	heap->merged = NULL;
+	for (i = 0; i < 2; i++) {
+		pool234* pool = &heap->pools[i];
+		pool->freenodes = pool->lastfree = NULL;
+		pool->slabs = pool->lastslab = NULL;
+		pool->slabused = 0;
+		pool->nodesize = i == 0 ? size0 : size1;
+#ifdef TREE234_COMPACT
+		pool->chunks = NULL;
+		pool->nchunks = pool->chunkroom = 0;
+		pool->tag = (uint32_t)i << 31;
+#endif
+	}
+	return heap;
+}
+
+static void* allocpool234(pool234* pool) {
+	void* n = pool->freenodes;
+	if (n) {
+		pool->freenodes = NEXTFREE234(n);
+		if (!pool->freenodes)
+			pool->lastfree = NULL;
+		return n;
+	}
+	if (!pool->slabs || pool->slabused == pool->slabs->size) {
+		intptr_t size = pool->slabs ? pool->slabs->size * 2 : SLAB234_MIN;
+		slab234* slab;
+		if (size > SLAB234_MAX)
+			size = SLAB234_MAX;
+		slab = smalloc(sizeof(slab234) + size * pool->nodesize);
+		slab->next = pool->slabs;
+		slab->size = size;
+		if (!pool->slabs)
+			pool->lastslab = slab;
+		pool->slabs = slab;
+		pool->slabused = 0;
+		LOG(("  allocated slab %p of %d nodes\n", slab, size));
+#ifdef TREE234_COMPACT
+		if (pool->nchunks == pool->chunkroom) {
+			pool->chunkroom = pool->chunkroom ? pool->chunkroom * 2 : 16;
+			pool->chunks = srealloc(pool->chunks, pool->chunkroom * sizeof(char*));
+		}
+		pool->chunks[pool->nchunks++] = (char*)slab->nodes;
+#endif
+	}
+	n = (char*)pool->slabs->nodes + pool->slabused * pool->nodesize;
+#ifdef TREE234_COMPACT
+	*(uint32_t*)n = pool->tag |
+		((pool->nchunks - 1) << SLAB234_SHIFT | (uint32_t)pool->slabused);
+#endif
+	pool->slabused++;
+	return n;
+}
+
+#ifdef TREE234_COMPACT
+static void* refnode234(heap234* heap, uint32_t ref) {
+	pool234* pool = &heap->pools[ref >> 31];
+	uint32_t i = ref & 0x7FFFFFFF;
+	return pool->chunks[i >> SLAB234_SHIFT] +
+		(i & (SLAB234_MIN - 1)) * pool->nodesize;
+}
+#endif
+
+static void freepool234(pool234* pool, void* n) {
+	NEXTFREE234(n) = pool->freenodes;
+	if (!pool->freenodes)
+		pool->lastfree = n;
+	pool->freenodes = n;
+}
+
+#ifndef TREE234_COMPACT
+/*
+ * Move the slabs and free nodes of from to to. Nodes keep being handed
+ * out from the newest slab of to, and what's left of the newest slab
+ * of from goes unused.
+ */
+static void mergepool234(pool234* to, pool234* from) {
+	if (from->slabs) {
+		if (!to->slabs) {
+			to->slabs = from->slabs;
+			to->lastslab = from->lastslab;
+			to->slabused = from->slabused;
+		}
+		else {
+			from->lastslab->next = to->slabs->next;
+			to->slabs->next = from->slabs;
+			if (to->lastslab == to->slabs)
+				to->lastslab = from->lastslab;
+		}
+	}
+	if (from->freenodes) {
+		NEXTFREE234(from->lastfree) = to->freenodes;
+		if (!to->freenodes)
+			to->lastfree = from->lastfree;
+		to->freenodes = from->freenodes;
+	}
+	from->freenodes = from->lastfree = NULL;
+	from->slabs = from->lastslab = NULL;
+}
+#endif
+
+/*
+ * Drop a reference to heap, freeing it once unused, and so on along
+ * the heaps it forwards to.
+ */
+static void releaseheap234(heap234* heap) {
+	while (heap && ATOMICADD234(&heap->refs, -1) == 1) {
+		heap234* next = heap->merged;
+		intptr_t i;
+		for (i = 0; i < 2; i++) {
+			slab234* slab = heap->pools[i].slabs;
+			while (slab) {
+				slab234* nextslab = slab->next;
+				sfree(slab);
+				slab = nextslab;
+			}
+#ifdef TREE234_COMPACT
+			sfree(heap->pools[i].chunks);
+#endif
+		}
+		sfree(heap);
+		heap = next;
+	}
+}
+
+/*
+ * The heap a tree allocates from, after following any forwarding.
+ */
+static heap234* treeheap234(heap234** heapp) {
+	heap234* heap = *heapp;
+	if (heap->merged) {
+		heap234* root = heap->merged;
+		while (root->merged)
+			root = root->merged;
+		ATOMICADD234(&root->refs, 1);
+		*heapp = root;
+		releaseheap234(heap);
+	}
+	return *heapp;
+}
+
+#ifndef TREE234_COMPACT
+/*
+ * Make the heaps of two trees one, the second one forwarding to the
+ * first.
+ */
+static void mergeheaps234(heap234** to, heap234** from) {
+	heap234* toheap = treeheap234(to);
+	heap234* fromheap = treeheap234(from);
+	intptr_t i;
+	if (toheap == fromheap)
+		return;
+	for (i = 0; i < 2; i++)
+		mergepool234(&toheap->pools[i], &fromheap->pools[i]);
+	fromheap->merged = toheap;
+	ATOMICADD234(&toheap->refs, 1);
+}
+#endif
+
+#if TREE234_KEYS == 3
+
 typedef struct node234_Tag node234;
 
 struct tree234_Tag {
 	node234* root;
 	cmpfn234 cmp;
+	heap234* heap;
+	node234* last;                 /* the rightmost leaf, if known */
+	intptr_t pending;              /* appended to it, not counted above */
 };
 
 struct node234_Tag {
@@ -69,6 +340,17 @@ struct node234_Tag {
 	void* elems[3];
 };
 
+/* Kid i of n, for the code shared with the compact B-tree layout. */
+#define KID234(t, n, i) ((n)->kids[i])
+
+static node234* allocnode234(tree234* t) {
+	return allocpool234(&treeheap234(&t->heap)->pools[0]);
+}
+
+static void freenode234(tree234* t, node234* n) {
+	freepool234(&treeheap234(&t->heap)->pools[0], n);
+}
+
 /*
  * Create a 2-3-4 tree.
  */
@@ -77,26 +359,58 @@ tree234* newtree234(cmpfn234 cmp) {
 	LOG(("created tree %p\n", ret));
 	ret->root = NULL;
 	ret->cmp = cmp;
+	ret->heap = newheap234(sizeof(node234), 0);
+	ret->last = NULL;
+	ret->pending = 0;
 	return ret;
 }
 
 /*
- * Free a 2-3-4 tree (not including freeing the elements).
+ * Free a 2-3-4 tree (not including freeing the elements). The nodes
+ * all live in the slabs, so there's no need to walk them.
  */
-static void freenode234(node234* n) {
-	if (!n)
-		return;
-	freenode234(n->kids[0]);
-	freenode234(n->kids[1]);
-	freenode234(n->kids[2]);
-	freenode234(n->kids[3]);
-	sfree(n);
-}
 void freetree234(tree234* t) {
-	freenode234(t->root);
+	releaseheap234(t->heap);
 	sfree(t);
 }
 
+/*
+ * Free a 2-3-4 tree, passing each element to destroy first, in order.
+ * The walk follows the parent pointers instead of recursing: down to
+ * the leftmost leaf, then up to the first ancestor with an element
+ * after the kid we came from, and down again to the leftmost leaf past
+ * that element. Each node is entered and left once, so it's O(n).
+ */
+void freetree234_with(tree234* t, destroyfn234 destroy, void* ctx) {
+	node234* n = t->root;
+	intptr_t i, k;
+
+	if (n) {
+		while (n->kids[0])
+			n = n->kids[0];
+		for (;;) {
+			for (i = 0; i < 3 && n->elems[i]; i++)
+				destroy(n->elems[i], ctx);
+			for (;;) {
+				node234* p = n->parent;
+				if (!p)
+					goto done;
+				for (k = 0; p->kids[k] != n; k++);
+				if (k < 3 && p->elems[k]) {
+					destroy(p->elems[k], ctx);
+					n = p->kids[k + 1];
+					while (n->kids[0])
+						n = n->kids[0];
+					break;
+				}
+				n = p;
+			}
+		}
+	}
+done:
+	freetree234(t);
+}
+
 /*
  * Internal function to count a node.
  */
@@ -118,110 +432,143 @@ static intptr_t countnode234(node234* n) {
  */
 intptr_t count234(tree234* t) {
 	if (t->root)
-		return countnode234(t->root);
+		return countnode234(t->root) + t->pending;
 	else
 		return 0;
 }
 
 /*
- * Add an element e to a 2-3-4 tree t. Returns e on success, or if
- * an existing element compares equal, returns that.
+ * What the cursor functions need to know of a node, the same for both
+ * layouts.
  */
-static void* add234_internal(tree234* t, void* e, intptr_t index) {
-	node234* n, ** np, * left, * right;
-	void* orig_e = e;
-	intptr_t c, lcount, rcount;
+static int nodeelems234(node234* n) {
+	return n->elems[2] ? 3 : n->elems[1] ? 2 : n->elems[0] ? 1 : 0;
+}
 
-	LOG(("adding node %p to tree %p\n", e, t));
-	if (t->root == NULL) {
-		t->root = mknew(node234);
-		t->root->elems[1] = t->root->elems[2] = NULL;
-		t->root->kids[0] = t->root->kids[1] = NULL;
-		t->root->kids[2] = t->root->kids[3] = NULL;
-		t->root->counts[0] = t->root->counts[1] = 0;
-		t->root->counts[2] = t->root->counts[3] = 0;
-		t->root->parent = NULL;
-		t->root->elems[0] = e;
-		LOG(("  created root %p\n", t->root));
-		return orig_e;
+static int isleaf234(node234* n) {
+	return n->kids[0] == NULL;
+}
+
+static intptr_t kidcount234(node234* n, int i) {
+	return n->counts[i];
+}
+
+/*
+ * add234 puts elements past the last one straight into the rightmost
+ * leaf while it has room, and leaves the counts of the nodes above it
+ * to be brought up to date here, by the first function that needs
+ * them. That's all but find234, so a tree being read with nothing else
+ * stays unchanged.
+ */
+static int appendleaf234(node234* n, void* e) {
+	int k = nodeelems234(n);
+	if (k == 3)
+		return 0;
+	n->elems[k] = e;
+	return 1;
+}
+
+static void sync234(tree234* t) {
+	node234* n;
+	if (!t->pending)
+		return;
+	for (n = t->root; n->kids[0]; n = n->kids[nodeelems234(n)])
+		n->counts[nodeelems234(n)] += t->pending;
+	t->pending = 0;
+}
+
+static node234* newnode234(tree234* t) {
+	node234* node = allocnode234(t);
+	intptr_t i;
+	node->parent = NULL;
+	for (i = 0; i < 4; i++) {
+		node->kids[i] = NULL;
+		node->counts[i] = 0;
 	}
+	for (i = 0; i < 3; i++)
+		node->elems[i] = NULL;
+	return node;
+}
 
-	np = &t->root;
-	n = *np;
-	while (*np) {
-		intptr_t childnum;
-		n = *np;
-		LOG(("  node %p: %p/%d [%p] %p/%d [%p] %p/%d [%p] %p/%d\n",
-			n,
-			n->kids[0], n->counts[0], n->elems[0],
-			n->kids[1], n->counts[1], n->elems[1],
-			n->kids[2], n->counts[2], n->elems[2],
-			n->kids[3], n->counts[3]));
-		if (index >= 0) {
-			if (!n->kids[0]) {
-				/*
-				 * Leaf node. We want to insert at kid position
-				 * equal to the index:
-				 *
-				 *   0 A 1 B 2 C 3
-				 */
-				childnum = index;
-			}
-			else {
-				/*
-				 * Internal node. We always descend through it (add
-				 * always starts at the bottom, never in the
-				 * middle).
-				 */
-				do { /* this is a do ... while (0) to allow `break' */
-					if (index <= n->counts[0]) {
-						childnum = 0;
-						break;
-					}
-					index -= n->counts[0] + 1;
-					if (index <= n->counts[1]) {
-						childnum = 1;
-						break;
-					}
-					index -= n->counts[1] + 1;
-					if (index <= n->counts[2]) {
-						childnum = 2;
-						break;
-					}
-					index -= n->counts[2] + 1;
-					if (index <= n->counts[3]) {
-						childnum = 3;
-						break;
-					}
-					return NULL;       /* error: index out of range */
-				} while (0);
+/*
+ * Create a 2-3-4 tree from n elements, bottom-up in O(n) rather than
+ * with n calls to add234 or addpos234.
+ *
+ * The leaves are filled first: ceil((n+1)/4) of them, holding all the
+ * elements but the ones separating them, shared out evenly so each
+ * leaf gets 3 or close to it. Each level above groups the nodes of the level
+ * below by 4, taking the separators between them, and passes up the
+ * separators between groups, until a single node is left. Every node
+ * but the rightmost of each level is thus full or nearly so, and the
+ * tree is as low as n elements allow.
+ */
+tree234* buildtree234(cmpfn234 cmp, void** elems, intptr_t n) {
+	tree234* ret = newtree234(cmp);
+	node234** nodes;
+	void** seps;
+	intptr_t nnodes, nparents, i, j, k, start, nkids;
+
+#ifndef NDEBUG
+	for (i = 1; cmp && i < n; i++)
+		assert(cmp(elems[i - 1], elems[i]) < 0);
+#endif
+
+	if (n <= 0)
+		return ret;
+
+	nnodes = (n + 1 + 3) / 4;
+	nodes = smalloc(nnodes * sizeof(*nodes));
+	seps = smalloc(nnodes * sizeof(*seps));
+	start = 0;
+	for (i = 0; i < nnodes; i++) {
+		intptr_t rest = n - (nnodes - 1);
+		intptr_t count = rest / nnodes + (i < rest % nnodes);
+		nodes[i] = newnode234(ret);
+		for (j = 0; j < count; j++)
+			nodes[i]->elems[j] = elems[start++];
+		if (i < nnodes - 1)
+			seps[i] = elems[start++];
+	}
+
+	/* Parents are written over the nodes and separators they take. */
+	while (nnodes > 1) {
+		nparents = (nnodes + 3) / 4;
+		start = 0;
+		for (i = 0; i < nparents; i++) {
+			node234* parent = newnode234(ret);
+			nkids = nnodes / nparents + (i < nnodes % nparents);
+			for (k = 0; k < nkids; k++) {
+				node234* kid = nodes[start];
+				kid->parent = parent;
+				parent->kids[k] = kid;
+				parent->counts[k] = countnode234(kid);
+				if (k < nkids - 1)
+					parent->elems[k] = seps[start];
+				start++;
 			}
+			nodes[i] = parent;
+			if (i < nparents - 1)
+				seps[i] = seps[start - 1];
 		}
-		else {
-			if ((c = t->cmp(e, n->elems[0])) < 0)
-				childnum = 0;
-			else if (c == 0)
-				return n->elems[0];	       /* already exists */
-			else if (n->elems[1] == NULL || (c = t->cmp(e, n->elems[1])) < 0)
-				childnum = 1;
-			else if (c == 0)
-				return n->elems[1];	       /* already exists */
-			else if (n->elems[2] == NULL || (c = t->cmp(e, n->elems[2])) < 0)
-				childnum = 2;
-			else if (c == 0)
-				return n->elems[2];	       /* already exists */
-			else
-				childnum = 3;
-		}
-		np = &n->kids[childnum];
-		LOG(("  moving to child %d (%p)\n", childnum, *np));
+		nnodes = nparents;
 	}
 
-	/*
-	 * We need to insert the new element in n at position np.
-	 */
-	left = NULL;  lcount = 0;
-	right = NULL; rcount = 0;
+	ret->root = nodes[0];
+	sfree(nodes);
+	sfree(seps);
+	LOG(("built tree %p from %d elements\n", ret, n));
+	return ret;
+}
+
+/*
+ * Insert e in n at kid position np, with the subtrees left and right
+ * (of lcount and rcount elements) on either side of it in place of the
+ * kid there, splitting 4-nodes up the tree as needed, and return the
+ * root. n NULL means above the root: e, left and right make a new one.
+ */
+static node234* insertkid234(tree234* t, node234* n, node234** np,
+	node234* left, intptr_t lcount,
+	void* e, node234* right, intptr_t rcount) {
 	while (n) {
 		LOG(("  at %p: %p/%d [%p] %p/%d [%p] %p/%d [%p] %p/%d\n",
 			n,
@@ -291,7 +638,7 @@ static void* add234_internal(tree234* t, void* e, intptr_t index) {
 			break;
 		}
 		else {
-			node234* m = mknew(node234);
+			node234* m = allocnode234(t);
 			m->parent = n->parent;
 			LOG(("  splitting a 4-node; created new node %p\n", m));
 			/*
@@ -388,62 +735,161 @@ static void* add234_internal(tree234* t, void* e, intptr_t index) {
 			n->parent->counts[childnum] = count;
 			n = n->parent;
 		}
+		return n;
 	}
 	else {
+		node234* root = allocnode234(t);
 		LOG(("  root is overloaded, split into two\n"));
-		t->root = mknew(node234);
-		t->root->kids[0] = left;     t->root->counts[0] = lcount;
-		t->root->elems[0] = e;
-		t->root->kids[1] = right;    t->root->counts[1] = rcount;
-		t->root->elems[1] = NULL;
-		t->root->kids[2] = NULL;     t->root->counts[2] = 0;
-		t->root->elems[2] = NULL;
-		t->root->kids[3] = NULL;     t->root->counts[3] = 0;
-		t->root->parent = NULL;
-		if (t->root->kids[0]) t->root->kids[0]->parent = t->root;
-		if (t->root->kids[1]) t->root->kids[1]->parent = t->root;
+		root->kids[0] = left;     root->counts[0] = lcount;
+		root->elems[0] = e;
+		root->kids[1] = right;    root->counts[1] = rcount;
+		root->elems[1] = NULL;
+		root->kids[2] = NULL;     root->counts[2] = 0;
+		root->elems[2] = NULL;
+		root->kids[3] = NULL;     root->counts[3] = 0;
+		root->parent = NULL;
+		if (root->kids[0]) root->kids[0]->parent = root;
+		if (root->kids[1]) root->kids[1]->parent = root;
 		LOG(("  new root is %p/%d [%p] %p/%d\n",
-			t->root->kids[0], t->root->counts[0],
-			t->root->elems[0],
-			t->root->kids[1], t->root->counts[1]));
+			root->kids[0], root->counts[0],
+			root->elems[0],
+			root->kids[1], root->counts[1]));
+		return root;
 	}
-
-	return orig_e;
-}
-
-void* add234(tree234* t, void* e) {
-	if (!t->cmp)		       /* tree is unsorted */
-		return NULL;
-
-	return add234_internal(t, e, -1);
-}
-void* addpos234(tree234* t, void* e, intptr_t index) {
-	if (index < 0 ||		       /* index out of range */
-		t->cmp)			       /* tree is sorted */
-		return NULL;		       /* return failure */
-
-	return add234_internal(t, e, index);  /* this checks the upper bound */
 }
 
 /*
- * Look up the element at a given numeric index in a 2-3-4 tree.
- * Returns NULL if the index is out of range.
+ * Add an element e to a 2-3-4 tree t. Returns e on success, or if
+ * an existing element compares equal, returns that.
  */
-void* index234(tree234* t, intptr_t index) {
-	node234* n;
-
-	if (!t->root)
-		return NULL;		       /* tree is empty */
-
-	if (index < 0 || index >= countnode234(t->root))
-		return NULL;		       /* out of range */
-
-	n = t->root;
+static void* add234_internal(tree234* t, void* e, intptr_t index) {
+	node234* n, ** np;
+	void* orig_e = e;
+	intptr_t c;
+	int right = 1;                 /* going down the right edge */
 
-	while (n) {
-		if (index < n->counts[0])
-			n = n->kids[0];
-		else if (index -= n->counts[0] + 1, index < 0)
+	LOG(("adding node %p to tree %p\n", e, t));
+	sync234(t);
+	t->last = NULL;
+	if (t->root == NULL) {
+		t->root = allocnode234(t);
+		t->root->elems[1] = t->root->elems[2] = NULL;
+		t->root->kids[0] = t->root->kids[1] = NULL;
+		t->root->kids[2] = t->root->kids[3] = NULL;
+		t->root->counts[0] = t->root->counts[1] = 0;
+		t->root->counts[2] = t->root->counts[3] = 0;
+		t->root->parent = NULL;
+		t->root->elems[0] = e;
+		t->last = t->root;
+		LOG(("  created root %p\n", t->root));
+		return orig_e;
+	}
+
+	np = &t->root;
+	n = *np;
+	while (*np) {
+		intptr_t childnum;
+		n = *np;
+		LOG(("  node %p: %p/%d [%p] %p/%d [%p] %p/%d [%p] %p/%d\n",
+			n,
+			n->kids[0], n->counts[0], n->elems[0],
+			n->kids[1], n->counts[1], n->elems[1],
+			n->kids[2], n->counts[2], n->elems[2],
+			n->kids[3], n->counts[3]));
+		if (index >= 0) {
+			if (!n->kids[0]) {
+				/*
+				 * Leaf node. We want to insert at kid position
+				 * equal to the index:
+				 *
+				 *   0 A 1 B 2 C 3
+				 */
+				childnum = index;
+			}
+			else {
+				/*
+				 * Internal node. We always descend through it (add
+				 * always starts at the bottom, never in the
+				 * middle).
+				 */
+				do { /* this is a do ... while (0) to allow `break' */
+					if (index <= n->counts[0]) {
+						childnum = 0;
+						break;
+					}
+					index -= n->counts[0] + 1;
+					if (index <= n->counts[1]) {
+						childnum = 1;
+						break;
+					}
+					index -= n->counts[1] + 1;
+					if (index <= n->counts[2]) {
+						childnum = 2;
+						break;
+					}
+					index -= n->counts[2] + 1;
+					if (index <= n->counts[3]) {
+						childnum = 3;
+						break;
+					}
+					return NULL;       /* error: index out of range */
+				} while (0);
+			}
+		}
+		else {
+			if ((c = t->cmp(e, n->elems[0])) < 0)
+				childnum = 0;
+			else if (c == 0)
+				return n->elems[0];	       /* already exists */
+			else if (n->elems[1] == NULL || (c = t->cmp(e, n->elems[1])) < 0)
+				childnum = 1;
+			else if (c == 0)
+				return n->elems[1];	       /* already exists */
+			else if (n->elems[2] == NULL || (c = t->cmp(e, n->elems[2])) < 0)
+				childnum = 2;
+			else if (c == 0)
+				return n->elems[2];	       /* already exists */
+			else
+				childnum = 3;
+		}
+		right &= childnum == nodeelems234(n);
+		np = &n->kids[childnum];
+		LOG(("  moving to child %d (%p)\n", childnum, *np));
+	}
+
+	/*
+	 * We need to insert the new element in n at position np.
+	 */
+	t->root = insertkid234(t, n, np, NULL, 0, e, NULL, 0);
+	if (right) {
+		/* It's the last element, so in the rightmost leaf, after any splits. */
+		for (n = t->root; n->kids[0]; n = n->kids[nodeelems234(n)])
+			;
+		t->last = n;
+	}
+	return orig_e;
+}
+
+/*
+ * Look up the element at a given numeric index in a 2-3-4 tree.
+ * Returns NULL if the index is out of range.
+ */
+void* index234(tree234* t, intptr_t index) {
+	node234* n;
+
+	if (!t->root)
+		return NULL;		       /* tree is empty */
+
+	sync234(t);
+	if (index < 0 || index >= countnode234(t->root))
+		return NULL;		       /* out of range */
+
+	n = t->root;
+
+	while (n) {
+		if (index < n->counts[0])
+			n = n->kids[0];
+		else if (index -= n->counts[0] + 1, index < 0)
 			return n->elems[0];
 		else if (index < n->counts[1])
 			n = n->kids[1];
@@ -480,6 +926,8 @@ void* findrelpos234(tree234* t, void* e, cmpfn234 cmp,
 
 	if (cmp == NULL)
 		cmp = t->cmp;
+	if (relation != REL234_EQ || index)
+		sync234(t);
 
 	n = t->root;
 	/*
@@ -573,16 +1021,6 @@ void* findrelpos234(tree234* t, void* e, cmpfn234 cmp,
 	if (ret && index) *index = idx;
 	return ret;
 }
-void* find234(tree234* t, void* e, cmpfn234 cmp) {
-	return findrelpos234(t, e, cmp, REL234_EQ, NULL);
-}
-void* findrel234(tree234* t, void* e, cmpfn234 cmp, int relation) {
-	return findrelpos234(t, e, cmp, relation, NULL);
-}
-void* findpos234(tree234* t, void* e, cmpfn234 cmp, intptr_t* index) {
-	return findrelpos234(t, e, cmp, REL234_EQ, index);
-}
-
 /*
  * Delete an element e in a 2-3-4 tree. Does not free the element,
  * merely removes all links to it from the tree nodes.
@@ -594,6 +1032,8 @@ static void* delpos234_internal(tree234* t, intptr_t index) {
 
 	retval = 0;
 
+	sync234(t);
+	t->last = NULL;
 	n = t->root;
 	LOG(("deleting item %d from tree %p\n", index, t));
 	while (1) {
@@ -752,7 +1192,7 @@ static void* delpos234_internal(tree234* t, intptr_t index) {
 
 					n->counts[ki + 1] = countnode234(sub);
 
-					sfree(sib);
+					freenode234(t, sib);
 
 					/*
 					 * That's built the big node in sub. Now we
@@ -776,7 +1216,7 @@ static void* delpos234_internal(tree234* t, intptr_t index) {
 						LOG(("  shifting root!\n"));
 						t->root = sub;
 						sub->parent = NULL;
-						sfree(n);
+						freenode234(t, n);
 					}
 				}
 			}
@@ -795,7 +1235,7 @@ static void* delpos234_internal(tree234* t, intptr_t index) {
 		 */
 		if (!n->parent && !n->elems[1] && !n->kids[0]) {
 			LOG(("  removed last element in tree\n"));
-			sfree(n);
+			freenode234(t, n);
 			t->root = NULL;
 			return retval;
 		}
@@ -891,7 +1331,7 @@ static void* delpos234_internal(tree234* t, intptr_t index) {
 			a->kids[3] = b->kids[1];
 			a->counts[3] = b->counts[1];
 			if (a->kids[3]) a->kids[3]->parent = a;
-			sfree(b);
+			freenode234(t, b);
 			n->counts[ei] = countnode234(a);
 			/*
 			 * That's built the big node in a, and destroyed b. Now
@@ -914,7 +1354,7 @@ static void* delpos234_internal(tree234* t, intptr_t index) {
 				LOG(("  shifting root!\n"));
 				t->root = a;
 				a->parent = NULL;
-				sfree(n);
+				freenode234(t, n);
 			}
 			/*
 			 * Now go round the deletion process again, with n
@@ -925,137 +1365,1672 @@ static void* delpos234_internal(tree234* t, intptr_t index) {
 		}
 	}
 }
-void* delpos234(tree234* t, intptr_t index) {
-	if (index < 0 || index >= countnode234(t->root))
-		return NULL;
-	return delpos234_internal(t, index);
-}
-void* del234(tree234* t, void* e) {
-	intptr_t index;
-	if (!findrelpos234(t, e, NULL, REL234_EQ, &index))
-		return NULL;		       /* it wasn't in there anyway */
-	return delpos234_internal(t, index); /* it's there; delete it. */
-}
-
-#ifdef TEST
-
 /*
- * Test code for the 2-3-4 tree. This code maintains an alternative
- * representation of the data in the tree, in an array (using the
- * obvious and slow insert and delete functions). After each tree
- * operation, the verify() function is called, which ensures all
- * the tree properties are preserved:
- *  - node->child->parent always equals node
- *  - tree->root->parent always equals NULL
- *  - number of kids == 0 or number of elements + 1;
- *  - tree has the same depth everywhere
- *  - every node has at least one element
- *  - subtree element counts are accurate
- *  - any NULL kid pointer is accompanied by a zero count
- *  - in a sorted tree: ordering property between elements of a
- *    node and elements of its children is preserved
- * and also ensures the list represented by the tree is the same
- * list it should be. (This last check also doubly verifies the
- * ordering properties, because the `same list it should be' is by
- * definition correctly ordered. It also ensures all nodes are
- * distinct, because the enum functions would get caught in a loop
- * if not.)
+ * Join the subtrees l and r, of heights lh and rh (-1 for an empty
+ * one), with e between them, and return the root of the result, with
+ * its height in *h. The shorter one takes the place of the last (or
+ * first) kid at its height down the edge of the taller one, with e
+ * next to it, the way insertion puts in a new element between two
+ * empty kids; that takes O(|lh - rh| + 1).
  */
+static node234* joinnode234(tree234* t, node234* l, int lh, void* e,
+	node234* r, int rh, int* h) {
+	node234* n = NULL, ** np = NULL, * top = NULL, * root;
+	int nh;
 
-#include <stdarg.h>
-
-#define srealloc realloc
-
- /*
-  * Error reporting function.
-  */
-void error(char* fmt, ...) {
-	va_list ap;
-	printf("ERROR: ");
-	va_start(ap, fmt);
-	vfprintf(stdout, fmt, ap);
-	va_end(ap);
-	printf("\n");
+	if (lh > rh) {
+		top = n = l;
+		for (nh = lh; nh > rh + 1; nh--)
+			n = n->kids[nodeelems234(n)];
+		np = &n->kids[nodeelems234(n)];
+		l = *np;
+	}
+	else if (rh > lh) {
+		top = n = r;
+		for (nh = rh; nh > lh + 1; nh--)
+			n = n->kids[0];
+		np = &n->kids[0];
+		r = *np;
+	}
+	LOG(("joining %p and %p around %p under %p\n", l, r, e, n));
+	root = insertkid234(t, n, np, l, countnode234(l), e, r, countnode234(r));
+	*h = (lh > rh ? lh : rh) + (root != top);
+	return root;
 }
 
-/* The array representation of the data. */
-void** array;
-intptr_t arraylen, arraysize;
-cmpfn234 cmp;
-
-/* The tree representation of the same data. */
-tree234* tree;
+/*
+ * A node of the kids from to to of the internal node n and the
+ * elements between them, or just the kid if there's one. n is reused
+ * when from is 0.
+ */
+static node234* fragment234(tree234* t, node234* n, int from, int to) {
+	node234* m;
+	int i;
 
-typedef struct {
-	intptr_t treedepth;
-	intptr_t elemcount;
-} chkctx;
+	if (from == to) {
+		m = n->kids[from];
+		m->parent = NULL;
+		return m;
+	}
+	m = from == 0 ? n : newnode234(t);
+	for (i = 0; i < 4; i++) {
+		m->kids[i] = i <= to - from ? n->kids[from + i] : NULL;
+		m->counts[i] = i <= to - from ? n->counts[from + i] : 0;
+		if (m->kids[i])
+			m->kids[i]->parent = m;
+	}
+	for (i = 0; i < 3; i++)
+		m->elems[i] = i < to - from ? n->elems[from + i] : NULL;
+	m->parent = NULL;
+	return m;
+}
 
-intptr_t chknode(chkctx* ctx, intptr_t level, node234* node,
-	void* lowbound, void* highbound) {
-	intptr_t nkids, nelems;
-	intptr_t i;
-	intptr_t count;
+/*
+ * Split the subtree n, of height h, before its element at index: the
+ * ones before go to the subtree returned in *l, with its height in
+ * *lh, and the rest to *r and *rh. The path down to index is cut in
+ * two, and each side is joined back up from the bottom with what hung
+ * off it, each join taking no more than the height difference, so
+ * O(log n) in all.
+ */
+static void splitnode234(tree234* t, node234* n, int h, intptr_t index,
+	node234** l, int* lh, node234** r, int* rh) {
+	int nkids = nodeelems234(n) + 1, i;
+	node234* a, * b;
+	int ah, bh;
 
-	/* Count the non-NULL kids. */
-	for (nkids = 0; nkids < 4 && node->kids[nkids]; nkids++);
-	/* Ensure no kids beyond the first NULL are non-NULL. */
-	for (i = nkids; i < 4; i++)
-		if (node->kids[i]) {
-			error("node %p: nkids=%d but kids[%d] non-NULL",
-				node, nkids, i);
+	if (h == 0) {
+		node234* m = NULL;
+		if (index < nkids - 1) {
+			m = newnode234(t);
+			for (i = (int)index; i < nkids - 1; i++) {
+				m->elems[i - index] = n->elems[i];
+				n->elems[i] = NULL;
+			}
 		}
-		else if (node->counts[i]) {
-			error("node %p: kids[%d] NULL but count[%d]=%d nonzero",
-				node, i, i, node->counts[i]);
+		n->parent = NULL;
+		if (index == 0) {
+			freenode234(t, n);
+			n = NULL;
 		}
+		*l = n;
+		*lh = n ? 0 : -1;
+		*r = m;
+		*rh = m ? 0 : -1;
+		return;
+	}
 
-	/* Count the non-NULL elements. */
-	for (nelems = 0; nelems < 3 && node->elems[nelems]; nelems++);
-	/* Ensure no elements beyond the first NULL are non-NULL. */
-	for (i = nelems; i < 3; i++)
-		if (node->elems[i]) {
-			error("node %p: nelems=%d but elems[%d] non-NULL",
-				node, nelems, i);
-		}
+	for (i = 0; index > n->counts[i]; i++)
+		index -= n->counts[i] + 1;
+	splitnode234(t, n->kids[i], h - 1, index, &a, &ah, &b, &bh);
 
-	if (nkids == 0) {
-		/*
-		 * If nkids==0, this is a leaf node; verify that the tree
-		 * depth is the same everywhere.
-		 */
-		if (ctx->treedepth < 0)
-			ctx->treedepth = level;    /* we didn't know the depth yet */
-		else if (ctx->treedepth != level)
-			error("node %p: leaf at depth %d, previously seen depth %d",
-				node, level, ctx->treedepth);
+	/* The right side first, as the left one may be built over n. */
+	if (i < nkids - 1) {
+		void* e = n->elems[i];
+		node234* m = fragment234(t, n, i + 1, nkids - 1);
+		*r = joinnode234(t, b, bh, e, m, i + 1 < nkids - 1 ? h : h - 1, rh);
 	}
 	else {
-		/*
-		 * If nkids != 0, then it should be nelems+1, unless nelems
-		 * is 0 in which case nkids should also be 0 (and so we
-		 * shouldn't be in this condition at all).
-		 */
-		intptr_t shouldkids = (nelems ? nelems + 1 : 0);
-		if (nkids != shouldkids) {
-			error("node %p: %d elems should mean %d kids but has %d",
-				node, nelems, shouldkids, nkids);
-		}
+		*r = b;
+		*rh = bh;
+	}
+	if (i > 0) {
+		void* e = n->elems[i - 1];
+		node234* m = fragment234(t, n, 0, i - 1);
+		if (i == 1)
+			freenode234(t, n);
+		*l = joinnode234(t, m, i > 1 ? h : h - 1, e, a, ah, lh);
 	}
+	else {
+		freenode234(t, n);
+		*l = a;
+		*lh = ah;
+	}
+}
 
-	/*
-	 * nelems should be at least 1.
-	 */
-	if (nelems == 0) {
-		error("node %p: no elems", node, nkids);
+/*
+ * One level of a plain find234, for findmany234: the element of n
+ * comparing equal to e goes in *found, or else the kid to go on to is
+ * returned, NULL at the bottom.
+ */
+static node234* findstep234(tree234* t, node234* n, void* e, cmpfn234 cmp,
+	void** found) {
+	int kcount, c;
+	(void)t;
+	for (kcount = 0; kcount < 3 && n->elems[kcount]; kcount++) {
+		c = cmp(e, n->elems[kcount]);
+		if (c < 0)
+			break;
+		if (c == 0) {
+			*found = n->elems[kcount];
+			return NULL;
+		}
 	}
+	return n->kids[kcount];
+}
 
-	/*
-	 * Add nelems to the running element count of the whole tree.
-	 */
-	ctx->elemcount += nelems;
+static void prefetchnode234(node234* n, int leaf) {
+	(void)leaf;
+	PREFETCH234(n);
+	PREFETCH234((char*)(n + 1) - 1);
+}
 
-	/*
+#else /* TREE234_KEYS != 3 */
+
+/*
+ * Counted B-tree layout. Each node holds up to TREE234_KEYS elements
+ * next to each other, and an internal node the counts and kids that go
+ * with them, so a lookup reads a few contiguous arrays per level
+ * instead of one small node per element. Leaves are allocated without
+ * the counts and kids.
+ *
+ * Every node but the root holds at least MINKEYS elements. Insertion
+ * splits full nodes on the way down, and deletion tops up minimal
+ * nodes on the way down by rotating an element from a sibling or
+ * merging with it, so both take a single pass from the root. With
+ * TREE234_KEYS at 3 this would be a 2-3-4 tree again.
+ */
+
+#if TREE234_KEYS < 4 || TREE234_KEYS > 255
+#error TREE234_KEYS must be between 3 and 255
+#endif
+
+#define MINKEYS ((TREE234_KEYS - 1) / 2)
+#define MAXDEPTH234 64
+
+typedef struct node234_Tag node234;
+
+/*
+ * Built with TREE234_COMPACT, nodes refer to their kids by 32-bit
+ * number (see allocpool234) rather than pointer, counts are 32 bits,
+ * and there are no parent pointers, as nothing but the checks in the
+ * test code goes up the tree. A subtree then holds 2^32 - 1 elements
+ * at most.
+ */
+#ifdef TREE234_COMPACT
+typedef uint32_t noderef234;
+typedef uint32_t nodecount234;
+#else
+typedef node234* noderef234;
+typedef intptr_t nodecount234;
+#endif
+
+struct node234_Tag {
+#ifdef TREE234_COMPACT
+	uint32_t ref;                  /* its own number */
+	uint16_t nelems;
+	uint16_t leaf;
+#else
+	node234* parent;
+	int32_t nelems;
+	int32_t leaf;
+#endif
+	void* elems[TREE234_KEYS];
+	/* Internal nodes only. */
+	nodecount234 counts[TREE234_KEYS + 1];
+	noderef234 kids[TREE234_KEYS + 1];
+};
+
+#define LEAFSIZE234 offsetof(node234, counts)
+
+#ifdef TREE234_COMPACT
+#define KID234(t, n, i) ((node234*)refnode234((t)->heap, (n)->kids[i]))
+#define REF234(n) ((n)->ref)
+#define SETPARENT234(n, p) ((void)0)
+#else
+#define KID234(t, n, i) ((void)(t), (n)->kids[i])
+#define REF234(n) (n)
+#define SETPARENT234(n, p) ((n)->parent = (p))
+#endif
+
+struct tree234_Tag {
+	node234* root;
+	cmpfn234 cmp;
+	heap234* heap;                 /* leaves in pools[0], the rest in pools[1] */
+	node234* last;                 /* as in the 2-3-4 layout */
+	intptr_t pending;
+};
+
+static node234* allocnode234(tree234* t, int leaf) {
+	node234* n = allocpool234(&treeheap234(&t->heap)->pools[!leaf]);
+	SETPARENT234(n, NULL);
+	n->nelems = 0;
+	n->leaf = leaf;
+	return n;
+}
+
+static void freenode234(tree234* t, node234* n) {
+	freepool234(&treeheap234(&t->heap)->pools[!n->leaf], n);
+}
+
+tree234* newtree234(cmpfn234 cmp) {
+	tree234* ret = mknew(tree234);
+	LOG(("created tree %p\n", ret));
+	ret->root = NULL;
+	ret->cmp = cmp;
+	ret->heap = newheap234(LEAFSIZE234, sizeof(node234));
+	ret->last = NULL;
+	ret->pending = 0;
+	return ret;
+}
+
+void freetree234(tree234* t) {
+	releaseheap234(t->heap);
+	sfree(t);
+}
+
+/*
+ * The same walk as the 2-3-4 layout, down to the leftmost leaf, then up
+ * to the first ancestor with an element after the kid we came from,
+ * but going up by a stack of the nodes above and the kid taken in
+ * each, as there may be no parent pointers.
+ */
+void freetree234_with(tree234* t, destroyfn234 destroy, void* ctx) {
+	node234* path[MAXDEPTH234];
+	intptr_t kids[MAXDEPTH234];
+	intptr_t depth = 0, i;
+	node234* n = t->root;
+
+	while (n) {
+		while (!n->leaf) {
+			path[depth] = n;
+			kids[depth++] = 0;
+			n = KID234(t, n, 0);
+		}
+		for (i = 0; i < n->nelems; i++)
+			destroy(n->elems[i], ctx);
+		while (depth > 0 && kids[depth - 1] == path[depth - 1]->nelems)
+			depth--;
+		if (depth == 0)
+			break;
+		n = path[depth - 1];
+		destroy(n->elems[kids[depth - 1]], ctx);
+		n = KID234(t, n, ++kids[depth - 1]);
+	}
+	freetree234(t);
+}
+
+static intptr_t countnode234(node234* n) {
+	intptr_t count, i;
+	if (!n)
+		return 0;
+	count = n->nelems;
+	if (!n->leaf)
+		for (i = 0; i <= n->nelems; i++)
+			count += n->counts[i];
+	return count;
+}
+
+intptr_t count234(tree234* t) {
+	return countnode234(t->root) + t->pending;
+}
+
+static int nodeelems234(node234* n) {
+	return n->nelems;
+}
+
+static int isleaf234(node234* n) {
+	return n->leaf;
+}
+
+static intptr_t kidcount234(node234* n, int i) {
+	return n->leaf ? 0 : n->counts[i];
+}
+
+static int appendleaf234(node234* n, void* e) {
+	if (n->nelems == TREE234_KEYS)
+		return 0;
+	n->elems[n->nelems++] = e;
+	return 1;
+}
+
+static void sync234(tree234* t) {
+	node234* n;
+	if (!t->pending)
+		return;
+	for (n = t->root; !n->leaf; n = KID234(t, n, n->nelems))
+		n->counts[n->nelems] += t->pending;
+	t->pending = 0;
+}
+
+/*
+ * Same bottom-up build as the 2-3-4 layout, with TREE234_KEYS + 1 kids
+ * per node instead of 4.
+ */
+tree234* buildtree234(cmpfn234 cmp, void** elems, intptr_t n) {
+	tree234* ret = newtree234(cmp);
+	node234** nodes;
+	void** seps;
+	intptr_t nnodes, nparents, i, j, k, start, nkids;
+
+#ifndef NDEBUG
+	for (i = 1; cmp && i < n; i++)
+		assert(cmp(elems[i - 1], elems[i]) < 0);
+#endif
+
+	if (n <= 0)
+		return ret;
+
+	nnodes = (n + 1 + TREE234_KEYS) / (TREE234_KEYS + 1);
+	nodes = smalloc(nnodes * sizeof(*nodes));
+	seps = smalloc(nnodes * sizeof(*seps));
+	start = 0;
+	for (i = 0; i < nnodes; i++) {
+		intptr_t rest = n - (nnodes - 1);
+		intptr_t count = rest / nnodes + (i < rest % nnodes);
+		nodes[i] = allocnode234(ret, 1);
+		for (j = 0; j < count; j++)
+			nodes[i]->elems[j] = elems[start++];
+		nodes[i]->nelems = (int32_t)count;
+		if (i < nnodes - 1)
+			seps[i] = elems[start++];
+	}
+
+	while (nnodes > 1) {
+		nparents = (nnodes + TREE234_KEYS) / (TREE234_KEYS + 1);
+		start = 0;
+		for (i = 0; i < nparents; i++) {
+			node234* parent = allocnode234(ret, 0);
+			nkids = nnodes / nparents + (i < nnodes % nparents);
+			for (k = 0; k < nkids; k++) {
+				node234* kid = nodes[start];
+				SETPARENT234(kid, parent);
+				parent->kids[k] = REF234(kid);
+				parent->counts[k] = countnode234(kid);
+				if (k < nkids - 1)
+					parent->elems[k] = seps[start];
+				start++;
+			}
+			parent->nelems = (int32_t)(nkids - 1);
+			nodes[i] = parent;
+			if (i < nparents - 1)
+				seps[i] = seps[start - 1];
+		}
+		nnodes = nparents;
+	}
+
+	ret->root = nodes[0];
+	sfree(nodes);
+	sfree(seps);
+	LOG(("built tree %p from %d elements\n", ret, n));
+	return ret;
+}
+
+/*
+ * Split the full kid i of n, which isn't full, around its middle
+ * element. The middle element moves up into n.
+ */
+static void splitkid234(tree234* t, node234* n, intptr_t i) {
+	node234* left = KID234(t, n, i);
+	node234* right = allocnode234(t, left->leaf);
+	intptr_t mid = TREE234_KEYS / 2;
+	intptr_t nright = TREE234_KEYS - mid - 1;
+	intptr_t rcount = nright, j;
+
+	LOG(("  splitting %p at kid %d of %p, new node %p\n", left, i, n, right));
+	memcpy(right->elems, left->elems + mid + 1, nright * sizeof(*right->elems));
+	if (!left->leaf) {
+		memcpy(right->kids, left->kids + mid + 1, (nright + 1) * sizeof(*right->kids));
+		memcpy(right->counts, left->counts + mid + 1, (nright + 1) * sizeof(*right->counts));
+		for (j = 0; j <= nright; j++) {
+			SETPARENT234(KID234(t, right, j), right);
+			rcount += right->counts[j];
+		}
+	}
+	right->nelems = (int32_t)nright;
+	SETPARENT234(right, n);
+	left->nelems = (int32_t)mid;
+
+	memmove(n->elems + i + 1, n->elems + i, (n->nelems - i) * sizeof(*n->elems));
+	memmove(n->kids + i + 2, n->kids + i + 1, (n->nelems - i) * sizeof(*n->kids));
+	memmove(n->counts + i + 2, n->counts + i + 1, (n->nelems - i) * sizeof(*n->counts));
+	n->elems[i] = left->elems[mid];
+	n->kids[i + 1] = REF234(right);
+	n->counts[i + 1] = rcount;
+	n->counts[i] -= rcount + 1;
+	n->nelems++;
+}
+
+/*
+ * Find where e goes in the elements of n: the index of the first one
+ * comparing >= e, with *found set if it compares equal.
+ */
+static intptr_t searchnode234(node234* n, void* e, cmpfn234 cmp, int* found) {
+	intptr_t lo = 0, hi = n->nelems;
+	*found = 0;
+	while (lo < hi) {
+		intptr_t mid = (lo + hi) / 2;
+		int c = cmp(e, n->elems[mid]);
+		if (c == 0) {
+			*found = 1;
+			return mid;
+		}
+		if (c < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return lo;
+}
+
+/*
+ * Add an element e to a B-tree t, at the given index in an unsorted
+ * tree, or where it sorts if index is -1. Returns e on success, or if
+ * an existing element compares equal, returns that.
+ */
+static void* add234_internal(tree234* t, void* e, intptr_t index) {
+	node234* path[MAXDEPTH234];
+	intptr_t kids[MAXDEPTH234];
+	intptr_t depth = 0, i;
+	node234* n;
+	int found, right = 1;
+
+	LOG(("adding node %p to tree %p\n", e, t));
+	if (index > count234(t))
+		return NULL;
+	sync234(t);
+	t->last = NULL;
+	if (t->root == NULL) {
+		t->root = allocnode234(t, 1);
+		t->root->elems[0] = e;
+		t->root->nelems = 1;
+		t->last = t->root;
+		LOG(("  created root %p\n", t->root));
+		return e;
+	}
+	if (t->root->nelems == TREE234_KEYS) {
+		node234* root = allocnode234(t, 0);
+		LOG(("  root is full, split it under new root %p\n", root));
+		root->kids[0] = REF234(t->root);
+		root->counts[0] = countnode234(t->root);
+		SETPARENT234(t->root, root);
+		t->root = root;
+		splitkid234(t, root, 0);
+	}
+
+	n = t->root;
+	for (;;) {
+		if (index < 0) {
+			i = searchnode234(n, e, t->cmp, &found);
+			if (found)
+				return n->elems[i];
+		}
+		else if (n->leaf) {
+			i = index;
+		}
+		else {
+			for (i = 0; index > n->counts[i]; i++)
+				index -= n->counts[i] + 1;
+		}
+
+		if (n->leaf) {
+			memmove(n->elems + i + 1, n->elems + i, (n->nelems - i) * sizeof(*n->elems));
+			n->elems[i] = e;
+			n->nelems++;
+			if (right && i == n->nelems - 1)
+				t->last = n;
+			break;
+		}
+
+		if (KID234(t, n, i)->nelems == TREE234_KEYS) {
+			splitkid234(t, n, i);
+			if (index < 0) {
+				int c = t->cmp(e, n->elems[i]);
+				if (c == 0)
+					return n->elems[i];
+				if (c > 0)
+					i++;
+			}
+			else if (index > n->counts[i]) {
+				index -= n->counts[i] + 1;
+				i++;
+			}
+		}
+		right &= i == n->nelems;
+		path[depth] = n;
+		kids[depth++] = i;
+		n = KID234(t, n, i);
+	}
+
+	/* Only count the element once it's in. */
+	while (depth-- > 0)
+		path[depth]->counts[kids[depth]]++;
+	return e;
+}
+
+void* index234(tree234* t, intptr_t index) {
+	node234* n = t->root;
+	intptr_t i;
+
+	if (index < 0 || index >= count234(t))
+		return NULL;
+	sync234(t);
+
+	for (;;) {
+		if (n->leaf)
+			return n->elems[index];
+		for (i = 0; index > n->counts[i]; i++)
+			index -= n->counts[i] + 1;
+		if (index == n->counts[i])
+			return n->elems[i];
+		n = KID234(t, n, i);
+	}
+}
+
+void* findrelpos234(tree234* t, void* e, cmpfn234 cmp,
+	int relation, intptr_t* index) {
+	node234* n = t->root;
+	intptr_t lt = 0, i, k, count, ret;
+	void* equal = NULL;
+	int found = 0;
+
+	assert(relation >= REL234_EQ && relation <= REL234_GE);
+	if (!n)
+		return NULL;
+	if (cmp == NULL)
+		cmp = t->cmp;
+
+	/* A plain find234 needs no counting. */
+	if (relation == REL234_EQ && !index) {
+		for (;;) {
+			i = searchnode234(n, e, cmp, &found);
+			if (found)
+				return n->elems[i];
+			if (n->leaf)
+				return NULL;
+			n = KID234(t, n, i);
+		}
+	}
+	sync234(t);
+	count = countnode234(n);
+
+	/*
+	 * Count the elements comparing < e. A NULL e with REL234_LT or
+	 * REL234_GT is above or below all of them.
+	 */
+	if (e == NULL) {
+		assert(relation == REL234_LT || relation == REL234_GT);
+		lt = (relation == REL234_LT ? count : 0);
+	}
+	else {
+		for (;;) {
+			i = searchnode234(n, e, cmp, &found);
+			if (!n->leaf)
+				for (k = 0; k < i + found; k++)
+					lt += n->counts[k];
+			lt += i;
+			if (found || n->leaf) {
+				if (found)
+					equal = n->elems[i];
+				break;
+			}
+			n = KID234(t, n, i);
+		}
+	}
+
+	switch (relation) {
+	case REL234_EQ:
+		ret = found ? lt : -1;
+		break;
+	case REL234_LT:
+		ret = lt - 1;
+		break;
+	case REL234_LE:
+		ret = found ? lt : lt - 1;
+		break;
+	case REL234_GT:
+		ret = found ? lt + 1 : lt;
+		break;
+	default: /* REL234_GE */
+		ret = lt;
+		break;
+	}
+	if (ret < 0 || ret >= count)
+		return NULL;
+	if (index)
+		*index = ret;
+	return (found && ret == lt) ? equal : index234(t, ret);
+}
+
+/*
+ * Merge kid i of n, the element after it and kid i+1 into kid i. If
+ * that empties the root, the merged kid becomes the root.
+ */
+static node234* mergekids234(tree234* t, node234* n, intptr_t i) {
+	node234* left = KID234(t, n, i);
+	node234* right = KID234(t, n, i + 1);
+	intptr_t j;
+
+	LOG(("  merging kids %d and %d of %p\n", i, i + 1, n));
+	left->elems[left->nelems] = n->elems[i];
+	memcpy(left->elems + left->nelems + 1, right->elems, right->nelems * sizeof(*left->elems));
+	if (!left->leaf) {
+		memcpy(left->kids + left->nelems + 1, right->kids, (right->nelems + 1) * sizeof(*left->kids));
+		memcpy(left->counts + left->nelems + 1, right->counts, (right->nelems + 1) * sizeof(*left->counts));
+		for (j = 0; j <= right->nelems; j++)
+			SETPARENT234(KID234(t, right, j), left);
+	}
+	left->nelems += right->nelems + 1;
+	n->counts[i] += n->counts[i + 1] + 1;
+	freenode234(t, right);
+
+	memmove(n->elems + i, n->elems + i + 1, (n->nelems - i - 1) * sizeof(*n->elems));
+	memmove(n->kids + i + 1, n->kids + i + 2, (n->nelems - i - 1) * sizeof(*n->kids));
+	memmove(n->counts + i + 1, n->counts + i + 2, (n->nelems - i - 1) * sizeof(*n->counts));
+	n->nelems--;
+
+	if (n->nelems == 0) {
+		LOG(("  shifting root!\n"));
+		t->root = left;
+		SETPARENT234(left, NULL);
+		freenode234(t, n);
+	}
+	return left;
+}
+
+/*
+ * Move the last element of kid i of n up into n, and element i of n
+ * down to the front of kid i+1, with the last kid of kid i if there
+ * are kids. Returns how many elements kid i+1 gained.
+ */
+static intptr_t rotateright234(tree234* t, node234* n, intptr_t i) {
+	node234* sib = KID234(t, n, i);
+	node234* kid = KID234(t, n, i + 1);
+	intptr_t moved = 1;
+
+	memmove(kid->elems + 1, kid->elems, kid->nelems * sizeof(*kid->elems));
+	kid->elems[0] = n->elems[i];
+	n->elems[i] = sib->elems[sib->nelems - 1];
+	if (!kid->leaf) {
+		memmove(kid->kids + 1, kid->kids, (kid->nelems + 1) * sizeof(*kid->kids));
+		memmove(kid->counts + 1, kid->counts, (kid->nelems + 1) * sizeof(*kid->counts));
+		kid->kids[0] = sib->kids[sib->nelems];
+		kid->counts[0] = sib->counts[sib->nelems];
+		SETPARENT234(KID234(t, kid, 0), kid);
+		moved += kid->counts[0];
+	}
+	kid->nelems++;
+	sib->nelems--;
+	n->counts[i] -= moved;
+	n->counts[i + 1] += moved;
+	return moved;
+}
+
+/*
+ * The other way: the first element of kid i+1 goes up, and element i
+ * of n down to the end of kid i.
+ */
+static intptr_t rotateleft234(tree234* t, node234* n, intptr_t i) {
+	node234* kid = KID234(t, n, i);
+	node234* sib = KID234(t, n, i + 1);
+	intptr_t moved = 1;
+
+	kid->elems[kid->nelems] = n->elems[i];
+	n->elems[i] = sib->elems[0];
+	memmove(sib->elems, sib->elems + 1, (sib->nelems - 1) * sizeof(*sib->elems));
+	if (!kid->leaf) {
+		kid->kids[kid->nelems + 1] = sib->kids[0];
+		kid->counts[kid->nelems + 1] = sib->counts[0];
+		SETPARENT234(KID234(t, kid, kid->nelems + 1), kid);
+		moved += sib->counts[0];
+		memmove(sib->kids, sib->kids + 1, sib->nelems * sizeof(*sib->kids));
+		memmove(sib->counts, sib->counts + 1, sib->nelems * sizeof(*sib->counts));
+	}
+	kid->nelems++;
+	sib->nelems--;
+	n->counts[i] += moved;
+	n->counts[i + 1] -= moved;
+	return moved;
+}
+
+/*
+ * Make sure kid i of n has more than MINKEYS elements, so one can be
+ * deleted from it. Returns the kid that now holds what kid i held,
+ * with *index adjusted to it.
+ */
+static intptr_t fillkid234(tree234* t, node234* n, intptr_t i, intptr_t* index) {
+	if (KID234(t, n, i)->nelems > MINKEYS)
+		return i;
+
+	if (i > 0 && KID234(t, n, i - 1)->nelems > MINKEYS) {
+		/* Rotate right: the last element of the left sibling goes up. */
+		*index += rotateright234(t, n, i - 1);
+		return i;
+	}
+
+	if (i < n->nelems && KID234(t, n, i + 1)->nelems > MINKEYS) {
+		/* Rotate left: the first element of the right sibling goes up. */
+		rotateleft234(t, n, i);
+		return i;
+	}
+
+	if (i < n->nelems) {
+		mergekids234(t, n, i);
+		return i;
+	}
+	*index += n->counts[i - 1] + 1;
+	mergekids234(t, n, i - 1);
+	return i - 1;
+}
+
+static void* delpos234_internal(tree234* t, intptr_t index) {
+	node234* n = t->root;
+	void* retval = NULL;
+	void** slot = NULL;            /* where the replacing element goes */
+	intptr_t i;
+
+	LOG(("deleting item %d from tree %p\n", index, t));
+	sync234(t);
+	t->last = NULL;
+	for (;;) {
+		if (n->leaf) {
+			void* e = n->elems[index];
+			memmove(n->elems + index, n->elems + index + 1,
+				(n->nelems - index - 1) * sizeof(*n->elems));
+			n->nelems--;
+			if (n->nelems == 0) {
+				LOG(("  removed last element in tree\n"));
+				freenode234(t, n);
+				t->root = NULL;
+			}
+			if (!slot)
+				return e;
+			*slot = e;
+			return retval;
+		}
+
+		for (i = 0; index > n->counts[i]; i++)
+			index -= n->counts[i] + 1;
+
+		if (index == n->counts[i]) {
+			/*
+			 * The element is in this internal node. Replace it with
+			 * its predecessor or successor if a kid can spare one,
+			 * else merge the kids around it and go on down.
+			 */
+			if (KID234(t, n, i)->nelems > MINKEYS) {
+				retval = n->elems[i];
+				slot = &n->elems[i];
+				index = n->counts[i] - 1;
+			}
+			else if (KID234(t, n, i + 1)->nelems > MINKEYS) {
+				retval = n->elems[i];
+				slot = &n->elems[i];
+				index = 0;
+				i++;
+			}
+			else {
+				node234* kid = mergekids234(t, n, i);
+				if (t->root == kid) {
+					n = kid;
+					continue;
+				}
+			}
+		}
+		else {
+			i = fillkid234(t, n, i, &index);
+			if (t->root == KID234(t, n, i)) {
+				n = t->root;
+				continue;
+			}
+		}
+		n->counts[i]--;
+		n = KID234(t, n, i);
+	}
+}
+
+/*
+ * Join the subtrees l and r, of heights lh and rh (-1 for an empty
+ * one), with e between them, and return the root of the result, with
+ * its height in *h.
+ *
+ * The shorter one becomes the last (or first) kid of the node just
+ * above its height down the edge of the taller one, with e next to
+ * it, full nodes being split on the way down so that one has room.
+ * Having been a root, it may be short of MINKEYS elements: it's then
+ * merged with its sibling, or takes elements from it. That takes
+ * O(|lh - rh| + 1).
+ */
+static node234* joinnode234(tree234* t, node234* l, int lh, void* e,
+	node234* r, int rh, int* h) {
+	node234* n;
+	intptr_t count;
+	int nh;
+
+	LOG(("joining %p and %p around %p\n", l, r, e));
+	if (lh == rh) {
+		if (lh < 0) {
+			n = allocnode234(t, 1);
+			n->elems[0] = e;
+			n->nelems = 1;
+			*h = 0;
+			return n;
+		}
+		n = allocnode234(t, 0);
+		n->elems[0] = e;
+		n->kids[0] = REF234(l);
+		n->kids[1] = REF234(r);
+		n->counts[0] = countnode234(l);
+		n->counts[1] = countnode234(r);
+		n->nelems = 1;
+		SETPARENT234(l, n);
+		SETPARENT234(r, n);
+		*h = lh + 1;
+		if (l->nelems + r->nelems < TREE234_KEYS) {
+			t->root = n;       /* for mergekids234 to move it down */
+			*h = lh;
+			return mergekids234(t, n, 0);
+		}
+		while (l->nelems < MINKEYS)
+			rotateleft234(t, n, 0);
+		while (r->nelems < MINKEYS)
+			rotateright234(t, n, 0);
+		return n;
+	}
+
+	if (lh > rh) {
+		count = countnode234(r) + 1;
+		if (l->nelems == TREE234_KEYS) {
+			n = allocnode234(t, 0);
+			n->kids[0] = REF234(l);
+			n->counts[0] = countnode234(l);
+			SETPARENT234(l, n);
+			splitkid234(t, n, 0);
+			l = n;
+			lh++;
+		}
+		for (n = l, nh = lh; nh > rh + 1; nh--) {
+			intptr_t i = n->nelems;
+			if (KID234(t, n, i)->nelems == TREE234_KEYS)
+				splitkid234(t, n, i++);
+			n->counts[i] += count;
+			n = KID234(t, n, i);
+		}
+		n->elems[n->nelems] = e;
+		if (r) {
+			n->kids[n->nelems + 1] = REF234(r);
+			n->counts[n->nelems + 1] = count - 1;
+			SETPARENT234(r, n);
+		}
+		n->nelems++;
+		if (r && r->nelems < MINKEYS) {
+			intptr_t i = n->nelems - 1;
+			if (KID234(t, n, i)->nelems + r->nelems < TREE234_KEYS)
+				mergekids234(t, n, i);
+			else
+				while (r->nelems < MINKEYS)
+					rotateright234(t, n, i);
+		}
+		*h = lh;
+		return l;
+	}
+
+	count = countnode234(l) + 1;
+	if (r->nelems == TREE234_KEYS) {
+		n = allocnode234(t, 0);
+		n->kids[0] = REF234(r);
+		n->counts[0] = countnode234(r);
+		SETPARENT234(r, n);
+		splitkid234(t, n, 0);
+		r = n;
+		rh++;
+	}
+	for (n = r, nh = rh; nh > lh + 1; nh--) {
+		if (KID234(t, n, 0)->nelems == TREE234_KEYS)
+			splitkid234(t, n, 0);
+		n->counts[0] += count;
+		n = KID234(t, n, 0);
+	}
+	memmove(n->elems + 1, n->elems, n->nelems * sizeof(*n->elems));
+	n->elems[0] = e;
+	if (l) {
+		memmove(n->kids + 1, n->kids, (n->nelems + 1) * sizeof(*n->kids));
+		memmove(n->counts + 1, n->counts, (n->nelems + 1) * sizeof(*n->counts));
+		n->kids[0] = REF234(l);
+		n->counts[0] = count - 1;
+		SETPARENT234(l, n);
+	}
+	n->nelems++;
+	if (l && l->nelems < MINKEYS) {
+		if (l->nelems + KID234(t, n, 1)->nelems < TREE234_KEYS)
+			mergekids234(t, n, 0);
+		else
+			while (l->nelems < MINKEYS)
+				rotateleft234(t, n, 0);
+	}
+	*h = rh;
+	return r;
+}
+
+/*
+ * A node of the kids from to to of the internal node n and the
+ * elements between them, or just the kid if there's one. n is reused
+ * when from is 0.
+ */
+static node234* fragment234(tree234* t, node234* n, intptr_t from, intptr_t to) {
+	node234* m;
+	intptr_t i;
+
+	if (from == to) {
+		m = KID234(t, n, from);
+		SETPARENT234(m, NULL);
+		return m;
+	}
+	m = from == 0 ? n : allocnode234(t, 0);
+	if (from > 0) {
+		memcpy(m->elems, n->elems + from, (to - from) * sizeof(*m->elems));
+		memcpy(m->kids, n->kids + from, (to - from + 1) * sizeof(*m->kids));
+		memcpy(m->counts, n->counts + from, (to - from + 1) * sizeof(*m->counts));
+		for (i = 0; i <= to - from; i++)
+			SETPARENT234(KID234(t, m, i), m);
+	}
+	m->nelems = (int32_t)(to - from);
+	SETPARENT234(m, NULL);
+	return m;
+}
+
+/*
+ * Same split as the 2-3-4 layout.
+ */
+static void splitnode234(tree234* t, node234* n, int h, intptr_t index,
+	node234** l, int* lh, node234** r, int* rh) {
+	intptr_t nkids = n->nelems + 1, i;
+	node234* a, * b;
+	int ah, bh;
+
+	if (n->leaf) {
+		node234* m = NULL;
+		if (index < n->nelems) {
+			m = allocnode234(t, 1);
+			m->nelems = (int32_t)(n->nelems - index);
+			memcpy(m->elems, n->elems + index, m->nelems * sizeof(*m->elems));
+		}
+		n->nelems = (int32_t)index;
+		SETPARENT234(n, NULL);
+		if (index == 0) {
+			freenode234(t, n);
+			n = NULL;
+		}
+		*l = n;
+		*lh = n ? 0 : -1;
+		*r = m;
+		*rh = m ? 0 : -1;
+		return;
+	}
+
+	for (i = 0; index > n->counts[i]; i++)
+		index -= n->counts[i] + 1;
+	splitnode234(t, KID234(t, n, i), h - 1, index, &a, &ah, &b, &bh);
+
+	/* The right side first, as the left one may be built over n. */
+	if (i < nkids - 1) {
+		void* e = n->elems[i];
+		node234* m = fragment234(t, n, i + 1, nkids - 1);
+		*r = joinnode234(t, b, bh, e, m, i + 1 < nkids - 1 ? h : h - 1, rh);
+	}
+	else {
+		*r = b;
+		*rh = bh;
+	}
+	if (i > 0) {
+		void* e = n->elems[i - 1];
+		node234* m = fragment234(t, n, 0, i - 1);
+		if (i == 1)
+			freenode234(t, n);
+		*l = joinnode234(t, m, i > 1 ? h : h - 1, e, a, ah, lh);
+	}
+	else {
+		freenode234(t, n);
+		*l = a;
+		*lh = ah;
+	}
+}
+
+static node234* findstep234(tree234* t, node234* n, void* e, cmpfn234 cmp,
+	void** found) {
+	int equal;
+	intptr_t i = searchnode234(n, e, cmp, &equal);
+	if (equal) {
+		*found = n->elems[i];
+		return NULL;
+	}
+	return n->leaf ? NULL : KID234(t, n, i);
+}
+
+/*
+ * A node is several cache lines, and a search reads the elements all
+ * over it before the kid at the end.
+ */
+static void prefetchnode234(node234* n, int leaf) {
+	size_t size = leaf ? LEAFSIZE234 : sizeof(node234), offset;
+	for (offset = 0; offset < size; offset += 64)
+		PREFETCH234((char*)n + offset);
+}
+
+#endif /* TREE234_KEYS != 3 */
+
+void* add234(tree234* t, void* e) {
+	node234* last = t->last;
+
+	if (!t->cmp)		       /* tree is unsorted */
+		return NULL;
+
+	/*
+	 * Past the end of a tree last added to at the end (see
+	 * add234_internal): no need to go down from the root for that.
+	 */
+	if (last && t->cmp(e, last->elems[nodeelems234(last) - 1]) > 0 &&
+		appendleaf234(last, e)) {
+		if (last != t->root)
+			t->pending++;
+		return e;
+	}
+	return add234_internal(t, e, -1);
+}
+void* addpos234(tree234* t, void* e, intptr_t index) {
+	if (index < 0 ||		       /* index out of range */
+		t->cmp)			       /* tree is sorted */
+		return NULL;		       /* return failure */
+
+	return add234_internal(t, e, index);  /* this checks the upper bound */
+}
+
+void* find234(tree234* t, void* e, cmpfn234 cmp) {
+	return findrelpos234(t, e, cmp, REL234_EQ, NULL);
+}
+void* findrel234(tree234* t, void* e, cmpfn234 cmp, int relation) {
+	return findrelpos234(t, e, cmp, relation, NULL);
+}
+void* findpos234(tree234* t, void* e, cmpfn234 cmp, intptr_t* index) {
+	return findrelpos234(t, e, cmp, REL234_EQ, index);
+}
+
+void* delpos234(tree234* t, intptr_t index) {
+	if (index < 0 || index >= count234(t))
+		return NULL;
+	return delpos234_internal(t, index);
+}
+void* del234(tree234* t, void* e) {
+	intptr_t index;
+	if (!findrelpos234(t, e, NULL, REL234_EQ, &index))
+		return NULL;		       /* it wasn't in there anyway */
+	return delpos234_internal(t, index); /* it's there; delete it. */
+}
+
+static int height234(tree234* t) {
+	int h = -1;
+	node234* n;
+	for (n = t->root; n; n = isleaf234(n) ? NULL : KID234(t, n, 0))
+		h++;
+	return h;
+}
+
+#ifdef TREE234_COMPACT
+/*
+ * Copy the subtree n of from into the heap of to, giving back the nodes
+ * to the heap of from as it goes.
+ */
+static node234* copynode234(tree234* to, tree234* from, node234* n) {
+	node234* m = allocnode234(to, n->leaf);
+	intptr_t i;
+	m->nelems = n->nelems;
+	memcpy(m->elems, n->elems, n->nelems * sizeof(*m->elems));
+	if (!n->leaf) {
+		memcpy(m->counts, n->counts, (n->nelems + 1) * sizeof(*m->counts));
+		for (i = 0; i <= n->nelems; i++)
+			m->kids[i] = REF234(copynode234(to, from, KID234(from, n, i)));
+	}
+	freenode234(from, n);
+	return m;
+}
+#endif
+
+/*
+ * Lookups of a batch go down the tree a level at a time together, all
+ * the leaves being at the same depth. The node each one goes on to is
+ * prefetched, and is in the cache by the time the others have searched
+ * theirs, so a level costs about one miss rather than one per lookup.
+ */
+#define FINDMANY234_LANES 16
+
+void findmany234(tree234* t, void** keys, intptr_t n, void** out) {
+	node234* nodes[FINDMANY234_LANES];
+	intptr_t base, i, m;
+	int h, depth;
+
+	for (i = 0; i < n; i++)
+		out[i] = NULL;
+	if (!t->cmp)		       /* tree is unsorted */
+		return;
+	h = height234(t);
+	for (base = 0; base < n; base += m) {
+		m = n - base < FINDMANY234_LANES ? n - base : FINDMANY234_LANES;
+		for (i = 0; i < m; i++)
+			nodes[i] = t->root;
+		for (depth = 0; depth <= h; depth++) {
+			for (i = 0; i < m; i++) {
+				if (!nodes[i])
+					continue;
+				nodes[i] = findstep234(t, nodes[i], keys[base + i], t->cmp,
+					&out[base + i]);
+				if (nodes[i])
+					prefetchnode234(nodes[i], depth + 1 == h);
+			}
+		}
+	}
+}
+
+tree234* join234(tree234* left, tree234* right) {
+	int h;
+
+#ifndef NDEBUG
+	if (left->cmp && left->root && right->root)
+		assert(left->cmp(index234(left, count234(left) - 1), index234(right, 0)) < 0);
+#endif
+
+	sync234(left);
+	left->last = NULL;
+#ifndef TREE234_COMPACT
+	mergeheaps234(&left->heap, &right->heap);
+#endif
+	if (right->root) {
+		/* The first element of right goes between the two. */
+		void* e = delpos234(right, 0);
+		int lh = height234(left), rh = height234(right);
+#ifdef TREE234_COMPACT
+		/*
+		 * Node numbers only mean something in their own heap, so the
+		 * smaller tree is copied into the heap of the other, and no
+		 * element gets copied more than O(log n) times over any run of
+		 * joins.
+		 */
+		if (left->heap != right->heap) {
+			if (count234(left) < count234(right)) {
+				heap234* heap = left->heap;
+				if (left->root)
+					left->root = copynode234(right, left, left->root);
+				left->heap = right->heap;
+				right->heap = heap;
+			}
+			else if (right->root)
+				right->root = copynode234(left, right, right->root);
+		}
+#endif
+		left->root = joinnode234(left, left->root, lh,
+			e, right->root, rh, &h);
+		right->root = NULL;
+	}
+	freetree234(right);
+	return left;
+}
+
+tree234* split234(tree234* t, intptr_t index) {
+	tree234* ret;
+	node234* l, * r;
+	int lh, rh;
+
+	if (index < 0 || index > count234(t))
+		return NULL;
+	sync234(t);
+	t->last = NULL;
+	ret = mknew(tree234);
+	ret->root = NULL;
+	ret->cmp = t->cmp;
+	ret->heap = treeheap234(&t->heap);
+	ATOMICADD234(&ret->heap->refs, 1);
+	ret->last = NULL;
+	ret->pending = 0;
+	if (t->root) {
+		splitnode234(t, t->root, height234(t), index, &l, &lh, &r, &rh);
+		t->root = l;
+		ret->root = r;
+	}
+	LOG(("split tree %p at %d, new tree %p\n", t, index, ret));
+	return ret;
+}
+
+tree234* splitkey234(tree234* t, void* e, cmpfn234 cmp) {
+	intptr_t index;
+	if (!t->cmp)		       /* tree is unsorted */
+		return NULL;
+	if (!findrelpos234(t, e, cmp, REL234_GE, &index))
+		index = count234(t);
+	return split234(t, index);
+}
+
+/*
+ * Cursors. nodes[0..depth] is the path from the root to the node of
+ * the current element, which is elems[pos[depth]] there; above it,
+ * pos[] is the kid the path goes through. Stepping goes down to the
+ * nearest leaf or up to the nearest ancestor with an element on that
+ * side, so each node on a full traversal is entered once and left
+ * once.
+ */
+static void* iterat234(iter234* it) {
+	return it->nodes[it->depth]->elems[it->pos[it->depth]];
+}
+
+static void* iteroff234(iter234* it) {
+	it->depth = -1;
+	return NULL;
+}
+
+/*
+ * Go down from the root to the element at the given index, which must
+ * be between begin and end.
+ */
+static void* iterindex234(iter234* it, intptr_t index) {
+	node234* n = it->tree->root;
+	int depth = 0, i;
+
+	sync234(it->tree);
+	it->index = index;
+	for (;;) {
+		assert(depth < ITER234_DEPTH);
+		it->nodes[depth] = n;
+		for (i = 0; index > kidcount234(n, i); i++)
+			index -= kidcount234(n, i) + 1;
+		it->pos[depth] = i;
+		if (index == kidcount234(n, i))
+			break;
+		n = KID234(it->tree, n, i);
+		depth++;
+	}
+	it->depth = depth;
+	return iterat234(it);
+}
+
+static void* iterstart234(iter234* it, tree234* t, intptr_t index,
+	intptr_t begin, intptr_t end) {
+	it->tree = t;
+	it->begin = begin;
+	it->end = end;
+	if (index < begin || index >= end)
+		return iteroff234(it);
+	return iterindex234(it, index);
+}
+
+void* iter234_first(iter234* it, tree234* t) {
+	intptr_t count = count234(t);
+	return iterstart234(it, t, 0, 0, count);
+}
+
+void* iter234_last(iter234* it, tree234* t) {
+	intptr_t count = count234(t);
+	return iterstart234(it, t, count - 1, 0, count);
+}
+
+void* iter234_seek(iter234* it, tree234* t, void* e, cmpfn234 cmp, int relation) {
+	intptr_t index = -1;
+	findrelpos234(t, e, cmp, relation, &index);
+	return iterstart234(it, t, index, 0, count234(t));
+}
+
+void* iter234_range(iter234* it, tree234* t, void* lo, void* hi, cmpfn234 cmp) {
+	intptr_t count = count234(t), begin = 0, end = count;
+	if (lo && !findrelpos234(t, lo, cmp, REL234_GE, &begin))
+		begin = count;
+	if (hi && !findrelpos234(t, hi, cmp, REL234_GE, &end))
+		end = count;
+	return iterstart234(it, t, begin, begin, end);
+}
+
+void* iter234_next(iter234* it) {
+	node234* n;
+	int d = it->depth;
+
+	if (d < 0 || it->index + 1 >= it->end)
+		return iteroff234(it);
+	it->index++;
+
+	n = it->nodes[d];
+	if (!isleaf234(n)) {
+		/* Down to the leftmost leaf of the kid after the element. */
+		n = KID234(it->tree, n, ++it->pos[d]);
+		for (;;) {
+			it->nodes[++d] = n;
+			it->pos[d] = 0;
+			if (isleaf234(n))
+				break;
+			n = KID234(it->tree, n, 0);
+		}
+		it->depth = d;
+		return iterat234(it);
+	}
+	if (it->pos[d] + 1 < nodeelems234(n)) {
+		it->pos[d]++;
+		return iterat234(it);
+	}
+	/* Up to the first ancestor with an element after the kid. */
+	do
+		d--;
+	while (it->pos[d] == nodeelems234(it->nodes[d]));
+	it->depth = d;
+	return iterat234(it);
+}
+
+void* iter234_prev(iter234* it) {
+	node234* n;
+	int d = it->depth;
+
+	if (d < 0 || it->index <= it->begin)
+		return iteroff234(it);
+	it->index--;
+
+	n = it->nodes[d];
+	if (!isleaf234(n)) {
+		/* Down to the rightmost leaf of the kid before the element. */
+		n = KID234(it->tree, n, it->pos[d]);
+		for (;;) {
+			it->nodes[++d] = n;
+			it->pos[d] = nodeelems234(n);
+			if (isleaf234(n))
+				break;
+			n = KID234(it->tree, n, it->pos[d]);
+		}
+		it->pos[d]--;
+		it->depth = d;
+		return iterat234(it);
+	}
+	if (it->pos[d] > 0) {
+		it->pos[d]--;
+		return iterat234(it);
+	}
+	/* Up to the first ancestor with an element before the kid. */
+	do
+		d--;
+	while (it->pos[d] == 0);
+	it->pos[d]--;
+	it->depth = d;
+	return iterat234(it);
+}
+
+/*
+ * A frozen tree is the header below followed by, at offsets worked
+ * out from the count alone,
+ *
+ *   uint64_t keys[count + 1]    in Eytzinger order, keys[0] unused
+ *   uint32_t ranks[count + 1]   the index of the key in each slot,
+ *                               count in ranks[0]
+ *   uint32_t slots[count]       the slot of the key at each index
+ *
+ * Slot k has its kids in slots 2k and 2k + 1, as in a binary heap, so
+ * a search is all arithmetic, and the 8 slots three levels under k
+ * share a cache line (with the block 64-byte aligned) that can be
+ * fetched while going down those levels.
+ */
+#define FROZEN234_VERSION 1
+
+struct frozen234_Tag {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t count;
+	uint64_t size;
+	uint64_t pad[4];               /* to a cache line */
+};
+
+static const char frozenmagic234[8] = { 'T', 'R', 'E', 'E', '2', '3', '4', 'F' };
+
+static uint64_t* frozenkeys234(const frozen234* f) {
+	return (uint64_t*)(f + 1);
+}
+
+static uint32_t* frozenranks234(const frozen234* f) {
+	return (uint32_t*)(frozenkeys234(f) + f->count + 1);
+}
+
+static uint32_t* frozenslots234(const frozen234* f) {
+	return frozenranks234(f) + f->count + 1;
+}
+
+size_t frozensize234(intptr_t n) {
+	size_t size = sizeof(frozen234) + (n + 1) * sizeof(uint64_t) +
+		(2 * n + 1) * sizeof(uint32_t);
+	return (size + 7) & ~(size_t)7;
+}
+
+/*
+ * The slots are filled in order of index, which is an in-order walk of
+ * the implicit tree: from the leftmost slot, the next one is the
+ * leftmost under the right kid if there is one, else the first
+ * ancestor reached from a left kid.
+ */
+frozen234* freeze234(tree234* t, keyfn234 key, void* buf) {
+	frozen234* f = buf;
+	intptr_t n = count234(t), i;
+	uint64_t* keys, k, prev = 0;
+	uint32_t* ranks, * slots;
+	iter234 it;
+	void* e;
+
+	if (!t->cmp || n >= UINT32_MAX)
+		return NULL;
+	memset(f, 0, sizeof(*f));
+	f->count = n;
+	keys = frozenkeys234(f);
+	ranks = frozenranks234(f);
+	slots = frozenslots234(f);
+	keys[0] = 0;
+	ranks[0] = (uint32_t)n;
+
+	for (k = 1; 2 * k <= (uint64_t)n; k *= 2)
+		;
+	for (i = 0, e = iter234_first(&it, t); e; i++, e = iter234_next(&it)) {
+		keys[k] = key(e);
+		if (i > 0 && keys[k] <= prev)
+			return NULL;	       /* keys not increasing */
+		prev = keys[k];
+		ranks[k] = (uint32_t)i;
+		slots[i] = (uint32_t)k;
+		if (2 * k + 1 <= (uint64_t)n) {
+			for (k = 2 * k + 1; 2 * k <= (uint64_t)n; k *= 2)
+				;
+		}
+		else {
+			while (k & 1)
+				k >>= 1;
+			k >>= 1;
+		}
+	}
+
+	/* Only valid once complete. */
+	memcpy(f->magic, frozenmagic234, sizeof(f->magic));
+	f->version = FROZEN234_VERSION;
+	f->size = frozensize234(n);
+	LOG(("froze tree %p into %p, %d bytes\n", t, f, (int)f->size));
+	return f;
+}
+
+const frozen234* openfrozen234(const void* buf, size_t size) {
+	const frozen234* f = buf;
+	if (size < sizeof(*f) ||
+		memcmp(f->magic, frozenmagic234, sizeof(f->magic)) != 0 ||
+		f->version != FROZEN234_VERSION ||
+		f->count >= UINT32_MAX ||
+		f->size != size || size != frozensize234((intptr_t)f->count))
+		return NULL;
+	return f;
+}
+
+intptr_t frozencount234(const frozen234* f) {
+	return (intptr_t)f->count;
+}
+
+uint64_t frozenkey234(const frozen234* f, intptr_t index) {
+	uint32_t k;
+	assert(index >= 0 && (uint64_t)index < f->count);
+	k = frozenslots234(f)[index];
+	return k <= f->count ? frozenkeys234(f)[k] : 0;
+}
+
+/*
+ * Going down, each step is to kid 2k if the key at k is at or past
+ * the one looked for, 2k + 1 if not, taken as arithmetic rather than
+ * a branch. Below the bottom, k holds the turns taken in its bits; the
+ * key found is where the last left turn was, so k is shifted right past
+ * its trailing ones and one more (a division by a power of 2, k being
+ * of any length), 0 if there was none.
+ */
+intptr_t findfrozen234(const frozen234* f, uint64_t key, int relation) {
+	const uint64_t* keys = frozenkeys234(f);
+	uint64_t n = f->count, k = 1;
+	uint64_t past = relation == REL234_GT || relation == REL234_LE;
+	intptr_t i;
+
+	assert(relation >= REL234_EQ && relation <= REL234_GE);
+	while (k <= n) {
+		PREFETCH234(keys + 8 * k);
+		k = 2 * k + ((keys[k] < key) | (past & (keys[k] == key)));
+	}
+	k /= (~k & (k + 1)) * 2;
+	i = frozenranks234(f)[k];
+	if ((uint64_t)i > n)
+		i = n;			       /* corrupt, but kept in range */
+
+	switch (relation) {
+	case REL234_EQ:
+		return (uint64_t)i < n && keys[k] == key ? i : -1;
+	case REL234_GE:
+	case REL234_GT:
+		return (uint64_t)i < n ? i : -1;
+	default:			       /* REL234_LT, REL234_LE */
+		return i - 1;
+	}
+}
+
+#ifdef TEST
+
+/*
+ * Test code for the 2-3-4 tree. This code maintains an alternative
+ * representation of the data in the tree, in an array (using the
+ * obvious and slow insert and delete functions). After each tree
+ * operation, the verify() function is called, which ensures all
+ * the tree properties are preserved:
+ *  - node->child->parent always equals node
+ *  - tree->root->parent always equals NULL
+ *  - number of kids == 0 or number of elements + 1;
+ *  - tree has the same depth everywhere
+ *  - every node has at least one element
+ *  - subtree element counts are accurate
+ *  - any NULL kid pointer is accompanied by a zero count
+ *  - in a sorted tree: ordering property between elements of a
+ *    node and elements of its children is preserved
+ * and also ensures the list represented by the tree is the same
+ * list it should be. (This last check also doubly verifies the
+ * ordering properties, because the `same list it should be' is by
+ * definition correctly ordered. It also ensures all nodes are
+ * distinct, because the enum functions would get caught in a loop
+ * if not.)
+ */
+
+#include <stdarg.h>
+
+ /*
+  * Error reporting function.
+  */
+void error(char* fmt, ...) {
+	va_list ap;
+	printf("ERROR: ");
+	va_start(ap, fmt);
+	vfprintf(stdout, fmt, ap);
+	va_end(ap);
+	printf("\n");
+}
+
+/* The array representation of the data. */
+void** array;
+intptr_t arraylen, arraysize;
+cmpfn234 cmp;
+
+/* The tree representation of the same data. */
+tree234* tree;
+
+/*
+ * In the sorted tests, the same data again in a tree from
+ * Tree234Template.h, which must give the same answers as tree234.
+ * Small nodes make it deep enough for every case of add and delete.
+ */
+#define TYPED234_NAME strtree
+#define TYPED234_TYPE char*
+#define TYPED234_LESS(a, b) (strcmp(*(a), *(b)) < 0)
+#define TYPED234_KEYS 4
+#include "Tree234Template.h"
+
+strtree_tree* typed;
+
+typedef struct {
+	intptr_t treedepth;
+	intptr_t elemcount;
+} chkctx;
+
+#if TREE234_KEYS == 3
+
+intptr_t chknode(chkctx* ctx, intptr_t level, node234* node,
+	void* lowbound, void* highbound) {
+	intptr_t nkids, nelems;
+	intptr_t i;
+	intptr_t count;
+
+	/* Count the non-NULL kids. */
+	for (nkids = 0; nkids < 4 && node->kids[nkids]; nkids++);
+	/* Ensure no kids beyond the first NULL are non-NULL. */
+	for (i = nkids; i < 4; i++)
+		if (node->kids[i]) {
+			error("node %p: nkids=%d but kids[%d] non-NULL",
+				node, nkids, i);
+		}
+		else if (node->counts[i]) {
+			error("node %p: kids[%d] NULL but count[%d]=%d nonzero",
+				node, i, i, node->counts[i]);
+		}
+
+	/* Count the non-NULL elements. */
+	for (nelems = 0; nelems < 3 && node->elems[nelems]; nelems++);
+	/* Ensure no elements beyond the first NULL are non-NULL. */
+	for (i = nelems; i < 3; i++)
+		if (node->elems[i]) {
+			error("node %p: nelems=%d but elems[%d] non-NULL",
+				node, nelems, i);
+		}
+
+	if (nkids == 0) {
+		/*
+		 * If nkids==0, this is a leaf node; verify that the tree
+		 * depth is the same everywhere.
+		 */
+		if (ctx->treedepth < 0)
+			ctx->treedepth = level;    /* we didn't know the depth yet */
+		else if (ctx->treedepth != level)
+			error("node %p: leaf at depth %d, previously seen depth %d",
+				node, level, ctx->treedepth);
+	}
+	else {
+		/*
+		 * If nkids != 0, then it should be nelems+1, unless nelems
+		 * is 0 in which case nkids should also be 0 (and so we
+		 * shouldn't be in this condition at all).
+		 */
+		intptr_t shouldkids = (nelems ? nelems + 1 : 0);
+		if (nkids != shouldkids) {
+			error("node %p: %d elems should mean %d kids but has %d",
+				node, nelems, shouldkids, nkids);
+		}
+	}
+
+	/*
+	 * nelems should be at least 1.
+	 */
+	if (nelems == 0) {
+		error("node %p: no elems", node, nkids);
+	}
+
+	/*
+	 * Add nelems to the running element count of the whole tree.
+	 */
+	ctx->elemcount += nelems;
+
+	/*
 	 * Check ordering property: all elements should be strictly >
 	 * lowbound, strictly < highbound, and strictly < each other in
 	 * sequence. (lowbound and highbound are NULL at edges of tree
@@ -1103,19 +3078,153 @@ intptr_t chknode(chkctx* ctx, intptr_t level, node234* node,
 	return count;
 }
 
+node234* firstkid(node234* node) {
+	return node->kids[0];
+}
+
+#else
+
+/*
+ * The same checks for the B-tree layout, where each node knows how
+ * many elements it has: between MINKEYS and TREE234_KEYS, or at least
+ * one in the root, and a kid more than that unless it's a leaf.
+ */
+intptr_t chknode(chkctx* ctx, intptr_t level, node234* node,
+	void* lowbound, void* highbound) {
+	intptr_t nelems = node->nelems;
+	intptr_t minelems = (node == tree->root ? 1 : MINKEYS);
+	intptr_t i;
+	intptr_t count;
+
+	if (nelems < minelems || nelems > TREE234_KEYS) {
+		error("node %p: %d elems, should be %d to %d",
+			node, nelems, minelems, TREE234_KEYS);
+	}
+
+	if (node->leaf) {
+		if (ctx->treedepth < 0)
+			ctx->treedepth = level;
+		else if (ctx->treedepth != level)
+			error("node %p: leaf at depth %d, previously seen depth %d",
+				node, level, ctx->treedepth);
+	}
+
+	ctx->elemcount += nelems;
+
+	if (cmp) {
+		for (i = -1; i < nelems; i++) {
+			void* lower = (i == -1 ? lowbound : node->elems[i]);
+			void* higher = (i + 1 == nelems ? highbound : node->elems[i + 1]);
+			if (lower && higher && cmp(lower, higher) >= 0) {
+				error("node %p: kid comparison [%d=%s,%d=%s] failed",
+					node, i, lower, i + 1, higher);
+			}
+		}
+	}
+
+	count = nelems;
+	if (node->leaf)
+		return count;
+
+	for (i = 0; i <= nelems; i++) {
+		void* lower = (i == 0 ? lowbound : node->elems[i - 1]);
+		void* higher = (i == nelems ? highbound : node->elems[i]);
+		node234* kid = KID234(tree, node, i);
+		intptr_t subcount;
+#ifdef TREE234_COMPACT
+		if (kid->ref != node->kids[i]) {
+			error("node %p kid %d: numbered %x, found %p numbered %x",
+				node, i, node->kids[i], kid, kid->ref);
+		}
+#else
+		if (kid->parent != node) {
+			error("node %p kid %d: parent ptr is %p not %p",
+				node, i, kid->parent, node);
+		}
+#endif
+		subcount = chknode(ctx, level + 1, kid, lower, higher);
+		if (node->counts[i] != subcount) {
+			error("node %p kid %d: count says %d, subtree really has %d",
+				node, i, node->counts[i], subcount);
+		}
+		count += subcount;
+	}
+
+	return count;
+}
+
+node234* firstkid(node234* node) {
+	return node->leaf ? NULL : KID234(tree, node, 0);
+}
+
+#endif
+
+intptr_t typedchk(chkctx* ctx, intptr_t level, strtree_node* node,
+	char* lowbound, char* highbound) {
+	intptr_t minelems = (node == typed->root ? 1 : (4 - 1) / 2);
+	intptr_t i, count = node->nelems, subcount;
+	strtree_inner* inner;
+
+	if (node->nelems < minelems || node->nelems > 4)
+		error("typed node %p: %d elems", node, node->nelems);
+	if (node->leaf) {
+		if (ctx->treedepth < 0)
+			ctx->treedepth = level;
+		else if (ctx->treedepth != level)
+			error("typed node %p: leaf at depth %d, previously seen depth %d",
+				node, level, ctx->treedepth);
+	}
+	for (i = -1; i < node->nelems; i++) {
+		char* lower = (i == -1 ? lowbound : node->elems[i]);
+		char* higher = (i + 1 == node->nelems ? highbound : node->elems[i + 1]);
+		if (lower && higher && strcmp(lower, higher) >= 0)
+			error("typed node %p: kid comparison [%d=%s,%d=%s] failed",
+				node, i, lower, i + 1, higher);
+	}
+	if (node->leaf)
+		return count;
+	inner = (strtree_inner*)node;
+	for (i = 0; i <= node->nelems; i++) {
+		subcount = typedchk(ctx, level + 1, inner->kids[i],
+			i == 0 ? lowbound : node->elems[i - 1],
+			i == node->nelems ? highbound : node->elems[i]);
+		if (inner->counts[i] != subcount)
+			error("typed node %p kid %d: count says %d, subtree really has %d",
+				node, i, inner->counts[i], subcount);
+		count += subcount;
+	}
+	return count;
+}
+
 void verify(void) {
 	chkctx ctx;
+	iter234 it;
 	intptr_t i;
 	void* p;
+	node234* node;
 
 	ctx.treedepth = -1;                /* depth unknown yet */
 	ctx.elemcount = 0;                 /* no elements seen yet */
+	/*
+	 * count234 adds in what add234 appended without passing it up the
+	 * tree; chknode wants the counts up to date.
+	 */
+	if (count234(tree) != arraylen)
+		error("count234 gave %d before syncing, array has %d",
+			count234(tree), arraylen);
+	sync234(tree);
+	for (node = tree->root; node && !isleaf234(node); node = KID234(tree, node, nodeelems234(node)))
+		;
+	if (tree->last && tree->last != node)
+		error("last leaf %p isn't the rightmost one, %p", tree->last, node);
 	/*
 	 * Verify validity of tree properties.
 	 */
 	if (tree->root) {
+#ifndef TREE234_COMPACT
 		if (tree->root->parent != NULL)
 			error("root->parent is %p should be null", tree->root->parent);
+#endif
 		chknode(&ctx, 0, tree->root, NULL, NULL);
 	}
 	printf("tree depth: %d\n", ctx.treedepth);
@@ -1141,6 +3250,38 @@ void verify(void) {
 		error("tree really contains %d elements, count234 gave %d",
 			ctx.elemcount, i);
 	}
+	/*
+	 * Walk the tree with a cursor, both ways.
+	 */
+	for (i = 0, p = iter234_first(&it, tree); p; p = iter234_next(&it), i++) {
+		if (i >= arraylen || array[i] != p || it.index != i)
+			error("iter234_next at %d gave %s(%d), array says %s",
+				i, p, it.index, i < arraylen ? array[i] : "nothing");
+	}
+	if (i != arraylen)
+		error("iter234_next gave %d elements, array has %d", i, arraylen);
+	for (i = arraylen - 1, p = iter234_last(&it, tree); p; p = iter234_prev(&it), i--) {
+		if (i < 0 || array[i] != p || it.index != i)
+			error("iter234_prev at %d gave %s(%d), array says %s",
+				i, p, it.index, i >= 0 ? array[i] : "nothing");
+	}
+	if (i != -1)
+		error("iter234_prev stopped at %d", i);
+
+	if (typed) {
+		ctx.treedepth = -1;
+		if (typed->root && typedchk(&ctx, 0, typed->root, NULL, NULL) != arraylen)
+			error("typed tree doesn't hold %d elements", arraylen);
+		if (strtree_count(typed) != arraylen)
+			error("strtree_count gave %d, array has %d",
+				strtree_count(typed), arraylen);
+		for (i = 0; i < arraylen; i++)
+			if (*strtree_index(typed, i) != array[i])
+				error("strtree_index(%d) gave %s, array says %s",
+					i, *strtree_index(typed, i), array[i]);
+		if (strtree_index(typed, arraylen))
+			error("strtree_index(%d) past the end", arraylen);
+	}
 }
 
 void internal_addtest(void* elem, intptr_t index, void* realret) {
@@ -1173,6 +3314,8 @@ void addtest(void* elem) {
 	void* realret;
 
 	realret = add234(tree, elem);
+	if (typed && *strtree_add(typed, elem) != realret)
+		error("strtree_add(%s) differs from add234", elem);
 
 	i = 0;
 	while (i < arraylen && cmp(elem, array[i]) > 0)
@@ -1210,6 +3353,11 @@ void delpostest(intptr_t i) {
 		ret = del234(tree, elem);
 	else
 		ret = delpos234(tree, index);
+	if (typed) {
+		char* typedret = NULL;
+		if (!strtree_del(typed, (char**)&elem, &typedret) || typedret != elem)
+			error("strtree_del(%s) gave %s", elem, typedret);
+	}
 
 	if (ret != elem) {
 		error("del returned %p, expected %p", ret, elem);
@@ -1274,9 +3422,13 @@ int findtest(void) {
 	const static char* const relnames[] = {
 	"EQ", "GE", "LE", "LT", "GT"
 	};
+	static const intptr_t batches[] = {
+	1, 5, FINDMANY234_LANES, FINDMANY234_LANES + 1, NSTR
+	};
 	intptr_t i, j, rel, index;
 	char* p, * ret, * realret, * realret2;
 	intptr_t lo, hi, mid, c;
+	iter234 it;
 
 	for (i = 0; i < NSTR; i++) {
 		p = strings[i];
@@ -1333,6 +3485,31 @@ int findtest(void) {
 						p, relnames[j], realret, index, index, realret2);
 				}
 			}
+			if (typed) {
+				intptr_t typedindex = -1;
+				char** typedret = strtree_findrelpos(typed, &p, rel, &typedindex);
+				if ((typedret ? *typedret : NULL) != realret
+					|| (realret && typedindex != index))
+					error("strtree_findrelpos(\"%s\",%s) differs from findrelpos234",
+						p, relnames[j]);
+				typedret = strtree_find(typed, &p);
+				if ((typedret ? *typedret : NULL) != find234(tree, p, NULL))
+					error("strtree_find(\"%s\") differs from find234", p);
+			}
+			realret2 = iter234_seek(&it, tree, p, NULL, rel);
+			if (realret2 != ret || (ret && it.index != mid)) {
+				error("iter234_seek(\"%s\",%s) gave %s(%d) should be %s(%d)",
+					p, relnames[j], realret2, it.index, ret, mid);
+			}
+			if (ret) {
+				realret2 = iter234_next(&it);
+				if (realret2 != (mid + 1 < arraylen ? array[mid + 1] : NULL))
+					error("iter234_next after %s gave %s", ret, realret2);
+				iter234_seek(&it, tree, p, NULL, rel);
+				realret2 = iter234_prev(&it);
+				if (realret2 != (mid > 0 ? array[mid - 1] : NULL))
+					error("iter234_prev before %s gave %s", ret, realret2);
+			}
 #if 0
 			printf("find(\"%s\",%s) gave %s(%d)\n", p, relnames[j],
 				realret, index);
@@ -1340,6 +3517,56 @@ int findtest(void) {
 		}
 	}
 
+	/*
+	 * All the strings in batches smaller and larger than the number
+	 * findmany234 walks at once.
+	 */
+	for (j = 0; j < lenof(batches); j++) {
+		void* found[NSTR];
+		for (i = 0; i < NSTR; i += batches[j]) {
+			intptr_t nkeys = (NSTR - i < batches[j] ? NSTR - i : batches[j]), k;
+			findmany234(tree, (void**)&strings[i], nkeys, found);
+			for (k = 0; k < nkeys; k++)
+				if (found[k] != find234(tree, strings[i + k], NULL))
+					error("findmany234 of \"%s\" gave %s should be %s",
+						strings[i + k], found[k], find234(tree, strings[i + k], NULL));
+		}
+	}
+
+	/*
+	 * Ranges [lo, hi) between pairs of strings, some empty, with
+	 * open ends too.
+	 */
+	for (i = 0; i <= NSTR; i++) {
+		char* lostr = (i < NSTR ? strings[i] : NULL);
+		char* histr = (i < NSTR ? strings[(i * 7 + 3) % NSTR] : NULL);
+		lo = 0;
+		while (lostr && lo < arraylen && strcmp(array[lo], lostr) < 0)
+			lo++;
+		hi = arraylen;
+		while (histr && hi > 0 && strcmp(array[hi - 1], histr) >= 0)
+			hi--;
+		for (mid = lo, p = iter234_range(&it, tree, lostr, histr, NULL);
+			p; p = iter234_next(&it), mid++) {
+			if (mid >= hi || p != array[mid])
+				error("range [%s,%s) gave %s at %d, should be %s",
+					lostr, histr, p, mid, mid < hi ? array[mid] : "nothing");
+		}
+		if (mid < hi)
+			error("range [%s,%s) stopped at %d, should be %d",
+				lostr, histr, mid, hi);
+		if (iter234_range(&it, tree, lostr, histr, NULL) && iter234_prev(&it))
+			error("range [%s,%s) went back past %s", lostr, histr, array[lo]);
+	}
+
+	if (typed) {
+		char** first = strtree_findrelpos(typed, NULL, REL234_GT, NULL);
+		char** last = strtree_findrelpos(typed, NULL, REL234_LT, NULL);
+		if ((first ? *first : NULL) != (arraylen ? array[0] : NULL)
+			|| (last ? *last : NULL) != (arraylen ? array[arraylen - 1] : NULL))
+			error("strtree_findrelpos(NULL) gave the wrong ends");
+	}
+
 	realret = findrelpos234(tree, NULL, NULL, REL234_GT, &index);
 	if (arraylen && (realret != array[0] || index != 0)) {
 		error("find(NULL,GT) gave %s(%d) should be %s(0)",
@@ -1361,6 +3588,399 @@ int findtest(void) {
 	}
 }
 
+/*
+ * Free a tree holding the same list as the array, checking the
+ * elements are passed in order.
+ */
+void freewithcheck(void* e, void* ctx) {
+	intptr_t* next = (intptr_t*)ctx;
+	if (*next >= arraylen || array[*next] != e)
+		error("freetree234_with passed %s at %d, expected %s",
+			e, (int)*next, *next < arraylen ? array[*next] : "nothing");
+	(*next)++;
+}
+
+void freewithtest(tree234* t) {
+	intptr_t next = 0;
+	freetree234_with(t, freewithcheck, &next);
+	if (next != arraylen)
+		error("freetree234_with passed %d elements, expected %d",
+			(int)next, (int)arraylen);
+}
+
+/*
+ * Build trees of every size up to a few hundred elements, and some
+ * larger ones, check them as if they had been built by add234, then
+ * make sure they take further adds and deletes.
+ */
+#define NBUILD 1500
+char buildnames[NBUILD][8];
+
+void buildtest(cmpfn234 buildcmp) {
+	void* elems[NBUILD];
+	intptr_t n, i, depth, mindepth, max;
+	node234* node;
+	tree234* copy;
+
+	for (i = 0; i < NBUILD; i++) {
+		sprintf(buildnames[i], "%05d", (int)i);
+		elems[i] = buildnames[i];
+	}
+	if (arraysize < NBUILD + 1) {
+		arraysize = NBUILD + 1;
+		array = (array == NULL ? smalloc(arraysize * sizeof(*array)) :
+			srealloc(array, arraysize * sizeof(*array)));
+	}
+
+	for (n = 0; n < NBUILD; n += (n < 300 ? 1 : 97)) {
+		printf("building %s tree of %d\n", buildcmp ? "sorted" : "unsorted", (int)n);
+		for (i = 0; i < n; i++)
+			array[i] = elems[i];
+		arraylen = n;
+		cmp = buildcmp;
+		tree = buildtree234(buildcmp, elems, n);
+		verify();
+
+		/* Packed: no taller than the lowest tree holding n elements. */
+		for (depth = -1, node = tree->root; node; node = firstkid(node))
+			depth++;
+		for (mindepth = n ? 0 : -1, max = TREE234_KEYS; max < n;
+			max = max * (TREE234_KEYS + 1) + TREE234_KEYS)
+			mindepth++;
+		if (depth != mindepth)
+			error("built tree of %d has depth %d, should be %d",
+				(int)n, (int)depth, (int)mindepth);
+
+		/* The same list added one by one, which leaves 2- and 3-nodes. */
+		copy = newtree234(buildcmp);
+		for (i = 0; i < n; i++) {
+			if (buildcmp)
+				add234(copy, elems[(i * 7919) % n]);
+			else
+				addpos234(copy, elems[i], i);
+		}
+		freewithtest(copy);
+
+		if (buildcmp) {
+			if (n > 0)	       /* findtest needs elements */
+				findtest();
+			addtest("00000x");
+			deltest(buildnames[n / 2]);
+			while (arraylen > 0)
+				deltest(array[arraylen / 3]);
+		}
+		else {
+			addpostest("x", n / 2);
+			while (arraylen > 0)
+				delpostest(arraylen / 3);
+		}
+		freetree234(tree);
+	}
+}
+
+/*
+ * Split trees of various sizes at a spread of indices, check both
+ * halves, and join them back. Half the trees are built by buildtree234
+ * and half by adding in a scattered order, for nodes of all fills.
+ * Some halves are freed apart, or joined to a tree with nodes of its
+ * own first, for the node memory they share.
+ */
+void* splitelems[NBUILD];
+
+void checkpart(tree234* t, cmpfn234 c, intptr_t from, intptr_t to) {
+	intptr_t i;
+	tree = t;
+	cmp = c;
+	for (i = from; i < to; i++)
+		array[i - from] = splitelems[i];
+	arraylen = to - from;
+	verify();
+}
+
+tree234* maketree(cmpfn234 c, intptr_t from, intptr_t to, int scattered) {
+	tree234* t;
+	intptr_t i, n = to - from;
+	if (!scattered)
+		return buildtree234(c, splitelems + from, n);
+	t = newtree234(c);
+	for (i = 0; i < n; i++) {
+		if (c)
+			add234(t, splitelems[from + (i * 7919) % n]);
+		else
+			addpos234(t, splitelems[from + i], i);
+	}
+	return t;
+}
+
+void splittest(cmpfn234 c) {
+	static const intptr_t big[] = { 97, 300, 1000, NBUILD - 1 };
+	intptr_t n, i, j, k, nsteps;
+	tree234* left, * right, * other;
+	char key[16];
+
+	for (i = 0; i < NBUILD; i++)
+		splitelems[i] = buildnames[i];
+	for (k = 0; k < 41 + (intptr_t)lenof(big); k++) {
+		n = k < 41 ? k : big[k - 41];
+		nsteps = n < 30 ? n : 30;
+		for (j = 0; j <= nsteps; j++) {
+			i = nsteps ? n * j / nsteps : 0;
+			printf("splitting %s tree of %d at %d\n", c ? "sorted" : "unsorted", (int)n, (int)i);
+			left = maketree(c, 0, n, (int)((n + j) % 2));
+			if (c && j % 4 == 1 && i < n)
+				right = splitkey234(left, splitelems[i], NULL);
+			else if (c && j % 4 == 3 && i > 0) {
+				sprintf(key, "%s-", buildnames[i - 1]);
+				right = splitkey234(left, key, NULL);
+			}
+			else
+				right = split234(left, i);
+			checkpart(left, c, 0, i);
+			checkpart(right, c, i, n);
+
+			switch (j % 3) {
+			case 0:
+				left = join234(left, right);
+				checkpart(left, c, 0, n);
+				if (n > 0)
+					c ? deltest(array[n / 2]) : delpostest(n / 2);
+				freetree234(tree);
+				break;
+			case 1:
+				freetree234(left);
+				checkpart(right, c, i, n);
+				c ? addtest("x") : addpostest("x", 0);
+				while (arraylen > 0 && arraylen + 5 > n - i)
+					c ? deltest(array[arraylen / 3]) : delpostest(arraylen / 3);
+				freetree234(tree);
+				break;
+			case 2:
+				other = maketree(c, 0, i, (int)((n + j + 1) % 2));
+				other = join234(other, right);
+				checkpart(other, c, 0, n);
+				checkpart(left, c, 0, i);
+				c ? addtest("x") : addpostest("x", arraylen);
+				freetree234(left);
+				checkpart(other, c, 0, n);
+				c ? addtest("x") : addpostest("x", n / 2);
+				freetree234(tree);
+				break;
+			}
+		}
+	}
+	arraylen = 0;
+}
+
+/*
+ * Add and delete at random among the NBUILD names, then at random
+ * indices in an unsorted tree: enough elements for a few levels of
+ * nodes whatever TREE234_KEYS is, with the splits, rotations and
+ * merges that come with them.
+ */
+/*
+ * Elements added in order, which add234 puts straight into the last
+ * leaf. Each is read back at once by one of the functions that need
+ * the counts of those appends, or left for the next ones.
+ */
+void appendtest(void) {
+	intptr_t order[NBUILD];
+	intptr_t i, j, index;
+	iter234 it;
+	void* e;
+
+	tree = newtree234(mycmp);
+	cmp = mycmp;
+	arraylen = 0;
+	for (i = 0; i < NBUILD; i++) {
+		e = buildnames[i];
+		printf("appending %s\n", (char*)e);
+		if (add234(tree, e) != e)
+			error("add234(%s) in order failed", e);
+		array[arraylen++] = e;
+		switch (i % 6) {
+		case 0:
+			if (count234(tree) != arraylen)
+				error("count234 after appending %s gave %d", e, count234(tree));
+			break;
+		case 1:
+			if (index234(tree, i) != e)
+				error("index234(%d) after appending %s gave %s", i, e, index234(tree, i));
+			break;
+		case 2:
+			if (findpos234(tree, e, NULL, &index) != e || index != i)
+				error("findpos234(%s) after appending it failed", e);
+			break;
+		case 3:
+			if (iter234_last(&it, tree) != e || it.index != i)
+				error("iter234_last after appending %s failed", e);
+			break;
+		case 4:
+			if (add234(tree, e) != e || add234(tree, buildnames[i / 2]) != buildnames[i / 2])
+				error("adding %s or %s again after appending failed", e, buildnames[i / 2]);
+			break;
+		}
+		if (i % 97 == 0)
+			verify();
+	}
+	verify();
+
+	/* Taking off the end must leave no finger on a freed node. */
+	for (i = 0; i < 100; i++) {
+		deltest(array[arraylen - 1]);
+		deltest(array[arraylen - 1]);
+		addtest(buildnames[arraylen]);
+	}
+	freetree234(tree);
+
+	/* Nearly in order: now and then one comes early. */
+	for (i = 0; i < NBUILD; i++)
+		order[i] = i;
+	for (i = 0; i + 5 < NBUILD; i += 10) {
+		j = order[i];
+		order[i] = order[i + 5];
+		order[i + 5] = j;
+	}
+	tree = newtree234(mycmp);
+	arraylen = 0;
+	for (i = 0; i < NBUILD; i++)
+		addtest(buildnames[order[i]]);
+	freetree234(tree);
+	arraylen = 0;
+}
+
+/*
+ * Freeze trees of names with key 2 * number, so odd keys fall between,
+ * and look up every key around them in every relation. Then copy the
+ * block as if through a file, and make sure openfrozen234 takes only
+ * a whole one.
+ */
+uint64_t namekey(void* e) {
+	return 2 * (uint64_t)atoi(e);
+}
+
+uint64_t reversekey(void* e) {
+	return NBUILD - (uint64_t)atoi(e);
+}
+
+void frozencheck(const frozen234* f, intptr_t n) {
+	static const char* const relnames[] = { "EQ", "LT", "LE", "GT", "GE" };
+	intptr_t i, expected, got;
+	uint64_t key;
+	int rel;
+
+	if (frozencount234(f) != n)
+		error("frozencount234 gave %d, expected %d", frozencount234(f), n);
+	for (i = 0; i < n; i++)
+		if (frozenkey234(f, i) != 2 * (uint64_t)i)
+			error("frozenkey234(%d) gave %d", i, (int)frozenkey234(f, i));
+	for (key = 0; key <= 2 * (uint64_t)n + 1; key++) {
+		for (rel = REL234_EQ; rel <= REL234_GE; rel++) {
+			switch (rel) {
+			case REL234_EQ: expected = key % 2 == 0 ? key / 2 : n; break;
+			case REL234_GE: expected = (key + 1) / 2; break;
+			case REL234_GT: expected = key / 2 + 1; break;
+			case REL234_LE: expected = key / 2; break;
+			default: expected = (key + 1) / 2 - 1; break;
+			}
+			if (expected >= n)
+				expected = rel == REL234_LT || rel == REL234_LE ? n - 1 : -1;
+			got = findfrozen234(f, key, rel);
+			if (got != expected)
+				error("findfrozen234(%d, %s) in %d gave %d, expected %d",
+					(int)key, relnames[rel], n, got, expected);
+		}
+	}
+}
+
+void frozentest(void) {
+	void* elems[NBUILD];
+	intptr_t n, i;
+	size_t size;
+	uint64_t* buf, * copy;
+	frozen234* f;
+
+	for (i = 0; i < NBUILD; i++)
+		elems[i] = buildnames[i];
+	for (n = 0; n <= NBUILD; n += (n < 300 ? 1 : 149)) {
+		printf("freezing %d\n", n);
+		tree = buildtree234(mycmp, elems, n);
+		size = frozensize234(n);
+		buf = smalloc(size);
+		copy = smalloc(size);
+		f = freeze234(tree, namekey, buf);
+		if (f != (frozen234*)buf)
+			error("freeze234 of %d failed", n);
+		frozencheck(f, n);
+
+		memcpy(copy, buf, size);
+		memset(buf, 0, size);
+		if (openfrozen234(copy, size) != (frozen234*)copy)
+			error("openfrozen234 of %d failed", n);
+		frozencheck((frozen234*)copy, n);
+		if (openfrozen234(copy, size - 8) || openfrozen234(copy, size + 8) ||
+			openfrozen234(buf, size))
+			error("openfrozen234 of %d took a bad block", n);
+
+		/* Wrong ranks give wrong answers, but indices in range. */
+		memset(frozenranks234((frozen234*)copy), 0xFF, (n + 1) * sizeof(uint32_t));
+		for (i = 0; i <= 2 * n + 1; i++) {
+			int rel;
+			for (rel = REL234_EQ; rel <= REL234_GE; rel++) {
+				intptr_t got = findfrozen234((frozen234*)copy, i, rel);
+				if (got < -1 || got >= n)
+					error("findfrozen234(%d) with bad ranks gave %d", i, got);
+			}
+		}
+
+		if (n > 1 && freeze234(tree, reversekey, buf))
+			error("freeze234 of %d took decreasing keys", n);
+		if (openfrozen234(buf, size))
+			error("openfrozen234 of %d took a failed freeze", n);
+		sfree(buf);
+		sfree(copy);
+		freetree234(tree);
+	}
+
+	tree = buildtree234(NULL, elems, 10);
+	buf = smalloc(frozensize234(10));
+	if (freeze234(tree, namekey, buf))
+		error("freeze234 of an unsorted tree succeeded");
+	sfree(buf);
+	freetree234(tree);
+}
+
+void randomtest(unsigned* seed) {
+	char in[NBUILD];
+	intptr_t i, j;
+
+	memset(in, 0, sizeof(in));
+	tree = newtree234(mycmp);
+	typed = strtree_new();
+	cmp = mycmp;
+	for (i = 0; i < 20000; i++) {
+		j = randomnumber(seed) % NBUILD;
+		printf("trial: %d, %s %s\n", (int)i, in[j] ? "deleting" : "adding", buildnames[j]);
+		if (in[j])
+			deltest(buildnames[j]);
+		else
+			addtest(buildnames[j]);
+		in[j] = !in[j];
+	}
+	while (arraylen > 0)
+		deltest(array[randomnumber(seed) % arraylen]);
+	freetree234(tree);
+	strtree_free(typed);
+	typed = NULL;
+
+	tree = newtree234(NULL);
+	cmp = NULL;
+	for (i = 0; i < 5000; i++)
+		addpostest(buildnames[i % NBUILD], randomnumber(seed) % (arraylen + 1));
+	while (arraylen > 0)
+		delpostest(randomnumber(seed) % arraylen);
+	freetree234(tree);
+}
+
 int main(void) {
 	intptr_t in[NSTR];
 	intptr_t i, j, k;
@@ -1370,6 +3990,7 @@ int main(void) {
 	array = NULL;
 	arraylen = arraysize = 0;
 	tree = newtree234(mycmp);
+	typed = strtree_new();
 	cmp = mycmp;
 
 	verify();
@@ -1397,6 +4018,16 @@ int main(void) {
 	}
 
 	freetree234(tree);
+	strtree_free(typed);
+	typed = NULL;
+
+	buildtest(mycmp);
+	buildtest(NULL);
+	splittest(mycmp);
+	splittest(NULL);
+	appendtest();
+	frozentest();
+	randomtest(&seed);
 
 	/*
 	 * Now try an unsorted tree. We don't really need to test
@@ -1429,3 +4060,479 @@ int main(void) {
 }
 
 #endif
+
+#ifdef BENCH_TREE234
+
+/*
+ * Benchmark, build on its own:
+ *   cc -O2 -DBENCH_TREE234 -IInclude Source/Tree234.c
+ *
+ * Builds sorted trees of 1000 to 1000000 integers (or up to the count
+ * given) with repeated add234 and with buildtree234, checks they hold
+ * the same elements and reports how many nodes each one takes. Each
+ * one is then split and joined back at a spread of indices, and cut in
+ * halves put back together with add234.
+ *
+ * Then tears down a tree of 1000000 allocated elements, added in
+ * scattered order, by deleting them one by one and with
+ * freetree234_with, and reports the mallocs its nodes took.
+ *
+ * Add -DTREE234_KEYS=n to time the B-tree layout with n elements per
+ * node. Insertion and lookup are timed first, in scattered order, for
+ * 1000, 100000 and 10000000 elements (with a count of 10000000), then
+ * a full traversal with index234 and with a cursor, then insertion
+ * and lookup again in a tree of intptr_t from Tree234Template.h.
+ *
+ * A tree of 1000000 (and 100000000, with a count that high) is frozen
+ * and timed against the live one. Give "frozen" after the count to
+ * time only that, which leaves the memory for 100000000.
+ */
+
+#include <time.h>
+
+static double now(void) {
+	struct timespec time;
+	timespec_get(&time, TIME_UTC);
+	return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+#if TREE234_KEYS == 3
+
+static intptr_t nodecount(tree234* t, node234* n) {
+	intptr_t count = 1, i;
+	if (!n)
+		return 0;
+	for (i = 0; i < 4; i++)
+		count += nodecount(t, n->kids[i]);
+	return count;
+}
+
+#else
+
+static intptr_t nodecount(tree234* t, node234* n) {
+	intptr_t count = 1, i;
+	if (!n)
+		return 0;
+	if (!n->leaf)
+		for (i = 0; i <= n->nelems; i++)
+			count += nodecount(t, KID234(t, n, i));
+	return count;
+}
+
+#endif
+
+static intptr_t slabcount(tree234* t) {
+	intptr_t count = 0, i;
+	slab234* slab;
+	for (i = 0; i < 2; i++)
+		for (slab = t->heap->pools[i].slabs; slab; slab = slab->next)
+			count++;
+	return count;
+}
+
+/*
+ * Memory taken by the nodes of t, slabs counted whole.
+ */
+static size_t slabbytes(tree234* t) {
+	size_t bytes = 0;
+	intptr_t i;
+	slab234* slab;
+	for (i = 0; i < 2; i++) {
+		pool234* pool = &t->heap->pools[i];
+		for (slab = pool->slabs; slab; slab = slab->next)
+			bytes += sizeof(slab234) + slab->size * pool->nodesize;
+#ifdef TREE234_COMPACT
+		bytes += pool->chunkroom * sizeof(*pool->chunks);
+#endif
+	}
+	return bytes;
+}
+
+static int intcmp(void* av, void* bv) {
+	intptr_t a = *(intptr_t*)av, b = *(intptr_t*)bv;
+	return (a > b) - (a < b);
+}
+
+static void freeelem(void* e, void* ctx) {
+	(void)ctx;
+	sfree(e);
+}
+
+static tree234* scatteredtree(intptr_t n) {
+	tree234* t = newtree234(intcmp);
+	intptr_t i;
+	for (i = 0; i < n; i++) {
+		intptr_t* key = smalloc(sizeof(*key));
+		*key = (i * 7919) % n;
+		add234(t, key);
+	}
+	return t;
+}
+
+/*
+ * Insert n keys in scattered order with add234, then look each one up
+ * with find234 in another scattered order.
+ */
+static void lookupbench(intptr_t n) {
+	intptr_t* keys = smalloc(n * sizeof(*keys));
+	tree234* t = newtree234(intcmp);
+	double start, addtime, findtime, indextime, itertime;
+	intptr_t i, step = 7919;
+	intptr_t* found;
+	iter234 it;
+
+	while (n % step == 0)
+		step += 2;
+	for (i = 0; i < n; i++)
+		keys[i] = (i * step) % n;
+
+	start = now();
+	for (i = 0; i < n; i++)
+		add234(t, &keys[i]);
+	addtime = now() - start;
+
+	start = now();
+	for (i = 0; i < n; i++) {
+		intptr_t key = (i * 104729) % n;
+		found = find234(t, &key, NULL);
+		if (!found || *found != key)
+			abort();
+	}
+	findtime = now() - start;
+
+	printf("%8d elements: add234 %6.1f ns, find234 %6.1f ns per element, %d nodes, %.1f bytes per element\n",
+		(int)n, addtime * 1e9 / n, findtime * 1e9 / n, (int)nodecount(t, t->root),
+		(double)slabbytes(t) / n);
+
+	start = now();
+	for (i = 0; i < n; i++)
+		if (*(intptr_t*)index234(t, i) != i)
+			abort();
+	indextime = now() - start;
+
+	start = now();
+	for (i = 0, found = iter234_first(&it, t); found; found = iter234_next(&it), i++)
+		if (*found != i)
+			abort();
+	if (i != n)
+		abort();
+	itertime = now() - start;
+
+	printf("%8d elements: traversal by index234 %6.1f ns, iter234_next %6.1f ns per element (%.1fx)\n",
+		(int)n, indextime * 1e9 / n, itertime * 1e9 / n, indextime / itertime);
+	freetree234(t);
+	sfree(keys);
+}
+
+/*
+ * The same keys in a tree from Tree234Template.h, holding them in its
+ * nodes and comparing them inline.
+ */
+#define TYPED234_NAME inttree
+#define TYPED234_TYPE intptr_t
+#define TYPED234_LESS(a, b) (*(a) < *(b))
+#include "Tree234Template.h"
+
+static void typedbench(intptr_t n) {
+	inttree_tree* t = inttree_new();
+	double start, addtime, findtime;
+	intptr_t i, step = 7919;
+
+	while (n % step == 0)
+		step += 2;
+
+	start = now();
+	for (i = 0; i < n; i++)
+		inttree_add(t, (i * step) % n);
+	addtime = now() - start;
+
+	start = now();
+	for (i = 0; i < n; i++) {
+		intptr_t key = (i * 104729) % n;
+		intptr_t* found = inttree_find(t, &key);
+		if (!found || *found != key)
+			abort();
+	}
+	findtime = now() - start;
+
+	printf("%8d elements: inttree_add %6.1f ns, inttree_find %6.1f ns per element\n",
+		(int)n, addtime * 1e9 / n, findtime * 1e9 / n);
+	inttree_free(t);
+}
+
+/*
+ * Look up every key of a tree of n in scattered order, with find234 and
+ * then with findmany234 in batches.
+ */
+static void findmanybench(intptr_t n) {
+	static const intptr_t batches[] = { 1, 8, 32, 128 };
+	intptr_t* keys = smalloc(n * sizeof(*keys));
+	intptr_t* lookups = smalloc(n * sizeof(*lookups));
+	void** elems = smalloc(n * sizeof(*elems));
+	void** ptrs = smalloc(n * sizeof(*ptrs));
+	void** found = smalloc(n * sizeof(*found));
+	tree234* t;
+	double start, findtime, manytime;
+	intptr_t i, j, b;
+
+	for (i = 0; i < n; i++) {
+		keys[i] = i;
+		elems[i] = &keys[i];
+		lookups[i] = (i * 104729) % n;
+		ptrs[i] = &lookups[i];
+	}
+	t = buildtree234(intcmp, elems, n);
+
+	start = now();
+	for (i = 0; i < n; i++)
+		if (*(intptr_t*)find234(t, ptrs[i], NULL) != lookups[i])
+			abort();
+	findtime = now() - start;
+	printf("%8d elements: find234 %6.2f M/s", (int)n, n / findtime * 1e-6);
+
+	for (b = 0; b < (intptr_t)(sizeof(batches) / sizeof(*batches)); b++) {
+		start = now();
+		for (i = 0; i < n; i += batches[b])
+			findmany234(t, ptrs + i, n - i < batches[b] ? n - i : batches[b], found + i);
+		manytime = now() - start;
+		for (j = 0; j < n; j++)
+			if (*(intptr_t*)found[j] != lookups[j])
+				abort();
+		printf(", findmany234 by %d %6.2f M/s", (int)batches[b], n / manytime * 1e-6);
+	}
+	printf("\n");
+
+	freetree234(t);
+	sfree(found);
+	sfree(ptrs);
+	sfree(elems);
+	sfree(lookups);
+	sfree(keys);
+}
+
+/*
+ * Add n keys with add234 in order, in order but for one in 16 swapped
+ * with the one 16 places on, and scattered.
+ */
+static void appendbench(intptr_t n) {
+	static const char* const names[] = { "sorted", "nearly sorted", "random" };
+	intptr_t* keys = smalloc(n * sizeof(*keys));
+	intptr_t i, j, k, step = 7919;
+	tree234* t;
+	double start;
+
+	while (n % step == 0)
+		step += 2;
+	printf("%8d elements: add234", (int)n);
+	for (k = 0; k < 3; k++) {
+		for (i = 0; i < n; i++)
+			keys[i] = k < 2 ? i : (i * step) % n;
+		if (k == 1)
+			for (i = 0; i + 16 < n; i += 32) {
+				j = keys[i];
+				keys[i] = keys[i + 16];
+				keys[i + 16] = j;
+			}
+		t = newtree234(intcmp);
+		start = now();
+		for (i = 0; i < n; i++)
+			add234(t, &keys[i]);
+		printf("%s %s %6.1f ns", k ? "," : "", names[k], (now() - start) * 1e9 / n);
+		if (count234(t) != n)
+			abort();
+		freetree234(t);
+	}
+	printf(" per element\n");
+	sfree(keys);
+}
+
+static uint64_t intkey(void* e) {
+	return *(intptr_t*)e;
+}
+
+/*
+ * Freeze a tree of n even integers, write it to a file and read it
+ * back, and look up scattered keys in the tree and in the frozen block:
+ * by key, by key falling between two, and by index.
+ */
+static void frozenbench(intptr_t n) {
+	intptr_t* keys = smalloc(n * sizeof(*keys));
+	void** elems = smalloc(n * sizeof(*elems));
+	size_t size = frozensize234(n);
+	char* buf, * readbuf;
+	const frozen234* f;
+	tree234* t;
+	FILE* fp;
+	double start, times[6];
+	intptr_t i, j, step = 104729, sum = 0;
+
+	while (n % step == 0)
+		step += 2;
+	for (i = 0; i < n; i++) {
+		keys[i] = 2 * i;
+		elems[i] = &keys[i];
+	}
+	t = buildtree234(intcmp, elems, n);
+	sfree(elems);
+	buf = smalloc(size + 63);
+
+	start = now();
+	f = freeze234(t, intkey, (void*)(((uintptr_t)buf + 63) & ~(uintptr_t)63));
+	times[0] = now() - start;
+	if (!f)
+		abort();
+
+	start = now();
+	fp = tmpfile();
+	if (!fp || fwrite(f, 1, size, fp) != size)
+		abort();
+	rewind(fp);
+	sfree(buf);
+	buf = smalloc(size + 63);
+	readbuf = (char*)(((uintptr_t)buf + 63) & ~(uintptr_t)63);
+	if (fread(readbuf, 1, size, fp) != size)
+		abort();
+	fclose(fp);
+	times[1] = now() - start;
+	if ((f = openfrozen234(readbuf, size)) == NULL)
+		abort();
+
+	start = now();
+	for (i = 0; i < n; i++) {
+		j = 2 * ((i * step) % n);
+		if (*(intptr_t*)find234(t, &j, NULL) != j)
+			abort();
+	}
+	times[2] = now() - start;
+	start = now();
+	for (i = 0; i < n; i++) {
+		j = 2 * ((i * step) % n);
+		if (findfrozen234(f, j, REL234_EQ) != j / 2)
+			abort();
+	}
+	times[3] = now() - start;
+	start = now();
+	for (i = 0; i < n; i++)
+		sum += findfrozen234(f, 2 * ((i * step) % n) + 1, REL234_LT);
+	times[4] = now() - start;
+	if (sum != (n - 1) * n / 2)
+		abort();
+	start = now();
+	for (i = 0; i < n; i++) {
+		j = (i * step) % n;
+		if (*(intptr_t*)index234(t, j) != (intptr_t)frozenkey234(f, j))
+			abort();
+	}
+	times[5] = now() - start;
+
+	printf("%9d elements: %.1f bytes per element in the tree, %.1f frozen; "
+		"freeze234 %.0f ms, file round trip %.0f ms\n",
+		(int)n, (double)slabbytes(t) / n, (double)size / n, times[0] * 1e3, times[1] * 1e3);
+	printf("%9d elements: find234 %6.1f ns, findfrozen234 EQ %6.1f ns, LT between %6.1f ns, "
+		"index234 + frozenkey234 %6.1f ns per lookup\n",
+		(int)n, times[2] * 1e9 / n, times[3] * 1e9 / n, times[4] * 1e9 / n, times[5] * 1e9 / n);
+
+	freetree234(t);
+	sfree(buf);
+	sfree(keys);
+}
+
+int main(int argc, char** argv) {
+	intptr_t maxn = argc > 1 ? (intptr_t)strtoul(argv[1], NULL, 10) : 1000000;
+	intptr_t n, i;
+
+	printf("%d elements per node, %d-byte nodes\n",
+		TREE234_KEYS, (int)sizeof(node234));
+	if (argc > 2 && strcmp(argv[2], "frozen") == 0) {
+		for (n = 1000000; n <= maxn; n *= 100)
+			frozenbench(n);
+		return 0;
+	}
+	for (n = 1000; n <= maxn; n *= 100) {
+		lookupbench(n);
+		findmanybench(n);
+		appendbench(n);
+		typedbench(n);
+	}
+	for (n = 1000000; n <= maxn; n *= 100)
+		frozenbench(n);
+
+	for (n = 1000; n <= maxn; n *= 10) {
+		intptr_t* keys = smalloc(n * sizeof(*keys));
+		void** elems = smalloc(n * sizeof(*elems));
+		tree234* added, * built, * other;
+		double start, addtime, buildtime, splittime;
+		void* e;
+		for (i = 0; i < n; i++) {
+			keys[i] = i * 2;
+			elems[i] = &keys[i];
+		}
+
+		start = now();
+		added = newtree234(intcmp);
+		for (i = 0; i < n; i++)
+			add234(added, elems[i]);
+		addtime = now() - start;
+
+		start = now();
+		built = buildtree234(intcmp, elems, n);
+		buildtime = now() - start;
+
+		for (i = 0; i < n; i++)
+			if (index234(added, i) != elems[i] || index234(built, i) != elems[i])
+				abort();
+		printf("%8d elements: add234 %8.2f ms, %7d nodes; buildtree234 %8.2f ms, %7d nodes (%.1fx)\n",
+			(int)n, addtime * 1e3, (int)nodecount(added, added->root),
+			buildtime * 1e3, (int)nodecount(built, built->root), addtime / buildtime);
+
+		/* Cut the built tree in two and put it back together, and
+		 * compare with merging the halves by re-adding one. */
+		start = now();
+		for (i = 0; i < 1000; i++)
+			built = join234(built, split234(built, (i * 7919) % (n + 1)));
+		splittime = (now() - start) / 1000;
+		for (i = 0; i < n; i++)
+			if (index234(built, i) != elems[i])
+				abort();
+		other = split234(added, n / 2);
+		start = now();
+		while ((e = delpos234(other, 0)) != NULL)
+			add234(added, e);
+		addtime = now() - start;
+		freetree234(other);
+		printf("%8d elements: split234 + join234 %8.2f us, merging halves with add234 %8.2f ms\n",
+			(int)n, splittime * 1e6, addtime * 1e3);
+
+		freetree234(added);
+		freetree234(built);
+		sfree(elems);
+		sfree(keys);
+	}
+
+	{
+		tree234* t;
+		double start, deltime, freetime;
+		void* e;
+		n = maxn < 1000000 ? maxn : 1000000;
+
+		t = scatteredtree(n);
+		start = now();
+		while ((e = delpos234(t, 0)) != NULL)
+			sfree(e);
+		freetree234(t);
+		deltime = now() - start;
+
+		t = scatteredtree(n);
+		printf("%8d elements: %d nodes in %d slabs\n",
+			(int)n, (int)nodecount(t, t->root), (int)slabcount(t));
+		start = now();
+		freetree234_with(t, freeelem, NULL);
+		freetime = now() - start;
+
+		printf("%8d elements: delpos234 loop %8.2f ms, freetree234_with %8.2f ms (%.1fx)\n",
+			(int)n, deltime * 1e3, freetime * 1e3, deltime / freetime);
+	}
+	return 0;
+}
+
+#endif